@@ -0,0 +1,455 @@
+//alertEngine.cpp - Threshold and anomaly alerts over every interface's rates
+
+#include "alertEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+// Every name a rate goes by: as JSON and CSV name it, as the text output
+// names it, and as the counter it comes from
+static const struct
+{
+    alert_metric metric;
+    const char *name;
+} metric_names[] = {
+    {METRIC_RX_BPS,    "rx_bps"},
+    {METRIC_RX_PPS,    "rx_pps"},
+    {METRIC_RX_DROPS,  "rx_drops_per_sec"},
+    {METRIC_RX_DROPS,  "rx_drops/s"},
+    {METRIC_RX_DROPS,  "rx_dropped/s"},
+    {METRIC_RX_ERRORS, "rx_errors_per_sec"},
+    {METRIC_RX_ERRORS, "rx_errors/s"},
+    {METRIC_TX_BPS,    "tx_bps"},
+    {METRIC_TX_PPS,    "tx_pps"},
+    {METRIC_TX_DROPS,  "tx_drops_per_sec"},
+    {METRIC_TX_DROPS,  "tx_drops/s"},
+    {METRIC_TX_DROPS,  "tx_dropped/s"},
+    {METRIC_TX_ERRORS, "tx_errors_per_sec"},
+    {METRIC_TX_ERRORS, "tx_errors/s"},
+};
+
+static bool parse_metric(const std::string &name, alert_metric &metric)
+{
+    for (const auto &known : metric_names) {
+        if (name == known.name) {
+            metric = known.metric;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Parses a whole number, which may have a fractional part or an exponent
+static bool parse_value(const std::string &text, double &value)
+{
+    char *end;
+
+    value = strtod(text.c_str(), &end);
+
+    return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+// Parses a duration such as 500ms, 5s, 2m or 1h, a bare number being seconds
+static bool parse_duration(const std::string &text, uint64_t &duration_ns)
+{
+    char *end;
+    double amount = strtod(text.c_str(), &end);
+    double unit_ns;
+
+    if (strcmp(end, "ms") == 0) {
+        unit_ns = 1e6;
+    } else if (strcmp(end, "s") == 0 || *end == '\0') {
+        unit_ns = 1e9;
+    } else if (strcmp(end, "m") == 0) {
+        unit_ns = 60e9;
+    } else if (strcmp(end, "h") == 0) {
+        unit_ns = 3600e9;
+    } else {
+        return false;
+    }
+
+    if (end == text.c_str() || !(amount >= 0) || amount * unit_ns > 1e18) {
+        return false;
+    }
+
+    duration_ns = amount * unit_ns;
+
+    return true;
+}
+
+// Parses a figure: a rate on its own or a statistic of one, "p99(rx_pps)"
+static bool parse_figure(const std::string &text, alert_rule &rule)
+{
+    size_t open = text.find('(');
+
+    rule.statistic = STATISTIC_VALUE;
+    rule.percentile = 0;
+
+    if (open == std::string::npos) {
+        return parse_metric(text, rule.metric);
+    }
+
+    if (text.back() != ')') {
+        return false;
+    }
+
+    std::string function = text.substr(0, open);
+
+    if (function == "ewma") {
+        rule.statistic = STATISTIC_EWMA;
+    } else if (function == "change") {
+        rule.statistic = STATISTIC_CHANGE;
+    } else if (function == "ratio") {
+        rule.statistic = STATISTIC_RATIO;
+    } else if (function.size() > 1 && function[0] == 'p') {
+        double percent;
+
+        if (!parse_value(function.substr(1), percent) || percent <= 0 || percent >= 100) {
+            return false;
+        }
+        rule.statistic = STATISTIC_PERCENTILE;
+        rule.percentile = percent / 100;
+    } else {
+        return false;
+    }
+
+    return parse_metric(text.substr(open + 1, text.size() - open - 2), rule.metric);
+}
+
+bool parse_alert_rule(const std::string &text, alert_rule &rule, std::string &error)
+{
+    std::istringstream words(text);
+    std::string figure, comparison, threshold, word;
+
+    rule.hold_ns = 0;
+
+    if (!(words >> figure >> comparison >> threshold)) {
+        error = "expected \"<figure> <op> <threshold> [for <duration>] [clear <level>]\"";
+        return false;
+    }
+
+    if (!parse_figure(figure, rule)) {
+        error = "unknown figure \"" + figure + "\"";
+        return false;
+    }
+
+    if (comparison != ">" && comparison != "<") {
+        error = "expected > or < after the figure";
+        return false;
+    }
+    rule.above = comparison == ">";
+
+    if (!parse_value(threshold, rule.threshold)) {
+        error = "invalid threshold \"" + threshold + "\"";
+        return false;
+    }
+    rule.clear_level = rule.threshold;
+    // Written back with single spaces, which is all the reports need
+    rule.text = figure + " " + comparison + " " + threshold;
+
+    while (words >> word) {
+        std::string argument;
+
+        if (!(words >> argument)) {
+            error = "nothing after \"" + word + "\"";
+            return false;
+        }
+
+        if (word == "for") {
+            if (!parse_duration(argument, rule.hold_ns)) {
+                error = "invalid duration \"" + argument + "\"";
+                return false;
+            }
+        } else if (word == "clear") {
+            if (!parse_value(argument, rule.clear_level)) {
+                error = "invalid clear level \"" + argument + "\"";
+                return false;
+            }
+        } else {
+            error = "unexpected \"" + word + "\"";
+            return false;
+        }
+
+        rule.text += " " + word + " " + argument;
+    }
+
+    // The clear level is on the quiet side of the threshold
+    if (rule.above ? rule.clear_level > rule.threshold : rule.clear_level < rule.threshold) {
+        error = "the clear level has to be on the other side of the threshold";
+        return false;
+    }
+
+    return true;
+}
+
+RollingSketch::RollingSketch() : current(0), half_started_ns(0)
+{
+    memset(counts, 0, sizeof(counts));
+    for (int half = 0; half < 2; half++) {
+        clear_half(half);
+    }
+}
+
+void RollingSketch::clear_half(int half)
+{
+    memset(counts[half], 0, sizeof(counts[half]));
+    totals[half] = 0;
+    lowest[half] = NUM_BUCKETS - 1;
+    highest[half] = 0;
+}
+
+// Values under 1 share the first bucket, the rest go by their power of two
+// and the top four bits under it
+int RollingSketch::bucket(double value)
+{
+    if (!(value >= 1)) {
+        return 0;
+    }
+
+    int exponent;
+    double mantissa = std::frexp(value, &exponent);
+    int index = 1 + (exponent - 1) * SUB_BUCKETS + (int)((mantissa - 0.5) * 2 * SUB_BUCKETS);
+
+    return index < NUM_BUCKETS ? index : NUM_BUCKETS - 1;
+}
+
+// The middle of a bucket
+double RollingSketch::bucket_value(int index)
+{
+    if (index == 0) {
+        return 0;
+    }
+
+    int exponent = (index - 1) / SUB_BUCKETS + 1;
+    int sub_bucket = (index - 1) % SUB_BUCKETS;
+
+    return std::ldexp(0.5 + (sub_bucket + 0.5) / (2 * SUB_BUCKETS), exponent);
+}
+
+void RollingSketch::add(double value, uint64_t now_ns, uint64_t half_window_ns)
+{
+    uint64_t elapsed = now_ns - half_started_ns;
+
+    // Move on to the other half, dropping what it held. After a gap of a
+    // whole window both halves are out of date
+    if (elapsed >= half_window_ns) {
+        if (elapsed >= 2 * half_window_ns) {
+            clear_half(current);
+        }
+
+        current = 1 - current;
+        clear_half(current);
+        half_started_ns = now_ns;
+    }
+
+    int index = bucket(value);
+    uint16_t &count = counts[current][index];
+
+    if (count < UINT16_MAX) {
+        count++;
+        totals[current]++;
+        lowest[current] = std::min(lowest[current], index);
+        highest[current] = std::max(highest[current], index);
+    }
+}
+
+double RollingSketch::percentile(double fraction) const
+{
+    uint64_t total = totals[0] + totals[1];
+
+    if (total == 0) {
+        return 0;
+    }
+
+    // The rank of the value wanted, counting from 1
+    uint64_t rank = std::ceil(fraction * total);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    // Only the buckets between the lowest and highest used are counted
+    int first = std::min(lowest[0], lowest[1]);
+    int last = std::max(highest[0], highest[1]);
+    uint64_t seen = 0;
+
+    for (int i = first; i < last; i++) {
+        seen += counts[0][i] + counts[1][i];
+
+        if (seen >= rank) {
+            return bucket_value(i);
+        }
+    }
+
+    return bucket_value(last);
+}
+
+void AlertEngine::set_rules(const std::vector<alert_rule> &rules, long window_ms)
+{
+    this->rules = rules;
+    window_ns = (uint64_t)window_ms * 1000000;
+
+    bool watched[NUM_ALERT_METRICS] = {};
+    bool sketched[NUM_ALERT_METRICS] = {};
+
+    for (const alert_rule &rule : rules) {
+        watched[rule.metric] = true;
+        if (rule.statistic == STATISTIC_PERCENTILE) {
+            sketched[rule.metric] = true;
+        }
+    }
+
+    watched_metrics.clear();
+    sketches_per_interface = 0;
+
+    for (int metric = 0; metric < NUM_ALERT_METRICS; metric++) {
+        if (watched[metric]) {
+            watched_metrics.push_back(metric);
+        }
+        sketch_index[metric] = sketched[metric] ? sketches_per_interface++ : -1;
+    }
+
+    // Everything starts over with the new rules
+    metric_states.assign(interface_count * NUM_ALERT_METRICS, metric_state());
+    sketches.assign(interface_count * sketches_per_interface, RollingSketch());
+    rule_states.assign(interface_count * rules.size(), rule_state());
+    firing = 0;
+}
+
+void AlertEngine::add_interface(int interface)
+{
+    if ((size_t)interface < interface_count) {
+        return;
+    }
+
+    interface_count = interface + 1;
+    metric_states.resize(interface_count * NUM_ALERT_METRICS, metric_state());
+    sketches.resize(interface_count * sketches_per_interface);
+    rule_states.resize(interface_count * rules.size(), rule_state());
+}
+
+void AlertEngine::clear_interface(int interface)
+{
+    if ((size_t)interface >= interface_count) {
+        return;
+    }
+
+    for (size_t i = 0; i < rules.size(); i++) {
+        rule_state &state = rule_states[interface * rules.size() + i];
+
+        if (state.firing) {
+            firing--;
+        }
+        state = rule_state();
+    }
+
+    for (int metric = 0; metric < NUM_ALERT_METRICS; metric++) {
+        metric_states[interface * NUM_ALERT_METRICS + metric] = metric_state();
+    }
+
+    for (int i = 0; i < sketches_per_interface; i++) {
+        sketches[interface * sketches_per_interface + i] = RollingSketch();
+    }
+}
+
+void AlertEngine::update(int interface, const std::string &interface_name,
+                         const interface_rates &rates, uint64_t time_ns, OutputSink &output)
+{
+    if (!rates.valid || rules.empty()) {
+        return;
+    }
+
+    const double values[NUM_ALERT_METRICS] = {
+        rates.rx_bits, rates.rx_packets, rates.rx_dropped, rates.rx_errors,
+        rates.tx_bits, rates.tx_packets, rates.tx_dropped, rates.tx_errors,
+    };
+    double changes[NUM_ALERT_METRICS];
+    double ratios[NUM_ALERT_METRICS];
+
+    metric_state *states = &metric_states[interface * NUM_ALERT_METRICS];
+    RollingSketch *interface_sketches = &sketches[interface * sketches_per_interface];
+
+    // Bring the statistics of every watched figure up to date. The ratio is
+    // taken against the average before this sample joins it
+    for (int metric : watched_metrics) {
+        metric_state &state = states[metric];
+        double value = values[metric];
+
+        if (!state.seen) {
+            state.average = value;
+            state.seen = true;
+            changes[metric] = 0;
+            ratios[metric] = 1;
+        } else {
+            double elapsed_ns = time_ns - state.previous_ns;
+
+            changes[metric] = elapsed_ns > 0 ? (value - state.previous) * 1e9 / elapsed_ns : 0;
+            ratios[metric] = state.average > 0 ? value / state.average : 1;
+            state.average += (1 - std::exp(-elapsed_ns / window_ns)) * (value - state.average);
+        }
+        state.previous = value;
+        state.previous_ns = time_ns;
+
+        if (sketch_index[metric] != -1) {
+            interface_sketches[sketch_index[metric]].add(value, time_ns, window_ns / 2);
+        }
+    }
+
+    rule_state *rule_states_here = &rule_states[interface * rules.size()];
+
+    for (size_t i = 0; i < rules.size(); i++) {
+        const alert_rule &rule = rules[i];
+        rule_state &state = rule_states_here[i];
+        double figure = 0;
+
+        switch (rule.statistic) {
+            case STATISTIC_VALUE: figure = values[rule.metric]; break;
+            case STATISTIC_EWMA: figure = states[rule.metric].average; break;
+            case STATISTIC_CHANGE: figure = changes[rule.metric]; break;
+            case STATISTIC_RATIO: figure = ratios[rule.metric]; break;
+            case STATISTIC_PERCENTILE:
+                figure = interface_sketches[sketch_index[rule.metric]].percentile(rule.percentile);
+                break;
+        }
+
+        if (!state.firing) {
+            bool holding = rule.above ? figure > rule.threshold : figure < rule.threshold;
+
+            if (!holding) {
+                state.holding_since_ns = 0;
+                continue;
+            }
+            if (state.holding_since_ns == 0) {
+                state.holding_since_ns = time_ns;
+            }
+
+            if (time_ns - state.holding_since_ns >= rule.hold_ns) {
+                state.firing = true;
+                fired++;
+                firing++;
+                output.alert(interface_name, rule.text.c_str(), true, figure);
+            }
+        } else if (rule.above ? figure <= rule.clear_level : figure >= rule.clear_level) {
+            state.firing = false;
+            state.holding_since_ns = 0;
+            resolved++;
+            firing--;
+            output.alert(interface_name, rule.text.c_str(), false, figure);
+        }
+    }
+}
+
+void AlertEngine::report(OutputSink &output) const
+{
+    const stat_field fields[] = {
+        {"rules", (double)rules.size()},
+        {"firing", (double)firing},
+        {"fired", (double)fired},
+        {"resolved", (double)resolved},
+    };
+
+    output.stats("alerts", fields, sizeof(fields) / sizeof(fields[0]));
+}
@@ -0,0 +1,183 @@
+//alertEngine.h - Threshold and anomaly alerts over every interface's rates
+//
+// Rules are written as "<figure> <op> <threshold> [for <duration>] [clear
+// <level>]", for instance
+//
+//     rx_drops_per_sec > 100 for 5s
+//     p99(rx_pps) > 800000 for 30s clear 600000
+//     ratio(tx_pps) < 0.2 for 3s clear 0.5
+//
+// A figure is one of an interface's rates (rx_bps, rx_pps, rx_drops_per_sec,
+// ... or rx_drops/s as the text output names them) or a statistic of one:
+// ewma() its exponentially weighted moving average, p<N>() its Nth
+// percentile over the window, change() how fast it is changing per second
+// and ratio() how it compares to its average, 1 being the usual. A rule
+// fires once its condition has held for the duration, and with a clear
+// level stays firing until the figure is back past that level rather than
+// just past the threshold, so a figure hovering at the threshold does not
+// make it flap. Firing and resolving are reported through the output sink.
+//
+// Every statistic is kept per interface at a fixed cost per sample: the
+// average and change take a few operations and the percentiles come from a
+// sketch of fixed size, so evaluating a sample costs the same however many
+// interfaces there are, and each rule adds one comparison
+
+#ifndef ALERT_ENGINE_H
+#define ALERT_ENGINE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "counterRates.h"
+#include "outputSink.h"
+
+// The rates a rule can watch, in the order of interface_rates
+enum alert_metric
+{
+    METRIC_RX_BPS,
+    METRIC_RX_PPS,
+    METRIC_RX_DROPS,
+    METRIC_RX_ERRORS,
+    METRIC_TX_BPS,
+    METRIC_TX_PPS,
+    METRIC_TX_DROPS,
+    METRIC_TX_ERRORS,
+    NUM_ALERT_METRICS
+};
+
+enum alert_statistic
+{
+    STATISTIC_VALUE,
+    STATISTIC_EWMA,
+    STATISTIC_PERCENTILE,
+    STATISTIC_CHANGE,
+    STATISTIC_RATIO
+};
+
+struct alert_rule
+{
+    // The rule as it was written, which is how its alerts are reported
+    std::string text;
+
+    alert_statistic statistic;
+    alert_metric metric;
+    // For STATISTIC_PERCENTILE, between 0 and 1
+    double percentile;
+
+    // Whether the rule fires above the threshold, or below it
+    bool above;
+    double threshold;
+    // Where a firing rule resolves, the threshold unless given
+    double clear_level;
+    // How long the condition has to hold before the rule fires
+    uint64_t hold_ns;
+};
+
+// Parses a rule. Returns false, with error describing why, if it is not one
+bool parse_alert_rule(const std::string &text, alert_rule &rule, std::string &error);
+
+// The percentiles of a figure over a sliding window, in fixed memory (3 KB).
+// Values are counted in buckets a sixteenth of a power of two wide, so a
+// percentile is within about 2% of the true one. The window is made of two
+// halves, the older of which is dropped every half window
+class RollingSketch
+{
+public:
+    static const int SUB_BUCKETS = 16;
+    // Values up to 2^48 (over 10^14, 100 Tb/s in bits) have a bucket, larger
+    // ones share the last
+    static const int NUM_BUCKETS = 1 + 48 * SUB_BUCKETS;
+
+    RollingSketch();
+
+    void add(double value, uint64_t now_ns, uint64_t half_window_ns);
+
+    // The value below which the fraction of the window's values lie, 0 if
+    // there are none
+    double percentile(double fraction) const;
+
+private:
+    static int bucket(double value);
+    static double bucket_value(int index);
+
+    void clear_half(int half);
+
+    // Counts stop at 65535, more samples than half a window ever holds
+    uint16_t counts[2][NUM_BUCKETS];
+    uint32_t totals[2];
+    // The lowest and highest bucket used in each half, which bound the
+    // buckets a percentile has to count through
+    int lowest[2];
+    int highest[2];
+    // Which half is being filled, and since when
+    int current;
+    uint64_t half_started_ns;
+};
+
+class AlertEngine
+{
+public:
+    // How far back averages and percentiles look unless set otherwise
+    static const long DEFAULT_WINDOW_MS = 60000;
+
+    AlertEngine() {}
+
+    // Replaces the rules, every interface's statistics and alerts start over.
+    // window_ms is both the time constant of the averages and the length of
+    // the percentiles' window
+    void set_rules(const std::vector<alert_rule> &rules, long window_ms = DEFAULT_WINDOW_MS);
+
+    // Makes room for interfaces up to the given index, which is how they are
+    // known in every other call
+    void add_interface(int interface);
+
+    // Forgets an interface's statistics and alerts, as when it is removed
+    void clear_interface(int interface);
+
+    // Updates the interface's statistics with its latest rates and evaluates
+    // every rule against them, reporting the alerts that fire or resolve
+    void update(int interface, const std::string &interface_name,
+                const interface_rates &rates, uint64_t time_ns, OutputSink &output);
+
+    // Reports the rules and the alerts fired so far, as stats named "alerts"
+    void report(OutputSink &output) const;
+
+private:
+    // What is kept per interface for each figure some rule watches
+    struct metric_state
+    {
+        double average;
+        double previous;
+        uint64_t previous_ns;
+        bool seen;
+    };
+
+    struct rule_state
+    {
+        // When the condition started holding, 0 while it does not
+        uint64_t holding_since_ns;
+        bool firing;
+    };
+
+    std::vector<alert_rule> rules;
+    uint64_t window_ns = DEFAULT_WINDOW_MS * 1000000ULL;
+
+    // The figures watched by any rule, and for each figure its sketch's
+    // position among an interface's sketches, -1 if no rule needs one
+    std::vector<int> watched_metrics;
+    int sketch_index[NUM_ALERT_METRICS];
+    int sketches_per_interface = 0;
+
+    // Per interface, laid out interface by interface
+    std::vector<metric_state> metric_states;
+    std::vector<RollingSketch> sketches;
+    std::vector<rule_state> rule_states;
+    size_t interface_count = 0;
+
+    uint64_t fired = 0;
+    uint64_t resolved = 0;
+    uint64_t firing = 0;
+};
+
+#endif
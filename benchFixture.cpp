@@ -0,0 +1,373 @@
+//benchFixture.cpp - Synthetic interfaces for benchmarking without real NICs
+
+#include "benchFixture.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The files of a fake interface, relative to its directory. The counters are
+// in the order of fake_counters
+static const char *counter_files[] = {
+    "carrier_up_count",
+    "carrier_down_count",
+    "statistics/rx_bytes",
+    "statistics/rx_dropped",
+    "statistics/rx_errors",
+    "statistics/rx_packets",
+    "statistics/tx_bytes",
+    "statistics/tx_dropped",
+    "statistics/tx_errors",
+    "statistics/tx_packets",
+};
+const int NUM_COUNTER_FILES = sizeof(counter_files) / sizeof(counter_files[0]);
+
+// Keeps every dump reply datagram under the 32KB the kernel sends at most
+const size_t MAX_REPLY_DATAGRAM = 32 * 1024;
+
+std::vector<std::string> fake_interface_names(int count, const std::string &prefix)
+{
+    std::vector<std::string> names;
+
+    for (int i = 0; i < count; i++) {
+        names.push_back(prefix + std::to_string(i));
+    }
+
+    return names;
+}
+
+void advance_counters(fake_counters &counters, uint64_t seed)
+{
+    // A cheap mix of the seed, so each interface gets its own traffic
+    uint64_t mixed = seed * 0x9E3779B97F4A7C15ULL;
+    uint64_t packets = 1 + (mixed >> 54);
+
+    counters.rx_packets += packets;
+    counters.rx_bytes += packets * (64 + (mixed >> 8) % 1437);
+    counters.tx_packets += packets / 2 + 1;
+    counters.tx_bytes += (packets / 2 + 1) * (64 + (mixed >> 20) % 1437);
+
+    // The occasional drop and error
+    if ((mixed & 0xFF) == 0) {
+        counters.rx_dropped++;
+    }
+    if ((mixed & 0x3FF) == 1) {
+        counters.rx_errors++;
+    }
+}
+
+// Writes a whole file, replacing what was in it
+static bool write_file(const std::string &path, const char *text, size_t length)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = write(fd, text, length) == (ssize_t)length;
+    int saved_errno = errno;
+
+    close(fd);
+    errno = saved_errno;
+
+    return written;
+}
+
+SysfsFixture::~SysfsFixture()
+{
+    destroy();
+}
+
+bool SysfsFixture::create(const std::string &root, int count, const std::string &prefix)
+{
+    root_directory = root.back() == '/' ? root : root + "/";
+
+    if (mkdir(root_directory.c_str(), 0755) == 0) {
+        created_root = true;
+    } else if (errno != EEXIST) {
+        return false;
+    }
+
+    interface_names = fake_interface_names(count, prefix);
+    counters.assign(count, fake_counters());
+
+    for (int i = 0; i < count; i++) {
+        std::string directory = root_directory + interface_names[i];
+
+        memset(&counters[i], 0, sizeof(counters[i]));
+        counters[i].carrier_up_count = 1;
+
+        if ((mkdir(directory.c_str(), 0755) == -1 && errno != EEXIST) ||
+            (mkdir((directory + "/statistics").c_str(), 0755) == -1 && errno != EEXIST) ||
+            !write_file(directory + "/operstate", "up\n", 3) ||
+            !write_counters(i)) {
+            return false;
+        }
+    }
+
+    return write_net_dev();
+}
+
+bool SysfsFixture::write_counters(int interface)
+{
+    const uint64_t *values = &counters[interface].carrier_up_count;
+    std::string directory = root_directory + interface_names[interface] + "/";
+
+    for (int i = 0; i < NUM_COUNTER_FILES; i++) {
+        char text[24];
+        char *end = std::to_chars(text, text + sizeof(text) - 1, values[i]).ptr;
+        *end++ = '\n';
+
+        if (!write_file(directory + counter_files[i], text, end - text)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Writes every interface's counters in the layout of /proc/net/dev. The file
+// is overwritten in place rather than replaced, as a collector keeps it open
+bool SysfsFixture::write_net_dev()
+{
+    std::string text =
+        "Inter-|   Receive                                                |  Transmit\n"
+        " face |bytes    packets errs drop fifo frame compressed multicast|"
+        "bytes    packets errs drop fifo colls carrier compressed\n";
+
+    for (size_t i = 0; i < interface_names.size(); i++) {
+        const fake_counters &values = counters[i];
+        char line[256];
+
+        snprintf(line, sizeof(line),
+                 "%6s: %7llu %7llu %4llu %4llu    0     0          0         0 "
+                 "%8llu %7llu %4llu %4llu    0     0       0          0\n",
+                 interface_names[i].c_str(),
+                 (unsigned long long)values.rx_bytes, (unsigned long long)values.rx_packets,
+                 (unsigned long long)values.rx_errors, (unsigned long long)values.rx_dropped,
+                 (unsigned long long)values.tx_bytes, (unsigned long long)values.tx_packets,
+                 (unsigned long long)values.tx_errors, (unsigned long long)values.tx_dropped);
+        text += line;
+    }
+
+    int fd = open(net_dev_path().c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = pwrite(fd, text.data(), text.size(), 0) == (ssize_t)text.size() &&
+                   ftruncate(fd, text.size()) == 0;
+    int saved_errno = errno;
+
+    close(fd);
+    errno = saved_errno;
+
+    return written;
+}
+
+bool SysfsFixture::advance()
+{
+    generation++;
+
+    for (size_t i = 0; i < interface_names.size(); i++) {
+        advance_counters(counters[i], generation * 1000003 + i);
+
+        if (!write_counters(i)) {
+            return false;
+        }
+    }
+
+    return write_net_dev();
+}
+
+void SysfsFixture::destroy()
+{
+    for (const std::string &name : interface_names) {
+        std::string directory = root_directory + name + "/";
+
+        for (const char *file : counter_files) {
+            unlink((directory + file).c_str());
+        }
+        unlink((directory + "operstate").c_str());
+        rmdir((directory + "statistics").c_str());
+        rmdir(directory.c_str());
+    }
+    if (!interface_names.empty()) {
+        unlink(net_dev_path().c_str());
+    }
+    interface_names.clear();
+
+    if (created_root) {
+        rmdir(root_directory.c_str());
+        created_root = false;
+    }
+}
+
+NetlinkFixture::~NetlinkFixture()
+{
+    stop();
+}
+
+int NetlinkFixture::start(int count, const std::string &prefix)
+{
+    int sockets[2];
+
+    // A sequenced packet socket keeps each reply a datagram of its own, as
+    // netlink does
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        return -1;
+    }
+
+    peer_socket = sockets[1];
+    interface_names = fake_interface_names(count, prefix);
+    counters.assign(count, fake_counters());
+    for (fake_counters &interface : counters) {
+        memset(&interface, 0, sizeof(interface));
+        interface.carrier_up_count = 1;
+    }
+    reply.resize(MAX_REPLY_DATAGRAM);
+
+    thread = std::thread(&NetlinkFixture::run, this);
+
+    return sockets[0];
+}
+
+void NetlinkFixture::stop()
+{
+    if (peer_socket == -1) {
+        return;
+    }
+
+    // Wakes the thread out of recv() with end of file
+    shutdown(peer_socket, SHUT_RDWR);
+    thread.join();
+
+    close(peer_socket);
+    peer_socket = -1;
+}
+
+void NetlinkFixture::run()
+{
+    char request[256];
+
+    while (true) {
+        ssize_t length = recv(peer_socket, request, sizeof(request), 0);
+
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length < (ssize_t)sizeof(struct nlmsghdr)) {
+            break;
+        }
+
+        const struct nlmsghdr *header = (const struct nlmsghdr *)request;
+
+        if (header->nlmsg_type == RTM_GETLINK) {
+            answer(header->nlmsg_seq);
+        }
+    }
+}
+
+// Appends an attribute to the message being built at the end of reply
+static void add_attribute(char *&position, unsigned short type, const void *data, size_t length)
+{
+    struct rtattr *attribute = (struct rtattr *)position;
+
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(length);
+    memcpy(RTA_DATA(attribute), data, length);
+
+    position += RTA_ALIGN(attribute->rta_len);
+}
+
+// Sends one RTM_NEWLINK per interface, as many to a datagram as fit, and
+// then NLMSG_DONE
+void NetlinkFixture::answer(uint32_t sequence)
+{
+    // The largest message built below, name included
+    const size_t MESSAGE_SPACE = NLMSG_SPACE(sizeof(struct ifinfomsg)) +
+                                 RTA_SPACE(IFNAMSIZ) + RTA_SPACE(sizeof(uint8_t)) +
+                                 RTA_SPACE(sizeof(struct rtnl_link_stats64)) +
+                                 2 * RTA_SPACE(sizeof(uint32_t));
+
+    generation++;
+
+    char *position = reply.data();
+
+    for (size_t i = 0; i <= interface_names.size(); i++) {
+        bool done = i == interface_names.size();
+
+        // Send what is built once the next message might not fit
+        if (position - reply.data() + MESSAGE_SPACE > reply.size() || done) {
+            if (done) {
+                struct nlmsghdr *header = (struct nlmsghdr *)position;
+
+                memset(header, 0, NLMSG_SPACE(sizeof(int)));
+                header->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+                header->nlmsg_type = NLMSG_DONE;
+                header->nlmsg_flags = NLM_F_MULTI;
+                header->nlmsg_seq = sequence;
+                position += NLMSG_SPACE(sizeof(int));
+            }
+
+            send(peer_socket, reply.data(), position - reply.data(), MSG_NOSIGNAL);
+            position = reply.data();
+
+            if (done) {
+                break;
+            }
+        }
+
+        fake_counters &interface = counters[i];
+        advance_counters(interface, generation * 1000003 + i);
+
+        struct nlmsghdr *header = (struct nlmsghdr *)position;
+        memset(position, 0, MESSAGE_SPACE);
+        header->nlmsg_type = RTM_NEWLINK;
+        header->nlmsg_flags = NLM_F_MULTI;
+        header->nlmsg_seq = sequence;
+
+        struct ifinfomsg *info = (struct ifinfomsg *)NLMSG_DATA(header);
+        info->ifi_family = AF_UNSPEC;
+        info->ifi_index = i + 1;
+        info->ifi_flags = IFF_UP | IFF_RUNNING;
+
+        char *attributes = position + NLMSG_SPACE(sizeof(struct ifinfomsg));
+        char *end = attributes;
+
+        uint8_t operstate = IF_OPER_UP;
+        uint32_t carrier_up = interface.carrier_up_count;
+        uint32_t carrier_down = interface.carrier_down_count;
+
+        struct rtnl_link_stats64 stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.rx_bytes = interface.rx_bytes;
+        stats.rx_dropped = interface.rx_dropped;
+        stats.rx_errors = interface.rx_errors;
+        stats.rx_packets = interface.rx_packets;
+        stats.tx_bytes = interface.tx_bytes;
+        stats.tx_dropped = interface.tx_dropped;
+        stats.tx_errors = interface.tx_errors;
+        stats.tx_packets = interface.tx_packets;
+
+        add_attribute(end, IFLA_IFNAME, interface_names[i].c_str(), interface_names[i].size() + 1);
+        add_attribute(end, IFLA_OPERSTATE, &operstate, sizeof(operstate));
+        add_attribute(end, IFLA_STATS64, &stats, sizeof(stats));
+        add_attribute(end, IFLA_CARRIER_UP_COUNT, &carrier_up, sizeof(carrier_up));
+        add_attribute(end, IFLA_CARRIER_DOWN_COUNT, &carrier_down, sizeof(carrier_down));
+
+        header->nlmsg_len = end - position;
+        position += NLMSG_ALIGN(header->nlmsg_len);
+    }
+}
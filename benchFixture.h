@@ -0,0 +1,112 @@
+//benchFixture.h - Synthetic interfaces for benchmarking without real NICs
+//
+// SysfsFixture lays out a directory tree shaped like /sys/class/net for any
+// number of fake interfaces, whose counters move on every time advance() is
+// called; a sysfs collector (or networkMonitor -d) pointed at its root
+// samples them as it would real ones. The same counters are written to a
+// file laid out as /proc/net/dev, for the procfs collector (or
+// networkMonitor -P). NetlinkFixture plays the kernel's side of
+// NETLINK_ROUTE on a socket pair, answering every RTM_GETLINK dump with one
+// RTM_NEWLINK message per fake interface, so the netlink collector's whole
+// request, receive and parse path runs against any number of interfaces.
+// Neither needs privileges
+
+#ifndef BENCH_FIXTURE_H
+#define BENCH_FIXTURE_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The counters of one fake interface, in the order of the sysfs files
+struct fake_counters
+{
+    uint64_t carrier_up_count;
+    uint64_t carrier_down_count;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t rx_errors;
+    uint64_t rx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t tx_errors;
+    uint64_t tx_packets;
+};
+
+// The names given to count fake interfaces: <prefix>0, <prefix>1, ...
+std::vector<std::string> fake_interface_names(int count, const std::string &prefix = "fake");
+
+// Moves an interface's counters on by one interval's worth of traffic. The
+// amount varies with seed, so interfaces do not all move in step
+void advance_counters(fake_counters &counters, uint64_t seed);
+
+class SysfsFixture
+{
+public:
+    SysfsFixture() {}
+    ~SysfsFixture();
+
+    SysfsFixture(const SysfsFixture &) = delete;
+    SysfsFixture &operator=(const SysfsFixture &) = delete;
+
+    // Creates root (if need be) and a directory in it for each of count
+    // interfaces. Returns false (with errno set) if the tree could not be
+    // written
+    bool create(const std::string &root, int count, const std::string &prefix = "fake");
+
+    // Moves every interface's counters on and rewrites its files
+    bool advance();
+
+    // Removes everything create() made
+    void destroy();
+
+    // The root to point a collector at, ending in '/'
+    const std::string &root() const { return root_directory; }
+    const std::vector<std::string> &names() const { return interface_names; }
+
+    // The file standing in for /proc/net/dev, hidden in the root so it is
+    // not taken for an interface
+    std::string net_dev_path() const { return root_directory + ".net_dev"; }
+
+private:
+    bool write_counters(int interface);
+    bool write_net_dev();
+
+    std::string root_directory;
+    bool created_root = false;
+    std::vector<std::string> interface_names;
+    std::vector<fake_counters> counters;
+    uint64_t generation = 0;
+};
+
+class NetlinkFixture
+{
+public:
+    NetlinkFixture() {}
+    ~NetlinkFixture();
+
+    NetlinkFixture(const NetlinkFixture &) = delete;
+    NetlinkFixture &operator=(const NetlinkFixture &) = delete;
+
+    // Starts answering dumps for count interfaces on a thread of its own.
+    // Returns the descriptor to give NetlinkCollector::attach(), or -1 (with
+    // errno set) on failure
+    int start(int count, const std::string &prefix = "fake");
+
+    // Stops answering and waits for the thread
+    void stop();
+
+private:
+    void run();
+    void answer(uint32_t sequence);
+
+    int peer_socket = -1;
+    std::thread thread;
+    std::vector<std::string> interface_names;
+    std::vector<fake_counters> counters;
+    std::vector<char> reply;
+    uint64_t generation = 0;
+};
+
+#endif
@@ -0,0 +1,287 @@
+//childSupervisor.cpp - Watches the intfMonitor processes, restarts and stops them
+
+#include "childSupervisor.h"
+
+#include <cerrno>
+#include <csignal>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "interfaceInfo.h"
+#include "sampleTimer.h"
+
+const uint64_t NS_PER_MS = 1000000;
+
+// glibc only wraps pidfd_open from 2.36 on
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ChildSupervisor::ChildSupervisor(EventLoop &loop)
+    : loop(loop), timer_fd(-1), restarts_pending(0), unwatched(0), stage(STAGE_RUNNING),
+      stage_deadline_ns(0), exits(0), unexpected_exits(0), restarts_made(0), terminated(0),
+      killed(0)
+{
+}
+
+ChildSupervisor::~ChildSupervisor()
+{
+    for (const child &running_child : children) {
+        if (running_child.pidfd != -1) {
+            loop.remove(running_child.pidfd);
+            close(running_child.pidfd);
+        }
+    }
+
+    if (timer_fd != -1) {
+        loop.remove(timer_fd);
+        close(timer_fd);
+    }
+}
+
+bool ChildSupervisor::open()
+{
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        return false;
+    }
+
+    return loop.add(timer_fd, EPOLLIN, [this](uint32_t events) { handle_timer(events); });
+}
+
+void ChildSupervisor::set_handlers(exit_handler exited, start_handler restart)
+{
+    this->exited = exited;
+    restart_child = restart;
+}
+
+bool ChildSupervisor::watch(int interface, pid_t pid)
+{
+    if ((size_t)interface >= restarts.size()) {
+        restarts.resize(interface + 1);
+    }
+
+    child started = {interface, pid, open_pidfd(pid), monotonic_ns(), stage != STAGE_RUNNING};
+
+    children.push_back(started);
+
+    if (started.pidfd == -1) {
+        unwatched++;
+        arm_timer();
+        return false;
+    }
+
+    loop.add(started.pidfd, EPOLLIN, [this, pid](uint32_t events) {
+        for (size_t i = 0; i < children.size(); i++) {
+            if (children[i].pid == pid) {
+                reap(i);
+                break;
+            }
+        }
+    });
+
+    return true;
+}
+
+void ChildSupervisor::expect_exit(int interface)
+{
+    for (child &running_child : children) {
+        if (running_child.interface == interface) {
+            running_child.expected = true;
+        }
+    }
+
+    if ((size_t)interface < restarts.size() && restarts[interface].due_ns != 0) {
+        restarts[interface].due_ns = 0;
+        restarts_pending--;
+        arm_timer();
+    }
+}
+
+// Collects the child at index if it has exited, returns false if it is
+// still running
+bool ChildSupervisor::reap(size_t index)
+{
+    child exited_child = children[index];
+    int status = 0;
+    pid_t result = waitpid(exited_child.pid, &status, WNOHANG);
+
+    // Someone else reaped it (ECHILD), it is gone all the same
+    if (result == 0 || (result == -1 && errno != ECHILD)) {
+        return false;
+    }
+
+    if (exited_child.pidfd != -1) {
+        loop.remove(exited_child.pidfd);
+        close(exited_child.pidfd);
+    } else {
+        unwatched--;
+    }
+    children.erase(children.begin() + index);
+
+    handle_exit(exited_child, status);
+
+    return true;
+}
+
+void ChildSupervisor::handle_exit(const child &exited_child, int status)
+{
+    exits++;
+
+    if (stage != STAGE_RUNNING) {
+        if (children.empty()) {
+            stage = STAGE_RUNNING;
+            arm_timer();
+            loop.stop();
+        }
+        return;
+    }
+
+    if (exited_child.expected) {
+        arm_timer();
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    restart &pending = restarts[exited_child.interface];
+
+    // Exiting soon after being started counts towards the backoff, staying
+    // up for a while starts over
+    if (now - exited_child.started_ns < (uint64_t)policy.max_backoff_ms * NS_PER_MS) {
+        pending.quick_exits++;
+    } else {
+        pending.quick_exits = 1;
+    }
+
+    uint64_t delay_ms = backoff_delay_ms(policy.backoff_ms, policy.max_backoff_ms, pending.quick_exits);
+
+    if (pending.due_ns == 0) {
+        restarts_pending++;
+    }
+    pending.due_ns = now + delay_ms * NS_PER_MS;
+    unexpected_exits++;
+    arm_timer();
+
+    if (exited) {
+        exited(exited_child.interface, status);
+    }
+}
+
+bool ChildSupervisor::shut_down()
+{
+    for (child &running_child : children) {
+        running_child.expected = true;
+    }
+
+    for (restart &pending : restarts) {
+        pending.due_ns = 0;
+    }
+    restarts_pending = 0;
+
+    if (children.empty()) {
+        arm_timer();
+        return false;
+    }
+
+    stage = STAGE_WAITING;
+    stage_deadline_ns = monotonic_ns() + policy.shutdown_timeout_ms * NS_PER_MS;
+    arm_timer();
+
+    return true;
+}
+
+void ChildSupervisor::escalate()
+{
+    if (stage == STAGE_WAITING) {
+        enter_stage(STAGE_TERMINATING, monotonic_ns());
+    } else if (stage == STAGE_TERMINATING) {
+        enter_stage(STAGE_KILLING, monotonic_ns());
+    } else if (stage == STAGE_KILLING) {
+        // Whatever is left is stuck in the kernel, stop waiting for it
+        stage = STAGE_RUNNING;
+        arm_timer();
+        loop.stop();
+    }
+}
+
+// Signals every child still running and gives them until the next deadline
+void ChildSupervisor::enter_stage(shutdown_stage next, uint64_t now_ns)
+{
+    int signal_number = next == STAGE_TERMINATING ? SIGTERM : SIGKILL;
+
+    for (const child &running_child : children) {
+        if (kill(running_child.pid, signal_number) == 0) {
+            (next == STAGE_TERMINATING ? terminated : killed)++;
+        }
+    }
+
+    stage = next;
+    stage_deadline_ns = now_ns + (next == STAGE_TERMINATING ? TERMINATE_GRACE_MS : KILL_GRACE_MS) * NS_PER_MS;
+}
+
+void ChildSupervisor::handle_timer(uint32_t events)
+{
+    uint64_t expirations;
+
+    while (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+    }
+
+    // Children without a pidfd are only found to have exited by asking
+    for (size_t i = children.size(); unwatched > 0 && i-- > 0;) {
+        if (children[i].pidfd == -1) {
+            reap(i);
+        }
+    }
+
+    uint64_t now = monotonic_ns();
+
+    // Starting a child may make room for more interfaces, so each restart is
+    // looked up again by index
+    for (size_t interface = 0; restarts_pending > 0 && interface < restarts.size(); interface++) {
+        if (restarts[interface].due_ns == 0 || restarts[interface].due_ns > now) {
+            continue;
+        }
+
+        restarts[interface].due_ns = 0;
+        restarts_pending--;
+        restarts_made++;
+
+        if (restart_child) {
+            restart_child(interface);
+        }
+    }
+
+    if (stage != STAGE_RUNNING && now >= stage_deadline_ns) {
+        escalate();
+    }
+
+    arm_timer();
+}
+
+// Ticks the timer while there is something to do on a tick
+void ChildSupervisor::arm_timer()
+{
+    tick_while_needed(timer_fd, TICK_MS, restarts_pending > 0 || unwatched > 0 || stage != STAGE_RUNNING);
+}
+
+void ChildSupervisor::report(OutputSink &output) const
+{
+    const stat_field fields[] = {
+        {"running", (double)children.size()},
+        {"exits", (double)exits},
+        {"unexpected_exits", (double)unexpected_exits},
+        {"restarts", (double)restarts_made},
+        {"terminated", (double)terminated},
+        {"killed", (double)killed},
+    };
+
+    output.stats("children", fields, sizeof(fields) / sizeof(fields[0]));
+}
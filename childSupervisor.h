@@ -0,0 +1,144 @@
+//childSupervisor.h - Watches the intfMonitor processes, restarts and stops them
+//
+// Each intfMonitor is watched through a pidfd registered with the event
+// loop, which becomes readable as soon as the process exits, so its exit is
+// noticed and reaped at once without SIGCHLD and no zombie is left behind.
+// One that exits without having been told to is started again after a
+// backoff, doubled for every exit in a row that came soon after a start, up
+// to max_backoff_ms. Shutting down tells every child at once and waits for
+// all of them against one deadline, then sends whatever is still running
+// SIGTERM and, a grace period later, SIGKILL, so how long it takes does not
+// depend on how many children there are
+
+#ifndef CHILD_SUPERVISOR_H
+#define CHILD_SUPERVISOR_H
+
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+#include <vector>
+
+#include "eventLoop.h"
+#include "outputSink.h"
+
+struct restart_policy
+{
+    // The wait before starting again a child that exited unasked, doubled
+    // for every further exit within max_backoff_ms of its start, up to
+    // max_backoff_ms
+    long backoff_ms = 1000;
+    long max_backoff_ms = 60000;
+
+    // How long the children have to exit once told to shut down before
+    // they are sent SIGTERM
+    long shutdown_timeout_ms = 2000;
+};
+
+class ChildSupervisor
+{
+public:
+    // How long a child has after SIGTERM before SIGKILL, and after SIGKILL
+    // before it is given up on
+    static const long TERMINATE_GRACE_MS = 1000;
+    static const long KILL_GRACE_MS = 1000;
+
+    // How often restarts that are due are made, and children that could not
+    // be given a pidfd are checked on
+    static const long TICK_MS = 100;
+
+    // Called with the interface a child was monitoring and its wait status
+    // when it exits without having been told to
+    typedef std::function<void(int interface, int status)> exit_handler;
+    // Called to start an interface's child again
+    typedef std::function<void(int interface)> start_handler;
+
+    explicit ChildSupervisor(EventLoop &loop);
+    ~ChildSupervisor();
+
+    ChildSupervisor(const ChildSupervisor &) = delete;
+    ChildSupervisor &operator=(const ChildSupervisor &) = delete;
+
+    // Creates the timer, returns false (with errno set) on failure
+    bool open();
+
+    void set_handlers(exit_handler exited, start_handler restart);
+    void set_policy(const restart_policy &policy) { this->policy = policy; }
+
+    // Watches a child started for an interface. Without a pidfd (before
+    // Linux 5.3) it is checked on every tick instead, returns false then
+    bool watch(int interface, pid_t pid);
+
+    // The interface's children were told to shut down, their exit is
+    // expected and they are not restarted. Forgets a restart still waiting
+    void expect_exit(int interface);
+
+    // Tells nothing more to the children, but starts the shutdown deadline:
+    // every child is expected to exit, restarts are forgotten and the event
+    // loop is stopped once no child is left or the last grace period ends.
+    // Returns false if there was no child to wait for
+    bool shut_down();
+
+    // Moves shutdown on to its next stage (SIGTERM, then SIGKILL) at once
+    void escalate();
+
+    // The number of children running
+    size_t running() const { return children.size(); }
+
+    // Reports the children's exits and restarts, as stats named "children"
+    void report(OutputSink &output) const;
+
+private:
+    struct child
+    {
+        int interface;
+        pid_t pid;
+        int pidfd;
+        uint64_t started_ns;
+        bool expected;
+    };
+
+    struct restart
+    {
+        // When the restart is due, 0 when none is scheduled
+        uint64_t due_ns = 0;
+        // Exits in a row that came soon after a start
+        int quick_exits = 0;
+    };
+
+    enum shutdown_stage
+    {
+        STAGE_RUNNING,
+        STAGE_WAITING,
+        STAGE_TERMINATING,
+        STAGE_KILLING
+    };
+
+    bool reap(size_t index);
+    void handle_exit(const child &exited, int status);
+    void handle_timer(uint32_t events);
+    void enter_stage(shutdown_stage stage, uint64_t now_ns);
+    void arm_timer();
+
+    EventLoop &loop;
+    int timer_fd;
+    restart_policy policy;
+    exit_handler exited;
+    start_handler restart_child;
+
+    std::vector<child> children;
+    // Indexed by interface
+    std::vector<restart> restarts;
+    size_t restarts_pending;
+    size_t unwatched;
+
+    shutdown_stage stage;
+    uint64_t stage_deadline_ns;
+
+    uint64_t exits;
+    uint64_t unexpected_exits;
+    uint64_t restarts_made;
+    uint64_t terminated;
+    uint64_t killed;
+};
+
+#endif
@@ -0,0 +1,58 @@
+//collector.cpp - Creation of the collector backends
+
+#include "collector.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "netlinkCollector.h"
+#include "procNetDevCollector.h"
+#include "sysfsSampler.h"
+
+Collector *create_collector(collector_backend backend, const std::string &sysfs_root,
+                            const std::string &proc_net_dev)
+{
+    if (backend == BACKEND_NETLINK) {
+        NetlinkCollector *collector = new NetlinkCollector();
+
+        if (collector->open()) {
+            return collector;
+        }
+
+        std::cout << "[ERR]: Unable to open netlink, falling back to sysfs:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+
+        delete collector;
+    }
+
+    if (backend == BACKEND_PROCFS) {
+        ProcNetDevCollector *collector = new ProcNetDevCollector(proc_net_dev, sysfs_root);
+
+        if (collector->open()) {
+            return collector;
+        }
+
+        std::cout << "[ERR]: Unable to open " << proc_net_dev << ", falling back to sysfs:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+
+        delete collector;
+    }
+
+    return new SysfsCollector(sysfs_root);
+}
+
+bool parse_backend(const std::string &name, collector_backend &backend)
+{
+    if (name == "sysfs") {
+        backend = BACKEND_SYSFS;
+    } else if (name == "netlink") {
+        backend = BACKEND_NETLINK;
+    } else if (name == "procfs") {
+        backend = BACKEND_PROCFS;
+    } else {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,70 @@
+//collector.h - Pluggable backends that gather interface statistics
+//
+// A collector tracks a set of interfaces, each identified by the slot number
+// returned when it was added, and refreshes all of them in one collect() call.
+// The slot of an interface that is removed is handed out again, so slots stay
+// as few as the interfaces tracked at once.
+// How that happens is up to the backend: the sysfs backend reads each
+// interface's files, the netlink backend asks the kernel for every interface
+// at once and the procfs backend reads every interface's counters from
+// /proc/net/dev
+
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <string>
+
+#include "interfaceInfo.h"
+
+enum collector_backend
+{
+    BACKEND_SYSFS,
+    BACKEND_NETLINK,
+    BACKEND_PROCFS
+};
+
+class Collector
+{
+public:
+    virtual ~Collector() {}
+
+    // The backend's name as accepted by parse_backend()
+    virtual const char *name() const = 0;
+
+    // Starts tracking the named interface and returns its slot
+    virtual int add_interface(const std::string &interface_name) = 0;
+
+    // Stops tracking the interface in the given slot, which is no longer
+    // refreshed or present and may be returned by a later add_interface()
+    virtual void remove_interface(int slot) = 0;
+
+    // Refreshes samples[slot] for every tracked slot. Returns the number of
+    // slots whose interface was found, or -1 (with errno set) if the backend
+    // itself failed
+    virtual int collect(interface_information *samples) = 0;
+
+    // Whether the interface in the given slot was found by the last collect()
+    virtual bool is_present(int slot) const = 0;
+};
+
+// Where the sysfs backend finds the interface directories unless told
+// otherwise, a fake tree elsewhere can stand in for it
+#define SYSFS_NET_ROOT "/sys/class/net/"
+
+// Where the procfs backend reads the counters unless told otherwise
+#define PROC_NET_DEV "/proc/net/dev"
+
+// Creates a collector for the requested backend, the sysfs backend reading
+// the interfaces under sysfs_root (which ends in '/') and the procfs backend
+// reading proc_net_dev. If the backend cannot be set up (no netlink support,
+// for instance) the sysfs backend is returned instead, so callers always get
+// a working collector
+Collector *create_collector(collector_backend backend,
+                            const std::string &sysfs_root = SYSFS_NET_ROOT,
+                            const std::string &proc_net_dev = PROC_NET_DEV);
+
+// Converts a backend name ("sysfs", "netlink" or "procfs"), returns false if
+// unknown
+bool parse_backend(const std::string &name, collector_backend &backend);
+
+#endif
@@ -0,0 +1,709 @@
+//counterBatch.cpp - Parsing and rating the counters of many interfaces at once
+
+#include "counterBatch.h"
+
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Counters some drivers still keep in 32 bits, and some kernels report
+// through 32-bit fields
+const uint64_t COUNTER32_LIMIT = 1ULL << 32;
+
+// The member each batch counter is stored from and rated into, and the scale
+// of the rate (bytes are reported as bits)
+static uint64_t interface_information::*const counter_members[NUM_BATCH_COUNTERS] = {
+    &interface_information::rx_bytes,
+    &interface_information::rx_packets,
+    &interface_information::rx_dropped,
+    &interface_information::rx_errors,
+    &interface_information::tx_bytes,
+    &interface_information::tx_packets,
+    &interface_information::tx_dropped,
+    &interface_information::tx_errors,
+};
+
+static double interface_rates::*const rate_members[NUM_BATCH_COUNTERS] = {
+    &interface_rates::rx_bits,
+    &interface_rates::rx_packets,
+    &interface_rates::rx_dropped,
+    &interface_rates::rx_errors,
+    &interface_rates::tx_bits,
+    &interface_rates::tx_packets,
+    &interface_rates::tx_dropped,
+    &interface_rates::tx_errors,
+};
+
+static const double rate_scales[NUM_BATCH_COUNTERS] = {8, 1, 1, 1, 8, 1, 1, 1};
+
+const char *simd_level_name(simd_level level)
+{
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE41: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+simd_level detected_simd_level()
+{
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SIMD_SSE41;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+// Zero (scalar) until it is initialised, so anything parsed during static
+// initialisation is still parsed correctly
+static simd_level active_level = detected_simd_level();
+
+simd_level current_simd_level()
+{
+    return active_level;
+}
+
+void use_simd_level(simd_level level)
+{
+    simd_level best = detected_simd_level();
+
+    active_level = level < best ? level : best;
+}
+
+// Adds the digits at position onto result and returns the end of them,
+// noting whether the result grew too large for 64 bits
+static const char *add_digits(const char *position, const char *end, uint64_t &result,
+                              bool &overflowed)
+{
+    while (position < end && (unsigned char)(*position - '0') <= 9) {
+        overflowed = overflowed || __builtin_mul_overflow(result, 10, &result) ||
+                     __builtin_add_overflow(result, (uint64_t)(*position - '0'), &result);
+        position++;
+    }
+
+    return position;
+}
+
+static const char *parse_decimal_scalar(const char *text, const char *end, uint64_t &value)
+{
+    uint64_t result = 0;
+    bool overflowed = false;
+    const char *position = add_digits(text, end, result, overflowed);
+
+    if (position != text && !overflowed) {
+        value = result;
+    }
+
+    return position;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Loaded from offset length and added to first, moves the length bytes from
+// first on to the end of a register and zeroes the rest (an index with the
+// top bit set, which -128 keeps whatever first is added)
+static const int8_t align_digits[32] = {
+    -128, -128, -128, -128, -128, -128, -128, -128,
+    -128, -128, -128, -128, -128, -128, -128, -128,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// Turns up to 16 digit values (characters less '0') from byte first on into
+// a number: the digits are lined up at the end of a register, then
+// neighbouring digits are multiplied and added into pairs, pairs into fours
+// and fours into eights
+__attribute__((target("sse4.1")))
+static inline uint64_t combine_digits(__m128i digits, size_t first, size_t length)
+{
+    __m128i order = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(align_digits + length)),
+                                 _mm_set1_epi8(first));
+    __m128i aligned = _mm_shuffle_epi8(digits, order);
+    __m128i pairs = _mm_maddubs_epi16(aligned, _mm_set1_epi16(0x010A));
+    __m128i fours = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));
+    __m128i eights = _mm_madd_epi16(_mm_packus_epi32(fours, fours), _mm_set1_epi32(0x00012710));
+
+    return (uint64_t)(uint32_t)_mm_cvtsi128_si32(eights) * 100000000 +
+           (uint32_t)_mm_extract_epi32(eights, 1);
+}
+
+// The bytes of a loaded chunk that are digits, as a mask of 16 bits
+__attribute__((target("sse4.1")))
+static inline unsigned digit_mask(__m128i digits)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits));
+}
+
+// Parses the first 16 digits at once and adds any after them on one at a
+// time
+__attribute__((target("sse4.1")))
+static inline const char *parse_decimal_sse41(const char *text, const char *end, uint64_t &value)
+{
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)text), _mm_set1_epi8('0'));
+
+    size_t length = __builtin_ctz(~digit_mask(digits));
+    if (length > (size_t)(end - text)) {
+        length = end - text;
+    }
+    if (length == 0) {
+        return text;
+    }
+
+    uint64_t result = combine_digits(digits, 0, length);
+    bool overflowed = false;
+    const char *position = add_digits(text + length, end, result, overflowed);
+
+    if (!overflowed) {
+        value = result;
+    }
+
+    return position;
+}
+#endif
+
+const char *parse_decimal(const char *text, const char *end, uint64_t &value)
+{
+#ifdef HAVE_X86_KERNELS
+    if (active_level >= SIMD_SSE41) {
+        return parse_decimal_sse41(text, end, value);
+    }
+#endif
+    return parse_decimal_scalar(text, end, value);
+}
+
+// Parses each number with parse after skipping the spaces before it
+template <const char *(*parse)(const char *, const char *, uint64_t &)>
+static int parse_each(const char *&text, const char *end, uint64_t *values, int count)
+{
+    int parsed = 0;
+
+    for (; parsed < count; parsed++) {
+        const char *position = text;
+
+        while (position < end && *position == ' ') {
+            position++;
+        }
+
+        const char *after = parse(position, end, values[parsed]);
+
+        if (after == position) {
+            break;
+        }
+        text = after;
+    }
+
+    return parsed;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Parses 64 bytes at a time: which bytes are digits and which are spaces is
+// found for the whole block first, so each number's digits are known from
+// bit masks and its parse does not wait on the one before
+__attribute__((target("avx2")))
+static int parse_decimals_avx2(const char *&text, const char *end, uint64_t *values, int count)
+{
+    const char *block = text;
+    int parsed = 0;
+
+    while (parsed < count && block < end) {
+        size_t available = end - block;
+        uint64_t digits = 0;
+        uint64_t spaces = 0;
+
+        // Only what the padding after end allows is loaded
+        for (size_t offset = 0; offset < 64 && offset < available; offset += 32) {
+            __m256i chunk = available - offset > 16
+                ? _mm256_loadu_si256((const __m256i *)(block + offset))
+                : _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(block + offset)));
+            __m256i chunk_digits = _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'));
+            __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk_digits, _mm256_set1_epi8(9)),
+                                                 chunk_digits);
+
+            digits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_digit) << offset;
+            spaces |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '))) << offset;
+        }
+        if (available < 64) {
+            digits &= (1ULL << available) - 1;
+            spaces &= (1ULL << available) - 1;
+        }
+
+        // Numbers are only taken up to the first byte that is neither
+        uint64_t others = ~(digits | spaces);
+        size_t stop = others == 0 ? 64 : __builtin_ctzll(others);
+        uint64_t starts = digits & ~(digits << 1);
+
+        if (stop < 64) {
+            starts &= (1ULL << stop) - 1;
+        }
+
+        const char *next_block = block + 64;
+
+        while (starts != 0 && parsed < count) {
+            size_t first = __builtin_ctzll(starts);
+            uint64_t after = ~(digits >> first);
+            size_t length = after == 0 ? 64 : __builtin_ctzll(after);
+
+            // Digits running to the end of the block may carry on past it,
+            // the next block starts with them
+            if (first + length == 64 && first > 0) {
+                next_block = block + first;
+                break;
+            }
+
+            if (length > 16) {
+                text = parse_decimal_sse41(block + first, end, values[parsed]);
+                if (first + length == 64) {
+                    next_block = text;
+                }
+            } else {
+                __m128i number = _mm_loadu_si128((const __m128i *)(block + first));
+
+                values[parsed] = combine_digits(_mm_sub_epi8(number, _mm_set1_epi8('0')), 0, length);
+                text = block + first + length;
+            }
+
+            parsed++;
+            starts &= starts - 1;
+        }
+
+        // Something other than a number or a space ends the numbers
+        if (stop < 64) {
+            break;
+        }
+        block = next_block;
+    }
+
+    return parsed;
+}
+#endif
+
+int parse_decimals(const char *&text, const char *end, uint64_t *values, int count)
+{
+#ifdef HAVE_X86_KERNELS
+    if (active_level >= SIMD_AVX2) {
+        return parse_decimals_avx2(text, end, values, count);
+    }
+    if (active_level >= SIMD_SSE41) {
+        return parse_each<parse_decimal_sse41>(text, end, values, count);
+    }
+#endif
+    return parse_each<parse_decimal_scalar>(text, end, values, count);
+}
+
+// Records where a line's name is, without the spaces before it
+static inline void name_line(counter_line &line, const char *name, const char *colon)
+{
+    while (name < colon && *name == ' ') {
+        name++;
+    }
+
+    line.name = name;
+    line.name_length = colon - name;
+    line.parsed = 0;
+}
+
+static size_t parse_counter_lines_each(const char *text, const char *end, int columns,
+                                       uint64_t *const *values, counter_line *lines,
+                                       size_t max_lines)
+{
+    const char *position = text;
+    size_t line = 0;
+
+    while (position < end && line < max_lines) {
+        const char *line_end = (const char *)memchr(position, '\n', end - position);
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+
+        const char *colon = (const char *)memchr(position, ':', line_end - position);
+
+        if (colon != nullptr) {
+            uint64_t numbers[64];
+            const char *numbers_start = colon + 1;
+            int wanted = columns < 64 ? columns : 64;
+
+            for (int column = 0; column < wanted; column++) {
+                numbers[column] = 0;
+            }
+
+            name_line(lines[line], position, colon);
+            lines[line].parsed = parse_decimals(numbers_start, line_end, numbers, wanted);
+            for (int column = 0; column < lines[line].parsed; column++) {
+                values[column][line] = numbers[column];
+            }
+            line++;
+        }
+
+        position = line_end + 1;
+    }
+
+    return line;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Classifies 64 bytes at a time into digits, colons and line ends, then
+// takes the numbers, names and line ends of the block in order from the bit
+// masks. Digits before a line's colon are its name's, and numbers after the
+// last column are skipped
+__attribute__((target("avx2")))
+static size_t parse_counter_lines_avx2(const char *text, const char *end, int columns,
+                                       uint64_t *const *values, counter_line *lines,
+                                       size_t max_lines)
+{
+    const char *block = text;
+    const char *name = text;
+    size_t line = 0;
+    // -1 while still before the line's colon
+    int column = -1;
+
+    while (block < end && line < max_lines) {
+        size_t available = end - block;
+        uint64_t digits = 0;
+        uint64_t colons = 0;
+        uint64_t newlines = 0;
+
+        // Only what the padding after end allows is loaded
+        for (size_t offset = 0; offset < 64 && offset < available; offset += 32) {
+            __m256i chunk = available - offset > 16
+                ? _mm256_loadu_si256((const __m256i *)(block + offset))
+                : _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(block + offset)));
+            __m256i chunk_digits = _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'));
+            __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk_digits, _mm256_set1_epi8(9)),
+                                                 chunk_digits);
+
+            digits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_digit) << offset;
+            colons |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(':'))) << offset;
+            newlines |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n'))) << offset;
+        }
+        if (available < 64) {
+            uint64_t inside = (1ULL << available) - 1;
+            digits &= inside;
+            colons &= inside;
+            newlines &= inside;
+        }
+
+        uint64_t starts = digits & ~(digits << 1);
+        uint64_t events = starts | colons | newlines;
+        const char *next_block = block + 64;
+
+        while (events != 0) {
+            size_t at = __builtin_ctzll(events);
+            uint64_t bit = 1ULL << at;
+
+            events &= events - 1;
+
+            if (newlines & bit) {
+                if (column != -1) {
+                    lines[line].parsed = column < columns ? column : columns;
+                    column = -1;
+                    if (++line == max_lines) {
+                        return line;
+                    }
+                }
+                name = block + at + 1;
+                continue;
+            }
+
+            if (colons & bit) {
+                if (column == -1) {
+                    name_line(lines[line], name, block + at);
+                    column = 0;
+                }
+                continue;
+            }
+
+            if (column == -1 || column >= columns) {
+                continue;
+            }
+
+            uint64_t after = ~(digits >> at);
+            size_t length = after == 0 ? 64 : __builtin_ctzll(after);
+
+            // Digits running to the end of the block may carry on past it,
+            // the next block starts with them
+            if (at + length == 64 && at > 0) {
+                next_block = block + at;
+                break;
+            }
+
+            uint64_t value = 0;
+
+            if (length > 16) {
+                next_block = parse_decimal_sse41(block + at, end, value);
+                if (at + length != 64) {
+                    next_block = block + 64;
+                }
+            } else {
+                __m128i number = _mm_loadu_si128((const __m128i *)(block + at));
+                value = combine_digits(_mm_sub_epi8(number, _mm_set1_epi8('0')), 0, length);
+            }
+
+            values[column++][line] = value;
+        }
+
+        block = next_block;
+    }
+
+    // The last line may have no line end
+    if (column != -1 && line < max_lines) {
+        lines[line].parsed = column < columns ? column : columns;
+        line++;
+    }
+
+    return line;
+}
+#endif
+
+size_t parse_counter_lines(const char *text, const char *end, int columns,
+                           uint64_t *const *values, counter_line *lines, size_t max_lines)
+{
+#ifdef HAVE_X86_KERNELS
+    if (active_level >= SIMD_AVX2) {
+        return parse_counter_lines_avx2(text, end, columns, values, lines, max_lines);
+    }
+#endif
+    return parse_counter_lines_each(text, end, columns, values, lines, max_lines);
+}
+
+void counter_batch::resize(size_t count)
+{
+    for (std::vector<uint64_t> &counter : counters) {
+        counter.resize(count);
+    }
+    carrier_up_count.resize(count);
+    carrier_down_count.resize(count);
+    timestamp_ns.resize(count);
+}
+
+void counter_batch::store(size_t index, const interface_information &info)
+{
+    for (int i = 0; i < NUM_BATCH_COUNTERS; i++) {
+        counters[i][index] = info.*counter_members[i];
+    }
+    carrier_up_count[index] = info.carrier_up_count;
+    carrier_down_count[index] = info.carrier_down_count;
+    timestamp_ns[index] = info.timestamp_ns;
+}
+
+void batch_rates::resize(size_t count)
+{
+    valid.resize(count);
+    reset.resize(count);
+    interval.resize(count);
+    for (std::vector<double> &rate : rates) {
+        rate.resize(count);
+    }
+    exceeded.resize(count);
+}
+
+void batch_rates::get(size_t index, interface_rates &rates_of) const
+{
+    rates_of.valid = valid[index];
+    rates_of.reset = reset[index];
+    rates_of.interval = interval[index];
+
+    for (int i = 0; i < NUM_BATCH_COUNTERS; i++) {
+        rates_of.*rate_members[i] = rates[i][index];
+    }
+}
+
+// Rates interfaces [first, count) of current against previous. An interface
+// is comparable when both samples were found and time moved on. A counter
+// that went backwards from below 2^32 wrapped, unless the link bounced (when
+// drivers reset their statistics); from anywhere else it started over, as
+// every counter did if the carrier counts went backwards (the device was
+// re-created)
+static void rate_scalar(const counter_batch &previous, const counter_batch &current,
+                        const double *thresholds, batch_rates &results,
+                        size_t first, size_t count)
+{
+    for (size_t i = first; i < count; i++) {
+        uint64_t was = previous.timestamp_ns[i];
+        uint64_t now = current.timestamp_ns[i];
+        bool comparable = was != 0 && now > was;
+        double per_second = comparable ? 1e9 / (double)(now - was) : 0;
+        bool started_over = current.carrier_up_count[i] < previous.carrier_up_count[i]
+            || current.carrier_down_count[i] < previous.carrier_down_count[i];
+        bool bounced = current.carrier_down_count[i] != previous.carrier_down_count[i];
+
+        double rates[NUM_BATCH_COUNTERS];
+        uint64_t exceeded = 0;
+
+        for (int counter = 0; counter < NUM_BATCH_COUNTERS; counter++) {
+            uint64_t before = previous.counters[counter][i];
+            uint64_t after = current.counters[counter][i];
+            bool back = after < before;
+
+            if (back && (bounced || before >= COUNTER32_LIMIT)) {
+                started_over = true;
+            }
+
+            uint64_t delta = after - before + (back ? COUNTER32_LIMIT : 0);
+
+            rates[counter] = (double)delta * rate_scales[counter] * per_second;
+            if (rates[counter] > thresholds[counter]) {
+                exceeded |= 1ULL << counter;
+            }
+        }
+
+        bool valid = comparable && !started_over;
+
+        results.valid[i] = valid;
+        results.reset[i] = comparable && started_over;
+        results.interval[i] = valid ? (double)(now - was) / 1e9 : 0;
+        results.exceeded[i] = valid ? exceeded : 0;
+
+        for (int counter = 0; counter < NUM_BATCH_COUNTERS; counter++) {
+            results.rates[counter][i] = valid ? rates[counter] : 0;
+        }
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+// Converts four unsigned 64-bit values to double, which AVX2 has no
+// instruction for: each half of a value is put into the mantissa of a double
+// with a known exponent, which is then subtracted back out
+__attribute__((target("avx2")))
+static inline __m256d unsigned_to_double(__m256i value)
+{
+    const __m256i magic_low = _mm256_set1_epi64x(0x4330000000000000);
+    const __m256i magic_high = _mm256_set1_epi64x(0x4530000000000000);
+    const __m256d magic_both = _mm256_set1_pd(0x1p84 + 0x1p52);
+
+    __m256i low = _mm256_blend_epi32(value, magic_low, 0xAA);
+    __m256i high = _mm256_xor_si256(_mm256_srli_epi64(value, 32), magic_high);
+
+    return _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(high), magic_both),
+                         _mm256_castsi256_pd(low));
+}
+
+// Whether each of four unsigned values is greater than the other's, which
+// AVX2 also lacks: flipping the sign bits makes the signed comparison do
+__attribute__((target("avx2")))
+static inline __m256i unsigned_greater(__m256i left, __m256i right)
+{
+    const __m256i sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(left, sign), _mm256_xor_si256(right, sign));
+}
+
+// The same four interfaces at a time, every lane worked out without
+// branches and the ones that are not valid masked to 0 at the end
+__attribute__((target("avx2")))
+static void rate_avx2(const counter_batch &previous, const counter_batch &current,
+                      const double *thresholds, batch_rates &results, size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i all = _mm256_set1_epi64x(-1);
+    const __m256i wrap = _mm256_set1_epi64x(COUNTER32_LIMIT);
+    const __m256d nanoseconds = _mm256_set1_pd(1e9);
+
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i was = _mm256_loadu_si256((const __m256i *)(previous.timestamp_ns.data() + i));
+        __m256i now = _mm256_loadu_si256((const __m256i *)(current.timestamp_ns.data() + i));
+        __m256i up_was = _mm256_loadu_si256((const __m256i *)(previous.carrier_up_count.data() + i));
+        __m256i up_now = _mm256_loadu_si256((const __m256i *)(current.carrier_up_count.data() + i));
+        __m256i down_was = _mm256_loadu_si256((const __m256i *)(previous.carrier_down_count.data() + i));
+        __m256i down_now = _mm256_loadu_si256((const __m256i *)(current.carrier_down_count.data() + i));
+
+        __m256i comparable = _mm256_andnot_si256(_mm256_cmpeq_epi64(was, zero), unsigned_greater(now, was));
+        __m256d elapsed = unsigned_to_double(_mm256_sub_epi64(now, was));
+        __m256d per_second = _mm256_and_pd(_mm256_div_pd(nanoseconds, elapsed),
+                                           _mm256_castsi256_pd(comparable));
+        __m256i started_over = _mm256_or_si256(unsigned_greater(up_was, up_now),
+                                               unsigned_greater(down_was, down_now));
+        __m256i bounced = _mm256_xor_si256(_mm256_cmpeq_epi64(down_was, down_now), all);
+
+        __m256d rates[NUM_BATCH_COUNTERS];
+        __m256i exceeded = zero;
+
+        for (int counter = 0; counter < NUM_BATCH_COUNTERS; counter++) {
+            __m256i before = _mm256_loadu_si256((const __m256i *)(previous.counters[counter].data() + i));
+            __m256i after = _mm256_loadu_si256((const __m256i *)(current.counters[counter].data() + i));
+
+            __m256i back = unsigned_greater(before, after);
+            __m256i small = _mm256_cmpeq_epi64(_mm256_srli_epi64(before, 32), zero);
+            __m256i delta = _mm256_add_epi64(_mm256_sub_epi64(after, before), _mm256_and_si256(back, wrap));
+
+            started_over = _mm256_or_si256(started_over,
+                _mm256_andnot_si256(_mm256_andnot_si256(bounced, small), back));
+
+            rates[counter] = _mm256_mul_pd(_mm256_mul_pd(unsigned_to_double(delta),
+                                                         _mm256_set1_pd(rate_scales[counter])),
+                                           per_second);
+
+            __m256d above = _mm256_cmp_pd(rates[counter], _mm256_set1_pd(thresholds[counter]), _CMP_GT_OQ);
+            exceeded = _mm256_or_si256(exceeded, _mm256_and_si256(_mm256_castpd_si256(above),
+                                                                  _mm256_set1_epi64x(1ULL << counter)));
+        }
+
+        __m256i valid = _mm256_andnot_si256(started_over, comparable);
+        __m256i reset = _mm256_and_si256(started_over, comparable);
+        __m256d valid_mask = _mm256_castsi256_pd(valid);
+
+        for (int counter = 0; counter < NUM_BATCH_COUNTERS; counter++) {
+            _mm256_storeu_pd(results.rates[counter].data() + i, _mm256_and_pd(rates[counter], valid_mask));
+        }
+        _mm256_storeu_pd(results.interval.data() + i,
+                         _mm256_and_pd(_mm256_div_pd(elapsed, nanoseconds), valid_mask));
+        _mm256_storeu_si256((__m256i *)(results.exceeded.data() + i), _mm256_and_si256(exceeded, valid));
+
+        int valid_lanes = _mm256_movemask_pd(valid_mask);
+        int reset_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(reset));
+
+        for (int lane = 0; lane < 4; lane++) {
+            results.valid[i + lane] = (valid_lanes >> lane) & 1;
+            results.reset[i + lane] = (reset_lanes >> lane) & 1;
+        }
+    }
+
+    rate_scalar(previous, current, thresholds, results, i, count);
+}
+#endif
+
+BatchRateCalculator::BatchRateCalculator()
+{
+    for (double &threshold : thresholds) {
+        threshold = std::numeric_limits<double>::infinity();
+    }
+}
+
+void BatchRateCalculator::resize(size_t count)
+{
+    // Interfaces added have no previous sample
+    previous.resize(count);
+    current.resize(count);
+    results.resize(count);
+}
+
+void BatchRateCalculator::set_threshold(batch_counter counter, double rate)
+{
+    thresholds[counter] = rate;
+}
+
+void BatchRateCalculator::update()
+{
+#ifdef HAVE_X86_KERNELS
+    if (active_level >= SIMD_AVX2) {
+        rate_avx2(previous, current, thresholds, results, current.size());
+    } else {
+        rate_scalar(previous, current, thresholds, results, 0, current.size());
+    }
+#else
+    rate_scalar(previous, current, thresholds, results, 0, current.size());
+#endif
+
+    std::swap(previous, current);
+}
@@ -0,0 +1,167 @@
+//counterBatch.h - Parsing and rating the counters of many interfaces at once
+//
+// Once every interface is sampled in one pass the work per tick is turning
+// decimal text into counters and counters into rates, the same few
+// operations over thousands of values. The counters are kept as a structure
+// of arrays (every interface's rx_bytes together, and so on) so that a
+// single pass rates four interfaces to an AVX2 instruction, and the decimal
+// parser takes sixteen digits to an SSE4.1 instruction. Which instructions
+// are used is decided once at run time from what the CPU supports, with a
+// scalar version of everything for the rest
+
+#ifndef COUNTER_BATCH_H
+#define COUNTER_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "counterRates.h"
+#include "interfaceInfo.h"
+
+// The instruction sets the kernels can be run with, each implying the ones
+// before it
+enum simd_level
+{
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+const char *simd_level_name(simd_level level);
+
+// The best level the CPU supports, and the level the kernels use, which is
+// that unless use_simd_level() lowered it
+simd_level detected_simd_level();
+simd_level current_simd_level();
+
+// Makes the kernels use at most the given level, to compare them. Not to be
+// called while a kernel is running on another thread
+void use_simd_level(simd_level level);
+
+// The parser may read this many bytes from where a number starts, whatever
+// the end given, so a buffer holding numbers must have that much room
+const size_t DECIMAL_READ_PADDING = 16;
+
+// Parses the unsigned decimal number at the start of [text, end) into value
+// and returns the end of its digits, as std::from_chars does. If text does
+// not start with a digit value is left alone and text is returned, if the
+// number does not fit in 64 bits value is left alone
+const char *parse_decimal(const char *text, const char *end, uint64_t &value);
+
+// Parses up to count numbers separated by spaces, as the columns of
+// /proc/net/dev are, into values and moves text past the last of them.
+// Returns the number parsed, which is short of count where something other
+// than a space or a digit was found first
+int parse_decimals(const char *&text, const char *end, uint64_t *values, int count);
+
+// Where a line of a table such as /proc/net/dev names its interface, and how
+// many of its numbers were found
+struct counter_line
+{
+    const char *name;
+    size_t name_length;
+    int parsed;
+};
+
+// Parses every "name: n n n ..." line of [text, end) in one go: the first
+// columns numbers after line i's colon go to values[0][i] up to
+// values[columns - 1][i], its name and how many numbers it had to lines[i].
+// Lines without a colon, such as headers, are skipped, and a number too
+// large for 64 bits is taken as 0. Returns the number of lines parsed, at
+// most max_lines. With AVX2 the whole text is classified 64 bytes at a
+// time, rather than each line being found and parsed on its own
+size_t parse_counter_lines(const char *text, const char *end, int columns,
+                           uint64_t *const *values, counter_line *lines, size_t max_lines);
+
+// The counters rates are computed for, in the order of interface_rates
+enum batch_counter
+{
+    BATCH_RX_BYTES,
+    BATCH_RX_PACKETS,
+    BATCH_RX_DROPPED,
+    BATCH_RX_ERRORS,
+    BATCH_TX_BYTES,
+    BATCH_TX_PACKETS,
+    BATCH_TX_DROPPED,
+    BATCH_TX_ERRORS,
+    NUM_BATCH_COUNTERS
+};
+
+// The samples of many interfaces laid out one array per counter
+struct counter_batch
+{
+    std::vector<uint64_t> counters[NUM_BATCH_COUNTERS];
+    std::vector<uint64_t> carrier_up_count;
+    std::vector<uint64_t> carrier_down_count;
+    // 0 where the interface was not found
+    std::vector<uint64_t> timestamp_ns;
+
+    size_t size() const { return timestamp_ns.size(); }
+    void resize(size_t count);
+
+    // Copies one interface's sample into the batch
+    void store(size_t index, const interface_information &info);
+};
+
+// The rates of many interfaces laid out one array per counter, every value
+// as it would be in that interface's interface_rates
+struct batch_rates
+{
+    std::vector<uint8_t> valid;
+    std::vector<uint8_t> reset;
+    std::vector<double> interval;
+    std::vector<double> rates[NUM_BATCH_COUNTERS];
+    // A bit per counter (1 << BATCH_RX_BYTES, ...) whose rate was over its
+    // threshold, only ever set where the rates are valid
+    std::vector<uint64_t> exceeded;
+
+    size_t size() const { return valid.size(); }
+    void resize(size_t count);
+
+    // The rates of one interface
+    void get(size_t index, interface_rates &rates) const;
+};
+
+// Turns consecutive batches into rates, exactly as a RateCalculator per
+// interface would: wrapped 32-bit counters are accounted for, and counters
+// that started over give a reset instead of rates. The batch of the
+// previous pass is kept, so interfaces keep their positions from one pass
+// to the next
+class BatchRateCalculator
+{
+public:
+    BatchRateCalculator();
+
+    // Sets the number of interfaces, those added start without a previous
+    // sample
+    void resize(size_t count);
+    size_t size() const { return previous.size(); }
+
+    // Forgets the previous sample at index, as when the position is given to
+    // another interface
+    void clear(size_t index) { previous.timestamp_ns[index] = 0; }
+
+    // A rate above which the counter's bit is set in exceeded, per second
+    // (bits for bytes). Rates are never over the default of infinity
+    void set_threshold(batch_counter counter, double rate);
+
+    // Where the next samples are stored, with counter_batch::store() or
+    // directly into the arrays. It holds an older pass until then, so every
+    // interface has to be stored
+    counter_batch &next() { return current; }
+
+    // Rates every interface in next() against the previous pass, which next()
+    // then replaces
+    void update();
+
+    const batch_rates &rates() const { return results; }
+
+private:
+    counter_batch previous;
+    counter_batch current;
+    batch_rates results;
+    double thresholds[NUM_BATCH_COUNTERS];
+};
+
+#endif
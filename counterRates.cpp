@@ -0,0 +1,107 @@
+//counterRates.cpp - Per-second rates between consecutive samples
+
+#include "counterRates.h"
+
+#include <cstring>
+
+// Counters some drivers still keep in 32 bits, and some kernels report
+// through 32-bit fields
+const uint64_t COUNTER32_LIMIT = 1ULL << 32;
+
+// The counters rates are computed for and the rate each one produces
+struct rate_counter
+{
+    uint64_t interface_information::*counter;
+    double interface_rates::*rate;
+    // Bytes are reported as bits
+    double scale;
+};
+
+static const rate_counter rate_counters[] = {
+    {&interface_information::rx_bytes,   &interface_rates::rx_bits,    8},
+    {&interface_information::rx_packets, &interface_rates::rx_packets, 1},
+    {&interface_information::rx_dropped, &interface_rates::rx_dropped, 1},
+    {&interface_information::rx_errors,  &interface_rates::rx_errors,  1},
+    {&interface_information::tx_bytes,   &interface_rates::tx_bits,    8},
+    {&interface_information::tx_packets, &interface_rates::tx_packets, 1},
+    {&interface_information::tx_dropped, &interface_rates::tx_dropped, 1},
+    {&interface_information::tx_errors,  &interface_rates::tx_errors,  1},
+};
+const int NUM_RATE_COUNTERS = sizeof(rate_counters) / sizeof(rate_counters[0]);
+
+// Works out how far a counter moved. A counter that went backwards from
+// below 2^32 is taken to have wrapped as a 32-bit counter; from anywhere
+// higher it can only have started over, and false is returned
+static bool counter_delta(uint64_t previous, uint64_t current, uint64_t &delta)
+{
+    if (current >= previous) {
+        delta = current - previous;
+        return true;
+    }
+
+    if (previous < COUNTER32_LIMIT) {
+        delta = COUNTER32_LIMIT - previous + current;
+        return true;
+    }
+
+    return false;
+}
+
+RateCalculator::RateCalculator() : has_previous(false)
+{
+}
+
+bool RateCalculator::update(const interface_information &info, interface_rates &rates)
+{
+    memset(&rates, 0, sizeof(rates));
+
+    // A sample of an interface that was not found carries no counters
+    if (info.timestamp_ns == 0) {
+        has_previous = false;
+        return false;
+    }
+
+    if (!has_previous || info.timestamp_ns <= previous.timestamp_ns) {
+        previous = info;
+        has_previous = true;
+        return false;
+    }
+
+    // The carrier counts only ever grow for as long as the device exists,
+    // going backwards means it was re-created. If the link went down in
+    // between, a counter going backwards is a driver resetting its
+    // statistics with the link rather than a wrap
+    bool recreated = info.carrier_up_count < previous.carrier_up_count
+        || info.carrier_down_count < previous.carrier_down_count;
+    bool link_bounced = info.carrier_down_count != previous.carrier_down_count;
+
+    uint64_t deltas[NUM_RATE_COUNTERS];
+    bool started_over = recreated;
+
+    for (int i = 0; i < NUM_RATE_COUNTERS && !started_over; i++) {
+        uint64_t before = previous.*(rate_counters[i].counter);
+        uint64_t after = info.*(rate_counters[i].counter);
+
+        if ((link_bounced && after < before) || !counter_delta(before, after, deltas[i])) {
+            started_over = true;
+        }
+    }
+
+    uint64_t elapsed = info.timestamp_ns - previous.timestamp_ns;
+    previous = info;
+
+    if (started_over) {
+        rates.reset = true;
+        return false;
+    }
+
+    rates.interval = elapsed / 1e9;
+
+    for (int i = 0; i < NUM_RATE_COUNTERS; i++) {
+        rates.*(rate_counters[i].rate) = deltas[i] * rate_counters[i].scale / rates.interval;
+    }
+
+    rates.valid = true;
+
+    return true;
+}
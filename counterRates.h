@@ -0,0 +1,56 @@
+//counterRates.h - Per-second rates between consecutive samples
+//
+// The counters an interface reports only ever grow, so what matters
+// operationally is how fast they grow. A RateCalculator keeps the previous
+// sample of one interface and turns each new one into rates, coping with
+// counters that wrapped and with interfaces that were reset or re-created
+// in between
+
+#ifndef COUNTER_RATES_H
+#define COUNTER_RATES_H
+
+#include <cstdint>
+
+#include "interfaceInfo.h"
+
+// The rates of one interface over the interval ending at a sample, every
+// value is per second
+struct interface_rates
+{
+    // Whether the rates hold anything. There is nothing to compare the first
+    // sample (or the first after a reset) against
+    bool valid;
+    // Whether the counters were found to have started over since the
+    // previous sample, the sample is then the new baseline
+    bool reset;
+    // The length of the interval, in seconds
+    double interval;
+
+    double rx_bits;
+    double rx_packets;
+    double rx_dropped;
+    double rx_errors;
+    double tx_bits;
+    double tx_packets;
+    double tx_dropped;
+    double tx_errors;
+};
+
+class RateCalculator
+{
+public:
+    RateCalculator();
+
+    // Computes the rates between the previous sample and this one, then
+    // keeps this one for next time. Returns rates.valid
+    bool update(const interface_information &info, interface_rates &rates);
+
+    // Forgets the previous sample, the next one starts afresh
+    void clear() { has_previous = false; }
+
+private:
+    interface_information previous;
+    bool has_previous;
+};
+
+#endif
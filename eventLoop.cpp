@@ -0,0 +1,110 @@
+//eventLoop.cpp - epoll based dispatch of descriptor readiness
+
+#include "eventLoop.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+// The most events handled per epoll_wait(), more simply wait for the next
+const int MAX_EVENTS = 64;
+
+EventLoop::EventLoop() : epoll_fd(-1), running(false)
+{
+}
+
+EventLoop::~EventLoop()
+{
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+}
+
+bool EventLoop::open()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    return epoll_fd != -1;
+}
+
+bool EventLoop::add(int fd, uint32_t events, event_handler handler)
+{
+    std::unique_ptr<event_handler> registered(new event_handler(std::move(handler)));
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events | EPOLLET;
+    event.data.ptr = registered.get();
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return false;
+    }
+
+    handlers[fd] = std::move(registered);
+
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events)
+{
+    auto found = handlers.find(fd);
+
+    if (found == handlers.end()) {
+        errno = ENOENT;
+        return false;
+    }
+
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events | EPOLLET;
+    event.data.ptr = found->second.get();
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) != -1;
+}
+
+void EventLoop::remove(int fd)
+{
+    auto found = handlers.find(fd);
+
+    if (found == handlers.end()) {
+        return;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+    *found->second = nullptr;
+    retired.push_back(std::move(found->second));
+    handlers.erase(found);
+}
+
+void EventLoop::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    running = true;
+
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+        if (ready == -1) {
+            if (errno != EINTR) {
+                std::cout << "server: epoll_wait: " << strerror(errno) << std::endl;
+                return;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            event_handler *handler = (event_handler *)events[i].data.ptr;
+
+            // Skip handlers removed earlier in this batch
+            if (*handler) {
+                (*handler)(events[i].events);
+            }
+        }
+
+        retired.clear();
+    }
+}
@@ -0,0 +1,63 @@
+//eventLoop.h - epoll based dispatch of descriptor readiness
+//
+// Every descriptor the network monitor waits on (the listening socket, each
+// connection, the sampler's events, shutdown signals) is registered with a
+// handler. A wakeup costs one epoll_wait() and touches only the descriptors
+// that are actually ready, however many are registered
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+// Called with the epoll events (EPOLLIN, EPOLLOUT, ...) ready on a descriptor
+typedef std::function<void(uint32_t events)> event_handler;
+
+class EventLoop
+{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Creates the epoll instance, returns false (with errno set) on failure
+    bool open();
+
+    // Starts watching fd for the given events. Registrations are
+    // edge-triggered, so a handler must consume everything that is ready
+    // (read or accept until EAGAIN) before returning
+    bool add(int fd, uint32_t events, event_handler handler);
+
+    // Changes the events watched on an already registered descriptor
+    bool modify(int fd, uint32_t events);
+
+    // Stops watching fd. Must be called before fd is closed; it is safe to
+    // call from inside any handler, including fd's own
+    void remove(int fd);
+
+    // Dispatches ready descriptors to their handlers until stop() is called
+    void run();
+
+    // Makes run() return once the current batch of handlers is done
+    void stop() { running = false; }
+
+private:
+    int epoll_fd;
+    bool running;
+
+    std::unordered_map<int, std::unique_ptr<event_handler>> handlers;
+
+    // Handlers removed during a dispatch batch, kept alive (but emptied)
+    // until the batch ends since later events in it may still point at them
+    std::vector<std::unique_ptr<event_handler>> retired;
+};
+
+#endif
@@ -0,0 +1,83 @@
+//fakeSysfs.cpp - Lays out fake interfaces for the monitors to sample
+//
+// Usage: fakeSysfs [-n interfaces] [-t ms] directory
+//
+// Creates a tree shaped like /sys/class/net in directory with the given
+// number of interfaces (fake0, fake1, ...), moves their counters on every
+// interval until interrupted and then removes them again. Point
+// networkMonitor at it with -d directory to monitor them without real NICs
+// or privileges, adding -b procfs -P directory/.net_dev for the procfs
+// backend
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+#include "benchFixture.h"
+#include "sampleTimer.h"
+
+static volatile sig_atomic_t is_running = 1;
+
+static void signal_handler(int signal)
+{
+    is_running = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 4;
+    long interval_ms = 1000;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:t:")) != -1) {
+        if (option == 'n' && atoi(optarg) > 0) {
+            count = atoi(optarg);
+        } else if (option == 't' && parse_interval(optarg, interval_ms)) {
+            continue;
+        } else {
+            std::cout << "usage: fakeSysfs [-n interfaces] [-t ms] directory" << std::endl;
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cout << "usage: fakeSysfs [-n interfaces] [-t ms] directory" << std::endl;
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    SysfsFixture fixture;
+    SampleTimer timer;
+
+    if (!fixture.create(argv[optind], count) || !timer.start(interval_ms)) {
+        std::cout << "[ERR]: Unable to create the fake interfaces:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::cout << "Faking " << count << " interfaces in " << fixture.root()
+              << ", counters move every " << interval_ms << " ms" << std::endl;
+
+    struct pollfd descriptor;
+    descriptor.fd = timer.fd();
+    descriptor.events = POLLIN;
+
+    while (is_running) {
+        if (poll(&descriptor, 1, -1) > 0 && timer.expired() && !fixture.advance()) {
+            std::cout << "[ERR]: Unable to update the fake interfaces:" << std::endl;
+            std::cout << strerror(errno) << std::endl;
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,487 @@
+//historyFile.cpp - On-disk history of interface counters
+
+#include "historyFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Identifies the start of a block in the data file
+const uint32_t BLOCK_MAGIC = 0x4b4c4248;   // "HBLK"
+
+// A block holds at most a minute of samples, and never more than this many
+// however short the sampling interval
+const uint64_t BLOCK_NS = 60 * 1000000000ULL;
+const uint32_t MAX_BLOCK_SAMPLES = 65536;
+
+// The counters stored for each sample, after its time and operstate
+static uint64_t interface_information::*const stored_counters[] = {
+    &interface_information::carrier_up_count,
+    &interface_information::carrier_down_count,
+    &interface_information::rx_bytes,
+    &interface_information::rx_dropped,
+    &interface_information::rx_errors,
+    &interface_information::rx_packets,
+    &interface_information::tx_bytes,
+    &interface_information::tx_dropped,
+    &interface_information::tx_errors,
+    &interface_information::tx_packets,
+};
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)value | 0x80);
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Reads a varint from [position, end), returns false if it runs off the end
+static bool get_varint(const uint8_t *&position, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64 && position < end; shift += 7) {
+        uint8_t byte = *position++;
+
+        value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Counters go backwards when an interface is reset, so their differences
+// are zigzag encoded to keep small negative ones small
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// The nanoseconds on a clock
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+HistoryWriter::HistoryWriter(const std::string &directory, int sync_seconds)
+    : directory(directory), sync_seconds(sync_seconds), stopping(false)
+{
+    realtime_offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+}
+
+HistoryWriter::~HistoryWriter()
+{
+    stop();
+
+    for (auto &file : interfaces) {
+        close(file->data_fd);
+        close(file->index_fd);
+    }
+}
+
+int HistoryWriter::add_interface(const std::string &interface_name)
+{
+    std::unique_ptr<interface_file> created(new interface_file());
+    interface_file &file = *created;
+    std::string base = directory + "/" + interface_name;
+
+    file.name = interface_name;
+    file.data_fd = open((base + ".data").c_str(),
+                        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    file.index_fd = open((base + ".index").c_str(),
+                         O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    struct stat status;
+    struct stat index_status;
+
+    if (file.data_fd == -1 || file.index_fd == -1 || fstat(file.data_fd, &status) == -1
+            || fstat(file.index_fd, &index_status) == -1) {
+        int saved_errno = errno;
+        if (file.data_fd != -1) {
+            close(file.data_fd);
+        }
+        if (file.index_fd != -1) {
+            close(file.index_fd);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+
+    // Anything already there (even a block cut short by a crash, which the
+    // index never points at) is left alone and appended after. A record cut
+    // short in the index would put every later one out of line, it goes
+    file.data_size = status.st_size;
+    file.index_size = index_status.st_size - index_status.st_size % sizeof(history_index_entry);
+    if ((uint64_t)index_status.st_size != file.index_size) {
+        ftruncate(file.index_fd, file.index_size);
+    }
+    memset(&file.entry, 0, sizeof(file.entry));
+    memset(&file.previous, 0, sizeof(file.previous));
+
+    interfaces.push_back(std::move(created));
+
+    return interfaces.size() - 1;
+}
+
+bool HistoryWriter::start()
+{
+    thread = std::thread(&HistoryWriter::run, this);
+
+    return true;
+}
+
+void HistoryWriter::record(int interface, const interface_information &info)
+{
+    // A sample of an interface that was not found holds nothing
+    if (info.timestamp_ns == 0) {
+        return;
+    }
+
+    interface_file &file = *interfaces.at(interface);
+    uint64_t timestamp = info.timestamp_ns + realtime_offset_ns;
+
+    // Every block covers one minute of the wall clock at most, and is
+    // finished early enough for the next sync to make it durable
+    if (file.entry.samples > 0
+            && (timestamp / BLOCK_NS != file.entry.first_ns / BLOCK_NS
+                || timestamp - file.entry.first_ns >= (uint64_t)sync_seconds * 1000000000ULL
+                || file.entry.samples == MAX_BLOCK_SAMPLES)) {
+        finish_block(interface);
+    }
+
+    if (file.entry.samples == 0) {
+        file.entry.first_ns = timestamp;
+        memset(&file.previous, 0, sizeof(file.previous));
+    }
+
+    put_varint(file.encoded, timestamp - file.previous.timestamp_ns);
+    file.encoded.push_back(operstate_code(info.operstate));
+
+    for (auto counter : stored_counters) {
+        put_varint(file.encoded, zigzag(info.*counter - file.previous.*counter));
+    }
+
+    file.previous = info;
+    file.previous.timestamp_ns = timestamp;
+    file.entry.last_ns = timestamp;
+    file.entry.samples++;
+}
+
+// Hands the interface's current block to the writing thread, which picks it
+// up at its next sync
+void HistoryWriter::finish_block(int interface)
+{
+    interface_file &file = *interfaces[interface];
+    finished_block block;
+
+    block.file = &file;
+    block.encoded.swap(file.encoded);
+    block.entry = file.entry;
+
+    memset(&file.entry, 0, sizeof(file.entry));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(std::move(block));
+}
+
+void HistoryWriter::stop()
+{
+    if (!thread.joinable()) {
+        return;
+    }
+
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        if (interfaces[i]->entry.samples > 0) {
+            finish_block(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+
+    thread.join();
+}
+
+void HistoryWriter::run()
+{
+    while (true) {
+        std::deque<finished_block> blocks;
+        bool stop_requested;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            wake.wait_for(lock, std::chrono::seconds(sync_seconds),
+                          [this] { return stopping; });
+
+            blocks.swap(pending);
+            stop_requested = stopping;
+        }
+
+        write_blocks(blocks);
+
+        if (stop_requested) {
+            break;
+        }
+    }
+}
+
+// Appends the blocks to their data files and only once those are on disk
+// adds them to the indexes, so the index never points past what was written
+void HistoryWriter::write_blocks(std::deque<finished_block> &blocks)
+{
+    std::vector<interface_file *> written;
+
+    for (finished_block &block : blocks) {
+        interface_file &file = *block.file;
+        history_block_header header;
+
+        header.magic = BLOCK_MAGIC;
+        header.samples = block.entry.samples;
+        header.length = block.encoded.size();
+        header.reserved = 0;
+
+        struct iovec parts[2];
+        parts[0].iov_base = &header;
+        parts[0].iov_len = sizeof(header);
+        parts[1].iov_base = block.encoded.data();
+        parts[1].iov_len = block.encoded.size();
+
+        size_t length = sizeof(header) + block.encoded.size();
+        ssize_t result;
+
+        do {
+            result = writev(file.data_fd, parts, 2);
+        } while (result == -1 && errno == EINTR);
+
+        // Whatever part of the block did get written is cut off again, the
+        // next block goes where this one should have
+        if (result != (ssize_t)length) {
+            std::cout << "[ERR]: Unable to write the history of " << file.name << ":" << std::endl;
+            std::cout << (result == -1 ? strerror(errno) : "short write") << std::endl;
+            if (result > 0) {
+                ftruncate(file.data_fd, file.data_size);
+            }
+            block.entry.length = 0;
+            continue;
+        }
+
+        block.entry.offset = file.data_size;
+        block.entry.length = length;
+        file.data_size += length;
+
+        if (std::find(written.begin(), written.end(), &file) == written.end()) {
+            written.push_back(&file);
+        }
+    }
+
+    for (interface_file *file : written) {
+        fdatasync(file->data_fd);
+    }
+
+    // An index record that is not wholly written is cut off again, the
+    // block it points at is only lost from the index
+    for (const finished_block &block : blocks) {
+        if (block.entry.length == 0) {
+            continue;
+        }
+
+        interface_file &file = *block.file;
+        ssize_t result;
+
+        do {
+            result = write(file.index_fd, &block.entry, sizeof(block.entry));
+        } while (result == -1 && errno == EINTR);
+
+        if (result != (ssize_t)sizeof(block.entry)) {
+            std::cout << "[ERR]: Unable to write the history index of " << file.name << ":" << std::endl;
+            std::cout << (result == -1 ? strerror(errno) : "short write") << std::endl;
+            if (result > 0) {
+                ftruncate(file.index_fd, file.index_size);
+            }
+            continue;
+        }
+
+        file.index_size += sizeof(block.entry);
+    }
+
+    for (interface_file *file : written) {
+        fdatasync(file->index_fd);
+    }
+}
+
+HistoryReader::HistoryReader()
+    : index(nullptr), index_entries(0), data(nullptr), data_size(0)
+{
+}
+
+HistoryReader::~HistoryReader()
+{
+    close();
+}
+
+void HistoryReader::close()
+{
+    if (index != nullptr) {
+        munmap((void *)index, index_entries * sizeof(history_index_entry));
+        index = nullptr;
+    }
+    if (data != nullptr) {
+        munmap((void *)data, data_size);
+        data = nullptr;
+    }
+    index_entries = 0;
+    data_size = 0;
+}
+
+// Maps a whole file read-only, an empty file maps to nullptr
+static bool map_file(const std::string &path, const void *&mapping, size_t &size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+
+    if (fd == -1) {
+        return false;
+    }
+
+    if (fstat(fd, &status) == -1) {
+        int saved_errno = errno;
+        ::close(fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    size = status.st_size;
+    mapping = nullptr;
+
+    if (size > 0) {
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (mapped == MAP_FAILED) {
+            int saved_errno = errno;
+            ::close(fd);
+            errno = saved_errno;
+            return false;
+        }
+
+        mapping = mapped;
+    }
+
+    ::close(fd);
+
+    return true;
+}
+
+bool HistoryReader::open(const std::string &directory, const std::string &interface_name)
+{
+    std::string base = directory + "/" + interface_name;
+    const void *index_mapping;
+    const void *data_mapping;
+    size_t index_size;
+
+    close();
+
+    if (!map_file(base + ".index", index_mapping, index_size)) {
+        return false;
+    }
+
+    // A record cut short by a crash is ignored
+    index = (const history_index_entry *)index_mapping;
+    index_entries = index_size / sizeof(history_index_entry);
+
+    if (!map_file(base + ".data", data_mapping, data_size)) {
+        int saved_errno = errno;
+        munmap((void *)index, index_size);
+        index = nullptr;
+        errno = saved_errno;
+        return false;
+    }
+
+    data = (const uint8_t *)data_mapping;
+
+    return true;
+}
+
+long HistoryReader::scan(uint64_t from_ns, uint64_t to_ns, const history_visitor &visitor) const
+{
+    // Blocks are in time order, skip straight to the first that ends at or
+    // after from_ns
+    const history_index_entry *first = std::lower_bound(
+            index, index + index_entries, from_ns,
+            [](const history_index_entry &entry, uint64_t time) {
+                return entry.last_ns < time;
+            });
+    long visited = 0;
+
+    for (const history_index_entry *entry = first;
+            entry < index + index_entries && entry->first_ns <= to_ns; entry++) {
+        if (entry->offset + entry->length > data_size
+                || entry->length < sizeof(history_block_header)) {
+            return -1;
+        }
+
+        const uint8_t *position = data + entry->offset;
+        const history_block_header *header = (const history_block_header *)position;
+
+        if (header->magic != BLOCK_MAGIC
+                || sizeof(*header) + header->length != entry->length) {
+            return -1;
+        }
+
+        position += sizeof(*header);
+        const uint8_t *end = position + header->length;
+
+        interface_information info;
+        memset(&info, 0, sizeof(info));
+
+        for (uint32_t i = 0; i < header->samples; i++) {
+            uint64_t value;
+
+            if (!get_varint(position, end, value) || position >= end) {
+                return -1;
+            }
+            info.timestamp_ns += value;
+
+            strncpy(info.operstate, operstate_name(*position++), OPERSTATE_LEN - 1);
+
+            for (auto counter : stored_counters) {
+                if (!get_varint(position, end, value)) {
+                    return -1;
+                }
+                info.*counter += unzigzag(value);
+            }
+
+            if (info.timestamp_ns >= from_ns && info.timestamp_ns <= to_ns) {
+                visitor(info);
+                visited++;
+            }
+        }
+    }
+
+    return visited;
+}
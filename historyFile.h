@@ -0,0 +1,152 @@
+//historyFile.h - On-disk history of interface counters
+//
+// Each interface's samples are appended to <directory>/<interface>.data as
+// one compressed block per minute, or per sync interval when that is
+// shorter, and every block gets a fixed-size record in
+// <directory>/<interface>.index. Inside a block each sample is stored as
+// varints of its difference from the one before (the first from zero), so a
+// quiet counter costs a byte. Timestamps are CLOCK_REALTIME nanoseconds so
+// they still mean something after a restart.
+//
+// The writer only encodes in memory on the caller's thread; a thread of its
+// own appends finished blocks and fdatasync()s them every few seconds, so a
+// crash loses at most about two sync intervals. A write that fails is cut
+// back off the file, so what follows it still lines up. The
+// reader maps the index and data and looks blocks up by time, so a day of
+// one interface is scanned without reading anything else
+
+#ifndef HISTORY_FILE_H
+#define HISTORY_FILE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "interfaceInfo.h"
+
+// Starts every block in the data file
+struct history_block_header
+{
+    uint32_t magic;
+    uint32_t samples;
+    uint32_t length;        // of the encoded samples that follow
+    uint32_t reserved;
+};
+
+// One record of the index file per block, in the order they were written
+struct history_index_entry
+{
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t offset;        // of the block header in the data file
+    uint32_t length;        // of the block including its header
+    uint32_t samples;
+};
+
+static_assert(sizeof(history_block_header) == 16, "history files have a fixed layout");
+static_assert(sizeof(history_index_entry) == 32, "history files have a fixed layout");
+
+class HistoryWriter
+{
+public:
+    // Blocks are finished and made durable at least every sync_seconds
+    explicit HistoryWriter(const std::string &directory, int sync_seconds = 10);
+    ~HistoryWriter();
+
+    HistoryWriter(const HistoryWriter &) = delete;
+    HistoryWriter &operator=(const HistoryWriter &) = delete;
+
+    // Opens (creating if need be) the interface's files and returns its
+    // index, or -1 (with errno set) on failure. Can be called at any time
+    int add_interface(const std::string &interface_name);
+
+    // Starts the thread that writes to disk
+    bool start();
+
+    // Adds a sample (timestamped on CLOCK_MONOTONIC) to the interface's
+    // current block. Never touches the disk
+    void record(int interface, const interface_information &info);
+
+    // Writes every block, including those not finished yet, and waits for
+    // the writing thread to finish
+    void stop();
+
+private:
+    struct interface_file
+    {
+        std::string name;
+        int data_fd;
+        int index_fd;
+        uint64_t data_size;
+        uint64_t index_size;
+
+        // The block being filled
+        std::vector<uint8_t> encoded;
+        history_index_entry entry;
+        interface_information previous;
+    };
+
+    // The writing thread reaches an interface's files only through the
+    // blocks it is handed, so adding interfaces never moves anything it uses
+    struct finished_block
+    {
+        interface_file *file;
+        std::vector<uint8_t> encoded;
+        history_index_entry entry;
+    };
+
+    void finish_block(int interface);
+    void run();
+    void write_blocks(std::deque<finished_block> &blocks);
+
+    std::string directory;
+    int sync_seconds;
+
+    // Converts CLOCK_MONOTONIC sample times to CLOCK_REALTIME
+    int64_t realtime_offset_ns;
+
+    std::vector<std::unique_ptr<interface_file>> interfaces;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<finished_block> pending;
+    bool stopping;
+};
+
+// Called with each sample read back, timestamp_ns is on CLOCK_REALTIME
+typedef std::function<void(const interface_information &info)> history_visitor;
+
+class HistoryReader
+{
+public:
+    HistoryReader();
+    ~HistoryReader();
+
+    HistoryReader(const HistoryReader &) = delete;
+    HistoryReader &operator=(const HistoryReader &) = delete;
+
+    // Maps the interface's files, returns false (with errno set) on failure
+    bool open(const std::string &directory, const std::string &interface_name);
+
+    // Visits every sample taken between from_ns and to_ns (CLOCK_REALTIME),
+    // oldest first. Returns the number visited, or -1 if a block is corrupt
+    long scan(uint64_t from_ns, uint64_t to_ns, const history_visitor &visitor) const;
+
+private:
+    void close();
+
+    const history_index_entry *index;
+    size_t index_entries;
+    const uint8_t *data;
+    size_t data_size;
+};
+
+#endif
@@ -0,0 +1,95 @@
+//historyReader.cpp - Prints an interface's history written by networkMonitor -H
+//
+// Usage: historyReader [-d directory] [-f from] [-t to] interface
+//
+// from and to are Unix times in seconds and default to the last 24 hours.
+// Only the index and the blocks covering that window are touched, each
+// sample is printed on one line as the time, operstate and the counters
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "historyFile.h"
+
+const uint64_t NS_PER_SECOND = 1000000000ULL;
+
+int main(int argc, char *argv[])
+{
+    std::string directory = "history";
+    uint64_t to = time(NULL);
+    uint64_t from = to - 24 * 60 * 60;
+
+    int option;
+    while ((option = getopt(argc, argv, "d:f:t:")) != -1)
+    {
+        if (option == 'd')
+        {
+            directory = optarg;
+        }
+        else if (option == 'f')
+        {
+            from = strtoull(optarg, NULL, 10);
+        }
+        else if (option == 't')
+        {
+            to = strtoull(optarg, NULL, 10);
+        }
+        else
+        {
+            std::cout << "usage: historyReader [-d directory] [-f from] [-t to] interface" << std::endl;
+            return -1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        std::cout << "usage: historyReader [-d directory] [-f from] [-t to] interface" << std::endl;
+        return -1;
+    }
+
+    HistoryReader reader;
+
+    if (!reader.open(directory, argv[optind]))
+    {
+        std::cout << "historyReader: " << directory << "/" << argv[optind] << ": "
+                  << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    std::cout << "time state up_count down_count rx_bytes rx_dropped rx_errors rx_packets"
+                 " tx_bytes tx_dropped tx_errors tx_packets" << std::endl;
+
+    long samples = reader.scan(from * NS_PER_SECOND, to * NS_PER_SECOND + NS_PER_SECOND - 1,
+                               [](const interface_information &info) {
+        std::cout << info.timestamp_ns / NS_PER_SECOND << "."
+                  << std::setw(3) << std::setfill('0')
+                  << info.timestamp_ns % NS_PER_SECOND / 1000000 << std::setfill(' ')
+                  << " " << info.operstate
+                  << " " << info.carrier_up_count
+                  << " " << info.carrier_down_count
+                  << " " << info.rx_bytes
+                  << " " << info.rx_dropped
+                  << " " << info.rx_errors
+                  << " " << info.rx_packets
+                  << " " << info.tx_bytes
+                  << " " << info.tx_dropped
+                  << " " << info.tx_errors
+                  << " " << info.tx_packets << "\n";
+    });
+
+    if (samples == -1)
+    {
+        std::cout << "historyReader: the history is corrupt" << std::endl;
+        return -1;
+    }
+
+    std::cout << samples << " samples" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+//historyStore.cpp - Per-interface history of rates in networkMonitor
+
+#include "historyStore.h"
+
+// How far back each tier reaches
+const uint64_t NS_PER_SECOND = 1000000000ULL;
+const uint64_t RAW_SPAN_NS = 300 * NS_PER_SECOND;
+const uint64_t TEN_SECONDS_NS = 10 * NS_PER_SECOND;
+const uint64_t MINUTE_NS = 60 * NS_PER_SECOND;
+const size_t TEN_SECOND_ENTRIES = 360;    // 1 hour
+const size_t MINUTE_ENTRIES = 1440;       // 24 hours
+
+// The raw tier is never larger than this however short the interval, at
+// 1 ms sampling it then covers 30 seconds instead of 5 minutes
+const size_t MAX_RAW_ENTRIES = 30000;
+
+// The names and rates of each metric, in history_metric order
+struct metric_source
+{
+    const char *name;
+    double interface_rates::*rate;
+};
+
+static const metric_source metric_sources[NUM_HISTORY_METRICS] = {
+    {"rx_bytes",   &interface_rates::rx_bits},
+    {"rx_packets", &interface_rates::rx_packets},
+    {"rx_dropped", &interface_rates::rx_dropped},
+    {"rx_errors",  &interface_rates::rx_errors},
+    {"tx_bytes",   &interface_rates::tx_bits},
+    {"tx_packets", &interface_rates::tx_packets},
+    {"tx_dropped", &interface_rates::tx_dropped},
+    {"tx_errors",  &interface_rates::tx_errors},
+};
+
+bool parse_metric(const std::string &name, history_metric &metric)
+{
+    for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+        if (name == metric_sources[i].name) {
+            metric = (history_metric)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *metric_name(history_metric metric)
+{
+    return metric_sources[metric].name;
+}
+
+HistoryTier::HistoryTier(size_t capacity, uint64_t bucket_ns, bool extremes)
+    : capacity(capacity), bucket_ns(bucket_ns), extremes(extremes),
+      start(0), count(0), timestamps(capacity),
+      averages(capacity * NUM_HISTORY_METRICS),
+      bucket_start(0), bucket_samples(0)
+{
+    if (extremes) {
+        minimums.resize(capacity * NUM_HISTORY_METRICS);
+        maximums.resize(capacity * NUM_HISTORY_METRICS);
+    }
+}
+
+void HistoryTier::append(uint64_t timestamp_ns, const float *minimum_values,
+                         const float *average_values, const float *maximum_values)
+{
+    // Once full the newest entry replaces the oldest
+    size_t slot = (start + count) % capacity;
+
+    if (count == capacity) {
+        start = (start + 1) % capacity;
+    } else {
+        count++;
+    }
+
+    timestamps[slot] = timestamp_ns;
+
+    for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+        averages[i * capacity + slot] = average_values[i];
+
+        if (extremes) {
+            minimums[i * capacity + slot] = minimum_values[i];
+            maximums[i * capacity + slot] = maximum_values[i];
+        }
+    }
+}
+
+void HistoryTier::add(uint64_t timestamp_ns, const float *values)
+{
+    if (bucket_ns == 0) {
+        append(timestamp_ns, values, values, values);
+        return;
+    }
+
+    uint64_t period = timestamp_ns - timestamp_ns % bucket_ns;
+
+    // A sample from a later period closes the one being summarised
+    if (bucket_samples > 0 && period != bucket_start) {
+        float bucket_averages[NUM_HISTORY_METRICS];
+
+        for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+            bucket_averages[i] = bucket_sums[i] / bucket_samples;
+        }
+
+        append(bucket_start, bucket_minimums, bucket_averages, bucket_maximums);
+        bucket_samples = 0;
+    }
+
+    if (bucket_samples == 0) {
+        bucket_start = period;
+
+        for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+            bucket_sums[i] = 0;
+            bucket_minimums[i] = values[i];
+            bucket_maximums[i] = values[i];
+        }
+    }
+
+    for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+        bucket_sums[i] += values[i];
+
+        if (values[i] < bucket_minimums[i]) {
+            bucket_minimums[i] = values[i];
+        }
+        if (values[i] > bucket_maximums[i]) {
+            bucket_maximums[i] = values[i];
+        }
+    }
+
+    bucket_samples++;
+}
+
+size_t HistoryTier::query(history_metric metric, uint64_t since_ns,
+                          std::vector<history_point> &points) const
+{
+    const float *metric_averages = &averages[metric * capacity];
+    const float *metric_minimums = extremes ? &minimums[metric * capacity] : metric_averages;
+    const float *metric_maximums = extremes ? &maximums[metric * capacity] : metric_averages;
+    size_t appended = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = (start + i) % capacity;
+
+        // A summary counts if any of its period is wanted
+        if (timestamps[slot] + bucket_ns < since_ns) {
+            continue;
+        }
+
+        history_point point;
+        point.timestamp_ns = timestamps[slot];
+        point.min = metric_minimums[slot];
+        point.avg = metric_averages[slot];
+        point.max = metric_maximums[slot];
+
+        points.push_back(point);
+        appended++;
+    }
+
+    return appended;
+}
+
+uint64_t HistoryTier::span_ns(uint64_t interval_ns) const
+{
+    return capacity * (bucket_ns != 0 ? bucket_ns : interval_ns);
+}
+
+size_t HistoryTier::memory(size_t capacity, bool extremes)
+{
+    return capacity * (sizeof(uint64_t)
+                       + NUM_HISTORY_METRICS * sizeof(float) * (extremes ? 3 : 1));
+}
+
+HistoryStore::HistoryStore(long interval_ms)
+    : interval_ns(interval_ms * 1000000ULL)
+{
+    raw_capacity = RAW_SPAN_NS / interval_ns;
+
+    if (raw_capacity > MAX_RAW_ENTRIES) {
+        raw_capacity = MAX_RAW_ENTRIES;
+    }
+    if (raw_capacity == 0) {
+        raw_capacity = 1;
+    }
+}
+
+int HistoryStore::add_interface(const std::string &interface_name)
+{
+    interfaces.push_back({interface_name,
+                          HistoryTier(raw_capacity, 0, false),
+                          HistoryTier(TEN_SECOND_ENTRIES, TEN_SECONDS_NS, false),
+                          HistoryTier(MINUTE_ENTRIES, MINUTE_NS, true)});
+
+    return interfaces.size() - 1;
+}
+
+void HistoryStore::record(int interface, const interface_rates &rates, uint64_t timestamp_ns)
+{
+    // Nothing to keep for the first sample or one after a reset
+    if (!rates.valid) {
+        return;
+    }
+
+    float values[NUM_HISTORY_METRICS];
+
+    for (int i = 0; i < NUM_HISTORY_METRICS; i++) {
+        values[i] = rates.*(metric_sources[i].rate);
+    }
+
+    interface_history &history = interfaces.at(interface);
+
+    history.raw.add(timestamp_ns, values);
+    history.ten_seconds.add(timestamp_ns, values);
+    history.minutes.add(timestamp_ns, values);
+}
+
+bool HistoryStore::query(const std::string &interface_name, history_metric metric,
+                         uint64_t seconds, std::vector<history_point> &points) const
+{
+    for (const interface_history &history : interfaces) {
+        if (history.name != interface_name) {
+            continue;
+        }
+
+        uint64_t span = seconds * NS_PER_SECOND;
+        uint64_t now = monotonic_ns();
+        uint64_t since = span < now ? now - span : 0;
+
+        if (span <= history.raw.span_ns(interval_ns)) {
+            history.raw.query(metric, since, points);
+        } else if (span <= history.ten_seconds.span_ns(interval_ns)) {
+            history.ten_seconds.query(metric, since, points);
+        } else {
+            history.minutes.query(metric, since, points);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+size_t HistoryStore::memory_per_interface() const
+{
+    return HistoryTier::memory(raw_capacity, false)
+        + HistoryTier::memory(TEN_SECOND_ENTRIES, false)
+        + HistoryTier::memory(MINUTE_ENTRIES, true);
+}
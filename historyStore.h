@@ -0,0 +1,141 @@
+//historyStore.h - Per-interface history of rates in networkMonitor
+//
+// Every sample's rates are kept in three tiers of fixed-size rings: the raw
+// rates for the last 5 minutes, 10 second averages for the last hour and
+// 1 minute minimum/average/maximum for the last 24 hours. Each ring stores
+// its timestamps and every metric in separate contiguous arrays, so a query
+// walks only the one metric it asks for.
+//
+// Values are floats, which keeps 7 significant digits of any rate. The
+// memory used per interface is fixed when the interface is added:
+//   raw         300 s / interval entries (at most 30000) x 40 bytes
+//               = 12 KB at 1 s, 1.2 MB at 10 ms or faster
+//   10 s tier   360 entries x 40 bytes  = 14 KB
+//   1 min tier  1440 entries x 104 bytes = 146 KB
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "counterRates.h"
+
+// The rates kept, named after the counter they are the rate of. The byte
+// counters are kept in bits per second, the rest per second
+enum history_metric
+{
+    HISTORY_RX_BYTES,
+    HISTORY_RX_PACKETS,
+    HISTORY_RX_DROPPED,
+    HISTORY_RX_ERRORS,
+    HISTORY_TX_BYTES,
+    HISTORY_TX_PACKETS,
+    HISTORY_TX_DROPPED,
+    HISTORY_TX_ERRORS,
+    NUM_HISTORY_METRICS
+};
+
+// Converts a counter name ("rx_bytes", "tx_dropped", ...), returns false if
+// unknown
+bool parse_metric(const std::string &name, history_metric &metric);
+const char *metric_name(history_metric metric);
+
+// One entry of a query. Raw and 10 second entries have min and max equal to
+// avg
+struct history_point
+{
+    // The sample's time, or the start of the period it summarises, on
+    // CLOCK_MONOTONIC
+    uint64_t timestamp_ns;
+    float min;
+    float avg;
+    float max;
+};
+
+// A ring of entries, each either one sample (bucket_ns of 0) or a summary of
+// every sample in a bucket_ns long period
+class HistoryTier
+{
+public:
+    HistoryTier(size_t capacity, uint64_t bucket_ns, bool extremes);
+
+    // Adds a sample's values (one per metric). A summarising tier only adds
+    // an entry once a sample from the next period arrives
+    void add(uint64_t timestamp_ns, const float *values);
+
+    // Appends the entries for metric at or after since_ns, oldest first.
+    // Returns the number appended
+    size_t query(history_metric metric, uint64_t since_ns,
+                 std::vector<history_point> &points) const;
+
+    // How far back a full ring of samples taken every interval_ns reaches
+    uint64_t span_ns(uint64_t interval_ns) const;
+
+    // The bytes used by a tier of the given capacity
+    static size_t memory(size_t capacity, bool extremes);
+
+private:
+    void append(uint64_t timestamp_ns, const float *minimums,
+                const float *averages, const float *maximums);
+
+    size_t capacity;
+    uint64_t bucket_ns;
+    bool extremes;
+
+    // The oldest entry and how many there are
+    size_t start;
+    size_t count;
+
+    // capacity timestamps, then capacity values per metric for each array
+    std::vector<uint64_t> timestamps;
+    std::vector<float> averages;
+    std::vector<float> minimums;
+    std::vector<float> maximums;
+
+    // The period being summarised
+    uint64_t bucket_start;
+    uint32_t bucket_samples;
+    double bucket_sums[NUM_HISTORY_METRICS];
+    float bucket_minimums[NUM_HISTORY_METRICS];
+    float bucket_maximums[NUM_HISTORY_METRICS];
+};
+
+class HistoryStore
+{
+public:
+    // interval_ms is how often samples arrive, which sizes the raw tier
+    explicit HistoryStore(long interval_ms = 1000);
+
+    // Starts keeping history for an interface and returns its index
+    int add_interface(const std::string &interface_name);
+
+    // Records the rates computed for one of the interface's samples
+    void record(int interface, const interface_rates &rates, uint64_t timestamp_ns);
+
+    // Fetches the last seconds of a metric for the named interface from the
+    // finest tier that reaches back that far, oldest first. Returns false if
+    // the interface is unknown
+    bool query(const std::string &interface_name, history_metric metric,
+               uint64_t seconds, std::vector<history_point> &points) const;
+
+    // The bytes of history kept for each interface
+    size_t memory_per_interface() const;
+
+private:
+    struct interface_history
+    {
+        std::string name;
+        HistoryTier raw;
+        HistoryTier ten_seconds;
+        HistoryTier minutes;
+    };
+
+    uint64_t interval_ns;
+    size_t raw_capacity;
+    std::vector<interface_history> interfaces;
+};
+
+#endif
@@ -0,0 +1,43 @@
+//interfaceInfo.cpp - The statistics gathered from an interface
+
+#include "interfaceInfo.h"
+
+#include <cstring>
+#include <time.h>
+
+// The kernel's IF_OPER_* values in the same words sysfs uses for operstate
+static const char *operstate_names[] = {
+    "unknown",          // IF_OPER_UNKNOWN
+    "notpresent",       // IF_OPER_NOTPRESENT
+    "down",             // IF_OPER_DOWN
+    "lowerlayerdown",   // IF_OPER_LOWERLAYERDOWN
+    "testing",          // IF_OPER_TESTING
+    "dormant",          // IF_OPER_DORMANT
+    "up",               // IF_OPER_UP
+};
+const uint8_t NUM_OPERSTATES = sizeof(operstate_names) / sizeof(operstate_names[0]);
+
+uint8_t operstate_code(const char *operstate)
+{
+    for (uint8_t code = 0; code < NUM_OPERSTATES; code++) {
+        if (strcmp(operstate, operstate_names[code]) == 0) {
+            return code;
+        }
+    }
+
+    return 0;
+}
+
+const char *operstate_name(uint8_t code)
+{
+    return code < NUM_OPERSTATES ? operstate_names[code] : operstate_names[0];
+}
+
+uint64_t monotonic_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,42 @@
+//interfaceInfo.h - The statistics gathered from an interface
+//
+// Shared by the collectors that fill it and the monitors that report it
+
+#ifndef INTERFACE_INFO_H
+#define INTERFACE_INFO_H
+
+#include <cstdint>
+#include <string>
+
+// Large enough for any operstate the kernel reports ("lowerlayerdown" is the
+// longest) plus the terminating '\0'
+const int OPERSTATE_LEN = 16;
+
+// This will hold the data from the interface during a monitor iteration
+struct interface_information
+{
+    char operstate[OPERSTATE_LEN];
+    uint64_t carrier_up_count;
+    uint64_t carrier_down_count;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t rx_errors;
+    uint64_t rx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t tx_errors;
+    uint64_t tx_packets;
+    // When the counters were read, in nanoseconds on CLOCK_MONOTONIC. 0 if
+    // the interface was not found
+    uint64_t timestamp_ns;
+};
+
+// The current time on CLOCK_MONOTONIC in nanoseconds, for timestamp_ns
+uint64_t monotonic_ns();
+
+// Converts between an operstate as sysfs words it ("up", "down", ...) and
+// the kernel's IF_OPER_* number for it
+uint8_t operstate_code(const char *operstate);
+const char *operstate_name(uint8_t code);
+
+#endif
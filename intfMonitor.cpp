@@ -16,8 +16,16 @@
 #include <sys/un.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <poll.h>
 
-const int MAXBUF=128;
+#include "collector.h"
+#include "interfaceInfo.h"
+#include "linkControl.h"
+#include "linkWatcher.h"
+#include "protocol.h"
+#include "sampleRing.h"
+#include "sampleTimer.h"
+#include "selfStats.h"
 
 // This will be reference to the socket used for communication with the network
 // monitor
@@ -25,13 +33,48 @@ int socket_descriptor = -1;
 
 bool isRunning = true;
 
-char buffer[MAXBUF];
+char buffer[MAX_MESSAGE];
 
-// The path to the socket file
-const std::string socket_file_pathname = "/tmp/a1-socket";
+// Identifies this interface in every message, assigned by the network
+// monitor with -n
+uint32_t interface_id = 0;
 
-// The interface directory "root" path
-std::string interface_directory = "/sys/class/net/";
+// Splits the stream from the network monitor back into messages
+MessageDecoder decoder;
+
+// With -r samples go through this shared-memory ring instead of the socket
+bool use_ring = false;
+SampleRing *ring = nullptr;
+
+// The path to the socket file, the network monitor's is given with -s
+std::string socket_file_pathname = "/tmp/a1-socket";
+
+// The interface directory "root" path, another tree can be given with -d
+std::string sysfs_root = SYSFS_NET_ROOT;
+std::string interface_directory;
+
+// The file the procfs backend reads, another can be given with -P
+std::string proc_net_dev = PROC_NET_DEV;
+
+// The backend gathering the interface's statistics, sysfs unless another is
+// selected with -b
+collector_backend backend = BACKEND_SYSFS;
+Collector *collector = nullptr;
+
+// Link notifications from the kernel, watched between samples so a link
+// going down is noticed straight away
+LinkWatcher link_watcher;
+
+// Sets the link up when told to, through a socket kept for every attempt
+LinkControl link_control;
+
+// When samples are taken (-t) and how the process is scheduled (-c, -p)
+sampling_schedule schedule;
+SampleTimer sample_timer;
+
+// How late each tick is taken, how long sampling and sending take and what
+// the process costs, sent to the network monitor whenever it asks
+SelfStats stats;
 
 static void signalHandler(int signal);
 
@@ -62,180 +105,273 @@ int make_connection()
     return socket_d;
 }
 
+// Sends a message of the given type (and its payload, if any) to the
+// network monitor through the socket
+int write_message(uint16_t type, const void *payload = nullptr, uint16_t length = 0)
+{
+    size_t message_length = encode_message(buffer, type, interface_id, payload, length);
+    size_t bytes_written = 0;
+
+    // Send the whole message over the socket file using write()
+    while (bytes_written < message_length)
+    {
+        ssize_t written = write(socket_descriptor, buffer + bytes_written,
+                                message_length - bytes_written);
+
+        if (written == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        bytes_written += written;
+    }
+
+    return bytes_written;
+}
+
+// Answers a Stats Request with everything timed and counted so far
+void send_stats()
+{
+    stats_payload payload;
+
+    stats.pack(payload);
+    write_message(MSG_STATS, &payload, sizeof(payload));
+}
+
 // Cleans up the process by closing the connected socket after sending the
-// "Done" message to the network monitor
+// "Done" message to the network monitor. The socket file belongs to the
+// network monitor, which keeps accepting other intfMonitors on it
 void clean_up()
 {
-    memset(buffer, '\0', sizeof(buffer));
-    strncpy(buffer, "Done", sizeof(buffer) - 1);
-    write(socket_descriptor, buffer, sizeof(buffer));
+    write_message(MSG_DONE);
 
     close(socket_descriptor);
-    unlink(socket_file_pathname.c_str());
 }
 
-// Reads the file at given path and returns its first piece of content (used
-// to read the interface files which should only have one piece of data)
-std::string read_file(std::string filepath) {
-    std::string contents = "";
-
-    std::ifstream file;
-
-    file.open(filepath);
+// Receives the next message from the network monitor and returns its type,
+// or 0 if the connection has gone
+uint16_t read_message()
+{
+    message_header header;
+    const char *payload;
+    char received[MAX_MESSAGE];
 
-    if (file.is_open())
+    // Read from the socket file until a whole message has arrived, messages
+    // may be split across reads or several may arrive in one
+    while (!decoder.next(header, payload))
     {
-        file >> contents;
+        if (decoder.failed())
+        {
+            return 0;
+        }
 
-        file.close();
-    } else {
-        std::cout << "[ERR]: Unable to open " << filepath << ":" << std::endl;
-        std::cout << strerror(errno) << std::endl;
+        ssize_t bytes_recieved = read(socket_descriptor, received, sizeof(received));
+
+        if (bytes_recieved > 0)
+        {
+            decoder.feed(received, bytes_recieved);
+        }
+        else if (bytes_recieved == 0 || errno != EINTR || !isRunning)
+        {
+            return 0;
+        }
     }
 
-    return contents;
+    return header.type;
 }
 
-// Sends a given message to the network monitor through the socket
-int write_message(std::string message)
+// Waits for the sample timer's next tick while watching for link changes
+// and for the network monitor telling us to shut down. Returns false as soon
+// as the kernel reports the interface is no longer up and running, true once
+// the tick is due or monitoring has to stop. Only the newest of the changes
+// waiting for the interface counts, a link that went down and came back up
+// again in the meantime is still up
+bool wait_for_next_sample(const std::string &interface_name)
 {
-    int bytes_written = 0;
+    // Without notifications (a descriptor of -1) poll() only watches the
+    // timer and the socket
+    struct pollfd descriptors[3];
+    descriptors[0].fd = sample_timer.fd();
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = link_watcher.fd();
+    descriptors[1].events = POLLIN;
+    descriptors[2].fd = socket_descriptor;
+    descriptors[2].events = POLLIN;
+
+    while (isRunning)
+    {
+        int ready = poll(descriptors, 3, -1);
 
-    // Clear the buffer of existing data and then copy the message into it
-    memset(buffer, '\0', sizeof(buffer));
-    strncpy(buffer, message.c_str(), sizeof(buffer) - 1);
+        // The network monitor can stop this interface being monitored
+        // while the link is still up, or go away altogether
+        if (ready > 0 && (descriptors[2].revents & (POLLIN | POLLHUP)))
+        {
+            uint16_t message = read_message();
 
-    // Send the buffer over the socket file using write()
-    bytes_written = write(socket_descriptor, buffer, sizeof(buffer));
+            if (message == MSG_STATS_REQUEST)
+            {
+                send_stats();
+            }
+            if (message == MSG_SHUT_DOWN)
+            {
+                clean_up();
+            }
+            if (message == MSG_SHUT_DOWN || message == 0)
+            {
+                isRunning = false;
+                return true;
+            }
+        }
 
-    return bytes_written;
-}
+        if (ready > 0 && (descriptors[0].revents & POLLIN) && sample_timer.expired())
+        {
+            stats.stage(STAGE_TICK_LAG).record(monotonic_ns() - sample_timer.due_ns());
+            return true;
+        }
 
-// Receives any incoming message from the network monitor and returns it as a
-// string
-std::string read_message()
-{
-    std::string message;
+        if (ready > 0 && (descriptors[1].revents & POLLIN))
+        {
+            link_change change;
+            bool changed = false;
+            bool running = true;
 
-    // Clear the buffer of any existing data and then read incoming data from
-    // the socket file into it
-    memset(buffer, '\0', sizeof(buffer));
-    size_t bytes_recieved = read(socket_descriptor, buffer, sizeof(buffer));
+            while (link_watcher.next_change(change))
+            {
+                if (interface_name == change.name)
+                {
+                    changed = true;
+                    running = link_is_running(change);
+                }
+            }
 
-    message = buffer;
+            if (changed && !running)
+            {
+                return false;
+            }
 
-    return message;
+            // Notifications were lost, sample now to find the real state
+            if (link_watcher.overflowed())
+            {
+                return true;
+            }
+        }
+    }
+
+    return true;
 }
 
 // Monitors the interface with given interface_name by reading data from its
-// director in /sys and printing that data out
-void monitor_interface(std::string interface_name)
+// director in /sys and sending each sample to the network monitor
+void monitor_interface(const std::string &interface_name)
 {
     // This will hold the data from the interface during a monitor iteration
-    struct interface_information
-    {
-        std::string operstate;
-        std::string carrier_up_count;
-        std::string carrier_down_count;
-        std::string rx_bytes;
-        std::string rx_dropped;
-        std::string rx_errors;
-        std::string rx_packets;
-        std::string tx_bytes;
-        std::string tx_dropped;
-        std::string tx_errors;
-        std::string tx_packets;
-    } interface_info;
+    struct interface_information interface_info;
 
     // Loop conditional flag which is set to false if the interface goes down
     bool link_is_up = true;
 
+    // The first sample is taken straight away, the rest on the timer's
+    // schedule
+    if (!sample_timer.start(schedule.interval_ms))
+    {
+        std::cout << "[ERR]: Unable to start the sample timer:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+        return;
+    }
+
+    // The changes queued while the link was not monitored, its going down
+    // and being set up again among them, are old news, the first sample
+    // reads its state as it is now
+    link_change change;
+    while (link_watcher.next_change(change))
+    {
+    }
+    link_watcher.overflowed();
+
     // Send the "Monitoring" message to the network monitor
-    write_message("Monitoring");
+    write_message(MSG_MONITORING);
 
     // As long as the interface is up...
     while (link_is_up && isRunning)
     {
-        // Get operstate info
-        std::string filepath = interface_directory + "/operstate";
-        interface_info.operstate = read_file(filepath);
-
-        // Get carrier_up_count info
-        filepath = interface_directory + "/carrier_up_count";
-        interface_info.carrier_up_count = read_file(filepath);
-
-        // Get carrier_down_count info
-        filepath = interface_directory + "/carrier_down_count";
-        interface_info.carrier_down_count = read_file(filepath);
-
-        // Get rx_bytes info
-        filepath = interface_directory + "/statistics/rx_bytes";
-        interface_info.rx_bytes = read_file(filepath);
-
-        // Get rx_dropped info
-        filepath = interface_directory + "/statistics/rx_dropped";
-        interface_info.rx_dropped = read_file(filepath);
-
-        // Get rx_errors info
-        filepath = interface_directory + "/statistics/rx_errors";
-        interface_info.rx_errors = read_file(filepath);
-
-        // Get rx_packets info
-        filepath = interface_directory + "/statistics/rx_packets";
-        interface_info.rx_packets = read_file(filepath);
-
-        // Get tx_bytes info
-        filepath = interface_directory + "/statistics/tx_bytes";
-        interface_info.tx_bytes = read_file(filepath);
-
-        // Get tx_dropped info
-        filepath = interface_directory + "/statistics/tx_dropped";
-        interface_info.tx_dropped = read_file(filepath);
-
-        // Get tx_errors info
-        filepath = interface_directory + "/statistics/tx_errors";
-        interface_info.tx_errors = read_file(filepath);
-
-        // Get tx_packets info
-        filepath = interface_directory + "/statistics/tx_packets";
-        interface_info.tx_packets = read_file(filepath);
-
-        // Print out all the information
-        std::cout << std::endl << "Interface:" << interface_name
-            << " state:" << interface_info.operstate
-            << " up_count:" << interface_info.carrier_up_count
-            << " down_count:" << interface_info.carrier_down_count << std::endl
-            << "rx_bytes:" << interface_info.rx_bytes
-            << " rx_dropped:" << interface_info.rx_dropped
-            << " rx_errors:" << interface_info.rx_errors
-            << " rx_packets:" << interface_info.rx_packets << std::endl
-            << "tx_bytes:" << interface_info.tx_bytes
-            << " tx_dropped:" << interface_info.tx_dropped
-            << " tx_errors:" << interface_info.tx_errors
-            << " tx_packets:" << interface_info.tx_packets << std::endl;
+        // Refresh operstate and every counter through the collector (it only
+        // tracks this one interface so the sample lands in slot 0)
+        uint64_t started = monotonic_ns();
+        int found = collector->collect(&interface_info);
+        uint64_t collected = monotonic_ns();
+
+        if (found == -1)
+        {
+            std::cout << "[ERR]: Unable to collect from " << collector->name() << ":" << std::endl;
+            std::cout << strerror(errno) << std::endl;
+        }
+        else if (found == 0)
+        {
+            std::cout << "[ERR]: Unable to read " << interface_directory << ":" << std::endl;
+            std::cout << "interface not found" << std::endl;
+        }
+
+        if (found < 1)
+        {
+            memset(&interface_info, 0, sizeof(interface_info));
+        }
+
+        // Send all the information to the network monitor, which reports it.
+        // Through the ring this is just a copy into shared memory; if the
+        // network monitor has fallen a whole ring behind the sample is
+        // dropped rather than waiting for it
+        if (ring != nullptr)
+        {
+            ring->push(interface_info);
+        }
+        else
+        {
+            sample_payload payload;
+            pack_sample(interface_info, payload);
+            write_message(MSG_SAMPLE, &payload, sizeof(payload));
+        }
+
+        stats.stage(STAGE_COLLECT).record(collected - started);
+        stats.stage(STAGE_SEND).record(monotonic_ns() - collected);
+        stats.count_tick();
 
         // If the operstate of the interface is not "up" then the interface has
         // gone down and we need to break this monitoring loop
-        if (interface_info.operstate.compare("up") != 0
-                && interface_info.operstate.length() > 0) {
+        if (strcmp(interface_info.operstate, "up") != 0
+                && interface_info.operstate[0] != '\0') {
+            link_is_up = false;
+        }
+
+        // Wait for the next tick before looping again, unless the link goes
+        // down in the meantime
+        if (link_is_up && !wait_for_next_sample(interface_name)) {
             link_is_up = false;
         }
 
-        // Sleep for 1 second before looping again
-        sleep(1);
     }
 
-    // Report to the network monitor that the link has gone down (the only way
-    // in which the above loop is broken unless the process is killed)
-    write_message("Link Down");
+    // Report to the network monitor that the link has gone down, unless the
+    // loop was broken by shutting down
+    if (!link_is_up)
+    {
+        write_message(MSG_LINK_DOWN);
+    }
+
+    // Printing missed ticks as they happen could hold up sampling behind a
+    // slow terminal, so they are reported once monitoring stops
+    uint64_t missed = sample_timer.missed_since_last();
+    if (missed > 0)
+    {
+        std::cout << "[WARN]: " << interface_name << " sampling fell behind, "
+                  << missed << " ticks missed" << std::endl;
+    }
 }
 
 int main(int argc, char *argv[])
 {
     struct sigaction new_action;
 
-    bool should_continue = true;
-
     // Populate the sigaction struct's members for the handler and the mask
     new_action.sa_handler = signalHandler;
     sigemptyset(&(new_action.sa_mask));
@@ -244,6 +380,63 @@ int main(int argc, char *argv[])
     // Link the SIGINT signal to our signal handler
     int return_value = sigaction(SIGINT, &new_action, NULL);
 
+    // Parse the options, the interface name follows them
+    int option;
+    while ((option = getopt(argc, argv, "b:n:rt:c:p:s:d:P:")) != -1)
+    {
+        if (option == 'b' && parse_backend(optarg, backend))
+        {
+            continue;
+        }
+        else if (option == 'r')
+        {
+            use_ring = true;
+        }
+        else if (option == 'n')
+        {
+            interface_id = strtoul(optarg, NULL, 10);
+        }
+        else if (option == 't' && parse_interval(optarg, schedule.interval_ms))
+        {
+            continue;
+        }
+        else if (option == 'c')
+        {
+            schedule.cpu = atoi(optarg);
+        }
+        else if (option == 'p')
+        {
+            schedule.fifo_priority = atoi(optarg);
+        }
+        else if (option == 's')
+        {
+            socket_file_pathname = optarg;
+        }
+        else if (option == 'd')
+        {
+            sysfs_root = optarg;
+            if (sysfs_root.back() != '/')
+            {
+                sysfs_root += '/';
+            }
+        }
+        else if (option == 'P')
+        {
+            proc_net_dev = optarg;
+        }
+        else
+        {
+            std::cout << "usage: intfMonitor [-b sysfs|netlink|procfs] [-n id] [-r] [-t ms] [-c cpu] [-p priority] [-s socket] [-d directory] [-P file] interface" << std::endl;
+            return -1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        std::cout << "usage: intfMonitor [-b sysfs|netlink|procfs] [-n id] [-r] [-t ms] [-c cpu] [-p priority] [-s socket] [-d directory] [-P file] interface" << std::endl;
+        return -1;
+    }
+
     // If the signal has been linked successfully, we can continue
     if (return_value != -1) {
         // Make a connection to the server
@@ -252,63 +445,103 @@ int main(int argc, char *argv[])
         // If the connection has been established, we can continue
         if (socket_descriptor != -1)
         {
-            // Let the network monitor know we're ready to monitor
-            write_message("Ready");
-
             // Grab the interface name specified as an argument and construct
             // it's directory path
-            std::string interface_name = argv[1];
-            interface_directory = interface_directory + interface_name;
+            std::string interface_name = argv[optind];
+            interface_directory = sysfs_root + interface_name;
+
+            // Let the network monitor know which interface we're ready to
+            // monitor
+            write_message(MSG_READY, interface_name.c_str(), interface_name.length());
+
+            // Hand the network monitor the sample ring, if we can't make one
+            // samples are sent over the socket instead
+            if (use_ring)
+            {
+                ring = SampleRing::create();
+
+                if (ring == nullptr)
+                {
+                    std::cout << "[ERR]: Unable to create the sample ring:" << std::endl;
+                    std::cout << strerror(errno) << std::endl;
+                }
+                else
+                {
+                    size_t length = encode_message(buffer, MSG_RING, interface_id);
+
+                    if (send_message_with_fd(socket_descriptor, buffer, length, ring->fd()) == -1)
+                    {
+                        std::cout << "[ERR]: Unable to pass the sample ring:" << std::endl;
+                        std::cout << strerror(errno) << std::endl;
+                        delete ring;
+                        ring = nullptr;
+                    }
+                }
+            }
+
+            // Set up the selected backend once, it is re-used for every
+            // sample from here on
+            collector = create_collector(backend, sysfs_root, proc_net_dev);
+            collector->add_interface(interface_name);
+
+            // Without notifications a link going down is still caught by
+            // the operstate check on every sample, just later
+            if (!link_watcher.open())
+            {
+                std::cout << "[ERR]: Unable to watch link changes:" << std::endl;
+                std::cout << strerror(errno) << std::endl;
+            }
+
+            // Pinning and real-time priority are best effort, without them
+            // sampling still works, just with more jitter
+            if (!apply_scheduling(schedule))
+            {
+                std::cout << "[ERR]: Unable to set the sampler's scheduling:" << std::endl;
+                std::cout << strerror(errno) << std::endl;
+            }
 
             while (isRunning)
             {
                 // Read any message available from the network monitor
-                std::string message = read_message();
+                uint16_t message = read_message();
 
+                // If the network monitor has gone there is nothing left to do
+                if (message == 0)
+                {
+                    isRunning = false;
+                }
                 // If the message is "Monitor", we need to start monitoring the
                 // interface
-                if (message.compare("Monitor") == 0)
+                else if (message == MSG_MONITOR)
                 {
                     monitor_interface(interface_name);
                 } 
+                // The network monitor asks what we have cost it
+                else if (message == MSG_STATS_REQUEST)
+                {
+                    send_stats();
+                }
                 // If the message is "Set Link Up", we attempt to set the
                 // interface status to up using an ioctl call
-                else if (message.compare("Set Link Up") == 0)
+                else if (message == MSG_SET_LINK_UP)
                 {
-                    struct ifreq interface;
-
-                    // Create a socket in order to target the interface
-                    int interface_socket = socket(AF_INET, SOCK_DGRAM, 0);
-
-                    if (interface_socket != -1)
+                    // If we were unsuccessful, we print out the error and
+                    // let the network monitor know
+                    if (link_control.set_link_up(interface_name) == -1)
                     {
-                        memset(&interface, 0, sizeof(ifreq));
-
-                        // Put the interface name and the up status flag in the
-                        // interface information
-                        strncpy(interface.ifr_name, interface_name.c_str(), IFNAMSIZ);
-                        interface.ifr_flags |= IFF_UP;
-
-                        // Use an ioctl call to send this interface flag
-                        // to the interface specified using the name
-                        int return_code = ioctl(interface_socket, SIOCSIFFLAGS, &interface);
-
-                        // If we were unsuccessful, we print out the error
-                        if (return_code == -1)
-                        {
-                            std::cout << "[ERR]: Unable to set interface up:" << std::endl
-                                    << strerror(errno) << std::endl;
-                        // Otherwise, we let the network monitor know that the
-                        // interface is now up and ready to be monitored again
-                        } else {
-                            write_message("Link Up");
-                        }
+                        std::cout << "[ERR]: Unable to set interface up:" << std::endl
+                                << strerror(errno) << std::endl;
+                        write_message(MSG_LINK_UP_FAILED);
+                    // Otherwise, we let the network monitor know that the
+                    // interface is now up and ready to be monitored again
+                    } else {
+                        write_message(MSG_LINK_UP);
                     }
                 }
                 // If the message is "Shut Down" we clean up any open connection
                 // and stop the main conditional loop by setting isRunning to
                 // false
-                else if (message.compare("Shut Down") == 0)
+                else if (message == MSG_SHUT_DOWN)
                 {
                     clean_up();
 
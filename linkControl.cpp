@@ -0,0 +1,79 @@
+//linkControl.cpp - Administrative control of an interface's link
+
+#include "linkControl.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+LinkControl::LinkControl() : control_socket(-1)
+{
+}
+
+LinkControl::~LinkControl()
+{
+    if (control_socket != -1)
+    {
+        close(control_socket);
+    }
+}
+
+// Any socket can target an interface, the same one does for all of them
+bool LinkControl::open_socket()
+{
+    if (control_socket == -1)
+    {
+        control_socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    }
+
+    return control_socket != -1;
+}
+
+int LinkControl::set_link_up(const std::string &interface_name)
+{
+    struct ifreq interface;
+
+    if (!open_socket())
+    {
+        return -1;
+    }
+
+    memset(&interface, 0, sizeof(ifreq));
+    strncpy(interface.ifr_name, interface_name.c_str(), IFNAMSIZ - 1);
+
+    // Read the interface's flags so that setting them changes only the up
+    // flag, rather than clearing every other one (promiscuous, multicast...)
+    if (ioctl(control_socket, SIOCGIFFLAGS, &interface) == -1)
+    {
+        return -1;
+    }
+
+    if (interface.ifr_flags & IFF_UP)
+    {
+        return 0;
+    }
+
+    interface.ifr_flags |= IFF_UP;
+
+    return ioctl(control_socket, SIOCSIFFLAGS, &interface);
+}
+
+int LinkControl::ethtool(const std::string &interface_name, void *command)
+{
+    struct ifreq interface;
+
+    if (!open_socket())
+    {
+        return -1;
+    }
+
+    memset(&interface, 0, sizeof(ifreq));
+    strncpy(interface.ifr_name, interface_name.c_str(), IFNAMSIZ - 1);
+    interface.ifr_data = (char *)command;
+
+    return ioctl(control_socket, SIOCETHTOOL, &interface);
+}
@@ -0,0 +1,37 @@
+//linkControl.h - Administrative control of an interface's link
+
+#ifndef LINK_CONTROL_H
+#define LINK_CONTROL_H
+
+#include <string>
+
+// Sets links up, and asks drivers for their statistics, through one control
+// socket opened on first use and kept for every link after, so recovering
+// many links at once is one ioctl pair per link rather than a socket each
+// as well
+class LinkControl
+{
+public:
+    LinkControl();
+    ~LinkControl();
+
+    LinkControl(const LinkControl &) = delete;
+    LinkControl &operator=(const LinkControl &) = delete;
+
+    // Sets the named interface's status to up. Its other flags are read
+    // first and kept as they are, and a link that is up already is left
+    // alone. Returns 0 on success, or -1 with errno set
+    int set_link_up(const std::string &interface_name);
+
+    // Passes an ethtool command (struct ethtool_gstrings, ethtool_stats, ...)
+    // to the named interface's driver, which fills it in. Returns 0 on
+    // success, or -1 with errno set
+    int ethtool(const std::string &interface_name, void *command);
+
+private:
+    bool open_socket();
+
+    int control_socket;
+};
+
+#endif
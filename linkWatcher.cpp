@@ -0,0 +1,130 @@
+//linkWatcher.cpp - Link state notifications from the kernel
+
+#include "linkWatcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+LinkWatcher::LinkWatcher()
+    : netlink_socket(-1), lost_changes(false), read_offset(0), read_length(0)
+{
+}
+
+LinkWatcher::~LinkWatcher()
+{
+    if (netlink_socket != -1) {
+        close(netlink_socket);
+    }
+}
+
+bool LinkWatcher::open()
+{
+    struct sockaddr_nl address;
+
+    netlink_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                            NETLINK_ROUTE);
+
+    if (netlink_socket == -1) {
+        return false;
+    }
+
+    // Join the link group, every RTM_NEWLINK and RTM_DELLINK is sent to us
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_LINK;
+
+    if (bind(netlink_socket, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        int saved_errno = errno;
+        close(netlink_socket);
+        netlink_socket = -1;
+        errno = saved_errno;
+        return false;
+    }
+
+    return true;
+}
+
+bool LinkWatcher::overflowed()
+{
+    bool overflow = lost_changes;
+
+    lost_changes = false;
+
+    return overflow;
+}
+
+// Receives the next datagram of notifications, returns false if none wait
+bool LinkWatcher::receive()
+{
+    while (true) {
+        ssize_t length = recv(netlink_socket, receive_buffer, sizeof(receive_buffer), 0);
+
+        if (length >= 0) {
+            read_offset = 0;
+            read_length = length;
+            return true;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        // The socket buffer overran, whatever was queued has been lost but
+        // the socket keeps working
+        if (errno == ENOBUFS) {
+            lost_changes = true;
+            continue;
+        }
+
+        return false;
+    }
+}
+
+bool LinkWatcher::next_change(link_change &change)
+{
+    if (netlink_socket == -1) {
+        return false;
+    }
+
+    while (true) {
+        if (read_offset >= read_length && !receive()) {
+            return false;
+        }
+
+        const struct nlmsghdr *header = (const struct nlmsghdr *)(receive_buffer + read_offset);
+        int remaining = read_length - read_offset;
+
+        if (!NLMSG_OK(header, remaining)) {
+            read_offset = read_length;
+            continue;
+        }
+
+        read_offset += NLMSG_ALIGN(header->nlmsg_len);
+
+        if (header->nlmsg_type != RTM_NEWLINK && header->nlmsg_type != RTM_DELLINK) {
+            continue;
+        }
+
+        const struct ifinfomsg *info = (const struct ifinfomsg *)NLMSG_DATA(header);
+        int attributes_length = IFLA_PAYLOAD(header);
+
+        memset(&change, 0, sizeof(change));
+        change.index = info->ifi_index;
+        change.flags = info->ifi_flags;
+        change.removed = header->nlmsg_type == RTM_DELLINK;
+
+        for (const struct rtattr *attribute = IFLA_RTA(info);
+                RTA_OK(attribute, attributes_length);
+                attribute = RTA_NEXT(attribute, attributes_length)) {
+            if (attribute->rta_type == IFLA_IFNAME) {
+                strncpy(change.name, (const char *)RTA_DATA(attribute), IF_NAMESIZE - 1);
+            }
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,65 @@
+//linkWatcher.h - Link state notifications from the kernel
+//
+// Subscribes to the RTNLGRP_LINK rtnetlink multicast group so link changes
+// are seen the moment the kernel reports them rather than whenever operstate
+// happens to be read next
+
+#ifndef LINK_WATCHER_H
+#define LINK_WATCHER_H
+
+#include <net/if.h>
+
+// One link notification
+struct link_change
+{
+    char name[IF_NAMESIZE];
+    int index;
+    unsigned int flags;
+    bool removed;
+};
+
+// Whether the flags of a link_change describe a link that can carry traffic
+inline bool link_is_running(const link_change &change)
+{
+    return !change.removed && (change.flags & IFF_UP) && (change.flags & IFF_RUNNING);
+}
+
+class LinkWatcher
+{
+public:
+    LinkWatcher();
+    ~LinkWatcher();
+
+    LinkWatcher(const LinkWatcher &) = delete;
+    LinkWatcher &operator=(const LinkWatcher &) = delete;
+
+    // Opens a non-blocking netlink socket subscribed to link notifications,
+    // returns false (with errno set) if the kernel refuses
+    bool open();
+
+    // The descriptor to poll, readable while notifications are waiting
+    int fd() const { return netlink_socket; }
+
+    // Pops the next waiting notification without blocking, returns false
+    // once there are none left
+    bool next_change(link_change &change);
+
+    // Returns true (and clears the flag) if the kernel dropped notifications
+    // because they were not read fast enough, in which case the caller
+    // should re-read the state of the links it cares about
+    bool overflowed();
+
+private:
+    bool receive();
+
+    int netlink_socket;
+    bool lost_changes;
+
+    // Notifications are received into this buffer and handed out one at a
+    // time from read_offset
+    char receive_buffer[16 * 1024];
+    int read_offset;
+    int read_length;
+};
+
+#endif
@@ -0,0 +1,467 @@
+//metricsExporter.cpp - Prometheus /metrics endpoint served from the event loop
+
+#include "metricsExporter.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A request larger than this is not a scrape
+const size_t MAX_REQUEST = 8192;
+
+// The counters exported for every interface
+struct exported_counter
+{
+    const char *name;
+    const char *help;
+    uint64_t interface_information::*member;
+};
+
+static const exported_counter exported_counters[] = {
+    {"netmon_carrier_up_count_total", "Times the carrier came up",
+     &interface_information::carrier_up_count},
+    {"netmon_carrier_down_count_total", "Times the carrier went down",
+     &interface_information::carrier_down_count},
+    {"netmon_rx_bytes_total", "Bytes received", &interface_information::rx_bytes},
+    {"netmon_rx_dropped_total", "Received packets dropped", &interface_information::rx_dropped},
+    {"netmon_rx_errors_total", "Receive errors", &interface_information::rx_errors},
+    {"netmon_rx_packets_total", "Packets received", &interface_information::rx_packets},
+    {"netmon_tx_bytes_total", "Bytes transmitted", &interface_information::tx_bytes},
+    {"netmon_tx_dropped_total", "Transmitted packets dropped", &interface_information::tx_dropped},
+    {"netmon_tx_errors_total", "Transmit errors", &interface_information::tx_errors},
+    {"netmon_tx_packets_total", "Packets transmitted", &interface_information::tx_packets},
+};
+
+static const char NOT_FOUND[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 10\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Not Found\n";
+
+static void append_number(std::string &out, uint64_t value)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+
+    out.append(digits, result.ptr - digits);
+}
+
+// A response other than a scrape's, made up as it is asked for
+static std::shared_ptr<const std::string> plain_response(const char *status, const std::string &body)
+{
+    std::string *response = new std::string();
+
+    response->reserve(body.size() + 128);
+    *response += "HTTP/1.1 ";
+    *response += status;
+    *response += "\r\nContent-Type: text/plain\r\nContent-Length: ";
+    append_number(*response, body.size());
+    *response += "\r\nConnection: close\r\n\r\n";
+    *response += body;
+
+    return std::shared_ptr<const std::string>(response);
+}
+
+static int hex_digit(char character)
+{
+    if (character >= '0' && character <= '9') {
+        return character - '0';
+    } else if (character >= 'a' && character <= 'f') {
+        return character - 'a' + 10;
+    } else if (character >= 'A' && character <= 'F') {
+        return character - 'A' + 10;
+    }
+
+    return -1;
+}
+
+// Undoes a query string's %XX and + encoding. A % not followed by two hex
+// digits is kept as it is
+static std::string url_decode(const std::string &text)
+{
+    std::string decoded;
+
+    decoded.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        int high = i + 2 < text.size() ? hex_digit(text[i + 1]) : -1;
+        int low = i + 2 < text.size() ? hex_digit(text[i + 2]) : -1;
+
+        if (text[i] == '%' && high != -1 && low != -1) {
+            decoded += (char)(high * 16 + low);
+            i += 2;
+        } else if (text[i] == '+') {
+            decoded += ' ';
+        } else {
+            decoded += text[i];
+        }
+    }
+
+    return decoded;
+}
+
+// The decoded value of a name=value parameter of a query string, empty if
+// missing
+static std::string query_parameter(const std::string &query, const char *name)
+{
+    size_t length = strlen(name);
+    size_t start = 0;
+
+    while (start < query.size()) {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos) {
+            end = query.size();
+        }
+
+        if (query.compare(start, length, name) == 0 && query[start + length] == '=') {
+            return url_decode(query.substr(start + length + 1, end - start - length - 1));
+        }
+        start = end + 1;
+    }
+
+    return "";
+}
+
+// Appends one sample line: name{interface="..."} value, with the backslashes,
+// quotes and newlines the text format does not allow in a label value escaped
+static void append_sample(std::string &out, const char *name,
+                          const std::string &interface_name, uint64_t value)
+{
+    out += name;
+    out += "{interface=\"";
+    for (char character : interface_name) {
+        if (character == '\\' || character == '"') {
+            out += '\\';
+            out += character;
+        } else if (character == '\n') {
+            out += "\\n";
+        } else {
+            out += character;
+        }
+    }
+    out += "\"} ";
+    append_number(out, value);
+    out += '\n';
+}
+
+MetricsExporter::MetricsExporter(EventLoop &loop)
+    : loop(loop), listen_fd(-1), history(nullptr), stale(true)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    close();
+}
+
+bool MetricsExporter::open(int port)
+{
+    struct sockaddr_in address;
+    int enable = 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listen_fd == -1) {
+        return false;
+    }
+
+    // Only scrapers on this host are served
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1
+            || listen(listen_fd, SOMAXCONN) == -1) {
+        int saved_errno = errno;
+        ::close(listen_fd);
+        listen_fd = -1;
+        errno = saved_errno;
+        return false;
+    }
+
+    loop.add(listen_fd, EPOLLIN, [this](uint32_t events) { accept_scrapes(events); });
+
+    return true;
+}
+
+void MetricsExporter::close()
+{
+    while (!scrapes.empty()) {
+        finish(scrapes.begin()->second.get());
+    }
+
+    if (listen_fd != -1) {
+        loop.remove(listen_fd);
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+int MetricsExporter::add_interface(const std::string &interface_name)
+{
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        if (interfaces[i].name == interface_name) {
+            interfaces[i].removed = false;
+            return i;
+        }
+    }
+
+    exported_interface exported;
+
+    exported.name = interface_name;
+    memset(&exported.info, 0, sizeof(exported.info));
+    exported.sampled = false;
+    exported.removed = false;
+
+    interfaces.push_back(exported);
+    stale = true;
+
+    return interfaces.size() - 1;
+}
+
+void MetricsExporter::remove_interface(int interface)
+{
+    exported_interface &exported = interfaces.at(interface);
+
+    exported.removed = true;
+    exported.sampled = false;
+    stale = true;
+}
+
+void MetricsExporter::update(int interface, const interface_information &info)
+{
+    exported_interface &exported = interfaces.at(interface);
+
+    // An interface that was not found keeps its last counters
+    if (info.timestamp_ns == 0 || exported.removed) {
+        return;
+    }
+
+    exported.info = info;
+    exported.sampled = true;
+    stale = true;
+}
+
+// Accepts every pending scrape, the loop is edge-triggered
+void MetricsExporter::accept_scrapes(uint32_t events)
+{
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        scrape *client = new scrape();
+        client->fd = fd;
+        client->sent = 0;
+        scrapes[fd].reset(client);
+
+        loop.add(fd, EPOLLIN | EPOLLRDHUP, [this, client](uint32_t events) {
+            service(client, events);
+        });
+    }
+}
+
+// Reads the request until its headers are complete, then sends the response
+void MetricsExporter::service(scrape *client, uint32_t events)
+{
+    if (client->response) {
+        if (send_response(client)) {
+            finish(client);
+        }
+        return;
+    }
+
+    char buffer[1024];
+
+    while (true) {
+        ssize_t received = read(client->fd, buffer, sizeof(buffer));
+
+        if (received > 0) {
+            client->request.append(buffer, received);
+
+            if (client->request.size() > MAX_REQUEST) {
+                finish(client);
+                return;
+            }
+            continue;
+        }
+
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // Closed before a whole request arrived
+        finish(client);
+        return;
+    }
+
+    if (client->request.find("\r\n\r\n") != std::string::npos) {
+        respond(client);
+    }
+}
+
+// Picks the response for a complete request and starts sending it
+void MetricsExporter::respond(scrape *client)
+{
+    const std::string &request = client->request;
+
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+        client->response = metrics_response();
+    } else if (history != nullptr && request.compare(0, 13, "GET /history?") == 0) {
+        size_t end = request.find(' ', 13);
+        client->response = history_response(request.substr(13, end == std::string::npos ? 0 : end - 13));
+    } else {
+        static const std::shared_ptr<const std::string> not_found =
+            std::make_shared<const std::string>(NOT_FOUND, sizeof(NOT_FOUND) - 1);
+        client->response = not_found;
+    }
+
+    if (send_response(client)) {
+        finish(client);
+    } else {
+        loop.modify(client->fd, EPOLLOUT | EPOLLRDHUP);
+    }
+}
+
+// Sends as much of the response as the socket takes. Returns true once
+// there is nothing more to do for the scrape, whether it was all sent or the
+// scraper went away
+bool MetricsExporter::send_response(scrape *client)
+{
+    const std::string &response = *client->response;
+
+    while (client->sent < response.size()) {
+        ssize_t written = send(client->fd, response.data() + client->sent,
+                               response.size() - client->sent, MSG_NOSIGNAL);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+
+        client->sent += written;
+    }
+
+    return true;
+}
+
+void MetricsExporter::finish(scrape *client)
+{
+    int fd = client->fd;
+
+    loop.remove(fd);
+    ::close(fd);
+    scrapes.erase(fd);
+}
+
+// The /metrics response, rebuilt only if a sample arrived since the last one
+std::shared_ptr<const std::string> MetricsExporter::metrics_response()
+{
+    if (stale || !cached) {
+        render();
+        stale = false;
+    }
+
+    return cached;
+}
+
+// Serializes the latest samples, every family together as the format asks
+void MetricsExporter::render()
+{
+    std::string body;
+
+    body.reserve(cached ? cached->size() : 4096);
+
+    body += "# HELP netmon_link_up Whether the interface's operstate is up\n";
+    body += "# TYPE netmon_link_up gauge\n";
+    for (const exported_interface &exported : interfaces) {
+        if (exported.sampled) {
+            append_sample(body, "netmon_link_up", exported.name,
+                          strcmp(exported.info.operstate, "up") == 0);
+        }
+    }
+
+    for (const exported_counter &counter : exported_counters) {
+        body += "# HELP ";
+        body += counter.name;
+        body += " ";
+        body += counter.help;
+        body += "\n# TYPE ";
+        body += counter.name;
+        body += " counter\n";
+
+        for (const exported_interface &exported : interfaces) {
+            if (exported.sampled) {
+                append_sample(body, counter.name, exported.name, exported.info.*(counter.member));
+            }
+        }
+    }
+
+    std::string *response = new std::string();
+
+    response->reserve(body.size() + 128);
+    *response += "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: ";
+    append_number(*response, body.size());
+    *response += "\r\nConnection: close\r\n\r\n";
+    *response += body;
+
+    // Scrapes still sending the previous response keep it alive
+    cached.reset(response);
+}
+
+// The /history response, made for every request as each asks for something
+// else
+std::shared_ptr<const std::string> MetricsExporter::history_response(const std::string &query) const
+{
+    std::string interface_name = query_parameter(query, "interface");
+    std::string seconds_text = query_parameter(query, "seconds");
+    history_metric metric;
+    char *end;
+    unsigned long seconds = strtoul(seconds_text.c_str(), &end, 10);
+
+    if (interface_name.empty() || !parse_metric(query_parameter(query, "metric"), metric)
+            || seconds_text.empty() || *end != '\0' || seconds == 0) {
+        return plain_response("400 Bad Request",
+                              "usage: /history?interface=<name>&metric=<counter>&seconds=<n>\n");
+    }
+
+    std::vector<history_point> points;
+
+    if (!history->query(interface_name, metric, seconds, points)) {
+        return plain_response("404 Not Found", "no history of " + interface_name + "\n");
+    }
+
+    std::string body;
+    char line[96];
+
+    body.reserve(points.size() * 48);
+    for (const history_point &point : points) {
+        int length = snprintf(line, sizeof(line), "%llu %.7g %.7g %.7g\n",
+                              (unsigned long long)point.timestamp_ns, point.min, point.avg, point.max);
+        body.append(line, length);
+    }
+
+    return plain_response("200 OK", body);
+}
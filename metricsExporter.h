@@ -0,0 +1,99 @@
+//metricsExporter.h - Prometheus /metrics endpoint served from the event loop
+//
+// Listens on a local TCP port and answers GET /metrics with the latest
+// sample of every interface in the Prometheus text format. The whole
+// response is serialized once and shared by every scrape until a new sample
+// arrives, so scraping often costs little more than the writes themselves.
+// Each scrape is written out as the socket takes it, without ever blocking
+// the loop.
+//
+// Given a history store it also answers GET /history?interface=<name>&
+// metric=<counter>&seconds=<n> with the last n seconds of that counter's
+// rate from the finest tier that reaches back that far, one
+// "<timestamp_ns> <min> <avg> <max>" line per entry, oldest first, timed on
+// CLOCK_MONOTONIC
+
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eventLoop.h"
+#include "historyStore.h"
+#include "interfaceInfo.h"
+
+class MetricsExporter
+{
+public:
+    explicit MetricsExporter(EventLoop &loop);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    // Starts listening on 127.0.0.1:port, returns false (with errno set) on
+    // failure
+    bool open(int port);
+
+    // Stops listening and drops every scrape in progress
+    void close();
+
+    // Starts exporting an interface and returns its index. One that was
+    // removed keeps its index and is exported again from its next sample
+    int add_interface(const std::string &interface_name);
+
+    // Stops exporting an interface, its series are gone from the next scrape
+    void remove_interface(int interface);
+
+    // Serves /history from the store, which must outlive the exporter
+    void serve_history(const HistoryStore *history) { this->history = history; }
+
+    // Replaces the interface's latest sample, an interface that was removed
+    // is left out
+    void update(int interface, const interface_information &info);
+
+private:
+    struct scrape
+    {
+        int fd;
+        std::string request;
+        // The response being sent and how much of it has been
+        std::shared_ptr<const std::string> response;
+        size_t sent;
+    };
+
+    struct exported_interface
+    {
+        std::string name;
+        interface_information info;
+        bool sampled;
+        bool removed;
+    };
+
+    void accept_scrapes(uint32_t events);
+    void service(scrape *client, uint32_t events);
+    void respond(scrape *client);
+    bool send_response(scrape *client);
+    void finish(scrape *client);
+    std::shared_ptr<const std::string> metrics_response();
+    std::shared_ptr<const std::string> history_response(const std::string &query) const;
+    void render();
+
+    EventLoop &loop;
+    int listen_fd;
+
+    std::vector<exported_interface> interfaces;
+    const HistoryStore *history;
+    std::unordered_map<int, std::unique_ptr<scrape>> scrapes;
+
+    // The full HTTP response for /metrics, rebuilt on the first scrape after
+    // a new sample
+    std::shared_ptr<const std::string> cached;
+    bool stale;
+};
+
+#endif
@@ -0,0 +1,854 @@
+//monitorBench.cpp - Benchmarks of the sampling path, reported as JSON
+//
+// Usage: monitorBench [-m seconds] [-f filter]
+//
+// Every benchmark repeats its operation for at least the minimum time (half
+// a second unless -m says otherwise), in the manner of Google Benchmark, and
+// reports the real and CPU time per iteration, the latency percentiles of
+// single iterations, the allocations each one made and, where an iteration
+// samples interfaces, the interfaces sampled per second. The results are
+// written to stdout in Google Benchmark's JSON layout so that runs can be
+// kept and compared for regressions. Only benchmarks whose name contains the
+// filter (-f) are run.
+//
+//   sysfs_collect/N    one sysfs collector pass over N fake interfaces
+//   netlink_collect/N  one netlink collector pass over N interfaces served
+//                      by a synthetic peer
+//   netlink_kernel/1   one netlink collector pass served by the kernel, for
+//                      the loopback interface
+//   procfs_collect/N   one procfs collector pass over N fake interfaces
+//   procfs_kernel/1    one procfs collector pass over the real
+//                      /proc/net/dev, for the loopback interface
+//   ipc_round_trip     a Monitor command to another process and its
+//                      Monitoring reply, over the monitors' protocol
+//   batch_tick/N[/scalar]
+//                      one pass of the batch kernels over N interfaces:
+//                      parsing their counters from text and rating them
+//                      against thresholds, with the best instructions the
+//                      CPU has or without any
+//   sampler_tick/N     one tick of in-process monitoring of N fake
+//                      interfaces, from the sampler thread collecting them
+//                      to every sample being rated and formatted. Its
+//                      allocations count every thread's, and should be 0
+//   alert_tick/N       one sample of each of N interfaces through the alert
+//                      engine, with a rule of every kind
+//   softnet_collect/N  one pass over a softnet_stat of N CPUs, rated and
+//                      reported
+//   top_frame/N        a sample of each of N interfaces into the --top
+//                      table and one frame of it, sorted by receive rate,
+//                      drawn on a 200x60 screen. At 10 frames a second its
+//                      CPU time times 10 is the table's share of a CPU
+//
+// The interfaces are synthetic (see benchFixture.h) or the loopback device,
+// so it runs anywhere without privileges or NICs
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "alertEngine.h"
+#include "benchFixture.h"
+#include "counterBatch.h"
+#include "counterRates.h"
+#include "interfaceInfo.h"
+#include "netlinkCollector.h"
+#include "outputSink.h"
+#include "procNetDevCollector.h"
+#include "protocol.h"
+#include "queueStats.h"
+#include "samplerThread.h"
+#include "selfStats.h"
+#include "sysfsSampler.h"
+#include "topDisplay.h"
+
+// The CPU time of the calling thread, so a fixture's own thread is not
+// charged to the benchmark
+static uint64_t thread_cpu_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Times the iterations of one benchmark. The loop is written
+//
+//     while (state.keep_running()) {
+//         ...one iteration...
+//     }
+//
+// and anything that is not to be measured is put between pause_timing()
+// and resume_timing()
+class BenchState
+{
+public:
+    explicit BenchState(double min_seconds)
+        : min_ns(min_seconds * 1e9), running(false), paused_ns(0), paused_cpu_ns(0),
+          paused_allocations(0), iterations(0), items_per_iteration(0),
+          real_ns(0), cpu_ns(0), allocations(0)
+    {
+    }
+
+    bool keep_running()
+    {
+        uint64_t now = monotonic_ns();
+
+        if (!running) {
+            running = true;
+            first_ns = now;
+            iteration_ns = now;
+            cpu_start_ns = thread_cpu_ns();
+            allocations_start = allocations_made();
+            return error.empty();
+        }
+
+        uint64_t elapsed = now - iteration_ns - paused_ns;
+
+        iterations++;
+        real_ns += elapsed;
+        latency.record(elapsed);
+        paused_ns = 0;
+
+        // Stop once enough has been timed, or long after if most of the
+        // time is going on paused work
+        if (!error.empty() || real_ns >= min_ns || now - first_ns >= 20 * min_ns) {
+            cpu_ns = thread_cpu_ns() - cpu_start_ns - paused_cpu_ns;
+            allocations = allocations_made() - allocations_start - paused_allocations;
+            return false;
+        }
+
+        iteration_ns = monotonic_ns();
+
+        return true;
+    }
+
+    void pause_timing()
+    {
+        paused_at_ns = monotonic_ns();
+        paused_cpu_at_ns = thread_cpu_ns();
+        paused_allocations_at = allocations_made();
+    }
+
+    void resume_timing()
+    {
+        paused_ns += monotonic_ns() - paused_at_ns;
+        paused_cpu_ns += thread_cpu_ns() - paused_cpu_at_ns;
+        paused_allocations += allocations_made() - paused_allocations_at;
+    }
+
+    // The number of interfaces (or other items) one iteration handles
+    void set_items_per_iteration(uint64_t items) { items_per_iteration = items; }
+
+    // Ends the benchmark, reporting it as failed
+    void fail(const std::string &message)
+    {
+        if (error.empty()) {
+            error = message;
+        }
+    }
+
+private:
+    uint64_t min_ns;
+    bool running;
+    uint64_t first_ns;
+    uint64_t iteration_ns;
+    uint64_t cpu_start_ns;
+    uint64_t allocations_start;
+
+    uint64_t paused_at_ns;
+    uint64_t paused_cpu_at_ns;
+    uint64_t paused_allocations_at;
+    uint64_t paused_ns;
+    uint64_t paused_cpu_ns;
+    uint64_t paused_allocations;
+
+public:
+    // The results once keep_running() has returned false
+    uint64_t iterations;
+    uint64_t items_per_iteration;
+    uint64_t real_ns;
+    uint64_t cpu_ns;
+    uint64_t allocations;
+    LatencyHistogram latency;
+    std::string error;
+};
+
+struct benchmark
+{
+    std::string name;
+    std::function<void(BenchState &)> run;
+};
+
+// Where the fake sysfs trees are laid out, private to this process
+static std::string fixture_root()
+{
+    const char *temporary = getenv("TMPDIR");
+
+    return std::string(temporary != nullptr ? temporary : "/tmp") +
+           "/monitorBench." + std::to_string(getpid());
+}
+
+static std::string error_text(const char *what)
+{
+    return std::string(what) + ": " + strerror(errno);
+}
+
+static void bench_sysfs_collect(BenchState &state, int count)
+{
+    SysfsFixture fixture;
+
+    if (!fixture.create(fixture_root(), count)) {
+        state.fail(error_text("unable to create the fake interfaces"));
+    }
+
+    SysfsCollector collector(fixture.root());
+    std::vector<interface_information> samples(count);
+
+    for (const std::string &name : fixture.names()) {
+        collector.add_interface(name);
+    }
+    state.set_items_per_iteration(count);
+
+    while (state.keep_running()) {
+        state.pause_timing();
+        fixture.advance();
+        state.resume_timing();
+
+        if (collector.collect(samples.data()) != count) {
+            state.fail(error_text("sysfs collect missed interfaces"));
+        }
+    }
+}
+
+static void bench_netlink_collect(BenchState &state, int count)
+{
+    NetlinkFixture fixture;
+    int fd = fixture.start(count);
+
+    if (fd == -1) {
+        state.fail(error_text("unable to start the netlink peer"));
+        return;
+    }
+
+    NetlinkCollector collector;
+    std::vector<interface_information> samples(count);
+
+    collector.attach(fd);
+    for (const std::string &name : fake_interface_names(count)) {
+        collector.add_interface(name);
+    }
+    state.set_items_per_iteration(count);
+
+    while (state.keep_running()) {
+        if (collector.collect(samples.data()) != count) {
+            state.fail(error_text("netlink collect missed interfaces"));
+        }
+    }
+}
+
+static void bench_netlink_kernel(BenchState &state)
+{
+    NetlinkCollector collector;
+    interface_information sample;
+
+    if (!collector.open()) {
+        state.fail(error_text("unable to open netlink"));
+    }
+    collector.add_interface("lo");
+    state.set_items_per_iteration(1);
+
+    while (state.keep_running()) {
+        if (collector.collect(&sample) != 1) {
+            state.fail(error_text("netlink collect missed lo"));
+        }
+    }
+}
+
+static void bench_procfs_collect(BenchState &state, int count)
+{
+    SysfsFixture fixture;
+
+    if (!fixture.create(fixture_root(), count)) {
+        state.fail(error_text("unable to create the fake interfaces"));
+    }
+
+    ProcNetDevCollector collector(fixture.net_dev_path(), fixture.root());
+    std::vector<interface_information> samples(count);
+
+    if (!collector.open()) {
+        state.fail(error_text("unable to open the fake /proc/net/dev"));
+    }
+    for (const std::string &name : fixture.names()) {
+        collector.add_interface(name);
+    }
+    state.set_items_per_iteration(count);
+
+    // The first pass learns which line is which interface and opens their
+    // sysfs files, as the sysfs collector does when interfaces are added
+    collector.collect(samples.data());
+
+    while (state.keep_running()) {
+        state.pause_timing();
+        fixture.advance();
+        state.resume_timing();
+
+        if (collector.collect(samples.data()) != count) {
+            state.fail(error_text("procfs collect missed interfaces"));
+        }
+    }
+}
+
+static void bench_procfs_kernel(BenchState &state)
+{
+    ProcNetDevCollector collector;
+    interface_information sample;
+
+    if (!collector.open()) {
+        state.fail(error_text("unable to open " PROC_NET_DEV));
+    }
+    collector.add_interface("lo");
+    state.set_items_per_iteration(1);
+
+    while (state.keep_running()) {
+        if (collector.collect(&sample) != 1) {
+            state.fail(error_text("procfs collect missed lo"));
+        }
+    }
+}
+
+// Reads from fd until the decoder holds a whole message. Returns false if
+// the other end has gone
+static bool receive_message(int fd, MessageDecoder &decoder, message_header &header)
+{
+    const char *payload;
+    char received[MAX_MESSAGE];
+
+    while (!decoder.next(header, payload)) {
+        ssize_t length = read(fd, received, sizeof(received));
+
+        if (length <= 0 && !(length == -1 && errno == EINTR)) {
+            return false;
+        }
+        if (length > 0) {
+            decoder.feed(received, length);
+        }
+    }
+
+    return true;
+}
+
+static void bench_ipc_round_trip(BenchState &state)
+{
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
+        state.fail(error_text("unable to create a socket pair"));
+        return;
+    }
+
+    // The other process answers every Monitor with Monitoring, as an
+    // intfMonitor does
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        MessageDecoder decoder;
+        message_header header;
+        char reply[MAX_MESSAGE];
+
+        close(sockets[0]);
+        while (receive_message(sockets[1], decoder, header)) {
+            size_t length = encode_message(reply, MSG_MONITORING, header.interface_id);
+            write(sockets[1], reply, length);
+        }
+        _exit(0);
+    }
+
+    close(sockets[1]);
+
+    if (pid == -1) {
+        state.fail(error_text("unable to fork"));
+    }
+
+    MessageDecoder decoder;
+    message_header header;
+    char request[MAX_MESSAGE];
+    size_t length = encode_message(request, MSG_MONITOR, 0);
+
+    state.set_items_per_iteration(1);
+
+    while (state.keep_running()) {
+        if (write(sockets[0], request, length) != (ssize_t)length ||
+            !receive_message(sockets[0], decoder, header) ||
+            header.type != MSG_MONITORING) {
+            state.fail(error_text("round trip failed"));
+        }
+    }
+
+    close(sockets[0]);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// Writes the counters of every interface as lines of text, one interface
+// per line in the manner of /proc/net/dev, with the parser's padding after
+static void render_counters(const std::vector<fake_counters> &counters, std::vector<char> &text)
+{
+    text.clear();
+
+    for (size_t i = 0; i < counters.size(); i++) {
+        const fake_counters &interface = counters[i];
+        const uint64_t values[NUM_BATCH_COUNTERS] = {
+            interface.rx_bytes, interface.rx_packets, interface.rx_dropped, interface.rx_errors,
+            interface.tx_bytes, interface.tx_packets, interface.tx_dropped, interface.tx_errors,
+        };
+        char line[256];
+        int length = snprintf(line, sizeof(line), "fake%zu:", i);
+
+        for (uint64_t value : values) {
+            length += snprintf(line + length, sizeof(line) - length, " %8llu",
+                               (unsigned long long)value);
+        }
+        line[length++] = '\n';
+
+        text.insert(text.end(), line, line + length);
+    }
+
+    text.insert(text.end(), DECIMAL_READ_PADDING, '\0');
+}
+
+static void bench_batch_tick(BenchState &state, int count, simd_level level)
+{
+    std::vector<fake_counters> counters(count);
+    std::vector<char> text;
+    std::vector<counter_line> lines(count);
+    BatchRateCalculator calculator;
+    uint64_t generation = 0;
+
+    // Counters of a host that has been up a while, a dozen digits or so
+    for (int i = 0; i < count; i++) {
+        memset(&counters[i], 0, sizeof(counters[i]));
+        counters[i].rx_bytes = 1000000000000ULL * (1 + i % 7);
+        counters[i].rx_packets = 1000000000ULL * (1 + i % 5);
+        counters[i].tx_bytes = 100000000000ULL * (1 + i % 3);
+        counters[i].tx_packets = 100000000ULL * (1 + i % 11);
+    }
+
+    calculator.resize(count);
+    calculator.set_threshold(BATCH_RX_BYTES, 1e9);
+    calculator.set_threshold(BATCH_RX_DROPPED, 100);
+    calculator.set_threshold(BATCH_RX_ERRORS, 10);
+    use_simd_level(level);
+    state.set_items_per_iteration(count);
+
+    while (state.keep_running()) {
+        state.pause_timing();
+        generation++;
+        for (int i = 0; i < count; i++) {
+            advance_counters(counters[i], generation * 1000003 + i);
+        }
+        render_counters(counters, text);
+        state.resume_timing();
+
+        counter_batch &batch = calculator.next();
+        uint64_t *columns[NUM_BATCH_COUNTERS];
+        uint64_t now = monotonic_ns();
+
+        for (int counter = 0; counter < NUM_BATCH_COUNTERS; counter++) {
+            columns[counter] = batch.counters[counter].data();
+        }
+
+        size_t parsed = parse_counter_lines(text.data(), text.data() + text.size() - DECIMAL_READ_PADDING,
+                                            NUM_BATCH_COUNTERS, columns, lines.data(), count);
+        if (parsed != (size_t)count) {
+            state.fail("unable to parse the counters");
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (lines[i].parsed != NUM_BATCH_COUNTERS) {
+                state.fail("unable to parse the counters");
+            }
+            batch.timestamp_ns[i] = now;
+        }
+
+        calculator.update();
+    }
+
+    use_simd_level(detected_simd_level());
+}
+
+// Handles the sampler's events as networkMonitor does until count samples
+// have been rated and formatted. Returns false if they stop coming
+static bool handle_samples(SamplerThread &sampler, std::vector<RateCalculator> &calculators,
+                           const std::vector<std::string> &names, OutputSink &output, int count)
+{
+    struct pollfd descriptor;
+    descriptor.fd = sampler.event_fd();
+    descriptor.events = POLLIN;
+
+    interface_event event;
+    interface_rates rates;
+
+    while (count > 0) {
+        if (!sampler.next_event(event)) {
+            if (poll(&descriptor, 1, 1000) == 0) {
+                return false;
+            }
+            continue;
+        }
+
+        if (event.type == MSG_SAMPLE) {
+            calculators[event.interface].update(event.info, rates);
+            output.sample(names[event.interface], event.info, rates);
+            count--;
+        }
+    }
+
+    return true;
+}
+
+static void bench_sampler_tick(BenchState &state, int count)
+{
+    SysfsFixture fixture;
+
+    if (!fixture.create(fixture_root(), count)) {
+        state.fail(error_text("unable to create the fake interfaces"));
+        return;
+    }
+
+    sampling_schedule schedule;
+    schedule.interval_ms = MIN_INTERVAL_MS;
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    OutputSink output(null_fd, FORMAT_CSV);
+    SamplerThread sampler(new SysfsCollector(fixture.root()), schedule);
+    std::vector<RateCalculator> calculators(count);
+
+    for (const std::string &name : fixture.names()) {
+        sampler.add_interface(name);
+    }
+
+    output.start();
+    if (!sampler.start()) {
+        state.fail(error_text("unable to start the sampler"));
+    }
+    for (int i = 0; i < count; i++) {
+        sampler.command(i, MSG_MONITOR);
+    }
+
+    // The first ticks grow the queues to their steady size
+    if (!handle_samples(sampler, calculators, fixture.names(), output, 64 * count)) {
+        state.fail("no samples from the sampler");
+    }
+    state.set_items_per_iteration(count);
+
+    while (state.keep_running()) {
+        if (!handle_samples(sampler, calculators, fixture.names(), output, count)) {
+            state.fail("no samples from the sampler");
+        }
+    }
+
+    sampler.stop();
+    output.stop();
+    close(null_fd);
+}
+
+static void bench_alert_tick(BenchState &state, int count)
+{
+    const char *rule_texts[] = {
+        "rx_drops_per_sec > 100 for 5s",
+        "ewma(rx_bps) > 8e9",
+        "p99(rx_pps) > 800000 for 30s clear 600000",
+        "change(tx_pps) > 100000",
+        "ratio(tx_pps) < 0.2 for 3s clear 0.5",
+    };
+    std::vector<alert_rule> rules;
+    std::string error;
+
+    for (const char *text : rule_texts) {
+        alert_rule rule;
+        if (!parse_alert_rule(text, rule, error)) {
+            state.fail(error);
+            return;
+        }
+        rules.push_back(rule);
+    }
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    OutputSink output(null_fd, FORMAT_CSV);
+    AlertEngine alerts;
+    std::vector<std::string> names;
+
+    alerts.set_rules(rules);
+    for (int i = 0; i < count; i++) {
+        alerts.add_interface(i);
+        names.push_back("fake" + std::to_string(i));
+    }
+    output.start();
+
+    interface_rates rates;
+    memset(&rates, 0, sizeof(rates));
+    rates.valid = true;
+    rates.interval = 1;
+
+    uint64_t now = monotonic_ns();
+    uint64_t tick = 0;
+
+    state.set_items_per_iteration(count);
+
+    // A second of simulated time per iteration, with traffic that now and
+    // then dips and drops packets so some alerts fire and resolve
+    while (state.keep_running()) {
+        tick++;
+        now += 1000000000;
+
+        for (int i = 0; i < count; i++) {
+            uint64_t noise = (tick * 2654435761ULL + i * 40503ULL) % 1000;
+            bool dip = (tick + i) % 97 < 4;
+
+            rates.rx_packets = 500000 + noise * 400;
+            rates.rx_bits = rates.rx_packets * 8000;
+            rates.rx_dropped = noise > 990 ? 500 : 0;
+            rates.tx_packets = dip ? 10000 : 400000 + noise * 100;
+            rates.tx_bits = rates.tx_packets * 8000;
+
+            alerts.update(i, names[i], rates, now, output);
+        }
+    }
+
+    output.stop();
+    close(null_fd);
+}
+
+static void bench_softnet_collect(BenchState &state, int count)
+{
+    std::string path = fixture_root() + ".softnet_stat";
+    FILE *file = fopen(path.c_str(), "w");
+
+    if (file == nullptr) {
+        state.fail(error_text("unable to write the fake softnet_stat"));
+        return;
+    }
+
+    // The layout of kernels from 5.10 on, the CPU's number last
+    for (int cpu = 0; cpu < count; cpu++) {
+        fprintf(file, "%08x %08x %08x 00000000 00000000 00000000 00000000 00000000 "
+                      "00000000 %08x 00000000 00000000 %08x\n",
+                0x1000000 + cpu * 4099, cpu % 3, cpu * 7, cpu * 11, cpu);
+    }
+    fclose(file);
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    OutputSink output(null_fd, FORMAT_CSV);
+    QueueStats stats(SYSFS_NET_ROOT, path);
+
+    output.start();
+
+    // The first two passes size everything
+    for (int i = 0; i < 2; i++) {
+        if (!stats.collect_softnet()) {
+            state.fail(error_text("unable to read the fake softnet_stat"));
+        }
+        stats.report_softnet(output);
+    }
+    state.set_items_per_iteration(count);
+
+    while (state.keep_running()) {
+        stats.collect_softnet();
+        stats.report_softnet(output);
+    }
+
+    output.stop();
+    close(null_fd);
+    unlink(path.c_str());
+}
+
+static void bench_top_frame(BenchState &state, int count)
+{
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    TopDisplay display;
+    interface_information info;
+    interface_rates rates;
+
+    memset(&info, 0, sizeof(info));
+    memset(&rates, 0, sizeof(rates));
+    strcpy(info.operstate, "up");
+    rates.valid = true;
+    rates.interval = 0.1;
+
+    display.open(null_fd, -1);
+    display.resize(200, 60);
+    display.set_sort(SORT_RX);
+    for (int i = 0; i < count; i++) {
+        display.add_interface(i, "fake" + std::to_string(i));
+    }
+
+    uint64_t tick = 0;
+    size_t written = 0;
+
+    state.set_items_per_iteration(count);
+
+    // Every rate moves every frame, so the order does too
+    while (state.keep_running()) {
+        tick++;
+        info.timestamp_ns = monotonic_ns();
+
+        for (int i = 0; i < count; i++) {
+            uint64_t noise = (tick * 2654435761ULL + i * 40503ULL) % 1000;
+
+            info.carrier_down_count = (tick + i) / 500;
+            rates.rx_packets = 500000 + noise * 400;
+            rates.rx_bits = rates.rx_packets * 8000;
+            rates.rx_dropped = noise > 990 ? 500 : 0;
+            rates.tx_packets = 400000 + noise * 100;
+            rates.tx_bits = rates.tx_packets * 8000;
+
+            display.update(i, info, rates);
+        }
+
+        written += display.render();
+    }
+
+    if (written == 0) {
+        state.fail("no frame was drawn");
+    }
+
+    display.close();
+    close(null_fd);
+}
+
+// Writes one benchmark's results as an element of the "benchmarks" array
+static void write_result(const std::string &name, const BenchState &state, bool last)
+{
+    double iterations = state.iterations > 0 ? state.iterations : 1;
+
+    std::cout << "    {\n"
+              << "      \"name\": \"" << name << "\",\n"
+              << "      \"run_name\": \"" << name << "\",\n"
+              << "      \"run_type\": \"iteration\",\n"
+              << "      \"iterations\": " << state.iterations << ",\n"
+              << "      \"real_time\": " << state.real_ns / iterations / 1000.0 << ",\n"
+              << "      \"cpu_time\": " << state.cpu_ns / iterations / 1000.0 << ",\n"
+              << "      \"time_unit\": \"us\",\n";
+
+    if (state.items_per_iteration > 0 && state.real_ns > 0) {
+        std::cout << "      \"items_per_second\": "
+                  << state.items_per_iteration * state.iterations * 1e9 / state.real_ns << ",\n";
+    }
+
+    std::cout << "      \"p50_us\": " << state.latency.percentile(0.5) / 1000.0 << ",\n"
+              << "      \"p99_us\": " << state.latency.percentile(0.99) / 1000.0 << ",\n"
+              << "      \"max_us\": " << state.latency.max() / 1000.0 << ",\n"
+              << "      \"allocations_per_iteration\": " << state.allocations / iterations;
+
+    if (!state.error.empty()) {
+        std::cout << ",\n      \"error_occurred\": true,\n"
+                  << "      \"error_message\": \"" << state.error << "\"";
+    }
+
+    std::cout << "\n    }" << (last ? "" : ",") << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    double min_seconds = 0.5;
+    std::string filter;
+    int option;
+
+    while ((option = getopt(argc, argv, "m:f:")) != -1) {
+        if (option == 'm' && atof(optarg) > 0) {
+            min_seconds = atof(optarg);
+        } else if (option == 'f') {
+            filter = optarg;
+        } else {
+            std::cout << "usage: monitorBench [-m seconds] [-f filter]" << std::endl;
+            return 1;
+        }
+    }
+
+    // The sysfs collector keeps every file it reads open, 11 per interface
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    std::vector<benchmark> benchmarks;
+    for (int count : {1, 16, 256}) {
+        benchmarks.push_back({"sysfs_collect/" + std::to_string(count),
+                              [count](BenchState &state) { bench_sysfs_collect(state, count); }});
+    }
+    for (int count : {1, 16, 256}) {
+        benchmarks.push_back({"netlink_collect/" + std::to_string(count),
+                              [count](BenchState &state) { bench_netlink_collect(state, count); }});
+    }
+    benchmarks.push_back({"netlink_kernel/1", bench_netlink_kernel});
+    for (int count : {1, 16, 256}) {
+        benchmarks.push_back({"procfs_collect/" + std::to_string(count),
+                              [count](BenchState &state) { bench_procfs_collect(state, count); }});
+    }
+    benchmarks.push_back({"procfs_kernel/1", bench_procfs_kernel});
+    benchmarks.push_back({"ipc_round_trip", bench_ipc_round_trip});
+    benchmarks.push_back({"batch_tick/10000",
+                          [](BenchState &state) { bench_batch_tick(state, 10000, detected_simd_level()); }});
+    benchmarks.push_back({"batch_tick/10000/scalar",
+                          [](BenchState &state) { bench_batch_tick(state, 10000, SIMD_SCALAR); }});
+    for (int count : {1, 16, 256}) {
+        benchmarks.push_back({"sampler_tick/" + std::to_string(count),
+                              [count](BenchState &state) { bench_sampler_tick(state, count); }});
+    }
+
+    benchmarks.push_back({"alert_tick/1000", [](BenchState &state) { bench_alert_tick(state, 1000); }});
+    benchmarks.push_back({"softnet_collect/64", [](BenchState &state) { bench_softnet_collect(state, 64); }});
+    benchmarks.push_back({"top_frame/500", [](BenchState &state) { bench_top_frame(state, 500); }});
+
+    std::vector<benchmark> selected;
+    for (const benchmark &candidate : benchmarks) {
+        if (candidate.name.find(filter) != std::string::npos) {
+            selected.push_back(candidate);
+        }
+    }
+
+    char host[256] = "";
+    char date[64] = "";
+    time_t now = time(NULL);
+    gethostname(host, sizeof(host) - 1);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+    std::cout << "{\n"
+              << "  \"context\": {\n"
+              << "    \"date\": \"" << date << "\",\n"
+              << "    \"host_name\": \"" << host << "\",\n"
+              << "    \"executable\": \"" << argv[0] << "\",\n"
+              << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+              << "    \"simd_level\": \"" << simd_level_name(detected_simd_level()) << "\",\n"
+              << "    \"min_time\": " << min_seconds << "\n"
+              << "  },\n"
+              << "  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < selected.size(); i++) {
+        BenchState state(min_seconds);
+
+        std::cerr << "Running " << selected[i].name << std::endl;
+        selected[i].run(state);
+        write_result(selected[i].name, state, i + 1 == selected.size());
+    }
+
+    std::cout << "  ]\n"
+              << "}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+//monitorConfig.cpp - The network monitor's settings, from a file and the command line
+
+#include "monitorConfig.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/un.h>
+
+// Parses a whole decimal number within [minimum, maximum]
+static bool parse_number(const std::string &text, long minimum, long maximum, long &value)
+{
+    char *end;
+
+    errno = 0;
+    value = strtol(text.c_str(), &end, 10);
+
+    return !text.empty() && *end == '\0' && errno == 0 &&
+           value >= minimum && value <= maximum;
+}
+
+static bool parse_switch(const std::string &text, bool &value)
+{
+    if (text == "yes" || text == "on" || text == "true" || text == "1") {
+        value = true;
+    } else if (text == "no" || text == "off" || text == "false" || text == "0") {
+        value = false;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Strips the whitespace from both ends
+static std::string trim(const std::string &text)
+{
+    size_t first = text.find_first_not_of(" \t\r");
+
+    if (first == std::string::npos) {
+        return "";
+    }
+
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool apply_setting(monitor_config &config, const config_setting &setting,
+                   std::string &error)
+{
+    const std::string &key = setting.first;
+    const std::string &value = setting.second;
+    long number;
+    bool valid = true;
+
+    if (key == "interface") {
+        valid = !value.empty() && value.size() < IF_NAMESIZE;
+        if (valid) {
+            config.interfaces.push_back(value);
+        }
+    } else if (key == "discover") {
+        valid = parse_switch(value, config.discover);
+    } else if (key == "include") {
+        config.include_patterns.push_back(value);
+    } else if (key == "exclude") {
+        config.exclude_patterns.push_back(value);
+    } else if (key == "recovery") {
+        valid = parse_switch(value, config.recover_links);
+    } else if (key == "recovery_backoff") {
+        valid = parse_number(value, 0, 3600000, number);
+        if (valid) {
+            config.recovery.backoff_ms = number;
+        }
+    } else if (key == "recovery_max_backoff") {
+        valid = parse_number(value, 0, 3600000, number);
+        if (valid) {
+            config.recovery.max_backoff_ms = number;
+        }
+    } else if (key == "recovery_batch") {
+        valid = parse_number(value, 1, 4096, number);
+        if (valid) {
+            config.recovery.batch = number;
+        }
+    } else if (key == "recovery_half_life") {
+        valid = parse_number(value, 0, 3600000, number);
+        if (valid) {
+            config.recovery.half_life_ms = number;
+        }
+    } else if (key == "alert") {
+        alert_rule rule;
+        valid = parse_alert_rule(value, rule, error);
+        if (!valid) {
+            error = "invalid alert \"" + value + "\": " + error;
+            return false;
+        }
+        config.alert_rules.push_back(rule);
+    } else if (key == "alert_window") {
+        valid = parse_number(value, 1000, 86400000, number);
+        if (valid) {
+            config.alert_window_ms = number;
+        }
+    } else if (key == "backend") {
+        valid = parse_backend(value, config.backend);
+        if (valid) {
+            config.backend_name = value;
+        }
+    } else if (key == "sysfs_root") {
+        valid = !value.empty();
+        if (valid) {
+            config.sysfs_root = value.back() == '/' ? value : value + "/";
+        }
+    } else if (key == "proc_net_dev") {
+        valid = !value.empty();
+        if (valid) {
+            config.proc_net_dev = value;
+        }
+    } else if (key == "interval") {
+        valid = parse_interval(value.c_str(), config.schedule.interval_ms);
+    } else if (key == "cpu") {
+        valid = parse_number(value, -1, CPU_SETSIZE - 1, number);
+        if (valid) {
+            config.schedule.cpu = number;
+        }
+    } else if (key == "priority") {
+        valid = parse_number(value, 0, 99, number);
+        if (valid) {
+            config.schedule.fifo_priority = number;
+        }
+    } else if (key == "isolate") {
+        valid = parse_switch(value, config.isolate_processes);
+    } else if (key == "rings") {
+        valid = parse_switch(value, config.use_rings);
+    } else if (key == "socket") {
+        // The path has to fit in a sockaddr_un
+        valid = !value.empty() && value.size() < sizeof(sockaddr_un::sun_path);
+        if (valid) {
+            config.socket_path = value;
+        }
+    } else if (key == "intf_monitor") {
+        config.intf_monitor_path = value;
+    } else if (key == "restart_backoff") {
+        valid = parse_number(value, 0, 3600000, number);
+        if (valid) {
+            config.restart.backoff_ms = number;
+        }
+    } else if (key == "restart_max_backoff") {
+        valid = parse_number(value, 0, 3600000, number);
+        if (valid) {
+            config.restart.max_backoff_ms = number;
+        }
+    } else if (key == "shutdown_timeout") {
+        valid = parse_number(value, 0, 600000, number);
+        if (valid) {
+            config.restart.shutdown_timeout_ms = number;
+        }
+    } else if (key == "output") {
+        valid = parse_format(value, config.format);
+    } else if (key == "history") {
+        config.history_directory = value;
+    } else if (key == "history_sync") {
+        valid = parse_number(value, 1, 86400, number);
+        if (valid) {
+            config.history_sync_seconds = number;
+        }
+    } else if (key == "stats_interval") {
+        valid = parse_number(value, 0, 86400, number);
+        if (valid) {
+            config.stats_interval_seconds = number;
+        }
+    } else if (key == "queue_stats_interval") {
+        valid = parse_number(value, 0, 86400, number);
+        if (valid) {
+            config.queue_stats_interval_seconds = number;
+        }
+    } else if (key == "top") {
+        valid = parse_switch(value, config.top);
+    } else if (key == "top_refresh") {
+        valid = parse_number(value, 10, 10000, number);
+        if (valid) {
+            config.top_refresh_ms = number;
+        }
+    } else if (key == "metrics_port") {
+        valid = parse_number(value, 1, 65535, number);
+        if (valid) {
+            config.metrics_port = number;
+        }
+    } else {
+        error = "unknown setting \"" + key + "\"";
+        return false;
+    }
+
+    if (!valid) {
+        error = "invalid " + key + " \"" + value + "\"";
+    }
+
+    return valid;
+}
+
+bool load_config(const std::string &path, monitor_config &config, std::string &error)
+{
+    std::ifstream file(path);
+
+    if (!file) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(file, line)) {
+        line_number++;
+
+        // Everything from a # on is a comment
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = path + ":" + std::to_string(line_number) + ": expected key = value";
+            return false;
+        }
+
+        config_setting setting(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+
+        if (!apply_setting(config, setting, error)) {
+            error = path + ":" + std::to_string(line_number) + ": " + error;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool needs_restart(const monitor_config &running, const monitor_config &reloaded)
+{
+    return running.backend != reloaded.backend ||
+           running.sysfs_root != reloaded.sysfs_root ||
+           running.proc_net_dev != reloaded.proc_net_dev ||
+           running.schedule.interval_ms != reloaded.schedule.interval_ms ||
+           running.schedule.cpu != reloaded.schedule.cpu ||
+           running.schedule.fifo_priority != reloaded.schedule.fifo_priority ||
+           running.isolate_processes != reloaded.isolate_processes ||
+           running.use_rings != reloaded.use_rings ||
+           running.socket_path != reloaded.socket_path ||
+           running.intf_monitor_path != reloaded.intf_monitor_path ||
+           running.format != reloaded.format ||
+           running.history_directory != reloaded.history_directory ||
+           running.history_sync_seconds != reloaded.history_sync_seconds ||
+           running.metrics_port != reloaded.metrics_port ||
+           running.top != reloaded.top;
+}
@@ -0,0 +1,129 @@
+//monitorConfig.h - The network monitor's settings, from a file and the command line
+//
+// Everything the network monitor can be told at startup: which interfaces to
+// monitor, how to sample them and where to report. Settings are read from a
+// configuration file of "key = value" lines and then from the command line,
+// which overrides the file, so it can run without anyone at the keyboard.
+// The file is read again on SIGHUP; of its settings only the interfaces, the
+// link recovery and intfMonitor restart policies, the alert rules, the
+// stats intervals and how often --top redraws are changed on a running
+// monitor, the others need a restart
+//
+// A configuration file looks like:
+//
+//     # Monitor the physical interfaces, every second
+//     discover = yes
+//     include = eth*
+//     include = enp*
+//     exclude = eth9
+//     interface = lo
+//     interval = 1000
+//     backend = netlink
+//     recovery = yes
+//     recovery_batch = 16
+//     alert = rx_drops_per_sec > 100 for 5s
+
+#ifndef MONITOR_CONFIG_H
+#define MONITOR_CONFIG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alertEngine.h"
+#include "childSupervisor.h"
+#include "collector.h"
+#include "outputSink.h"
+#include "recoveryScheduler.h"
+#include "sampleTimer.h"
+#include "topDisplay.h"
+
+// The socket the intfMonitors connect to unless another is configured
+#define DEFAULT_SOCKET_PATH "/tmp/a1-socket"
+
+struct monitor_config
+{
+    // Interfaces monitored by name (interface), whether or not they match
+    // the patterns
+    std::vector<std::string> interfaces;
+
+    // Whether every interface in /sys/class/net passing the include and
+    // exclude patterns is monitored, as links come and go (discover)
+    bool discover = false;
+    std::vector<std::string> include_patterns;
+    std::vector<std::string> exclude_patterns;
+
+    // Whether a monitored link that goes down is set up again (recovery),
+    // and how soon and how many at once (recovery_backoff,
+    // recovery_max_backoff and recovery_half_life in milliseconds,
+    // recovery_batch)
+    bool recover_links = true;
+    recovery_policy recovery;
+
+    // The rules alerts are raised by, one per alert setting, and how far back
+    // their averages and percentiles look in milliseconds (alert_window)
+    std::vector<alert_rule> alert_rules;
+    long alert_window_ms = AlertEngine::DEFAULT_WINDOW_MS;
+
+    // How the interfaces are sampled (backend, interval, cpu, priority),
+    // where the sysfs backend and discovery find them (sysfs_root, which
+    // always ends in '/') and what the procfs backend reads (proc_net_dev)
+    collector_backend backend = BACKEND_SYSFS;
+    std::string backend_name = "sysfs";
+    std::string sysfs_root = SYSFS_NET_ROOT;
+    std::string proc_net_dev = PROC_NET_DEV;
+    sampling_schedule schedule;
+
+    // Whether each interface gets its own intfMonitor process (isolate),
+    // delivering its samples through a shared-memory ring (rings), where it
+    // listens for them (socket) and where the intfMonitor program is
+    // (intf_monitor, next to the network monitor when empty)
+    bool isolate_processes = false;
+    bool use_rings = false;
+    std::string socket_path = DEFAULT_SOCKET_PATH;
+    std::string intf_monitor_path;
+
+    // How soon an intfMonitor that exited unasked is started again
+    // (restart_backoff, restart_max_backoff) and how long they all have to
+    // exit on shutdown before being terminated (shutdown_timeout), in
+    // milliseconds
+    restart_policy restart;
+
+    // Where samples are reported (output, history, history_sync, metrics_port)
+    output_format format = FORMAT_TEXT;
+    std::string history_directory;
+    int history_sync_seconds = 10;
+    int metrics_port = 0;
+
+    // How often the monitor reports what it costs itself, in seconds, 0 for
+    // only when sent SIGUSR1 (stats_interval)
+    int stats_interval_seconds = 0;
+
+    // How often every interface's queues and every CPU's softnet counters
+    // are rated and reported, in seconds, 0 for never (queue_stats_interval)
+    int queue_stats_interval_seconds = 0;
+
+    // Whether the terminal shows a live table of every interface instead of
+    // the reports (top), and how often it is redrawn in milliseconds
+    // (top_refresh)
+    bool top = false;
+    long top_refresh_ms = TopDisplay::DEFAULT_REFRESH_MS;
+};
+
+// One "key = value" setting, as found in a file or made from an option
+typedef std::pair<std::string, std::string> config_setting;
+
+// Applies one setting. Returns false, with error describing why, if the key
+// is unknown or the value invalid
+bool apply_setting(monitor_config &config, const config_setting &setting,
+                   std::string &error);
+
+// Reads a configuration file into config, on top of what it holds already.
+// Returns false, with error naming the file and line, if it can not be read
+// or a setting is invalid
+bool load_config(const std::string &path, monitor_config &config, std::string &error);
+
+// Whether any of the settings that only take effect at startup differ
+bool needs_restart(const monitor_config &running, const monitor_config &reloaded);
+
+#endif
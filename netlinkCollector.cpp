@@ -0,0 +1,306 @@
+//netlinkCollector.cpp - rtnetlink collector backend
+
+#include "netlinkCollector.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/if.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Large enough for any single datagram of a link dump (the kernel caps them
+// at 32KB)
+const size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+
+// How many times a dump interrupted by link changes is made again
+const int MAX_DUMP_ATTEMPTS = 3;
+
+NetlinkCollector::NetlinkCollector()
+    : netlink_socket(-1), sequence(0), receive_buffer(RECEIVE_BUFFER_SIZE)
+{
+}
+
+NetlinkCollector::~NetlinkCollector()
+{
+    if (netlink_socket != -1) {
+        close(netlink_socket);
+    }
+}
+
+bool NetlinkCollector::open()
+{
+    struct sockaddr_nl address;
+
+    netlink_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (netlink_socket == -1) {
+        return false;
+    }
+
+    // Let the kernel pick our port id
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+
+    if (bind(netlink_socket, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        int saved_errno = errno;
+        close(netlink_socket);
+        netlink_socket = -1;
+        errno = saved_errno;
+        return false;
+    }
+
+    return true;
+}
+
+int NetlinkCollector::add_interface(const std::string &interface_name)
+{
+    int slot;
+
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        names[slot] = interface_name;
+    } else {
+        slot = present.size();
+        names.push_back(interface_name);
+        present.push_back(false);
+    }
+
+    slots_by_name[interface_name] = slot;
+
+    return slot;
+}
+
+void NetlinkCollector::remove_interface(int slot)
+{
+    // The name may have been given to a newer slot since
+    auto found = slots_by_name.find(names[slot]);
+    if (found != slots_by_name.end() && found->second == slot) {
+        slots_by_name.erase(found);
+    }
+
+    names[slot].clear();
+    present[slot] = false;
+    free_slots.push_back(slot);
+}
+
+// Asks the kernel for every link in one RTM_GETLINK dump
+bool NetlinkCollector::send_dump_request()
+{
+    struct
+    {
+        struct nlmsghdr header;
+        struct ifinfomsg info;
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = ++sequence;
+    request.info.ifi_family = AF_UNSPEC;
+
+    ssize_t bytes_sent;
+
+    do {
+        bytes_sent = send(netlink_socket, &request, request.header.nlmsg_len, 0);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    return bytes_sent == (ssize_t)request.header.nlmsg_len;
+}
+
+// Copies the counters of one RTM_NEWLINK message into its slot, if the
+// interface it describes is one we track
+void NetlinkCollector::parse_link(const struct nlmsghdr *header,
+                                  interface_information *samples)
+{
+    const struct ifinfomsg *info = (const struct ifinfomsg *)NLMSG_DATA(header);
+    int attributes_length = IFLA_PAYLOAD(header);
+
+    const char *interface_name = nullptr;
+    const struct rtattr *operstate = nullptr;
+    const struct rtattr *stats = nullptr;
+    const struct rtattr *carrier_up = nullptr;
+    const struct rtattr *carrier_down = nullptr;
+
+    for (const struct rtattr *attribute = IFLA_RTA(info);
+            RTA_OK(attribute, attributes_length);
+            attribute = RTA_NEXT(attribute, attributes_length)) {
+        switch (attribute->rta_type) {
+            case IFLA_IFNAME:
+                interface_name = (const char *)RTA_DATA(attribute);
+                break;
+            case IFLA_OPERSTATE:
+                operstate = attribute;
+                break;
+            case IFLA_STATS64:
+                stats = attribute;
+                break;
+            case IFLA_CARRIER_UP_COUNT:
+                carrier_up = attribute;
+                break;
+            case IFLA_CARRIER_DOWN_COUNT:
+                carrier_down = attribute;
+                break;
+        }
+    }
+
+    if (interface_name == nullptr) {
+        return;
+    }
+
+    auto found = slots_by_name.find(interface_name);
+
+    if (found == slots_by_name.end()) {
+        return;
+    }
+
+    int slot = found->second;
+    interface_information &sample = samples[slot];
+
+    memset(&sample, 0, sizeof(sample));
+
+    uint8_t state = IF_OPER_UNKNOWN;
+    if (operstate != nullptr) {
+        state = *(const uint8_t *)RTA_DATA(operstate);
+    }
+    strncpy(sample.operstate, operstate_name(state), OPERSTATE_LEN - 1);
+
+    // Attributes are only 4-byte aligned and older kernels send a shorter
+    // struct, so copy out what is there
+    if (stats != nullptr) {
+        struct rtnl_link_stats64 link_stats;
+        size_t length = RTA_PAYLOAD(stats);
+
+        memset(&link_stats, 0, sizeof(link_stats));
+        memcpy(&link_stats, RTA_DATA(stats),
+               length < sizeof(link_stats) ? length : sizeof(link_stats));
+
+        sample.rx_bytes = link_stats.rx_bytes;
+        sample.rx_dropped = link_stats.rx_dropped;
+        sample.rx_errors = link_stats.rx_errors;
+        sample.rx_packets = link_stats.rx_packets;
+        sample.tx_bytes = link_stats.tx_bytes;
+        sample.tx_dropped = link_stats.tx_dropped;
+        sample.tx_errors = link_stats.tx_errors;
+        sample.tx_packets = link_stats.tx_packets;
+    }
+
+    if (carrier_up != nullptr) {
+        uint32_t value;
+        memcpy(&value, RTA_DATA(carrier_up), sizeof(value));
+        sample.carrier_up_count = value;
+    }
+
+    if (carrier_down != nullptr) {
+        uint32_t value;
+        memcpy(&value, RTA_DATA(carrier_down), sizeof(value));
+        sample.carrier_down_count = value;
+    }
+
+    sample.timestamp_ns = monotonic_ns();
+
+    present[slot] = true;
+}
+
+// Asks for a dump and takes every reply until the kernel marks its end.
+// interrupted is set if links changed while it was being made, which can
+// leave some of them out
+bool NetlinkCollector::receive_dump(interface_information *samples, bool &interrupted)
+{
+    if (!send_dump_request()) {
+        return false;
+    }
+
+    bool done = false;
+
+    while (!done) {
+        ssize_t length = recv(netlink_socket, receive_buffer.data(),
+                              receive_buffer.size(), 0);
+
+        if (length == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // The peer has gone, no end of the dump will ever come
+        if (length == 0) {
+            errno = ECONNRESET;
+            return false;
+        }
+
+        for (const struct nlmsghdr *header = (const struct nlmsghdr *)receive_buffer.data();
+                NLMSG_OK(header, length);
+                header = NLMSG_NEXT(header, length)) {
+            // Skip anything left over from an earlier, interrupted dump
+            if (header->nlmsg_seq != sequence) {
+                continue;
+            }
+
+            if (header->nlmsg_flags & NLM_F_DUMP_INTR) {
+                interrupted = true;
+            }
+
+            if (header->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+
+            if (header->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *error = (const struct nlmsgerr *)NLMSG_DATA(header);
+                errno = -error->error;
+                return false;
+            }
+
+            if (header->nlmsg_type == RTM_NEWLINK) {
+                parse_link(header, samples);
+            }
+        }
+    }
+
+    return true;
+}
+
+int NetlinkCollector::collect(interface_information *samples)
+{
+    if (netlink_socket == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // A dump that links changed during is asked for again, and if they keep
+    // changing the pass fails rather than taking the links it missed as gone
+    for (int attempt = 1; ; attempt++) {
+        bool interrupted = false;
+
+        for (size_t slot = 0; slot < present.size(); slot++) {
+            present[slot] = false;
+        }
+
+        if (!receive_dump(samples, interrupted)) {
+            return -1;
+        }
+        if (!interrupted) {
+            break;
+        }
+        if (attempt == MAX_DUMP_ATTEMPTS) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    int found = 0;
+
+    for (size_t slot = 0; slot < present.size(); slot++) {
+        if (present[slot]) {
+            found++;
+        }
+    }
+
+    return found;
+}
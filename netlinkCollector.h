@@ -0,0 +1,62 @@
+//netlinkCollector.h - rtnetlink collector backend
+//
+// Sends a single RTM_GETLINK dump request over NETLINK_ROUTE per collect()
+// and picks the operstate, carrier counts and IFLA_STATS64 counters of every
+// tracked interface out of the reply, so the cost of a pass is one request
+// and its replies no matter how many interfaces or counters are tracked. A
+// dump the kernel marks as interrupted by link changes is asked for again
+
+#ifndef NETLINK_COLLECTOR_H
+#define NETLINK_COLLECTOR_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "collector.h"
+#include "interfaceInfo.h"
+
+class NetlinkCollector : public Collector
+{
+public:
+    NetlinkCollector();
+    ~NetlinkCollector();
+
+    NetlinkCollector(const NetlinkCollector &) = delete;
+    NetlinkCollector &operator=(const NetlinkCollector &) = delete;
+
+    // Opens and binds the netlink socket, returns false (with errno set) if
+    // the kernel refuses
+    bool open();
+
+    // Talks to the peer at the other end of an already connected datagram
+    // socket instead of the kernel, taking ownership of it. Lets a synthetic
+    // peer stand in for rtnetlink
+    void attach(int socket) { netlink_socket = socket; }
+
+    const char *name() const override { return "netlink"; }
+    int add_interface(const std::string &interface_name) override;
+    void remove_interface(int slot) override;
+    int collect(interface_information *samples) override;
+    bool is_present(int slot) const override { return present[slot]; }
+
+private:
+    bool send_dump_request();
+    bool receive_dump(interface_information *samples, bool &interrupted);
+    void parse_link(const struct nlmsghdr *header, interface_information *samples);
+
+    int netlink_socket;
+    uint32_t sequence;
+
+    // Replies are received into this buffer, sized to hold the largest
+    // datagram the kernel sends for a dump
+    std::vector<char> receive_buffer;
+
+    std::unordered_map<std::string, int> slots_by_name;
+    std::vector<std::string> names;
+    std::vector<bool> present;
+    std::vector<int> free_slots;
+};
+
+#endif
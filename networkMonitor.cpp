@@ -3,6 +3,7 @@
 // 31-Jul-20  D. Jonathan      Modified
 
 #include <fcntl.h>
+#include <climits>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -14,199 +15,1644 @@
 #include <sys/un.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
-#define SOCKET_PATH "/tmp/a1-socket"
-#define MAX_BUF     256
+#include "alertEngine.h"
+#include "childSupervisor.h"
+#include "collector.h"
+#include "counterRates.h"
+#include "eventLoop.h"
+#include "historyFile.h"
+#include "historyStore.h"
+#include "linkWatcher.h"
+#include "metricsExporter.h"
+#include "monitorConfig.h"
+#include "outputSink.h"
+#include "protocol.h"
+#include "queueStats.h"
+#include "recoveryScheduler.h"
+#include "sampleRing.h"
+#include "sampleTimer.h"
+#include "samplerThread.h"
+#include "selfStats.h"
+#include "topDisplay.h"
+
+#define MAX_BUF     MAX_MESSAGE
+
+// How often the sample rings are drained, often enough that a ring never
+// fills even at 100 samples per second
+#define RING_DRAIN_MS 100
+
+// How long the intfMonitors have to answer a Stats Request before the
+// stats are reported with whatever they answered
+#define CHILD_STATS_WAIT_MS 100
+
+// The options that only have a long name
+#define TOP_OPTION      256
+#define REFRESH_OPTION  257
 
 using namespace std;
 
+// The state kept for each connected intfMonitor
+struct Connection
+{
+    int fd;
+    // Index of the interface (in intf) the intfMonitor is monitoring, known
+    // once it reports Ready
+    int interface = -1;
+    // Splits the bytes received into messages
+    MessageDecoder decoder;
+    // Bytes the socket has not accepted yet
+    string output;
+    // Descriptors received but not yet claimed by a Ring message
+    deque<int> passedFds;
+    // The shared-memory ring the intfMonitor pushes its samples into, once
+    // it has sent one (-r)
+    unique_ptr<SampleRing> ring;
+};
+
 // Socket variables
-int master_fd, max_fd, rc;
-fd_set active_fd_set;
-fd_set read_fd_set;
-int ret;
-int MAX_CLIENTS, numClients=0;
-int *clients;
+int master_fd = -1;
+int numClients=0;
+// Every open connection in the order the intfMonitors connected, and the
+// connection of each interface (indexed like intf) once it is Ready
+vector<unique_ptr<Connection>> connections;
+vector<Connection *> interfaceConnections;
+
+// Waits on every descriptor, SIGINT arrives through signal_fd
+EventLoop eventLoop;
+int signal_fd = -1;
+
+// I/O variables
+char buffer[MAX_BUF];
+
+// User input variables
+int numOfInterfaces;
+vector<string> intf;
+
+// Every interface ever monitored keeps its index in intf, and in each table
+// indexed like it, for as long as the monitor runs. One that is removed is
+// only marked inactive, and takes its old index again if it comes back
+unordered_map<string, int> interfaceIndexes;
+vector<bool> activeInterfaces;
+
+// The intfMonitor processes are watched through pidfds, restarted when they
+// exit unasked and all stopped together against one deadline on shutdown
+ChildSupervisor supervisor(eventLoop);
+bool shuttingDown = false;
+sigset_t startingSignals;
+
+// The running settings, read from the configuration file (-f) and then the
+// command line, which overrides it. SIGHUP reads both again
+monitor_config config;
+string configPath;
+vector<config_setting> commandLineSettings;
+
+// The intfMonitor program started for each interface with -i
+string intfMonitorProgram;
+
+// While discovering, links being created and deleted are followed
+LinkWatcher linkWatcher;
+
+// Where samples and statuses are reported, in the configured format
+OutputSink *output = nullptr;
+
+// Turns each interface's samples (indexed like intf) into rates
+vector<RateCalculator> rateCalculators;
+
+// The rates of every interface over the last day, sized for the sampling
+// interval once the options are known
+HistoryStore history;
+
+// Writes every sample to disk when a history directory is configured.
+// historyFiles (indexed like intf) holds each interface's index in the
+// writer, -1 when its files could not be opened and it is not recorded
+HistoryWriter *historyWriter = nullptr;
+vector<int> historyFiles;
+
+// Serves every interface's latest sample to Prometheus when a port is
+// configured
+MetricsExporter *metrics = nullptr;
+
+// Unless each interface is monitored by its own intfMonitor process (-i), a
+// single in-process sampler thread monitors all of them
+SamplerThread *sampler = nullptr;
+
+// With rings the intfMonitors' samples are drained every time ring_timer_fd
+// fires. ringsDropped counts the samples they had no room for, added up as
+// each ring is let go
+int ring_timer_fd = -1;
+uint64_t ringsDropped = 0;
+
+// What the monitor costs itself, reported on SIGUSR1 and every time
+// stats_timer_fd fires. linkDownAt (indexed like intf) holds when each
+// interface's link went down, until a sample shows it up again after its
+// monitor reported Link Up, which linkSetUp marks. With intfMonitors
+// each of them is asked for its own first, and the report is made once
+// child_stats_timer_fd fires
+SelfStats selfStats;
+int stats_timer_fd = -1;
+int child_stats_timer_fd = -1;
+vector<uint64_t> linkDownAt;
+vector<bool> linkSetUp;
+
+// Links that went down are set up again in batches, on every tick of
+// recovery_timer_fd while any recovery is scheduled
+RecoveryScheduler recovery;
+int recovery_timer_fd = -1;
+vector<int> dueRecoveries;
+
+// Every sample's rates are checked against the configured alert rules
+AlertEngine alerts;
+
+// Each interface's queues (indexed like intf) and every CPU's softnet
+// counters are rated every time queue_timer_fd fires, to show traffic piling
+// onto one queue or CPU. It reads the sysfs root and the softnet_stat beside
+// the configured /proc/net/dev, so it is made once the config is loaded
+QueueStats *queueStats = nullptr;
+int queue_timer_fd = -1;
+
+// With --top the terminal shows a live table of every interface (indexed
+// like intf) in place of the reports, redrawn every time top_timer_fd fires
+TopDisplay topDisplay;
+int terminal_fd = -1;
+int top_timer_fd = -1;
+
+void getUserInput();
+bool loadSettings(monitor_config &loaded, string &error);
+void reloadConfig();
+void startStatsTimer();
+void startQueueStatsTimer();
+void handleQueueStatsTimer(uint32_t events);
+void handleStatsTimer(uint32_t events);
+void reportStats();
+void handleChildStatsTimer(uint32_t events);
+void writeStats();
+bool startTop();
+void startTopTimer();
+void handleTopTimer(uint32_t events);
+void handleTopInput(uint32_t events);
+void applyAlertRules(const monitor_config &loaded);
+void armRecoveryTimer();
+void handleRecoveryTimer(uint32_t events);
+string findIntfMonitor();
+bool watchLinks();
+void applyInterfaces();
+bool configuredInterface(const string &name);
+bool wantedInterface(const string &name);
+void addInterface(const string &name);
+void removeInterface(const string &name);
+void startMonitor(int interface);
+void handleChildExit(int interface, int status);
+void restartMonitor(int interface);
+void discoverInterfaces();
+void handleLinkChanges(uint32_t events);
+void clean_up();
+int createAndBindSocket();
+void acceptConnections();
+void acceptNewConnections(uint32_t events);
+void serviceConnection(Connection *connection, uint32_t events);
+void closeConnection(Connection *connection);
+void handleSignals(uint32_t events);
+void handleSamplerEvents(uint32_t events);
+void handleRingTimer(uint32_t events);
+void drainRing(Connection *connection);
+void attachRing(Connection *connection);
+void handleMessage(Connection *connection, const message_header &header, const char *payload);
+void handleStatus(int interface, uint16_t status);
+void reportStatus(int interface, const char *status);
+void handleSample(int interface, const interface_information &info,
+                  const interface_rates *rates = nullptr);
+void sendCommand(int interface, message_type command);
+int write_message(uint16_t type, int interface, Connection *connection);
+int flushOutput(Connection *connection);
+bool receiveAvailable(Connection *connection);
+bool read_message(Connection *connection, message_header &header, const char *&payload);
+
+int main(int argc, char *argv[])
+{
+    sigset_t signals;
+    sigset_t originalSignals;
+
+    // Block SIGINT, SIGHUP, SIGUSR1 and SIGWINCH and receive them through a
+    // signalfd instead, so ctrl+c, a reload, a stats request and a resized
+    // terminal are just more events for the event loop to handle
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &signals, &originalSignals);
+
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signal_fd == -1 || !eventLoop.open()) {
+        cout << "server: " << strerror(errno) << endl;
+        return -1;
+    }
+    eventLoop.add(signal_fd, EPOLLIN, handleSignals);
+
+    // Parse the options, each one is kept as the setting it stands for so
+    // that it still overrides the configuration file when that is reloaded.
+    // The interfaces to monitor follow the options
+    const struct option longOptions[] = {
+        {"top", no_argument, NULL, TOP_OPTION},
+        {"refresh", required_argument, NULL, REFRESH_OPTION},
+        {NULL, 0, NULL, 0},
+    };
+    monitor_config checked;
+    string error;
+    int option;
+    while((option = getopt_long(argc, argv, "f:b:irt:c:p:H:S:o:m:aI:X:s:e:nT:d:P:A:W:Q:", longOptions, NULL)) != -1) {
+        config_setting setting;
+
+        switch(option) {
+            case 'f': configPath = optarg; continue;
+            case 'b': setting = {"backend", optarg}; break;
+            case 'i': setting = {"isolate", "yes"}; break;
+            case 'r': setting = {"rings", "yes"}; break;
+            case 't': setting = {"interval", optarg}; break;
+            case 'c': setting = {"cpu", optarg}; break;
+            case 'p': setting = {"priority", optarg}; break;
+            case 'H': setting = {"history", optarg}; break;
+            case 'S': setting = {"history_sync", optarg}; break;
+            case 'o': setting = {"output", optarg}; break;
+            case 'm': setting = {"metrics_port", optarg}; break;
+            case 'a': setting = {"discover", "yes"}; break;
+            case 'I': setting = {"include", optarg}; break;
+            case 'X': setting = {"exclude", optarg}; break;
+            case 's': setting = {"socket", optarg}; break;
+            case 'e': setting = {"intf_monitor", optarg}; break;
+            case 'n': setting = {"recovery", "no"}; break;
+            case 'T': setting = {"stats_interval", optarg}; break;
+            case 'd': setting = {"sysfs_root", optarg}; break;
+            case 'P': setting = {"proc_net_dev", optarg}; break;
+            case 'A': setting = {"alert", optarg}; break;
+            case 'W': setting = {"alert_window", optarg}; break;
+            case 'Q': setting = {"queue_stats_interval", optarg}; break;
+            case TOP_OPTION: setting = {"top", "yes"}; break;
+            case REFRESH_OPTION: setting = {"top_refresh", optarg}; break;
+            default: setting = {"", ""}; break;
+        }
+
+        if(!apply_setting(checked, setting, error)) {
+            if(!setting.first.empty()) {
+                cout << "server: " << error << endl;
+            }
+            cout << "usage: networkMonitor [-f file] [-b sysfs|netlink|procfs] [-d directory] [-P file] [-i [-r] [-s socket] [-e intfMonitor]]"
+                 << " [-t ms] [-c cpu] [-p priority] [-H directory [-S seconds]] [-o text|json|csv]"
+                 << " [-m port] [-a [-I pattern]... [-X pattern]...] [-n] [-T seconds] [-A rule]... [-W ms] [-Q seconds] [--top [--refresh ms]] [interface]..." << endl;
+            return -1;
+        }
+        commandLineSettings.push_back(setting);
+    }
+    for(int i = optind; i < argc; i++) {
+        commandLineSettings.push_back({"interface", argv[i]});
+    }
+
+    if(!loadSettings(config, error)) {
+        cout << "server: " << error << endl;
+        return -1;
+    }
+
+    // The table is drawn on the terminal and sorted from its keyboard, which
+    // leaves no one to ask for the interfaces
+    if(config.top && (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))) {
+        cout << "server: --top needs a terminal" << endl;
+        return -1;
+    }
+    if(config.top && configPath.empty() && config.interfaces.empty() && !config.discover) {
+        cout << "server: --top needs interfaces to monitor, or -a" << endl;
+        return -1;
+    }
+
+    history = HistoryStore(config.schedule.interval_ms);
+    recovery.set_policy(config.recovery);
+    alerts.set_rules(config.alert_rules, config.alert_window_ms);
+
+    std::string procNetDirectory = config.proc_net_dev.substr(0, config.proc_net_dev.rfind('/') + 1);
+    queueStats = new QueueStats(config.sysfs_root, procNetDirectory + "softnet_stat");
+
+    recovery_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(recovery_timer_fd == -1) {
+        cout << "server: unable to start the recovery timer: " << strerror(errno) << endl;
+        return -1;
+    }
+    eventLoop.add(recovery_timer_fd, EPOLLIN, handleRecoveryTimer);
+
+    // Reports are only formatted into memory as they arrive, the sink's own
+    // thread writes them out
+    output = new OutputSink(STDOUT_FILENO, config.format);
+    output->start();
+
+    if(config.metrics_port != 0) {
+        metrics = new MetricsExporter(eventLoop);
+        metrics->serve_history(&history);
+        if(!metrics->open(config.metrics_port)) {
+            cout << "server: unable to serve metrics on port " << config.metrics_port << ": "
+                 << strerror(errno) << endl;
+            return -1;
+        }
+    }
+
+    // Samples are only encoded in memory as they arrive, the writer's own
+    // thread puts them on disk
+    if(!config.history_directory.empty()) {
+        historyWriter = new HistoryWriter(config.history_directory, config.history_sync_seconds);
+        historyWriter->start();
+    }
+
+    // Forked intfMonitors get back the signal mask we started with
+    startingSignals = originalSignals;
+
+    if(!config.isolate_processes) {
+        // In-process mode, one sampler thread monitors every interface and
+        // reports back through its event descriptor instead of a socket
+        sampler = new SamplerThread(create_collector(config.backend, config.sysfs_root, config.proc_net_dev), config.schedule, &selfStats);
+    }
+    else {
+        intfMonitorProgram = findIntfMonitor();
+
+        supervisor.set_policy(config.restart);
+        supervisor.set_handlers(handleChildExit, restartMonitor);
+        if(!supervisor.open()) {
+            cout << "server: unable to start the child supervisor: " << strerror(errno) << endl;
+            return -1;
+        }
+
+        // Set master file descriptor to server socket listening for new connections
+        master_fd = createAndBindSocket();
+        eventLoop.add(master_fd, EPOLLIN, acceptNewConnections);
+
+        // With rings the samples no longer wake us, they are collected on a
+        // timer of our own
+        if(config.use_rings) {
+            struct itimerspec interval;
+            memset(&interval, 0, sizeof(interval));
+            interval.it_interval.tv_nsec = RING_DRAIN_MS * 1000000L;
+            interval.it_value = interval.it_interval;
+
+            ring_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if(ring_timer_fd == -1 || timerfd_settime(ring_timer_fd, 0, &interval, NULL) == -1) {
+                cout << "server: unable to start the ring timer: " << strerror(errno) << endl;
+                return -1;
+            }
+            eventLoop.add(ring_timer_fd, EPOLLIN, handleRingTimer);
+        }
+    }
+
+    startStatsTimer();
+    startQueueStatsTimer();
+
+    if(config.top && !startTop()) {
+        return -1;
+    }
+
+    // Monitor the configured interfaces, only asking for them when nothing
+    // was configured at all
+    if(config.discover && !watchLinks()) {
+        return -1;
+    }
+
+    if(configPath.empty() && config.interfaces.empty() && !config.discover) {
+        getUserInput();
+    }
+    else {
+        applyInterfaces();
+    }
+
+    cout << "Keeping " << history.memory_per_interface() / 1024
+         << " KB of history per interface" << endl;
+
+    if(sampler != nullptr) {
+        if(!sampler->start()) {
+            cout << "server: unable to start the sampler: " << strerror(errno) << endl;
+            return -1;
+        }
+        eventLoop.add(sampler->event_fd(), EPOLLIN, handleSamplerEvents);
+    }
+
+    acceptConnections();
+
+    return 0;
+}
+
+// Reads the configuration file, if there is one, and then the settings
+// given on the command line
+bool loadSettings(monitor_config &loaded, string &error)
+{
+    if(!configPath.empty() && !load_config(configPath, loaded, error)) {
+        return false;
+    }
+
+    for(const config_setting &setting : commandLineSettings) {
+        if(!apply_setting(loaded, setting, error)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Reads the configuration again on SIGHUP and applies what can change
+// without a restart. Only the interfaces that are no longer configured are
+// stopped and only the new ones started, the rest carry on undisturbed
+void reloadConfig()
+{
+    monitor_config reloaded;
+    string error;
+
+    if(configPath.empty()) {
+        cout << "server: no configuration file to reload" << endl;
+        return;
+    }
+
+    if(!loadSettings(reloaded, error)) {
+        cout << "server: keeping the running configuration: " << error << endl;
+        return;
+    }
+
+    if(needs_restart(config, reloaded)) {
+        cout << "server: only the interfaces, recovery, restarts, alerts, stats intervals and --top refresh are reloaded, "
+             << "the other changes take a restart" << endl;
+    }
+
+    config.interfaces = reloaded.interfaces;
+    config.discover = reloaded.discover;
+    config.include_patterns = reloaded.include_patterns;
+    config.exclude_patterns = reloaded.exclude_patterns;
+    config.recover_links = reloaded.recover_links;
+    config.recovery = reloaded.recovery;
+    recovery.set_policy(config.recovery);
+    config.restart = reloaded.restart;
+    supervisor.set_policy(config.restart);
+
+    if(!config.recover_links) {
+        recovery.cancel_all();
+        armRecoveryTimer();
+    }
+
+    applyAlertRules(reloaded);
+
+    if(config.stats_interval_seconds != reloaded.stats_interval_seconds) {
+        config.stats_interval_seconds = reloaded.stats_interval_seconds;
+        startStatsTimer();
+    }
+
+    if(config.queue_stats_interval_seconds != reloaded.queue_stats_interval_seconds) {
+        config.queue_stats_interval_seconds = reloaded.queue_stats_interval_seconds;
+        startQueueStatsTimer();
+    }
+
+    if(config.top_refresh_ms != reloaded.top_refresh_ms) {
+        config.top_refresh_ms = reloaded.top_refresh_ms;
+        startTopTimer();
+    }
+
+    if(config.discover && !watchLinks()) {
+        config.discover = false;
+    }
+
+    applyInterfaces();
+
+    cout << "server: reloaded " << configPath << endl;
+}
+
+// Reports the monitor's own stats every stats_interval seconds, or stops
+// reporting them when it is 0
+void startStatsTimer()
+{
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_interval.tv_sec = config.stats_interval_seconds;
+    interval.it_value = interval.it_interval;
+
+    if(stats_timer_fd == -1) {
+        if(config.stats_interval_seconds == 0) {
+            return;
+        }
+
+        stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(stats_timer_fd == -1) {
+            cout << "server: unable to start the stats timer: " << strerror(errno) << endl;
+            return;
+        }
+        eventLoop.add(stats_timer_fd, EPOLLIN, handleStatsTimer);
+    }
+
+    // An interval of 0 disarms the timer
+    timerfd_settime(stats_timer_fd, 0, &interval, NULL);
+}
+
+void handleStatsTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    while (read(stats_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+        reportStats();
+    }
+}
+
+// Rates every interface's queues and every CPU's softnet counters each
+// queue_stats_interval seconds, or stops when it is 0
+void startQueueStatsTimer()
+{
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_interval.tv_sec = config.queue_stats_interval_seconds;
+    interval.it_value = interval.it_interval;
+
+    if(queue_timer_fd == -1) {
+        if(config.queue_stats_interval_seconds == 0) {
+            return;
+        }
+
+        queue_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(queue_timer_fd == -1) {
+            cout << "server: unable to start the queue stats timer: " << strerror(errno) << endl;
+            return;
+        }
+        eventLoop.add(queue_timer_fd, EPOLLIN, handleQueueStatsTimer);
+    }
+
+    // An interval of 0 disarms the timer
+    timerfd_settime(queue_timer_fd, 0, &interval, NULL);
+}
+
+// Reports the queues of every interface whose driver counts per queue, the
+// first pass only gives the counters a starting point
+void handleQueueStatsTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    while (read(queue_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+    }
+
+    for(size_t i = 0; i < intf.size(); i++) {
+        if(activeInterfaces[i] && queueStats->collect(i)) {
+            queueStats->report(i, *output);
+        }
+    }
+
+    if(queueStats->collect_softnet()) {
+        queueStats->report_softnet(*output);
+    }
+}
+
+// Asks every intfMonitor what it has cost so far, and reports once they
+// have had CHILD_STATS_WAIT_MS to answer. In-process there is no one to ask
+void reportStats()
+{
+    if(!config.isolate_processes) {
+        writeStats();
+        return;
+    }
+
+    for(size_t i = 0; i < intf.size(); i++) {
+        if(activeInterfaces[i]) {
+            sendCommand(i, MSG_STATS_REQUEST);
+        }
+    }
+
+    if(child_stats_timer_fd == -1) {
+        child_stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(child_stats_timer_fd == -1) {
+            cout << "server: unable to wait for the intfMonitors' stats: " << strerror(errno) << endl;
+            writeStats();
+            return;
+        }
+        eventLoop.add(child_stats_timer_fd, EPOLLIN, handleChildStatsTimer);
+    }
+
+    // A report already waiting takes the answers to this request too
+    struct itimerspec wait;
+    memset(&wait, 0, sizeof(wait));
+    timerfd_gettime(child_stats_timer_fd, &wait);
+    if(wait.it_value.tv_sec == 0 && wait.it_value.tv_nsec == 0) {
+        wait.it_value.tv_nsec = CHILD_STATS_WAIT_MS * 1000000L;
+        timerfd_settime(child_stats_timer_fd, 0, &wait, NULL);
+    }
+}
+
+void handleChildStatsTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    if(read(child_stats_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        writeStats();
+    }
+}
+
+// Reports what the monitor and the intfMonitors cost, how link recovery has
+// gone, how many alerts have fired and, with intfMonitors, how they have
+// fared
+void writeStats()
+{
+    selfStats.report(*output);
+    recovery.report(*output);
+    alerts.report(*output);
+
+    if(config.isolate_processes) {
+        supervisor.report(*output);
+    }
+}
+
+// Takes over the terminal for the table. Everything that would have been
+// printed on it goes to /dev/null instead, the reports and the intfMonitors'
+// output alike, as anything written over the table would stay there until
+// the cells under it change
+bool startTop()
+{
+    terminal_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    cout.flush();
+    if(terminal_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+        cout << "server: unable to take over the terminal: " << strerror(errno) << endl;
+        return false;
+    }
+    close(null_fd);
+
+    if(!topDisplay.open(terminal_fd, STDIN_FILENO) || !eventLoop.add(STDIN_FILENO, EPOLLIN, handleTopInput)) {
+        int error = errno;
+
+        topDisplay.close();
+        dup2(terminal_fd, STDOUT_FILENO);
+        close(terminal_fd);
+        terminal_fd = -1;
+        cout << "server: unable to take over the terminal: " << strerror(error) << endl;
+        return false;
+    }
+
+    startTopTimer();
+
+    return true;
+}
+
+// Redraws the table every top_refresh milliseconds, however often the
+// interfaces are sampled
+void startTopTimer()
+{
+    if(!config.top) {
+        return;
+    }
+
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_interval.tv_sec = config.top_refresh_ms / 1000;
+    interval.it_interval.tv_nsec = config.top_refresh_ms % 1000 * 1000000L;
+    interval.it_value = interval.it_interval;
+
+    if(top_timer_fd == -1) {
+        top_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(top_timer_fd == -1) {
+            return;
+        }
+        eventLoop.add(top_timer_fd, EPOLLIN, handleTopTimer);
+    }
+
+    timerfd_settime(top_timer_fd, 0, &interval, NULL);
+}
+
+// Draws a frame, however many refreshes were missed it is only one
+void handleTopTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    while (read(top_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+    }
+
+    topDisplay.render();
+}
+
+// Sorts and scrolls the table, and quitting it is a ctrl+c
+void handleTopInput(uint32_t events)
+{
+    if(topDisplay.handle_input()) {
+        topDisplay.render();
+    }
+    else if(shuttingDown) {
+        supervisor.escalate();
+    }
+    else {
+        eventLoop.stop();
+    }
+}
+
+// Takes reloaded alert rules. Changing them starts every alert over, so
+// rules that are still the same are left running
+void applyAlertRules(const monitor_config &loaded)
+{
+    bool same = config.alert_window_ms == loaded.alert_window_ms &&
+                config.alert_rules.size() == loaded.alert_rules.size();
+
+    for(size_t i = 0; same && i < loaded.alert_rules.size(); i++) {
+        same = config.alert_rules[i].text == loaded.alert_rules[i].text;
+    }
+
+    if(same) {
+        return;
+    }
+
+    config.alert_rules = loaded.alert_rules;
+    config.alert_window_ms = loaded.alert_window_ms;
+    alerts.set_rules(config.alert_rules, config.alert_window_ms);
+}
+
+// Ticks the recovery timer while recoveries are scheduled
+void armRecoveryTimer()
+{
+    tick_while_needed(recovery_timer_fd, RecoveryScheduler::TICK_MS, recovery.pending());
+}
+
+// Sets up every link whose recovery is due, a batch at a time. Each one is
+// told to set the link up and monitor it again, as an intfMonitor would be
+void handleRecoveryTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    if(read(recovery_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    recovery.take_due(monotonic_ns(), dueRecoveries);
+
+    for(int interface : dueRecoveries) {
+        if(activeInterfaces.at(interface) && config.recover_links) {
+            sendCommand(interface, MSG_SET_LINK_UP);
+            sendCommand(interface, MSG_MONITOR);
+        }
+    }
+
+    armRecoveryTimer();
+}
+
+// The intfMonitor program, the configured one or else the one installed
+// next to the network monitor, wherever it was started from
+string findIntfMonitor()
+{
+    if(!config.intf_monitor_path.empty()) {
+        return config.intf_monitor_path;
+    }
+
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+    if(length == -1) {
+        return "./intfMonitor";
+    }
+
+    string program(path, length);
+    return program.substr(0, program.rfind('/') + 1) + "intfMonitor";
+}
+
+// Starts following links being created and deleted, if not already
+bool watchLinks()
+{
+    if(linkWatcher.fd() != -1) {
+        return true;
+    }
+
+    if(!linkWatcher.open()) {
+        cout << "server: unable to watch links: " << strerror(errno) << endl;
+        return false;
+    }
+    eventLoop.add(linkWatcher.fd(), EPOLLIN, handleLinkChanges);
+
+    return true;
+}
+
+// Brings the monitored interfaces in line with the configuration, removing
+// the ones no longer configured and adding the new ones
+void applyInterfaces()
+{
+    for(size_t i = 0; i < intf.size(); i++) {
+        if(activeInterfaces[i] && !configuredInterface(intf[i])) {
+            removeInterface(intf[i]);
+        }
+    }
+
+    for(const string &name : config.interfaces) {
+        addInterface(name);
+    }
+
+    if(config.discover) {
+        discoverInterfaces();
+    }
+}
+
+// Whether an interface is to be monitored, because it is named or because
+// it exists and is discovered
+bool configuredInterface(const string &name)
+{
+    for(const string &configured : config.interfaces) {
+        if(configured == name) {
+            return true;
+        }
+    }
+
+    return config.discover && wantedInterface(name) &&
+           access((config.sysfs_root + name).c_str(), F_OK) == 0;
+}
+
+// Whether an interface name passes the include (-I) and exclude (-X)
+// patterns. With no include patterns everything is included
+bool wantedInterface(const string &name)
+{
+    bool included = config.include_patterns.empty();
+
+    for(const string &pattern : config.include_patterns) {
+        if(fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+            included = true;
+            break;
+        }
+    }
+
+    for(const string &pattern : config.exclude_patterns) {
+        if(fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+            return false;
+        }
+    }
+
+    return included;
+}
+
+// Starts monitoring an interface, or resumes one that was removed and has
+// come back under the same name. Every per-interface table only ever grows
+// at the end, so the interfaces already being monitored keep their index
+// and are not disturbed
+void addInterface(const string &name)
+{
+    auto known = interfaceIndexes.find(name);
+
+    if(known != interfaceIndexes.end()) {
+        int interface = known->second;
+
+        if(!activeInterfaces.at(interface)) {
+            activeInterfaces.at(interface) = true;
+            topDisplay.add_interface(interface, name);
+            if(metrics != nullptr) {
+                metrics->add_interface(name);
+            }
+            reportStatus(interface, "Added");
+
+            // The sampler tracks it again under its old index and reports
+            // it Ready by itself
+            if(sampler != nullptr) {
+                sampler->add_interface(name);
+            }
+            else {
+                startMonitor(interface);
+            }
+        }
+        return;
+    }
+
+    int interface = intf.size();
+
+    intf.push_back(name);
+    interfaceIndexes[name] = interface;
+    activeInterfaces.push_back(true);
+    linkDownAt.push_back(0);
+    linkSetUp.push_back(false);
+    recovery.add_interface(interface);
+    alerts.add_interface(interface);
+    queueStats->add_interface(name);
+    topDisplay.add_interface(interface, name);
+    interfaceConnections.push_back(nullptr);
+    rateCalculators.emplace_back();
+    history.add_interface(name);
+
+    if(metrics != nullptr) {
+        metrics->add_interface(name);
+    }
+
+    historyFiles.push_back(historyWriter != nullptr ? historyWriter->add_interface(name) : -1);
+    if(historyWriter != nullptr && historyFiles.back() == -1) {
+        cout << "server: unable to open the history of " << name << ": "
+             << strerror(errno) << endl;
+    }
+
+    if(sampler != nullptr) {
+        sampler->add_interface(name);
+    }
+
+    reportStatus(interface, "Added");
+
+    // The sampler reports a new interface Ready by itself
+    if(sampler == nullptr) {
+        startMonitor(interface);
+    }
+}
+
+// Stops monitoring an interface that has gone away, its index and history
+// are kept in case it comes back
+void removeInterface(const string &name)
+{
+    auto known = interfaceIndexes.find(name);
+
+    if(known == interfaceIndexes.end() || !activeInterfaces.at(known->second)) {
+        return;
+    }
+
+    int interface = known->second;
+
+    activeInterfaces.at(interface) = false;
+    rateCalculators.at(interface).clear();
+    linkDownAt.at(interface) = 0;
+    linkSetUp.at(interface) = false;
+    recovery.cancel(interface);
+    armRecoveryTimer();
+    alerts.clear_interface(interface);
+    queueStats->clear(interface);
+    topDisplay.remove_interface(interface);
+    if(metrics != nullptr) {
+        metrics->remove_interface(interface);
+    }
+    reportStatus(interface, "Removed");
+
+    // The sampler gives up the interface's slot and reports Done, an
+    // intfMonitor answers with Done and exits, and is not restarted
+    if(sampler != nullptr) {
+        sampler->remove_interface(interface);
+    }
+    else {
+        supervisor.expect_exit(interface);
+        sendCommand(interface, MSG_SHUT_DOWN);
+    }
+}
+
+// Gets an interface monitored: in-process the sampler already tracks it and
+// is as good as Ready, otherwise an intfMonitor is started for it
+void startMonitor(int interface)
+{
+    if(sampler != nullptr) {
+        handleStatus(interface, MSG_READY);
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        // The intfMonitor handles SIGINT itself, give it back the
+        // signal mask we started with
+        sigprocmask(SIG_SETMASK, &startingSignals, NULL);
+        // Each intfMonitor identifies itself by its index in intf
+        string id = to_string(interface);
+        string interval = to_string(config.schedule.interval_ms);
+        string cpu = to_string(config.schedule.cpu);
+        string priority = to_string(config.schedule.fifo_priority);
+        vector<const char *> args = {intfMonitorProgram.c_str(), "-b", config.backend_name.c_str(),
+                                     "-n", id.c_str(), "-t", interval.c_str(),
+                                     "-c", cpu.c_str(), "-p", priority.c_str(),
+                                     "-s", config.socket_path.c_str(),
+                                     "-d", config.sysfs_root.c_str(),
+                                     "-P", config.proc_net_dev.c_str()};
+        if(config.use_rings) args.push_back("-r");
+        args.push_back(intf.at(interface).c_str());
+        args.push_back(NULL);
+        execvp(args[0], (char *const *)args.data());
+        cout << "child:main: pid:"<<getpid()<<" I should not get here!"<<endl;
+        cout<<strerror(errno)<<endl;
+        _exit(-1);
+    }
+
+    if(pid == -1) {
+        cout << "server: unable to start an intfMonitor for " << intf.at(interface)
+             << ": " << strerror(errno) << endl;
+        return;
+    }
+
+    // Without a pidfd the supervisor checks on it every tick instead
+    supervisor.watch(interface, pid);
+}
+
+// Reports an intfMonitor that exited without being told to, the supervisor
+// starts it again after a backoff
+void handleChildExit(int interface, int status)
+{
+    bool crashed = WIFSIGNALED(status) || WEXITSTATUS(status) != 0;
+
+    reportStatus(interface, crashed ? "Monitor Crashed" : "Monitor Exited");
+}
+
+// Starts again the intfMonitor of an interface that is still wanted
+void restartMonitor(int interface)
+{
+    if(shuttingDown || !activeInterfaces.at(interface)) {
+        return;
+    }
+
+    reportStatus(interface, "Monitor Restarted");
+    startMonitor(interface);
+}
+
+// Adds every interface under the sysfs root that passes the filters
+void discoverInterfaces()
+{
+    DIR *directory = opendir(config.sysfs_root.c_str());
+
+    if(directory == NULL) {
+        cout << "server: unable to list interfaces: " << strerror(errno) << endl;
+        return;
+    }
+
+    struct dirent *entry;
+    while((entry = readdir(directory)) != NULL) {
+        if(entry->d_name[0] != '.' && wantedInterface(entry->d_name)) {
+            addInterface(entry->d_name);
+        }
+    }
+
+    closedir(directory);
+}
+
+// Follows links being created and deleted while discovering
+void handleLinkChanges(uint32_t events)
+{
+    link_change change;
+
+    // Once discovery is turned off by a reload changes are only drained
+    while(linkWatcher.next_change(change)) {
+        if(!config.discover || change.name[0] == '\0' || !wantedInterface(change.name)) {
+            continue;
+        }
+
+        if(change.removed) {
+            removeInterface(change.name);
+        }
+        else {
+            addInterface(change.name);
+        }
+    }
+
+    // Changes were lost, catch up by looking at which interfaces exist now
+    if(linkWatcher.overflowed() && config.discover) {
+        for(size_t i = 0; i < intf.size(); i++) {
+            if(activeInterfaces[i] && access((config.sysfs_root + intf[i]).c_str(), F_OK) == -1) {
+                removeInterface(intf[i]);
+            }
+        }
+        discoverInterfaces();
+    }
+}
+
+// Services the interface monitors until SIGINT, then cleans up
+void acceptConnections()
+{
+    // Dispatches every ready descriptor to its handler, returns once a
+    // SIGINT has been received
+    eventLoop.run();
+
+    // This line executes when the Network Monitor has received a ctrl+c
+    // which stops the event loop
+    clean_up();
+}
+
+// Accepts every pending connection from an intfMonitor
+void acceptNewConnections(uint32_t events)
+{
+    // Edge-triggered, so keep accepting until there are none left
+    while(true)
+    {
+        int fd = accept4(master_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                cout << "server 2: " << strerror(errno) << endl;
+            }
+            break;
+        }
+
+        // Which interface the connection belongs to is learnt from its
+        // Ready message
+        Connection *connection = new Connection();
+        connection->fd = fd;
+        connections.push_back(unique_ptr<Connection>(connection));
+
+        // Add the new connection to the event loop
+        eventLoop.add(fd, EPOLLIN | EPOLLRDHUP, [connection](uint32_t events) {
+            serviceConnection(connection, events);
+        });
+
+        ++numClients;
+    }
+}
+
+// Handles data arriving on, or room to send on, an already-connected socket
+void serviceConnection(Connection *connection, uint32_t events)
+{
+    if (events & EPOLLOUT)
+    {
+        flushOutput(connection);
+    }
 
-// I/O variables
-string message;
-char buffer[MAX_BUF];
-int len;
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        bool open = receiveAvailable(connection);
+        message_header header;
+        const char *payload;
 
-// Global boolean flags
-bool isRunning = true;
-bool isParent = true;
+        // Handle every whole message that arrived
+        while (read_message(connection, header, payload))
+        {
+            handleMessage(connection, header, payload);
+        }
 
-// User input variables
-int numOfInterfaces;
-vector<string> intf;
+        if (connection->decoder.failed())
+        {
+            cout << "server: malformed message, dropping connection" << endl;
+            open = false;
+        }
 
-pid_t *childPid = nullptr;
+        if (!open)
+        {
+            // A monitor that was replaced, when its interface was added
+            // again or its monitor restarted, can close after the new one
+            // is Ready, and must not take the new one's place with it
+            int interface = connection->interface;
+            bool current = interface != -1 && interfaceConnections.at(interface) == connection;
+            if (current)
+            {
+                reportStatus(interface, "connection closed");
+            }
+            closeConnection(connection);
+            if (current)
+            {
+                interfaceConnections.at(interface) = nullptr;
+            }
 
-void getUserInput();
-void clean_up();
-int createAndBindSocket();
-void acceptConnections();
-int write_message(std::string message, int clientSocket);
-std::string read_message(int clientSocket);
-static void signalHandler(int signum);
+            // Nothing refers to it any more, connection is gone after this
+            for (auto it = connections.begin(); it != connections.end(); ++it)
+            {
+                if (it->get() == connection)
+                {
+                    connections.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+}
 
-int main()
+// Stops watching and closes a connection
+void closeConnection(Connection *connection)
 {
-    struct sigaction action;
+    if (connection->fd == -1) return;
 
-    bool should_continue = true;
+    // Report whatever the intfMonitor pushed before it went away
+    drainRing(connection);
+    if (connection->ring)
+    {
+        ringsDropped += connection->ring->dropped();
+    }
+    connection->ring.reset();
 
-    // Populate the sigaction struct's members for the handler and the mask
-    action.sa_handler = signalHandler;
-    sigemptyset(&(action.sa_mask));
-    action.sa_flags = 0;
-    sigaction(SIGINT, &action, NULL);
+    if (connection->interface != -1 &&
+        interfaceConnections.at(connection->interface) == connection)
+    {
+        selfStats.forget_child(connection->interface);
+    }
 
-    // Retrieve number of interfaces and their names
-    getUserInput();
+    for (int fd : connection->passedFds)
+    {
+        close(fd);
+    }
+    connection->passedFds.clear();
 
-    // Set master file descriptor to server socket listening for new connections
-    master_fd = createAndBindSocket();
+    eventLoop.remove(connection->fd);
+    close(connection->fd);
+    connection->fd = -1;
+}
 
-    // Based on user input create child intfMonitor processes
-    for(int i=0; i < numOfInterfaces & isParent; i++) {
-        childPid[i] = fork();
+// Reads the blocked signals waiting on signal_fd, SIGINT stops the loop, and
+// while shutting down hurries the intfMonitors along
+void handleSignals(uint32_t events)
+{
+    struct signalfd_siginfo info;
 
-        if(childPid[i]==0) {
-            isParent = false; 
-            execlp("./intfMonitor", "./intfMonitor", intf.at(i).c_str(), NULL);
-            cout << "child:main: pid:"<<getpid()<<" I should not get here!"<<endl;
-            cout<<strerror(errno)<<endl;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        // If user inputs ctrl+c program will exit socket communications
+        // loop and begin shutting down child processes and cleanup program
+        // resources
+        if (info.ssi_signo == SIGINT && shuttingDown)
+        {
+            supervisor.escalate();
+        }
+        else if (info.ssi_signo == SIGINT)
+        {
+            eventLoop.stop();
+        }
+        // SIGHUP reloads the configuration without a restart
+        else if (info.ssi_signo == SIGHUP)
+        {
+            reloadConfig();
+        }
+        // SIGUSR1 asks what the monitor costs itself
+        else if (info.ssi_signo == SIGUSR1)
+        {
+            reportStats();
+        }
+        // The table is drawn to fit the terminal again
+        else if (info.ssi_signo == SIGWINCH)
+        {
+            if (config.top)
+            {
+                topDisplay.resize();
+                topDisplay.render();
+            }
+        }
+        else
+        {
+            cout<<"NetworkMonitor: Undefined signal"<<endl;
         }
     }
+}
+
+// Handles every status and sample the in-process sampler has reported
+void handleSamplerEvents(uint32_t events)
+{
+    interface_event event;
 
-    // Ensure we are the parent process
-    // if so calls acceptConnections()
-    if(isParent) {
-        acceptConnections();
+    while (sampler->next_event(event))
+    {
+        if (event.type == MSG_SAMPLE)
+        {
+            handleSample(event.interface, event.info, &event.rates);
+        }
+        else
+        {
+            handleStatus(event.interface, event.type);
+        }
     }
+}
 
-    return 0;
+// Drains every intfMonitor's sample ring each time the ring timer fires
+void handleRingTimer(uint32_t events)
+{
+    uint64_t expirations;
+
+    while (read(ring_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+    }
+
+    for (auto &connection : connections)
+    {
+        drainRing(connection.get());
+    }
 }
 
-void acceptConnections()
+// Reports every sample waiting in a connection's ring
+void drainRing(Connection *connection)
+{
+    if (!connection->ring || connection->interface == -1) return;
+
+    interface_information info;
+
+    while (connection->ring->pop(info))
+    {
+        handleSample(connection->interface, info);
+    }
+}
+
+// Maps the ring whose descriptor came with a Ring message, from then on the
+// connection's samples are taken from it
+void attachRing(Connection *connection)
 {
-    // Clear and initialized fd sets
-    FD_ZERO(&read_fd_set);
-    FD_ZERO(&active_fd_set);
+    if (connection->passedFds.empty())
+    {
+        cout << "server: Ring message without a descriptor" << endl;
+        return;
+    }
+
+    int fd = connection->passedFds.front();
+    connection->passedFds.pop_front();
 
-    // Add the master_fd to the socket set
-    FD_SET(master_fd, &active_fd_set);
-    max_fd = master_fd;
+    SampleRing *ring = SampleRing::attach(fd);
+    close(fd);
 
-    // Loops until while isRunning...
-    while(isRunning)
+    if (ring == nullptr)
     {
-        // Select from up to max_fd + 1 sockets
-        read_fd_set = active_fd_set;
-        ret=select(max_fd+1, &read_fd_set, NULL, NULL, NULL);
-        if (ret < 0) 
+        cout << "server: unable to map the sample ring: " << strerror(errno) << endl;
+        return;
+    }
+
+    if (connection->ring)
+    {
+        drainRing(connection);
+        ringsDropped += connection->ring->dropped();
+    }
+    connection->ring.reset(ring);
+}
+
+// Handles one message from an intfMonitor
+void handleMessage(Connection *connection, const message_header &header, const char *payload)
+{
+    // The first message names the interface the intfMonitor was started
+    // for, by its index in intf
+    if (header.type == MSG_READY)
+    {
+        if (header.interface_id >= intf.size())
         {
-            cout << "server 1 : " << strerror(errno) << endl;
+            cout << "server: Ready from unknown interface " << header.interface_id << endl;
+            return;
         }
+        connection->interface = header.interface_id;
+        interfaceConnections.at(connection->interface) = connection;
+    }
+
+    if (connection->interface == -1)
+    {
+        return;
+    }
+
+    if (header.type == MSG_SAMPLE && header.length == sizeof(sample_payload))
+    {
+        sample_payload sample;
+        interface_information info;
+
+        memcpy(&sample, payload, sizeof(sample));
+        unpack_sample(sample, info);
+
+        handleSample(connection->interface, info);
+    }
+    else if (header.type == MSG_RING)
+    {
+        attachRing(connection);
+    }
+    else if (header.type == MSG_STATS && header.length == sizeof(stats_payload))
+    {
+        stats_payload stats;
+
+        memcpy(&stats, payload, sizeof(stats));
+        selfStats.record_child(connection->interface, stats);
+    }
+    else
+    {
+        handleStatus(connection->interface, header.type);
+    }
+}
 
-        // Service all the sockets with input pending 
-        else 
+// Reacts to a status reported by an interface's monitor, whether that is an
+// intfMonitor process or the in-process sampler
+void handleStatus(int interface, uint16_t status)
+{
+    // An interface that has been removed is not monitored or recovered, an
+    // intfMonitor that only connects afterwards (or during shutdown) is
+    // told to shut down
+    if(!activeInterfaces.at(interface) || shuttingDown)
+    {
+        if(status == MSG_READY)
         {
-            // Connection request on the master socket
-            if (FD_ISSET (master_fd, &read_fd_set))
-            {
-                // Accept the new connection
-                clients[numClients] = accept(master_fd, NULL, NULL);
-                if (clients[numClients] < 0) 
-                {
-                     cout << "server 2: " << strerror(errno) << endl;
-                } 
-                else 
-                {
-                    // Add the new connection to the set
-                    FD_SET (clients[numClients], &active_fd_set);
+            sendCommand(interface, MSG_SHUT_DOWN);
+        }
+    }
+    // Once an interface's monitor is ready it is told to begin monitoring
+    else if(status == MSG_READY)
+    {
+        sendCommand(interface, MSG_MONITOR);
+    }
 
-                    // Sends message "Monitor" to client (intfMonitor)
-                    // to start displaying interface monitoring statistics
-                    write_message("Monitor", numClients);
+    // If the interface monitor returns "Link Down" the link's recovery is
+    // scheduled, when it is due that interface's monitor is told to restore
+    // the link and begin monitoring and displaying interface statistics
+    // again, unless recovery is turned off
+    bool suppressed = false;
 
-                    // Update the maximum fd
-                    if(max_fd<clients[numClients]) max_fd=clients[numClients];
-                    ++numClients;
-                }
-            }
+    if(status == MSG_LINK_DOWN && activeInterfaces.at(interface) && config.recover_links && !shuttingDown)
+    {
+        uint64_t now = monotonic_ns();
 
-            // Data arriving on an already-connected socket
-            else 
-            {
-                // Find which client sent the data
-                for (int i = 0; i < numClients; i++) 
-                {
-                    if (FD_ISSET (clients[i], &read_fd_set)) {
-                        
-                        // Read message from client interface
-                        message = read_message(i);
-                        
-                        // If the client interface monitor returns "Link Down"
-                        // we will message the that client interface to restore the link
-                        // and begin monitoring and displaying interface statistics again
-                        if(message.compare("Link Down") == 0)
-                        {
-                            write_message("Set Link Up", i);
-                            write_message("Monitor", i);
-                        }
-                        // Prints out status of an interface. Eg: "Link Down", "Link Up", "Monitoring"...
-                        cout << "Interface " << intf.at(i).c_str() << ": " << message <<endl;
-                    }
-                }
-            }
+        // Recovery is timed from the first Link Down, however many tries
+        // it takes
+        if(linkDownAt.at(interface) == 0) {
+            linkDownAt.at(interface) = now;
         }
+        linkSetUp.at(interface) = false;
+        suppressed = !recovery.link_down(interface, now);
+        armRecoveryTimer();
+    }
+    // The link has only been told to come up, it is recovered once a sample
+    // shows it up
+    else if(status == MSG_LINK_UP)
+    {
+        recovery.link_up(interface);
+        linkSetUp.at(interface) = linkDownAt.at(interface) != 0;
+    }
+    else if(status == MSG_LINK_UP_FAILED)
+    {
+        recovery.link_up_failed(interface);
+    }
+    // Reports the status of an interface. Eg: "Link Down", "Link Up", "Monitoring"...
+    reportStatus(interface, message_name(status));
+
+    // A flapping link is left down for a while, which is worth knowing
+    if(suppressed)
+    {
+        reportStatus(interface, "Recovery Suppressed");
+    }
+}
+
+// Reports an interface's status, and with --top shows it in its row
+void reportStatus(int interface, const char *status)
+{
+    output->status(intf.at(interface), status);
+
+    if(config.top)
+    {
+        topDisplay.set_status(interface, status);
+    }
+}
+
+// Reports a sample taken by an interface's monitor, timing how long it took
+// to get here and to handle. The in-process sampler rates every interface
+// in one batch and passes its rates along, intfMonitors' samples are rated
+// here one at a time
+void handleSample(int interface, const interface_information &info,
+                  const interface_rates *sampledRates)
+{
+    uint64_t started = monotonic_ns();
+    interface_rates rates;
+
+    if(info.timestamp_ns != 0)
+    {
+        selfStats.stage(STAGE_DELIVERY).record(started - info.timestamp_ns);
+    }
+
+    // Time how long the recovery took, from Link Down to the first sample
+    // with the link up again
+    if(linkSetUp.at(interface) && strcmp(info.operstate, "up") == 0)
+    {
+        selfStats.stage(STAGE_RECOVERY).record(started - linkDownAt.at(interface));
+        recovery.recovered(interface, started);
+        linkDownAt.at(interface) = 0;
+        linkSetUp.at(interface) = false;
+    }
+
+    if(sampledRates != nullptr)
+    {
+        rates = *sampledRates;
+    }
+    else
+    {
+        rateCalculators.at(interface).update(info, rates);
+    }
+    history.record(interface, rates, info.timestamp_ns);
+
+    if(historyWriter != nullptr && historyFiles.at(interface) != -1)
+    {
+        historyWriter->record(historyFiles.at(interface), info);
+    }
+
+    if(metrics != nullptr)
+    {
+        metrics->update(interface, info);
+    }
+
+    // With --top the sample is shown in the table instead, the report
+    // would only go to /dev/null
+    uint64_t formatting = monotonic_ns();
+    if(config.top)
+    {
+        topDisplay.update(interface, info, rates);
+    }
+    else
+    {
+        output->sample(intf.at(interface), info, rates);
+    }
+    uint64_t formatted = monotonic_ns();
+
+    // Alerts are reported after the sample that raised them
+    alerts.update(interface, intf.at(interface), rates,
+                  info.timestamp_ns != 0 ? info.timestamp_ns : started, *output);
+    uint64_t finished = monotonic_ns();
+
+    selfStats.stage(STAGE_FORMAT).record(formatted - formatting);
+    selfStats.stage(STAGE_DISPATCH).record(finished - started);
+
+    // The sampler counts its own ticks, from here every intfMonitor's
+    // sample is a tick
+    if(sampler == nullptr)
+    {
+        selfStats.count_tick();
+    }
+}
+
+// Sends a command to an interface's monitor, whether that is an intfMonitor
+// process or the in-process sampler
+void sendCommand(int interface, message_type command)
+{
+    if(sampler != nullptr)
+    {
+        sampler->command(interface, command);
+    }
+    else if(interfaceConnections.at(interface) != nullptr)
+    {
+        write_message(command, interface, interfaceConnections.at(interface));
     }
-    // This line executes when the Network Monitor has received
-    // a ctrl+c which is handled by the Sighandler which sets isRunning
-    // to false breaking the loop
-    clean_up();
 }
 
 // Sends a given message to the interface monitor through the socket
-int write_message(std::string message, int clientSocket)
+int write_message(uint16_t type, int interface, Connection *connection)
+{
+    if (connection->fd == -1) return -1;
+
+    // Encode the message and queue it behind anything not sent yet, then
+    // send what the socket will take
+    size_t length = encode_message(buffer, type, interface);
+    connection->output.append(buffer, length);
+
+    return flushOutput(connection);
+}
+
+// Writes as much queued output as the socket accepts without blocking. If
+// some is left the connection is also watched for room to send the rest
+int flushOutput(Connection *connection)
 {
     int bytes_written = 0;
 
-    // Clear the buffer of existing data and then copy the message into it
-    memset(buffer, '\0', sizeof(buffer));
-    strncpy(buffer, message.c_str(), sizeof(buffer) - 1);
+    while (!connection->output.empty())
+    {
+        ssize_t written = write(connection->fd, connection->output.data(),
+                                connection->output.size());
 
-    // Send the buffer over the socket file using write()
-    bytes_written = write(clients[clientSocket], buffer, sizeof(buffer));
+        if (written == -1)
+        {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                cout << "Networking Monitor write error: " << strerror(errno) << endl;
+                connection->output.clear();
+                return -1;
+            }
+            break;
+        }
 
-    if(bytes_written ==-1) {
-        cout << "Networking Monitor write error: " << strerror(errno) << endl;
+        connection->output.erase(0, written);
+        bytes_written += written;
     }
+
+    uint32_t events = EPOLLIN | EPOLLRDHUP;
+    if (!connection->output.empty()) events |= EPOLLOUT;
+    eventLoop.modify(connection->fd, events);
+
     return bytes_written;
 }
 
-// Receives any incoming message from the interface monitor and returns it as a string
-std::string read_message(int clientSocket)
+// Reads everything the socket has for us into the connection's input.
+// Returns false once the intfMonitor has closed its end
+bool receiveAvailable(Connection *connection)
 {
-    std::string message;
+    while (connection->fd != -1)
+    {
+        // A Ring message's descriptor arrives with its bytes
+        vector<int> fds;
+        ssize_t bytes_recieved = receive_with_fds(connection->fd, buffer, sizeof(buffer), fds);
 
-    // Clear the buffer of any existing data and then read incoming data from
-    // the socket file into it
-    memset(buffer, '\0', sizeof(buffer));
-    size_t bytes_recieved = read(clients[clientSocket], buffer, sizeof(buffer));
+        connection->passedFds.insert(connection->passedFds.end(), fds.begin(), fds.end());
 
-    if(bytes_recieved == -1) {
-        cout<<"server: Read Error"<<endl;
-        cout<<strerror(errno)<<endl;
+        if (bytes_recieved > 0)
+        {
+            connection->decoder.feed(buffer, bytes_recieved);
+        }
+        else if (bytes_recieved == 0 || errno == ECONNRESET)
+        {
+            return false;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return true;
+        }
+        else if (errno != EINTR)
+        {
+            cout<<"server: Read Error"<<endl;
+            cout<<strerror(errno)<<endl;
+            return false;
+        }
     }
 
-    message = buffer;
+    return false;
+}
 
-    return message;
+// Takes the next whole message received from the interface monitor,
+// returns false if none is complete yet
+bool read_message(Connection *connection, message_header &header, const char *&payload)
+{
+    return connection->decoder.next(header, payload);
 }
 
 // Create and bind a socket to act as the server for our interface monitors to connect to
@@ -217,15 +1663,15 @@ int createAndBindSocket()
 
     //Create the socket
     memset(&addr, 0, sizeof(addr));
-    if ((rc = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    if ((rc = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
         cout << "server: " << strerror(errno) << endl;
         exit(-1);
     }
 
     //Set the socket path to a local socket file
     addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, SOCKET_PATH);
-    unlink(SOCKET_PATH);
+    strncpy(addr.sun_path, config.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(config.socket_path.c_str());
 
     //Bind the socket
     if (bind(rc, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
@@ -236,9 +1682,9 @@ int createAndBindSocket()
 
     cout<<"Waiting for the client..."<<endl;
     //Listen for a client to connect to this local socket file
-    if (listen(rc, numOfInterfaces) == -1) {
+    if (listen(rc, SOMAXCONN) == -1) {
         cout << "server: " << strerror(errno) << endl;
-        unlink(SOCKET_PATH);
+        unlink(config.socket_path.c_str());
         close(rc);
         exit(-1);
     }
@@ -259,14 +1705,6 @@ void getUserInput(){
         cin >> numOfInterfaces;
     }
 
-    // Allocate the childPid array based on user input
-    childPid = new pid_t[numOfInterfaces];
-
-    // Set the maximum amount of clients able to connect 
-    // to the number interfaces user has input
-    MAX_CLIENTS = numOfInterfaces;
-    clients = new int[MAX_CLIENTS];
-
     // Query user for the name of each interface 
     for(int i = 0; i < numOfInterfaces; i++){
         
@@ -281,62 +1719,153 @@ void getUserInput(){
             cin.ignore(256, '\n');
             cin >> in;
         }
-        // Store interface names into a vector
-        intf.push_back(in);
+        // Start monitoring the interface, its index in intf identifies it
+        addInterface(in);
     }
     
     
 }
 
-// The signal handler (only used for SIGINT)
-static void signalHandler(int signum)
-{
-    // If user inputs ctrl+c program will exit socket communications loop
-    // and begin shutting down child processes and cleanup program resources
-    switch(signum) {
-        case SIGINT:
-            isRunning = false;
-	    break;
-        default:
-            cout<<"NetworkMonitor: Undefined signal"<<endl;
-    }
-}
-
 // Shuts down child intfMonitor processes and cleans up program resources
 void clean_up()
 {  
-    // Loop through all clients
-    for(int i = 0; i < numClients; i++)
+    // In-process, tell the sampler to stop monitoring every interface and
+    // wait for its thread to finish
+    if(sampler != nullptr)
     {
-        // Tell all client intfMonitors to shut down and clean up
-        write_message("Shut Down", i);
+        for(size_t i = 0; i < intf.size(); i++)
+        {
+            if(activeInterfaces[i])
+            {
+                sampler->command(i, MSG_SHUT_DOWN);
+            }
+        }
+        sampler->stop();
 
-        //Give some time for shutdown process
-        sleep(1);
+        if(sampler->missed_ticks() > 0)
+        {
+            cout << "Sampler missed " << sampler->missed_ticks() << " ticks" << endl;
+        }
 
-        // On shutdown intfMonitor may send a "Done" message
-        // read the message
-        message = read_message(i);
-        
-        // If "Done" is received close socket connection to the client
-        if(message.compare("Done")){
-            FD_CLR(clients[i], &active_fd_set);
-            close(clients[i]);
+        eventLoop.remove(sampler->event_fd());
+        delete sampler;
+        sampler = nullptr;
+    }
+
+    // Tell every intfMonitor to shut down at once, then go on servicing
+    // their connections (and their Done messages) until the supervisor has
+    // seen the last of them exit, or sent SIGTERM and SIGKILL to those that
+    // did not in time. However many there are this takes no longer than
+    // the one deadline and its grace periods
+    if(config.isolate_processes)
+    {
+        shuttingDown = true;
+        recovery.cancel_all();
+        armRecoveryTimer();
+
+        for(auto &connection : connections)
+        {
+            if (connection->fd != -1 && connection->interface != -1)
+            {
+                write_message(MSG_SHUT_DOWN, connection->interface, connection.get());
+            }
         }
-        // If "Done" isn't received close socket connection to the client
-        else{
-            FD_CLR(clients[i], &active_fd_set);
-            close(clients[i]);
+
+        if(supervisor.shut_down())
+        {
+            eventLoop.run();
         }
     }
 
-    // Clean up program resources
-    delete [] childPid;
-    delete [] clients;
+    for(auto &connection : connections)
+    {
+        closeConnection(connection.get());
+    }
+    connections.clear();
+
+    if(metrics != nullptr)
+    {
+        metrics->close();
+        delete metrics;
+        metrics = nullptr;
+    }
+
+    delete queueStats;
+    queueStats = nullptr;
+
+    // Write out the history still held in memory
+    if(historyWriter != nullptr)
+    {
+        historyWriter->stop();
+        delete historyWriter;
+        historyWriter = nullptr;
+    }
+
+    if(linkWatcher.fd() != -1)
+    {
+        eventLoop.remove(linkWatcher.fd());
+    }
+
+    // Close master file descriptor to socket and unlink socket path, if the
+    // interface monitors were separate processes
+    if(master_fd != -1)
+    {
+        eventLoop.remove(master_fd);
+        close(master_fd);
+        unlink(config.socket_path.c_str());
+    }
+
+    if(ring_timer_fd != -1)
+    {
+        eventLoop.remove(ring_timer_fd);
+        close(ring_timer_fd);
+    }
+
+    if(stats_timer_fd != -1)
+    {
+        eventLoop.remove(stats_timer_fd);
+        close(stats_timer_fd);
+    }
+
+    if(child_stats_timer_fd != -1)
+    {
+        eventLoop.remove(child_stats_timer_fd);
+        close(child_stats_timer_fd);
+    }
+
+    if(queue_timer_fd != -1)
+    {
+        eventLoop.remove(queue_timer_fd);
+        close(queue_timer_fd);
+    }
+
+    // Everything has been reported, write out what is still queued
+    if(output != nullptr)
+    {
+        output->stop();
+        if(output->dropped() > 0)
+        {
+            cout << "Dropped " << output->dropped() << " reports the output could not keep up with" << endl;
+        }
+        if(ringsDropped > 0)
+        {
+            cout << "Dropped " << ringsDropped << " samples the intfMonitors' rings had no room for" << endl;
+        }
+        delete output;
+        output = nullptr;
+    }
 
-    // Close master file descriptor to socket
-    close(master_fd);
+    // Give the terminal back as it was, what is printed from here on is
+    // seen again
+    if(terminal_fd != -1)
+    {
+        eventLoop.remove(top_timer_fd);
+        close(top_timer_fd);
+        eventLoop.remove(STDIN_FILENO);
+        topDisplay.close();
+        dup2(terminal_fd, STDOUT_FILENO);
+        close(terminal_fd);
+    }
 
-    // Unlink socket path
-    unlink(SOCKET_PATH);
+    close(signal_fd);
 }
\ No newline at end of file
@@ -0,0 +1,601 @@
+//outputSink.cpp - Batched, non-blocking report output
+
+#include "outputSink.h"
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Every chunk is this large and there are this many, so at most 1 MB of
+// reports can be waiting for a slow reader
+const size_t CHUNK_SIZE = 64 * 1024;
+const int NUM_CHUNKS = 16;
+
+// How long a partly filled chunk may wait before it is written anyway
+const std::chrono::milliseconds FLUSH_INTERVAL(100);
+
+bool parse_format(const std::string &name, output_format &format)
+{
+    if (name == "text") {
+        format = FORMAT_TEXT;
+    } else if (name == "json") {
+        format = FORMAT_JSON;
+    } else if (name == "csv") {
+        format = FORMAT_CSV;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void LineBuffer::append(const char *text, size_t length)
+{
+    if (length > CAPACITY - used) {
+        length = CAPACITY - used;
+    }
+
+    memcpy(buffer + used, text, length);
+    used += length;
+}
+
+void LineBuffer::append(const char *text)
+{
+    append(text, strlen(text));
+}
+
+void LineBuffer::append(uint64_t value)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+
+    append(digits, result.ptr - digits);
+}
+
+void LineBuffer::append(double value)
+{
+    char digits[64];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value,
+                                std::chars_format::fixed, 3);
+
+    if (result.ec != std::errc()) {
+        append("0");
+        return;
+    }
+
+    // Leave out the zeros after the point, and the point if nothing is left
+    char *end = result.ptr;
+    while (end[-1] == '0') {
+        end--;
+    }
+    if (end[-1] == '.') {
+        end--;
+    }
+
+    append(digits, end - digits);
+}
+
+// The monitors' original report: a block of three lines per sample, and a
+// fourth and fifth for the rates, and one line per status
+class TextFormatter : public OutputFormatter
+{
+public:
+    void sample(LineBuffer &line, const std::string &interface_name,
+                const interface_information &info, const interface_rates &rates) override
+    {
+        line.append("\nInterface:");
+        line.append(interface_name.c_str());
+        line.append(" state:");
+        line.append(info.operstate);
+        line.append(" up_count:");
+        line.append(info.carrier_up_count);
+        line.append(" down_count:");
+        line.append(info.carrier_down_count);
+        line.append("\nrx_bytes:");
+        line.append(info.rx_bytes);
+        line.append(" rx_dropped:");
+        line.append(info.rx_dropped);
+        line.append(" rx_errors:");
+        line.append(info.rx_errors);
+        line.append(" rx_packets:");
+        line.append(info.rx_packets);
+        line.append("\ntx_bytes:");
+        line.append(info.tx_bytes);
+        line.append(" tx_dropped:");
+        line.append(info.tx_dropped);
+        line.append(" tx_errors:");
+        line.append(info.tx_errors);
+        line.append(" tx_packets:");
+        line.append(info.tx_packets);
+        line.append("\n");
+
+        if (!rates.valid) {
+            return;
+        }
+
+        line.append("rx_bps:");
+        line.append((uint64_t)rates.rx_bits);
+        line.append(" rx_pps:");
+        line.append((uint64_t)rates.rx_packets);
+        line.append(" rx_drops/s:");
+        line.append(rates.rx_dropped);
+        line.append(" rx_errors/s:");
+        line.append(rates.rx_errors);
+        line.append("\ntx_bps:");
+        line.append((uint64_t)rates.tx_bits);
+        line.append(" tx_pps:");
+        line.append((uint64_t)rates.tx_packets);
+        line.append(" tx_drops/s:");
+        line.append(rates.tx_dropped);
+        line.append(" tx_errors/s:");
+        line.append(rates.tx_errors);
+        line.append("\n");
+    }
+
+    void status(LineBuffer &line, const std::string &interface_name,
+                const char *status) override
+    {
+        line.append("Interface ");
+        line.append(interface_name.c_str());
+        line.append(": ");
+        line.append(status);
+        line.append("\n");
+    }
+
+    void stats(LineBuffer &line, const char *name,
+               const stat_field *fields, size_t count) override
+    {
+        line.append("Stats ");
+        line.append(name);
+        line.append(":");
+
+        for (size_t i = 0; i < count; i++) {
+            line.append(" ");
+            line.append(fields[i].name);
+            line.append(":");
+            line.append(fields[i].value);
+        }
+
+        line.append("\n");
+    }
+    void alert(LineBuffer &line, const std::string &interface_name,
+               const char *rule, bool firing, double value) override
+    {
+        line.append("Interface ");
+        line.append(interface_name.c_str());
+        line.append(firing ? ": Alert firing: " : ": Alert resolved: ");
+        line.append(rule);
+        line.append(" value:");
+        line.append(value);
+        line.append("\n");
+    }
+};
+
+// Appends text as the inside of a JSON string. Interface names may hold
+// quotes, backslashes and control characters, so every string is escaped
+static void append_json(LineBuffer &line, const char *text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char character = text[i];
+        if (character != '"' && character != '\\' && character >= 0x20) {
+            continue;
+        }
+
+        line.append(text + start, i - start);
+        start = i + 1;
+
+        if (character == '"' || character == '\\') {
+            char escaped[2] = {'\\', (char)character};
+            line.append(escaped, 2);
+        } else {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[character >> 4], hex[character & 0xf]};
+            line.append(escaped, 6);
+        }
+    }
+
+    line.append(text + start, length - start);
+}
+
+static void append_json(LineBuffer &line, const char *text)
+{
+    append_json(line, text, strlen(text));
+}
+
+// One JSON object per line
+class JsonFormatter : public OutputFormatter
+{
+public:
+    void sample(LineBuffer &line, const std::string &interface_name,
+                const interface_information &info, const interface_rates &rates) override
+    {
+        line.append("{\"interface\":\"");
+        append_json(line, interface_name.c_str(), interface_name.size());
+        line.append("\",\"time_ns\":");
+        line.append(info.timestamp_ns);
+        line.append(",\"state\":\"");
+        append_json(line, info.operstate, strnlen(info.operstate, OPERSTATE_LEN));
+        line.append("\",\"carrier_up_count\":");
+        line.append(info.carrier_up_count);
+        line.append(",\"carrier_down_count\":");
+        line.append(info.carrier_down_count);
+        line.append(",\"rx_bytes\":");
+        line.append(info.rx_bytes);
+        line.append(",\"rx_dropped\":");
+        line.append(info.rx_dropped);
+        line.append(",\"rx_errors\":");
+        line.append(info.rx_errors);
+        line.append(",\"rx_packets\":");
+        line.append(info.rx_packets);
+        line.append(",\"tx_bytes\":");
+        line.append(info.tx_bytes);
+        line.append(",\"tx_dropped\":");
+        line.append(info.tx_dropped);
+        line.append(",\"tx_errors\":");
+        line.append(info.tx_errors);
+        line.append(",\"tx_packets\":");
+        line.append(info.tx_packets);
+
+        if (rates.valid) {
+            line.append(",\"rx_bps\":");
+            line.append(rates.rx_bits);
+            line.append(",\"rx_pps\":");
+            line.append(rates.rx_packets);
+            line.append(",\"rx_drops_per_sec\":");
+            line.append(rates.rx_dropped);
+            line.append(",\"rx_errors_per_sec\":");
+            line.append(rates.rx_errors);
+            line.append(",\"tx_bps\":");
+            line.append(rates.tx_bits);
+            line.append(",\"tx_pps\":");
+            line.append(rates.tx_packets);
+            line.append(",\"tx_drops_per_sec\":");
+            line.append(rates.tx_dropped);
+            line.append(",\"tx_errors_per_sec\":");
+            line.append(rates.tx_errors);
+        }
+
+        line.append("}\n");
+    }
+
+    void status(LineBuffer &line, const std::string &interface_name,
+                const char *status) override
+    {
+        line.append("{\"interface\":\"");
+        append_json(line, interface_name.c_str(), interface_name.size());
+        line.append("\",\"status\":\"");
+        append_json(line, status);
+        line.append("\"}\n");
+    }
+
+    void stats(LineBuffer &line, const char *name,
+               const stat_field *fields, size_t count) override
+    {
+        line.append("{\"stats\":\"");
+        append_json(line, name);
+        line.append("\"");
+
+        for (size_t i = 0; i < count; i++) {
+            line.append(",\"");
+            append_json(line, fields[i].name);
+            line.append("\":");
+            line.append(fields[i].value);
+        }
+
+        line.append("}\n");
+    }
+    void alert(LineBuffer &line, const std::string &interface_name,
+               const char *rule, bool firing, double value) override
+    {
+        line.append("{\"interface\":\"");
+        append_json(line, interface_name.c_str(), interface_name.size());
+        line.append("\",\"alert\":\"");
+        append_json(line, rule);
+        line.append(firing ? "\",\"state\":\"firing\"" : "\",\"state\":\"resolved\"");
+        line.append(",\"value\":");
+        line.append(value);
+        line.append("}\n");
+    }
+};
+
+// One row per report, statuses put their word in the state column and leave
+// the rest empty, as do samples without rates
+class CsvFormatter : public OutputFormatter
+{
+public:
+    void header(LineBuffer &line) override
+    {
+        line.append("kind,interface,time_ns,state,carrier_up_count,carrier_down_count,"
+                    "rx_bytes,rx_dropped,rx_errors,rx_packets,"
+                    "tx_bytes,tx_dropped,tx_errors,tx_packets,"
+                    "rx_bps,rx_pps,rx_drops_per_sec,rx_errors_per_sec,"
+                    "tx_bps,tx_pps,tx_drops_per_sec,tx_errors_per_sec\n");
+    }
+
+    void sample(LineBuffer &line, const std::string &interface_name,
+                const interface_information &info, const interface_rates &rates) override
+    {
+        const uint64_t counters[] = {
+            info.carrier_up_count, info.carrier_down_count,
+            info.rx_bytes, info.rx_dropped, info.rx_errors, info.rx_packets,
+            info.tx_bytes, info.tx_dropped, info.tx_errors, info.tx_packets,
+        };
+        const double rate_values[] = {
+            rates.rx_bits, rates.rx_packets, rates.rx_dropped, rates.rx_errors,
+            rates.tx_bits, rates.tx_packets, rates.tx_dropped, rates.tx_errors,
+        };
+
+        line.append("sample,");
+        line.append(interface_name.c_str());
+        line.append(",");
+        line.append(info.timestamp_ns);
+        line.append(",");
+        line.append(info.operstate);
+
+        for (uint64_t counter : counters) {
+            line.append(",");
+            line.append(counter);
+        }
+
+        for (double rate : rate_values) {
+            line.append(",");
+            if (rates.valid) {
+                line.append(rate);
+            }
+        }
+
+        line.append("\n");
+    }
+
+    void status(LineBuffer &line, const std::string &interface_name,
+                const char *status) override
+    {
+        line.append("status,");
+        line.append(interface_name.c_str());
+        line.append(",,");
+        line.append(status);
+        line.append(",,,,,,,,,,,,,,,,,,\n");
+    }
+
+    // Stats put their name in the interface column and their figures, as
+    // name=value pairs separated by semicolons, in the state column
+    void stats(LineBuffer &line, const char *name,
+               const stat_field *fields, size_t count) override
+    {
+        line.append("stats,");
+        line.append(name);
+        line.append(",");
+        line.append(monotonic_ns());
+        line.append(",");
+
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) {
+                line.append(";");
+            }
+            line.append(fields[i].name);
+            line.append("=");
+            line.append(fields[i].value);
+        }
+
+        line.append(",,,,,,,,,,,,,,,,,,\n");
+    }
+    // Alerts put whether they are firing, the rule and the figure in the
+    // state column the same way
+    void alert(LineBuffer &line, const std::string &interface_name,
+               const char *rule, bool firing, double value) override
+    {
+        line.append("alert,");
+        line.append(interface_name.c_str());
+        line.append(",");
+        line.append(monotonic_ns());
+        line.append(firing ? ",firing;rule=" : ",resolved;rule=");
+        line.append(rule);
+        line.append(";value=");
+        line.append(value);
+        line.append(",,,,,,,,,,,,,,,,,,\n");
+    }
+};
+
+OutputFormatter *create_formatter(output_format format)
+{
+    switch (format) {
+        case FORMAT_JSON:
+            return new JsonFormatter();
+        case FORMAT_CSV:
+            return new CsvFormatter();
+        default:
+            return new TextFormatter();
+    }
+}
+
+OutputSink::OutputSink(int fd, output_format format)
+    : fd(fd), formatter(create_formatter(format)), stopping(false), dropped_lines(0)
+{
+    current.data.reset(new char[CHUNK_SIZE]);
+    current.used = 0;
+
+    for (int i = 1; i < NUM_CHUNKS; i++) {
+        chunk spare_chunk;
+        spare_chunk.data.reset(new char[CHUNK_SIZE]);
+        spare_chunk.used = 0;
+        spare.push_back(std::move(spare_chunk));
+    }
+    filled.reserve(NUM_CHUNKS);
+
+    LineBuffer line;
+    formatter->header(line);
+    queue(line);
+}
+
+OutputSink::~OutputSink()
+{
+    stop();
+}
+
+void OutputSink::start()
+{
+    thread = std::thread(&OutputSink::run, this);
+}
+
+void OutputSink::sample(const std::string &interface_name, const interface_information &info,
+                        const interface_rates &rates)
+{
+    LineBuffer line;
+
+    formatter->sample(line, interface_name, info, rates);
+    queue(line);
+}
+
+void OutputSink::status(const std::string &interface_name, const char *status)
+{
+    LineBuffer line;
+
+    formatter->status(line, interface_name, status);
+    queue(line);
+}
+
+void OutputSink::stats(const char *name, const stat_field *fields, size_t count)
+{
+    LineBuffer line;
+
+    formatter->stats(line, name, fields, count);
+    queue(line);
+}
+
+void OutputSink::alert(const std::string &interface_name, const char *rule, bool firing,
+                       double value)
+{
+    LineBuffer line;
+
+    formatter->alert(line, interface_name, rule, firing, value);
+    queue(line);
+}
+
+// Copies a formatted report into the current chunk, moving on to a spare
+// one when it is full. With no spare left the report is dropped
+void OutputSink::queue(const LineBuffer &line)
+{
+    if (line.length() == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (current.used + line.length() > CHUNK_SIZE) {
+        if (spare.empty()) {
+            dropped_lines++;
+            return;
+        }
+
+        filled.push_back(std::move(current));
+        current = std::move(spare.back());
+        spare.pop_back();
+
+        wake.notify_one();
+    }
+
+    memcpy(current.data.get() + current.used, line.data(), line.length());
+    current.used += line.length();
+}
+
+void OutputSink::stop()
+{
+    if (!thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+
+    thread.join();
+}
+
+void OutputSink::run()
+{
+    // Swapped with filled, so both need room for every chunk up front
+    std::vector<chunk> batch;
+    batch.reserve(NUM_CHUNKS);
+    struct iovec parts[NUM_CHUNKS];
+
+    while (true) {
+        bool stop_requested;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            wake.wait_for(lock, FLUSH_INTERVAL,
+                          [this] { return stopping || !filled.empty(); });
+
+            batch.swap(filled);
+
+            // Take the partly filled chunk too, so output never waits
+            // longer than FLUSH_INTERVAL
+            if (current.used > 0 && !spare.empty()) {
+                batch.push_back(std::move(current));
+                current = std::move(spare.back());
+                spare.pop_back();
+            }
+
+            stop_requested = stopping;
+        }
+
+        int count = 0;
+        for (chunk &waiting : batch) {
+            parts[count].iov_base = waiting.data.get();
+            parts[count].iov_len = waiting.used;
+            count++;
+        }
+
+        // Write the whole batch, picking up where a short write stopped. If
+        // the output is gone the batch is discarded
+        struct iovec *next = parts;
+
+        while (count > 0) {
+            ssize_t written = writev(fd, next, count);
+
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            while (count > 0 && (size_t)written >= next->iov_len) {
+                written -= next->iov_len;
+                next++;
+                count--;
+            }
+
+            if (count > 0) {
+                next->iov_base = (char *)next->iov_base + written;
+                next->iov_len -= written;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (chunk &written_chunk : batch) {
+                written_chunk.used = 0;
+                spare.push_back(std::move(written_chunk));
+            }
+        }
+        batch.clear();
+
+        if (stop_requested) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (filled.empty() && current.used == 0) {
+                break;
+            }
+        }
+    }
+}
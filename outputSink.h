@@ -0,0 +1,147 @@
+//outputSink.h - Batched, non-blocking report output
+//
+// Samples and statuses are formatted (as text, JSON lines or CSV) straight
+// into a preallocated buffer with std::to_chars and copied into the sink's
+// current chunk; nothing is written on the caller's thread. A writer thread
+// of the sink's own hands every filled chunk to the terminal or pipe in one
+// writev(). If the reader falls so far behind that every chunk is waiting to
+// be written, further lines are dropped and counted rather than making the
+// caller wait
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "counterRates.h"
+#include "interfaceInfo.h"
+
+enum output_format
+{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV
+};
+
+// Converts a format name ("text", "json" or "csv"), returns false if unknown
+bool parse_format(const std::string &name, output_format &format);
+
+// A fixed-size buffer one report is formatted into. Anything that does not
+// fit is cut off
+class LineBuffer
+{
+public:
+    static const size_t CAPACITY = 1024;
+
+    LineBuffer() : used(0) {}
+
+    void append(const char *text);
+    void append(const char *text, size_t length);
+    void append(uint64_t value);
+    // Rates are written with up to three decimals
+    void append(double value);
+
+    const char *data() const { return buffer; }
+    size_t length() const { return used; }
+
+private:
+    char buffer[CAPACITY];
+    size_t used;
+};
+
+// One named figure of a stats report
+struct stat_field
+{
+    const char *name;
+    double value;
+};
+
+// Turns samples, statuses and stats into lines of one format
+class OutputFormatter
+{
+public:
+    virtual ~OutputFormatter() {}
+
+    // Written once before anything else
+    virtual void header(LineBuffer &line) {}
+
+    // rates is only used if rates.valid
+    virtual void sample(LineBuffer &line, const std::string &interface_name,
+                        const interface_information &info,
+                        const interface_rates &rates) = 0;
+
+    virtual void status(LineBuffer &line, const std::string &interface_name,
+                        const char *status) = 0;
+
+    // The monitor's own figures under a name ("collect", "usage", ...)
+    virtual void stats(LineBuffer &line, const char *name,
+                       const stat_field *fields, size_t count) = 0;
+
+    // An alert rule starting to fire, or resolving, on an interface, with
+    // the figure that made it
+    virtual void alert(LineBuffer &line, const std::string &interface_name,
+                       const char *rule, bool firing, double value) = 0;
+};
+
+OutputFormatter *create_formatter(output_format format);
+
+class OutputSink
+{
+public:
+    // Writes to fd in the given format
+    OutputSink(int fd, output_format format);
+    ~OutputSink();
+
+    OutputSink(const OutputSink &) = delete;
+    OutputSink &operator=(const OutputSink &) = delete;
+
+    // Starts the writer thread
+    void start();
+
+    // Queues a report, never blocking on the output
+    void sample(const std::string &interface_name, const interface_information &info,
+                const interface_rates &rates);
+    void status(const std::string &interface_name, const char *status);
+    void stats(const char *name, const stat_field *fields, size_t count);
+    void alert(const std::string &interface_name, const char *rule, bool firing, double value);
+
+    // Writes everything queued and waits for the writer thread to finish
+    void stop();
+
+    // The number of reports dropped because the output was not keeping up
+    uint64_t dropped() const { return dropped_lines; }
+
+private:
+    struct chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t used;
+    };
+
+    void queue(const LineBuffer &line);
+    void run();
+
+    int fd;
+    std::unique_ptr<OutputFormatter> formatter;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    // The chunk being filled, filled chunks waiting for the writer and empty
+    // chunks ready for reuse. Every chunk is allocated up front
+    chunk current;
+    std::vector<chunk> filled;
+    std::vector<chunk> spare;
+    uint64_t dropped_lines;
+};
+
+#endif
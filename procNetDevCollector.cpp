@@ -0,0 +1,303 @@
+//procNetDevCollector.cpp - /proc/net/dev collector backend
+
+#include "procNetDevCollector.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "counterBatch.h"
+#include "sysfsSampler.h"
+
+// The numbers on a line after the interface name: bytes, packets, errs,
+// drop, fifo, frame, compressed and multicast received, then bytes,
+// packets, errs, drop, fifo, colls, carrier and compressed sent
+const int NUM_COLUMNS = 16;
+
+// The columns kept and the member of interface_information each one is
+// parsed into. The kernel counts missed packets in with the dropped ones
+static const struct
+{
+    int column;
+    uint64_t interface_information::*member;
+} counter_columns[] = {
+    {0,  &interface_information::rx_bytes},
+    {1,  &interface_information::rx_packets},
+    {2,  &interface_information::rx_errors},
+    {3,  &interface_information::rx_dropped},
+    {8,  &interface_information::tx_bytes},
+    {9,  &interface_information::tx_packets},
+    {10, &interface_information::tx_errors},
+    {11, &interface_information::tx_dropped},
+};
+
+// Enough for a hundred interfaces, it grows to fit more the first time they
+// are read
+const size_t INITIAL_BUFFER_SIZE = 16 * 1024;
+
+ProcNetDevCollector::ProcNetDevCollector(const std::string &path,
+                                         const std::string &sysfs_root, int state_passes)
+    : file_path(path), sysfs_directory(sysfs_root), file_fd(-1),
+      buffer(INITIAL_BUFFER_SIZE + DECIMAL_READ_PADDING), file_length(0), pass(1),
+      state_passes(state_passes > 0 ? state_passes : 1)
+{
+}
+
+ProcNetDevCollector::~ProcNetDevCollector()
+{
+    if (file_fd != -1) {
+        close(file_fd);
+    }
+
+    for (link_state &state : states) {
+        close_state(state);
+    }
+}
+
+bool ProcNetDevCollector::open()
+{
+    file_fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    return file_fd != -1;
+}
+
+int ProcNetDevCollector::add_interface(const std::string &interface_name)
+{
+    int slot;
+
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        names[slot] = interface_name;
+    } else {
+        slot = present.size();
+        names.push_back(interface_name);
+        states.emplace_back();
+        present.push_back(false);
+    }
+    slots_by_name[interface_name] = slot;
+
+    // A line already seen may be the new interface's
+    line_names.clear();
+    line_slots.clear();
+
+    return slot;
+}
+
+void ProcNetDevCollector::remove_interface(int slot)
+{
+    // The name may have been given to a newer slot since
+    auto found = slots_by_name.find(names[slot]);
+    if (found != slots_by_name.end() && found->second == slot) {
+        slots_by_name.erase(found);
+    }
+
+    names[slot].clear();
+    close_state(states[slot]);
+    states[slot] = link_state();
+    present[slot] = false;
+    free_slots.push_back(slot);
+
+    // The lines already seen may name the interface
+    line_names.clear();
+    line_slots.clear();
+}
+
+// Reads the whole file into the buffer. procfs hands it out a page or so
+// per read, so reads go on at the offset reached until one returns nothing
+bool ProcNetDevCollector::read_file()
+{
+    size_t total = 0;
+
+    for (;;) {
+        size_t room = buffer.size() - DECIMAL_READ_PADDING;
+
+        if (total == room) {
+            buffer.resize(2 * room + DECIMAL_READ_PADDING);
+            room = 2 * room;
+        }
+
+        ssize_t bytes_read = pread(file_fd, buffer.data() + total, room - total, total);
+
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        total += bytes_read;
+    }
+
+    file_length = total;
+
+    return true;
+}
+
+// The slot of the interface named on the given line, -1 if it is not
+// tracked. Lines keep their interface from one pass to the next unless links
+// come or go, so the name is only looked up when it changed
+int ProcNetDevCollector::slot_for_line(size_t line, const char *name, size_t length)
+{
+    name_key key = {{0, 0}};
+
+    if (length >= sizeof(key)) {
+        return -1;
+    }
+    memcpy(key.words, name, length);
+
+    if (line < line_names.size() && line_names[line] == key) {
+        return line_slots[line];
+    }
+
+    if (line >= line_names.size()) {
+        line_names.resize(line + 1);
+        line_slots.resize(line + 1);
+    }
+
+    auto found = slots_by_name.find(std::string(name, length));
+
+    line_names[line] = key;
+    line_slots[line] = found == slots_by_name.end() ? -1 : found->second;
+
+    return line_slots[line];
+}
+
+void ProcNetDevCollector::close_state(link_state &state)
+{
+    for (int *fd : {&state.operstate_fd, &state.carrier_up_fd, &state.carrier_down_fd}) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void ProcNetDevCollector::open_state(int slot)
+{
+    link_state &state = states[slot];
+    std::string directory = sysfs_directory + names[slot];
+
+    close_state(state);
+    state.operstate_fd = ::open((directory + "/operstate").c_str(), O_RDONLY | O_CLOEXEC);
+    state.carrier_up_fd = ::open((directory + "/carrier_up_count").c_str(), O_RDONLY | O_CLOEXEC);
+    state.carrier_down_fd = ::open((directory + "/carrier_down_count").c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Reads an interface's operstate and carrier counts from sysfs, reopening
+// the files first if asked to or if the interface they were opened for has
+// gone. Without them (no sysfs) the operstate is left empty, which the
+// monitors do not take as the link being down, and the counts at 0
+void ProcNetDevCollector::read_state(int slot, bool reopen)
+{
+    link_state &state = states[slot];
+
+    if (reopen) {
+        open_state(slot);
+    }
+
+    bool is_read = state.operstate_fd != -1 && read_operstate(state.operstate_fd, state.operstate);
+
+    // The files may be those of an interface removed since, try fresh ones
+    if (!is_read && !reopen) {
+        open_state(slot);
+        is_read = state.operstate_fd != -1 && read_operstate(state.operstate_fd, state.operstate);
+    }
+
+    if (!is_read) {
+        close_state(state);
+        state.operstate[0] = '\0';
+        state.carrier_up_count = 0;
+        state.carrier_down_count = 0;
+        return;
+    }
+
+    if (state.carrier_up_fd == -1 || !read_counter(state.carrier_up_fd, state.carrier_up_count)) {
+        state.carrier_up_count = 0;
+    }
+    if (state.carrier_down_fd == -1 || !read_counter(state.carrier_down_fd, state.carrier_down_count)) {
+        state.carrier_down_count = 0;
+    }
+}
+
+int ProcNetDevCollector::collect(interface_information *samples)
+{
+    for (size_t slot = 0; slot < present.size(); slot++) {
+        present[slot] = false;
+    }
+
+    if (file_fd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (!read_file()) {
+        return -1;
+    }
+
+    uint64_t now = monotonic_ns();
+    int found = 0;
+
+    pass++;
+
+    const char *position = buffer.data();
+    const char *end = buffer.data() + file_length;
+    size_t line = 0;
+
+    while (position < end) {
+        const char *line_end = (const char *)memchr(position, '\n', end - position);
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+
+        // The two header lines have no name before a colon
+        const char *colon = (const char *)memchr(position, ':', line_end - position);
+        if (colon == nullptr) {
+            position = line_end + 1;
+            continue;
+        }
+
+        const char *name = position;
+        while (name < colon && *name == ' ') {
+            name++;
+        }
+
+        int slot = slot_for_line(line++, name, colon - name);
+        const char *numbers = colon + 1;
+        uint64_t values[NUM_COLUMNS];
+
+        if (slot != -1 && parse_decimals(numbers, line_end, values, NUM_COLUMNS) == NUM_COLUMNS) {
+            link_state &state = states[slot];
+            interface_information &sample = samples[slot];
+
+            // An interface not there on the last pass may be a new one
+            // under the same name, so its files are opened again. The rest
+            // take turns, a share of them on every pass, so no one pass
+            // pays for reading them all
+            bool appeared = state.seen_pass != pass - 1;
+            if (appeared || (uint64_t)slot % state_passes == pass % state_passes) {
+                read_state(slot, appeared);
+            }
+            state.seen_pass = pass;
+
+            memcpy(sample.operstate, state.operstate, OPERSTATE_LEN);
+            sample.carrier_up_count = state.carrier_up_count;
+            sample.carrier_down_count = state.carrier_down_count;
+            for (const auto &counter : counter_columns) {
+                sample.*(counter.member) = values[counter.column];
+            }
+            sample.timestamp_ns = now;
+
+            present[slot] = true;
+            found++;
+        }
+
+        position = line_end + 1;
+    }
+
+    return found;
+}
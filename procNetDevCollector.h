@@ -0,0 +1,107 @@
+//procNetDevCollector.h - /proc/net/dev collector backend
+//
+// /proc/net/dev holds the rx and tx counters of every interface, one line
+// each, so a pass is re-reading that one file (kept open, with pread() into
+// a buffer that is reused) and parsing it top to bottom. Which slot a line
+// belongs to is worked out the first time a name is seen on that line and
+// remembered, so while the interfaces stay put no names are looked up or
+// compared as strings. The file has no operstate or carrier counts; those
+// come from each interface's sysfs files, read less often. None of it needs
+// netlink or any privileges
+
+#ifndef PROC_NET_DEV_COLLECTOR_H
+#define PROC_NET_DEV_COLLECTOR_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "collector.h"
+#include "interfaceInfo.h"
+
+class ProcNetDevCollector : public Collector
+{
+public:
+    // How many passes it takes for every interface's operstate and carrier
+    // counts to be read again, unless told otherwise; each pass reads those
+    // of a share of the interfaces. A link going down is still seen straight
+    // away through link notifications, where they are watched
+    static const int DEFAULT_STATE_PASSES = 10;
+
+    // path is the file to read in place of /proc/net/dev, and sysfs_root the
+    // directory holding the interface directories the states are read from
+    explicit ProcNetDevCollector(const std::string &path = PROC_NET_DEV,
+                                 const std::string &sysfs_root = SYSFS_NET_ROOT,
+                                 int state_passes = DEFAULT_STATE_PASSES);
+    ~ProcNetDevCollector();
+
+    ProcNetDevCollector(const ProcNetDevCollector &) = delete;
+    ProcNetDevCollector &operator=(const ProcNetDevCollector &) = delete;
+
+    // Opens the file, returns false (with errno set) if it can not be
+    bool open();
+
+    const char *name() const override { return "procfs"; }
+    int add_interface(const std::string &interface_name) override;
+    void remove_interface(int slot) override;
+    int collect(interface_information *samples) override;
+    bool is_present(int slot) const override { return present[slot]; }
+
+private:
+    // An interface name as two words, zero padded, so names are compared as
+    // numbers. Every name fits, the kernel keeps them under IFNAMSIZ (16)
+    struct name_key
+    {
+        uint64_t words[2];
+
+        bool operator==(const name_key &other) const
+        {
+            return words[0] == other.words[0] && words[1] == other.words[1];
+        }
+    };
+
+    // The sysfs files of a tracked interface read on the slower pass and
+    // what was last read from them
+    struct link_state
+    {
+        int operstate_fd = -1;
+        int carrier_up_fd = -1;
+        int carrier_down_fd = -1;
+        char operstate[OPERSTATE_LEN] = "";
+        uint64_t carrier_up_count = 0;
+        uint64_t carrier_down_count = 0;
+        // The last pass the interface was found on
+        uint64_t seen_pass = 0;
+    };
+
+    bool read_file();
+    int slot_for_line(size_t line, const char *name, size_t length);
+    void read_state(int slot, bool reopen);
+    void open_state(int slot);
+    void close_state(link_state &state);
+
+    std::string file_path;
+    std::string sysfs_directory;
+    int file_fd;
+
+    // The whole file as last read, with room for the parser's read ahead
+    std::vector<char> buffer;
+    size_t file_length;
+
+    std::vector<std::string> names;
+    std::unordered_map<std::string, int> slots_by_name;
+
+    // The name seen on each line of the last pass and its slot, -1 for
+    // interfaces that are not tracked
+    std::vector<name_key> line_names;
+    std::vector<int> line_slots;
+
+    std::vector<link_state> states;
+    std::vector<bool> present;
+    std::vector<int> free_slots;
+    uint64_t pass;
+    int state_passes;
+};
+
+#endif
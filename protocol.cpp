@@ -0,0 +1,221 @@
+//protocol.cpp - The framed binary protocol between intfMonitor and networkMonitor
+
+#include "protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The most descriptors collected from a single read
+const int MAX_PASSED_FDS = 4;
+
+const char *message_name(uint16_t type)
+{
+    switch (type) {
+        case MSG_READY:
+            return "Ready";
+        case MSG_MONITORING:
+            return "Monitoring";
+        case MSG_LINK_DOWN:
+            return "Link Down";
+        case MSG_LINK_UP:
+            return "Link Up";
+        case MSG_DONE:
+            return "Done";
+        case MSG_SAMPLE:
+            return "Sample";
+        case MSG_RING:
+            return "Ring";
+        case MSG_LINK_UP_FAILED:
+            return "Link Up Failed";
+        case MSG_STATS:
+            return "Stats";
+        case MSG_MONITOR:
+            return "Monitor";
+        case MSG_SET_LINK_UP:
+            return "Set Link Up";
+        case MSG_SHUT_DOWN:
+            return "Shut Down";
+        case MSG_STATS_REQUEST:
+            return "Stats Request";
+    }
+
+    return "Unknown";
+}
+
+size_t encode_message(char *buffer, uint16_t type, uint32_t interface_id,
+                      const void *payload, uint16_t length)
+{
+    message_header header;
+
+    if (length > MAX_PAYLOAD) {
+        length = MAX_PAYLOAD;
+    }
+
+    header.type = type;
+    header.length = length;
+    header.interface_id = interface_id;
+
+    memcpy(buffer, &header, sizeof(header));
+    if (length > 0) {
+        memcpy(buffer + sizeof(header), payload, length);
+    }
+
+    return sizeof(header) + length;
+}
+
+void pack_sample(const interface_information &info, sample_payload &payload)
+{
+    payload.operstate = operstate_code(info.operstate);
+    payload.carrier_up_count = info.carrier_up_count;
+    payload.carrier_down_count = info.carrier_down_count;
+    payload.rx_bytes = info.rx_bytes;
+    payload.rx_dropped = info.rx_dropped;
+    payload.rx_errors = info.rx_errors;
+    payload.rx_packets = info.rx_packets;
+    payload.tx_bytes = info.tx_bytes;
+    payload.tx_dropped = info.tx_dropped;
+    payload.tx_errors = info.tx_errors;
+    payload.tx_packets = info.tx_packets;
+    payload.timestamp_ns = info.timestamp_ns;
+}
+
+void unpack_sample(const sample_payload &payload, interface_information &info)
+{
+    memset(info.operstate, 0, sizeof(info.operstate));
+    strncpy(info.operstate, operstate_name(payload.operstate), OPERSTATE_LEN - 1);
+    info.carrier_up_count = payload.carrier_up_count;
+    info.carrier_down_count = payload.carrier_down_count;
+    info.rx_bytes = payload.rx_bytes;
+    info.rx_dropped = payload.rx_dropped;
+    info.rx_errors = payload.rx_errors;
+    info.rx_packets = payload.rx_packets;
+    info.tx_bytes = payload.tx_bytes;
+    info.tx_dropped = payload.tx_dropped;
+    info.tx_errors = payload.tx_errors;
+    info.tx_packets = payload.tx_packets;
+    info.timestamp_ns = payload.timestamp_ns;
+}
+
+ssize_t send_message_with_fd(int socket, const char *message, size_t length, int fd)
+{
+    struct msghdr header;
+    struct iovec data;
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    memset(&header, 0, sizeof(header));
+    memset(&control, 0, sizeof(control));
+
+    data.iov_base = (void *)message;
+    data.iov_len = length;
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(rights), &fd, sizeof(int));
+
+    ssize_t sent;
+
+    do {
+        sent = sendmsg(socket, &header, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+
+    return sent;
+}
+
+ssize_t receive_with_fds(int socket, char *buffer, size_t size, std::vector<int> &fds)
+{
+    struct msghdr header;
+    struct iovec data;
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    memset(&header, 0, sizeof(header));
+
+    data.iov_base = buffer;
+    data.iov_len = size;
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received = recvmsg(socket, &header, MSG_CMSG_CLOEXEC);
+
+    if (received <= 0) {
+        return received;
+    }
+
+    for (struct cmsghdr *message = CMSG_FIRSTHDR(&header); message != NULL;
+            message = CMSG_NXTHDR(&header, message)) {
+        if (message->cmsg_level != SOL_SOCKET || message->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        int count = (message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (int i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(message) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+
+    return received;
+}
+
+MessageDecoder::MessageDecoder() : read_offset(0), corrupt(false)
+{
+    // Room for a partial message left over plus a full read, so a stream
+    // read MAX_MESSAGE at a time never grows the buffer
+    buffer.reserve(2 * MAX_MESSAGE);
+}
+
+void MessageDecoder::feed(const char *data, size_t length)
+{
+    // Drop the messages already taken out before growing the buffer, which
+    // moves what is left to the front without reallocating
+    if (read_offset > 0) {
+        buffer.erase(buffer.begin(), buffer.begin() + read_offset);
+        read_offset = 0;
+    }
+
+    buffer.insert(buffer.end(), data, data + length);
+}
+
+bool MessageDecoder::next(message_header &header, const char *&payload)
+{
+    size_t available = buffer.size() - read_offset;
+
+    if (corrupt || available < sizeof(message_header)) {
+        return false;
+    }
+
+    memcpy(&header, buffer.data() + read_offset, sizeof(header));
+
+    if (header.length > MAX_PAYLOAD) {
+        corrupt = true;
+        return false;
+    }
+
+    if (available < sizeof(message_header) + header.length) {
+        return false;
+    }
+
+    payload = buffer.data() + read_offset + sizeof(message_header);
+    read_offset += sizeof(message_header) + header.length;
+
+    return true;
+}
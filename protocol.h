@@ -0,0 +1,149 @@
+//protocol.h - The framed binary protocol between intfMonitor and networkMonitor
+//
+// Every message is an 8 byte header (type, payload length and the id of the
+// interface it concerns) followed by its payload. Statuses and commands have
+// no payload; Ready carries the interface name and Sample carries a packed
+// copy of interface_information, so a sample costs 97 bytes on the wire.
+// Ring has no payload either but passes a shared-memory sample ring's
+// descriptor alongside it (SCM_RIGHTS), after which samples go through the
+// ring rather than the socket. Stats answers a Stats Request with a summary
+// of how the intfMonitor has sampled and what it has cost so far.
+// Both ends run on the same host, so fields are in host byte order
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+#include "interfaceInfo.h"
+
+enum message_type : uint16_t
+{
+    // Statuses, sent by an interface monitor
+    MSG_READY = 1,
+    MSG_MONITORING,
+    MSG_LINK_DOWN,
+    MSG_LINK_UP,
+    MSG_DONE,
+    MSG_SAMPLE,
+    MSG_RING,
+    MSG_LINK_UP_FAILED,
+    MSG_STATS,
+
+    // Commands, sent by the network monitor
+    MSG_MONITOR = 32,
+    MSG_SET_LINK_UP,
+    MSG_SHUT_DOWN,
+    MSG_STATS_REQUEST
+};
+
+struct __attribute__((packed)) message_header
+{
+    uint16_t type;
+    uint16_t length;
+    uint32_t interface_id;
+};
+
+// The payload of MSG_SAMPLE
+struct __attribute__((packed)) sample_payload
+{
+    uint8_t operstate;
+    uint64_t carrier_up_count;
+    uint64_t carrier_down_count;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t rx_errors;
+    uint64_t rx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t tx_errors;
+    uint64_t tx_packets;
+    uint64_t timestamp_ns;
+};
+
+// The stages an intfMonitor times itself, STAGE_TICK_LAG to STAGE_SEND
+const int MONITOR_STAGES = 3;
+
+// One timed stage of MSG_STATS, in nanoseconds
+struct __attribute__((packed)) stage_summary
+{
+    uint64_t count;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+// The payload of MSG_STATS, everything counted since the intfMonitor started
+struct __attribute__((packed)) stats_payload
+{
+    stage_summary stages[MONITOR_STAGES];
+    uint64_t ticks;
+    uint64_t cpu_ns;
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t read_bytes;
+    uint64_t written_bytes;
+    uint64_t allocations;
+    uint64_t context_switches;
+};
+
+// No message carries more than this, a longer length means the stream is
+// corrupt
+const size_t MAX_PAYLOAD = 256;
+const size_t MAX_MESSAGE = sizeof(message_header) + MAX_PAYLOAD;
+
+static_assert(sizeof(stats_payload) <= MAX_PAYLOAD, "a Stats message must fit in one message");
+
+// The word used for a message type when reporting it, the same text the
+// monitors used to exchange ("Ready", "Link Down", "Set Link Up", ...)
+const char *message_name(uint16_t type);
+
+// Writes a whole message into buffer (which must hold MAX_MESSAGE bytes) and
+// returns its size
+size_t encode_message(char *buffer, uint16_t type, uint32_t interface_id,
+                      const void *payload = nullptr, uint16_t length = 0);
+
+// Converts between a sample and its wire form
+void pack_sample(const interface_information &info, sample_payload &payload);
+void unpack_sample(const sample_payload &payload, interface_information &info);
+
+// Sends a whole encoded message with a descriptor attached. Returns the
+// number of bytes sent, or -1 with errno set
+ssize_t send_message_with_fd(int socket, const char *message, size_t length, int fd);
+
+// Reads from a socket like read(), also collecting any descriptors that were
+// passed along with the bytes
+ssize_t receive_with_fds(int socket, char *buffer, size_t size, std::vector<int> &fds);
+
+// Splits a byte stream back into messages. Bytes are fed in as they are
+// read, however they were split or coalesced by the socket, and whole
+// messages are taken out with next()
+class MessageDecoder
+{
+public:
+    MessageDecoder();
+
+    // Appends bytes read from the stream
+    void feed(const char *data, size_t length);
+
+    // Takes the next whole message. payload points into the decoder and stays
+    // valid until the next call to feed(). Returns false if no whole message
+    // has arrived yet, or if the stream is corrupt (see failed())
+    bool next(message_header &header, const char *&payload);
+
+    // Whether a header with an impossible length was seen, after which the
+    // stream cannot be resynchronised
+    bool failed() const { return corrupt; }
+
+private:
+    std::vector<char> buffer;
+    size_t read_offset;
+    bool corrupt;
+};
+
+#endif
@@ -0,0 +1,528 @@
+//queueStats.cpp - Per-queue and per-CPU receive statistics, for RSS imbalance
+
+#include "queueStats.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/ethtool.h>
+#include <unistd.h>
+
+#include "interfaceInfo.h"
+
+// The summary fields of each direction's report
+static const char *const queue_count_fields[] = {"rx_queues", "tx_queues"};
+static const char *const imbalance_fields[] = {"rx_imbalance", "tx_imbalance"};
+static const char *const hot_queue_fields[] = {"rx_hot_queue", "tx_hot_queue"};
+static const char *const total_fields[] = {"rx_pps", "tx_pps"};
+static const char *const direction_names[] = {"rx", "tx"};
+
+// The columns of softnet_stat used: packets processed, dropped and time
+// squeezed first, and the CPU the line is for (kernels from 5.10 on, older
+// ones leave offline CPUs out without saying so) as the thirteenth
+const int SOFTNET_CPU_COLUMN = 12;
+const int SOFTNET_COLUMNS = 13;
+
+spread_score score_spread(const double *rates, size_t count)
+{
+    spread_score score = {0, -1};
+    double total = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        total += rates[i];
+        if (score.hottest == -1 || rates[i] > rates[score.hottest]) {
+            score.hottest = i;
+        }
+    }
+
+    if (total <= 0) {
+        score.hottest = -1;
+        return score;
+    }
+
+    score.imbalance = rates[score.hottest] / (total / count);
+
+    return score;
+}
+
+// Splits a statistic's name into words at anything but letters and digits,
+// and between letters and digits, so "rx-0.rx_packets" is rx 0 rx packets
+static std::vector<std::string> name_words(const char *name)
+{
+    std::vector<std::string> words;
+    std::string word;
+
+    for (const char *character = name; ; character++) {
+        bool letter = (*character >= 'a' && *character <= 'z') || (*character >= 'A' && *character <= 'Z');
+        bool digit = *character >= '0' && *character <= '9';
+        bool word_digits = !word.empty() && word[0] >= '0' && word[0] <= '9';
+
+        if (!word.empty() && (!(letter || digit) || digit != word_digits)) {
+            words.push_back(word);
+            word.clear();
+        }
+
+        if (*character == '\0') {
+            break;
+        }
+        if (letter) {
+            word += *character | 0x20;
+        } else if (digit) {
+            word += *character;
+        }
+    }
+
+    return words;
+}
+
+// Works out whether a statistic is a queue's packets or bytes counter, and
+// which queue's. The queue number has to come straight after rx or tx, or
+// after queue, or first of all ([0]: ...). Packet size buckets such as
+// rx_1024_to_1518_bytes still pass, it is the queue count that rules them out
+static bool parse_queue_counter(const char *name, int &queue, int &direction, bool &bytes)
+{
+    std::vector<std::string> words = name_words(name);
+
+    if (words.size() < 3) {
+        return false;
+    }
+
+    const std::string &kind = words.back();
+    if (kind == "bytes") {
+        bytes = true;
+    } else if (kind == "packets" || kind == "pkts") {
+        bytes = false;
+    } else {
+        return false;
+    }
+
+    direction = -1;
+    queue = -1;
+
+    for (size_t i = 0; i + 1 < words.size(); i++) {
+        bool number = words[i][0] >= '0' && words[i][0] <= '9';
+
+        if (direction == -1 && (words[i] == "rx" || words[i] == "tx")) {
+            direction = words[i] == "rx" ? 0 : 1;
+        }
+
+        if (queue == -1 && number &&
+            (i == 0 || words[i - 1] == "rx" || words[i - 1] == "tx" || words[i - 1] == "queue")) {
+            queue = atoi(words[i].c_str());
+        }
+    }
+
+    return direction != -1 && queue != -1;
+}
+
+QueueStats::QueueStats(const std::string &sysfs_root, const std::string &softnet_path)
+    : sysfs_directory(sysfs_root), softnet_path(softnet_path), softnet_fd(-1),
+      softnet_previous_ns(0), softnet_has_previous(false), softnet_drops(0),
+      softnet_squeezes(0), softnet_has_rates(false)
+{
+}
+
+QueueStats::~QueueStats()
+{
+    if (softnet_fd != -1) {
+        close(softnet_fd);
+    }
+}
+
+int QueueStats::add_interface(const std::string &interface_name)
+{
+    interfaces.emplace_back();
+    interfaces.back().name = interface_name;
+    interfaces.back().report_name = "queues/" + interface_name;
+
+    return interfaces.size() - 1;
+}
+
+void QueueStats::clear(int interface)
+{
+    tracked_interface &tracked = interfaces[interface];
+
+    // It may be back as another device, with other statistics
+    tracked.learnt = false;
+    tracked.has_previous = false;
+    tracked.has_rates = false;
+}
+
+// The number of queue directories (rx-0, rx-1...) sysfs lists for an
+// interface
+int QueueStats::count_queues(const std::string &interface_name, const char *prefix)
+{
+    DIR *directory = opendir((sysfs_directory + interface_name + "/queues").c_str());
+    int count = 0;
+
+    if (directory == NULL) {
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+            count++;
+        }
+    }
+
+    closedir(directory);
+
+    return count;
+}
+
+// Learns which of the driver's statistics are queue counters. Returns false
+// if there are none
+bool QueueStats::learn(tracked_interface &tracked)
+{
+    tracked.counters.clear();
+    tracked.has_previous = false;
+    tracked.has_rates = false;
+
+    for (int direction : {QUEUE_RX, QUEUE_TX}) {
+        tracked.queue_count[direction] = count_queues(tracked.name, direction == QUEUE_RX ? "rx-" : "tx-");
+    }
+
+    // How many statistics there are, the one set asked about is followed by
+    // its length. Older drivers only say through drvinfo
+    uint64_t set_buffer[(sizeof(struct ethtool_sset_info) + sizeof(uint32_t) + 7) / 8] = {};
+    struct ethtool_sset_info *set_info = (struct ethtool_sset_info *)set_buffer;
+
+    set_info->cmd = ETHTOOL_GSSET_INFO;
+    set_info->sset_mask = 1ULL << ETH_SS_STATS;
+
+    if (control.ethtool(tracked.name, set_info) == 0 && (set_info->sset_mask & (1ULL << ETH_SS_STATS))) {
+        tracked.stat_count = set_info->data[0];
+    } else {
+        struct ethtool_drvinfo driver;
+
+        memset(&driver, 0, sizeof(driver));
+        driver.cmd = ETHTOOL_GDRVINFO;
+        tracked.stat_count = control.ethtool(tracked.name, &driver) == 0 ? driver.n_stats : 0;
+    }
+
+    if (tracked.stat_count == 0) {
+        return false;
+    }
+
+    std::vector<char> names(sizeof(struct ethtool_gstrings) + tracked.stat_count * ETH_GSTRING_LEN);
+    struct ethtool_gstrings *strings = (struct ethtool_gstrings *)names.data();
+
+    strings->cmd = ETHTOOL_GSTRINGS;
+    strings->string_set = ETH_SS_STATS;
+    strings->len = tracked.stat_count;
+
+    if (control.ethtool(tracked.name, strings) == -1) {
+        return false;
+    }
+
+    for (uint32_t stat = 0; stat < strings->len; stat++) {
+        char name[ETH_GSTRING_LEN + 1];
+        queue_counter counter;
+        int direction;
+
+        memcpy(name, strings->data + stat * ETH_GSTRING_LEN, ETH_GSTRING_LEN);
+        name[ETH_GSTRING_LEN] = '\0';
+
+        if (!parse_queue_counter(name, counter.queue, direction, counter.bytes) ||
+            counter.queue >= tracked.queue_count[direction]) {
+            continue;
+        }
+        counter.stat = stat;
+        counter.direction = (queue_direction)direction;
+
+        // The first counter of its kind for the queue is the one kept
+        bool known = false;
+        for (const queue_counter &other : tracked.counters) {
+            known = known || (other.queue == counter.queue && other.direction == counter.direction &&
+                              other.bytes == counter.bytes);
+        }
+        if (!known) {
+            tracked.counters.push_back(counter);
+        }
+    }
+
+    if (tracked.counters.empty()) {
+        return false;
+    }
+
+    // The reply is a struct ethtool_stats, the command and count in the
+    // first eight bytes and a counter in each eight after
+    tracked.reply.assign(1 + tracked.stat_count, 0);
+    tracked.previous.assign(tracked.counters.size(), 0);
+
+    for (int direction : {QUEUE_RX, QUEUE_TX}) {
+        tracked.rates[direction].assign(tracked.queue_count[direction], queue_rates());
+        tracked.field_names[direction].clear();
+
+        for (int queue = 0; queue < tracked.queue_count[direction] && queue < MAX_REPORTED_QUEUES; queue++) {
+            tracked.field_names[direction].push_back(direction_names[direction] + std::to_string(queue) + "_pps");
+        }
+    }
+
+    return true;
+}
+
+bool QueueStats::collect(int interface)
+{
+    tracked_interface &tracked = interfaces[interface];
+
+    if (!tracked.learnt) {
+        tracked.learnt = true;
+        learn(tracked);
+    }
+
+    if (tracked.counters.empty()) {
+        return false;
+    }
+
+    struct ethtool_stats *stats = (struct ethtool_stats *)tracked.reply.data();
+
+    stats->cmd = ETHTOOL_GSTATS;
+    stats->n_stats = tracked.stat_count;
+
+    if (control.ethtool(tracked.name, stats) == -1) {
+        tracked.has_previous = false;
+        return false;
+    }
+
+    // The driver changed its statistics (a reconfigured queue count, say),
+    // they are learnt again on the next pass
+    if (stats->n_stats != tracked.stat_count) {
+        tracked.learnt = false;
+        tracked.has_previous = false;
+        return false;
+    }
+
+    uint64_t now = monotonic_ns();
+    const uint64_t *values = tracked.reply.data() + 1;
+
+    if (tracked.has_previous && now > tracked.previous_ns) {
+        double seconds = (now - tracked.previous_ns) / 1e9;
+
+        for (size_t i = 0; i < tracked.counters.size(); i++) {
+            const queue_counter &counter = tracked.counters[i];
+            uint64_t value = values[counter.stat];
+            // A counter that went back was reset, it counts from 0 again
+            double rate = value >= tracked.previous[i] ? (value - tracked.previous[i]) / seconds : 0;
+            queue_rates &rates = tracked.rates[counter.direction][counter.queue];
+
+            (counter.bytes ? rates.bytes : rates.packets) = rate;
+        }
+        tracked.has_rates = true;
+    }
+
+    for (size_t i = 0; i < tracked.counters.size(); i++) {
+        tracked.previous[i] = values[tracked.counters[i].stat];
+    }
+    tracked.previous_ns = now;
+    tracked.has_previous = true;
+
+    return true;
+}
+
+void QueueStats::report(int interface, OutputSink &output)
+{
+    tracked_interface &tracked = interfaces[interface];
+
+    if (!tracked.has_rates) {
+        return;
+    }
+
+    fields.clear();
+
+    for (int direction : {QUEUE_RX, QUEUE_TX}) {
+        const std::vector<queue_rates> &rates = tracked.rates[direction];
+        double total = 0;
+
+        packet_rates.clear();
+        for (const queue_rates &queue : rates) {
+            packet_rates.push_back(queue.packets);
+            total += queue.packets;
+        }
+
+        spread_score score = score_spread(packet_rates.data(), packet_rates.size());
+
+        fields.push_back({queue_count_fields[direction], (double)rates.size()});
+        fields.push_back({imbalance_fields[direction], score.imbalance});
+        fields.push_back({hot_queue_fields[direction], (double)score.hottest});
+        fields.push_back({total_fields[direction], total});
+    }
+
+    for (int direction : {QUEUE_RX, QUEUE_TX}) {
+        for (size_t queue = 0; queue < tracked.field_names[direction].size(); queue++) {
+            fields.push_back({tracked.field_names[direction][queue].c_str(),
+                              tracked.rates[direction][queue].packets});
+        }
+    }
+
+    output.stats(tracked.report_name.c_str(), fields.data(), fields.size());
+}
+
+// Parses a hexadecimal number, moving text past it and the spaces after
+static uint64_t parse_hex(const char *&text, const char *end)
+{
+    uint64_t value = 0;
+
+    for (; text < end; text++) {
+        char character = *text;
+
+        if (character >= '0' && character <= '9') {
+            value = value * 16 + (character - '0');
+        } else if (character >= 'a' && character <= 'f') {
+            value = value * 16 + (character - 'a' + 10);
+        } else {
+            break;
+        }
+    }
+
+    while (text < end && *text == ' ') {
+        text++;
+    }
+
+    return value;
+}
+
+bool QueueStats::collect_softnet()
+{
+    if (softnet_fd == -1) {
+        softnet_fd = open(softnet_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (softnet_fd == -1) {
+            return false;
+        }
+        // A line is about 150 bytes, room for 64 CPUs to start with
+        softnet_text.resize(64 * 160);
+    }
+
+    // procfs hands the file out a page or so per read, so reads go on at
+    // the offset reached until one returns nothing
+    size_t length = 0;
+
+    for (;;) {
+        if (length == softnet_text.size()) {
+            softnet_text.resize(2 * softnet_text.size());
+        }
+
+        ssize_t bytes_read = pread(softnet_fd, softnet_text.data() + length,
+                                   softnet_text.size() - length, length);
+
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        length += bytes_read;
+    }
+
+    const char *position = softnet_text.data();
+    const char *end = softnet_text.data() + length;
+    size_t line = 0;
+    bool layout_changed = false;
+
+    while (position < end) {
+        const char *line_end = (const char *)memchr(position, '\n', end - position);
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+
+        uint64_t columns[SOFTNET_COLUMNS] = {};
+        int column = 0;
+
+        while (position < line_end && column < SOFTNET_COLUMNS) {
+            columns[column++] = parse_hex(position, line_end);
+        }
+
+        if (column >= 3) {
+            int cpu = column > SOFTNET_CPU_COLUMN ? (int)columns[SOFTNET_CPU_COLUMN] : (int)line;
+
+            if (line >= softnet_current.size()) {
+                softnet_current.resize(line + 1);
+                cpu_ids.resize(line + 1, -1);
+            }
+            if (cpu_ids[line] != cpu) {
+                cpu_ids[line] = cpu;
+                layout_changed = true;
+            }
+
+            softnet_current[line] = {columns[0], columns[1], columns[2]};
+            line++;
+        }
+
+        position = line_end + 1;
+    }
+
+    // CPUs came or went, the rates start over
+    if (line != softnet_current.size() || layout_changed) {
+        softnet_current.resize(line);
+        cpu_ids.resize(line);
+        softnet_has_previous = false;
+        softnet_has_rates = false;
+
+        cpu_field_names.clear();
+        for (size_t i = 0; i < line && i < (size_t)MAX_REPORTED_CPUS; i++) {
+            cpu_field_names.push_back("cpu" + std::to_string(cpu_ids[i]) + "_pps");
+        }
+    }
+
+    uint64_t now = monotonic_ns();
+
+    if (softnet_has_previous && now > softnet_previous_ns) {
+        double seconds = (now - softnet_previous_ns) / 1e9;
+
+        cpu_rates.resize(line);
+        softnet_drops = 0;
+        softnet_squeezes = 0;
+
+        // The counters are 32 bits wide in the kernel, and wrap
+        for (size_t i = 0; i < line; i++) {
+            const softnet_counters &current = softnet_current[i];
+            const softnet_counters &previous = softnet_previous[i];
+
+            cpu_rates[i] = (uint32_t)(current.processed - previous.processed) / seconds;
+            softnet_drops += (uint32_t)(current.dropped - previous.dropped) / seconds;
+            softnet_squeezes += (uint32_t)(current.time_squeeze - previous.time_squeeze) / seconds;
+        }
+        softnet_has_rates = true;
+    }
+
+    softnet_previous = softnet_current;
+    softnet_previous_ns = now;
+    softnet_has_previous = true;
+
+    return true;
+}
+
+void QueueStats::report_softnet(OutputSink &output)
+{
+    if (!softnet_has_rates) {
+        return;
+    }
+
+    spread_score score = score_spread(cpu_rates.data(), cpu_rates.size());
+    double total = 0;
+
+    for (double rate : cpu_rates) {
+        total += rate;
+    }
+
+    fields.clear();
+    fields.push_back({"cpus", (double)cpu_rates.size()});
+    fields.push_back({"imbalance", score.imbalance});
+    fields.push_back({"hot_cpu", score.hottest == -1 ? -1.0 : (double)cpu_ids[score.hottest]});
+    fields.push_back({"pps", total});
+    fields.push_back({"drops_per_sec", softnet_drops});
+    fields.push_back({"squeezes_per_sec", softnet_squeezes});
+
+    for (size_t i = 0; i < cpu_field_names.size(); i++) {
+        fields.push_back({cpu_field_names[i].c_str(), cpu_rates[i]});
+    }
+
+    output.stats("softnet", fields.data(), fields.size());
+}
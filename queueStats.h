@@ -0,0 +1,167 @@
+//queueStats.h - Per-queue and per-CPU receive statistics, for RSS imbalance
+//
+// An interface's aggregate counters can look fine while one of its receive
+// queues, or the CPU its interrupts land on, is saturated. QueueStats
+// gathers each queue's packet and byte counters from the driver's ethtool
+// statistics and each CPU's softnet counters from /proc/net/softnet_stat,
+// and rates them. How unevenly the traffic is spread is scored as the
+// busiest queue's (or CPU's) packet rate over the average: 1 when it is
+// spread evenly, the number of queues when one takes it all.
+//
+// Collection is tiered. The expensive part, the driver's list of statistic
+// names and which queue and counter each one is, is learnt once per
+// interface, along with how many queues sysfs lists under queues/. From then
+// on a pass is one ETHTOOL_GSTATS ioctl per interface, on one control
+// socket, into a buffer kept for it, and one read of softnet_stat. The
+// names are learnt again if the driver's count of statistics changes.
+// Drivers name their per-queue counters in many ways (rx_queue_0_packets,
+// rx0_packets, rx-0.rx_packets, [0]: rx_ucast_packets...); the first
+// packets and bytes counters found for each queue are taken
+
+#ifndef QUEUE_STATS_H
+#define QUEUE_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "collector.h"
+#include "linkControl.h"
+#include "outputSink.h"
+
+// Where the per-CPU softnet counters are read unless told otherwise
+#define PROC_SOFTNET_STAT "/proc/net/softnet_stat"
+
+// How unevenly packets are spread over queues or CPUs
+struct spread_score
+{
+    // The busiest one's packet rate over the average, 0 without traffic
+    double imbalance;
+    // Which one is the busiest
+    int hottest;
+};
+
+// Scores packet rates spread over count queues or CPUs
+spread_score score_spread(const double *rates, size_t count);
+
+class QueueStats
+{
+public:
+    // Queues and CPUs beyond these still count towards the scores, but
+    // their own rates are not reported, to keep a report to one line
+    static const int MAX_REPORTED_QUEUES = 16;
+    static const int MAX_REPORTED_CPUS = 16;
+
+    explicit QueueStats(const std::string &sysfs_root = SYSFS_NET_ROOT,
+                        const std::string &softnet_path = PROC_SOFTNET_STAT);
+    ~QueueStats();
+
+    QueueStats(const QueueStats &) = delete;
+    QueueStats &operator=(const QueueStats &) = delete;
+
+    // Starts tracking the named interface and returns its index
+    int add_interface(const std::string &interface_name);
+
+    // Refreshes an interface's queue counters and rates. Returns false if
+    // its driver has no per-queue statistics, or they could not be read
+    bool collect(int interface);
+
+    // Forgets an interface's previous counters, as when it is removed
+    void clear(int interface);
+
+    // Reports an interface's queues, as stats named "queues/<interface>",
+    // once two collects have given it rates
+    void report(int interface, OutputSink &output);
+
+    // Refreshes every CPU's softnet counters and rates. Returns false if
+    // softnet_stat could not be read
+    bool collect_softnet();
+
+    // Reports the CPUs, as stats named "softnet", once two collects have
+    // given them rates
+    void report_softnet(OutputSink &output);
+
+private:
+    enum queue_direction
+    {
+        QUEUE_RX,
+        QUEUE_TX
+    };
+
+    // Where a queue's counter is among the driver's statistics
+    struct queue_counter
+    {
+        int stat;
+        int queue;
+        queue_direction direction;
+        bool bytes;
+    };
+
+    struct queue_rates
+    {
+        double packets;
+        double bytes;
+    };
+
+    struct tracked_interface
+    {
+        std::string name;
+        // What its stats are reported as, "queues/<interface>"
+        std::string report_name;
+
+        // Learnt once: how many statistics the driver has and which of them
+        // are queue counters, the queues sysfs lists and the names the
+        // queues' rates are reported under
+        bool learnt = false;
+        uint32_t stat_count = 0;
+        std::vector<queue_counter> counters;
+        int queue_count[2] = {0, 0};
+        std::vector<std::string> field_names[2];
+
+        // Refreshed every pass: the ETHTOOL_GSTATS reply, the counters it
+        // held last time and when, and the rates between the two
+        std::vector<uint64_t> reply;
+        std::vector<uint64_t> previous;
+        uint64_t previous_ns = 0;
+        bool has_previous = false;
+        std::vector<queue_rates> rates[2];
+        bool has_rates = false;
+    };
+
+    // One CPU's softnet counters: packets processed, dropped because the
+    // backlog was full, and times its budget ran out with work left
+    struct softnet_counters
+    {
+        uint64_t processed;
+        uint64_t dropped;
+        uint64_t time_squeeze;
+    };
+
+    bool learn(tracked_interface &tracked);
+    int count_queues(const std::string &interface_name, const char *prefix);
+
+    std::string sysfs_directory;
+    std::string softnet_path;
+    LinkControl control;
+    std::vector<tracked_interface> interfaces;
+
+    // softnet_stat, kept open and read into a buffer kept for it
+    int softnet_fd;
+    std::vector<char> softnet_text;
+    std::vector<int> cpu_ids;
+    std::vector<softnet_counters> softnet_current;
+    std::vector<softnet_counters> softnet_previous;
+    uint64_t softnet_previous_ns;
+    bool softnet_has_previous;
+    std::vector<double> cpu_rates;
+    double softnet_drops;
+    double softnet_squeezes;
+    bool softnet_has_rates;
+    std::vector<std::string> cpu_field_names;
+
+    // The fields of the report being made, kept between reports
+    std::vector<stat_field> fields;
+    std::vector<double> packet_rates;
+};
+
+#endif
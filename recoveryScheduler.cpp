@@ -0,0 +1,152 @@
+//recoveryScheduler.cpp - When links that went down are set up again
+
+#include "recoveryScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "sampleTimer.h"
+
+const uint64_t NS_PER_MS = 1000000;
+
+void RecoveryScheduler::add_interface(int interface)
+{
+    if ((size_t)interface >= links.size()) {
+        links.resize(interface + 1);
+    }
+}
+
+// The link's penalty as it has decayed by now_ns
+double RecoveryScheduler::decayed_penalty(const link_recovery &link, uint64_t now_ns) const
+{
+    if (policy.half_life_ms <= 0 || link.penalty == 0) {
+        return 0;
+    }
+
+    double elapsed_ms = (double)(now_ns - link.penalty_ns) / NS_PER_MS;
+
+    return link.penalty * std::exp2(-elapsed_ms / policy.half_life_ms);
+}
+
+bool RecoveryScheduler::link_down(int interface, uint64_t now_ns)
+{
+    link_recovery &link = links[interface];
+
+    // Going down again soon after a recovery, or without ever coming up
+    // from the last attempt, backs off further every time, staying up for a
+    // while starts over
+    if (link.attempted || (link.recovered_ns != 0 &&
+        now_ns - link.recovered_ns < (uint64_t)policy.max_backoff_ms * NS_PER_MS)) {
+        link.quick_downs++;
+    } else {
+        link.quick_downs = 0;
+    }
+    link.attempted = false;
+
+    uint64_t delay_ms = backoff_delay_ms(policy.backoff_ms, policy.max_backoff_ms, link.quick_downs);
+
+    bool suppressed = false;
+
+    if (policy.half_life_ms > 0) {
+        link.penalty = std::min(decayed_penalty(link, now_ns) + FLAP_PENALTY, (double)MAX_PENALTY);
+        link.penalty_ns = now_ns;
+
+        // Held down until the penalty has decayed to the reuse level
+        if (link.penalty > SUPPRESS_PENALTY) {
+            uint64_t reuse_ms = policy.half_life_ms * std::log2(link.penalty / REUSE_PENALTY);
+
+            delay_ms = std::max(delay_ms, reuse_ms);
+            suppressed = true;
+            suppressions++;
+        }
+    }
+
+    if (link.due_ns == 0) {
+        scheduled.push_back(interface);
+    }
+    link.due_ns = now_ns + delay_ms * NS_PER_MS;
+
+    return !suppressed;
+}
+
+void RecoveryScheduler::link_up(int interface)
+{
+    links[interface].attempted = true;
+    links_up++;
+}
+
+void RecoveryScheduler::link_up_failed(int interface)
+{
+    links[interface].attempted = true;
+    failures++;
+}
+
+void RecoveryScheduler::recovered(int interface, uint64_t now_ns)
+{
+    links[interface].recovered_ns = now_ns;
+    links[interface].attempted = false;
+    recoveries++;
+}
+
+void RecoveryScheduler::cancel(int interface)
+{
+    if ((size_t)interface >= links.size() || links[interface].due_ns == 0) {
+        return;
+    }
+
+    links[interface].due_ns = 0;
+    scheduled.erase(std::find(scheduled.begin(), scheduled.end(), interface));
+}
+
+void RecoveryScheduler::cancel_all()
+{
+    for (int interface : scheduled) {
+        links[interface].due_ns = 0;
+    }
+    scheduled.clear();
+}
+
+void RecoveryScheduler::take_due(uint64_t now_ns, std::vector<int> &due)
+{
+    due.clear();
+
+    for (int interface : scheduled) {
+        if (links[interface].due_ns <= now_ns) {
+            due.push_back(interface);
+        }
+    }
+
+    std::sort(due.begin(), due.end(), [this](int first, int second) {
+        return links[first].due_ns < links[second].due_ns;
+    });
+
+    // What does not fit in this tick's batch stays scheduled for the next
+    if (due.size() > (size_t)policy.batch) {
+        deferrals += due.size() - policy.batch;
+        due.resize(policy.batch);
+    }
+
+    for (int interface : due) {
+        links[interface].due_ns = 0;
+    }
+    scheduled.erase(std::remove_if(scheduled.begin(), scheduled.end(),
+                                   [this](int interface) { return links[interface].due_ns == 0; }),
+                    scheduled.end());
+
+    attempts += due.size();
+}
+
+void RecoveryScheduler::report(OutputSink &output) const
+{
+    const stat_field fields[] = {
+        {"attempts", (double)attempts},
+        {"links_up", (double)links_up},
+        {"failures", (double)failures},
+        {"recovered", (double)recoveries},
+        {"suppressed", (double)suppressions},
+        {"deferred", (double)deferrals},
+        {"pending", (double)scheduled.size()},
+    };
+
+    output.stats("recoveries", fields, sizeof(fields) / sizeof(fields[0]));
+}
@@ -0,0 +1,119 @@
+//recoveryScheduler.h - When links that went down are set up again
+//
+// Setting a link up the moment it reports Link Down turns a switch reboot,
+// where dozens of ports flap together and keep flapping, into a storm of
+// attempts. Instead each Link Down schedules a recovery, and the recoveries
+// that are due are taken together once per tick, no more than a batch of
+// them. A link that goes down again soon after being recovered waits longer
+// each time (exponential backoff), and one that keeps flapping is damped:
+// every Link Down adds to a penalty that halves over a half-life, and while
+// it is over the suppress level the link is left down until the penalty
+// decays to the reuse level. How the attempts went is counted for reporting
+
+#ifndef RECOVERY_SCHEDULER_H
+#define RECOVERY_SCHEDULER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "outputSink.h"
+
+struct recovery_policy
+{
+    // The wait before recovering a link that went down again within
+    // max_backoff_ms of its last recovery, doubled for every further time,
+    // up to max_backoff_ms. A link that stayed up longer is recovered on the
+    // next tick
+    long backoff_ms = 1000;
+    long max_backoff_ms = 60000;
+
+    // The most recoveries started on one tick, the rest wait for the next
+    int batch = 8;
+
+    // How long a link's flap penalty takes to halve, 0 for no damping
+    long half_life_ms = 30000;
+};
+
+class RecoveryScheduler
+{
+public:
+    // Added to a link's penalty for every Link Down. Recovery is suppressed
+    // above SUPPRESS_PENALTY until the penalty is back under REUSE_PENALTY,
+    // and the penalty never goes over MAX_PENALTY, so no link is held down
+    // for more than four half-lives
+    static const int FLAP_PENALTY = 1000;
+    static const int SUPPRESS_PENALTY = 3000;
+    static const int REUSE_PENALTY = 750;
+    static const int MAX_PENALTY = 12000;
+
+    // How often the due recoveries are taken
+    static const long TICK_MS = 100;
+
+    RecoveryScheduler() {}
+
+    void set_policy(const recovery_policy &policy) { this->policy = policy; }
+
+    // Makes room for interfaces up to the given index, which is how they
+    // are known in every other call
+    void add_interface(int interface);
+
+    // Schedules the recovery of a link that went down at now_ns. Returns
+    // false if the link is flapping and its recovery suppressed for now
+    bool link_down(int interface, uint64_t now_ns);
+
+    // The link was set up (Link Up) or could not be (Link Up Failed). A
+    // Link Down before it is recovered backs off as a quick one does
+    void link_up(int interface);
+    void link_up_failed(int interface);
+
+    // The link's operstate is up again after a recovery
+    void recovered(int interface, uint64_t now_ns);
+
+    // Forgets the interface's scheduled recovery, if any. Its penalty is kept
+    void cancel(int interface);
+
+    // Forgets every scheduled recovery
+    void cancel_all();
+
+    // Replaces due with the interfaces whose recovery is due at now_ns, the
+    // longest waiting first and at most a batch of them
+    void take_due(uint64_t now_ns, std::vector<int> &due);
+
+    // Whether any recovery is scheduled
+    bool pending() const { return !scheduled.empty(); }
+
+    // Reports the attempts made so far, as stats named "recoveries"
+    void report(OutputSink &output) const;
+
+private:
+    struct link_recovery
+    {
+        // When the recovery is due, 0 when there is none scheduled
+        uint64_t due_ns = 0;
+        // The penalty as of penalty_ns
+        double penalty = 0;
+        uint64_t penalty_ns = 0;
+        // Link Downs in a row that came soon after a recovery
+        int quick_downs = 0;
+        uint64_t recovered_ns = 0;
+        // Set up, or tried to be, and not up yet
+        bool attempted = false;
+    };
+
+    double decayed_penalty(const link_recovery &link, uint64_t now_ns) const;
+
+    recovery_policy policy;
+    std::vector<link_recovery> links;
+
+    // The interfaces with a recovery scheduled
+    std::vector<int> scheduled;
+
+    uint64_t attempts = 0;
+    uint64_t links_up = 0;
+    uint64_t failures = 0;
+    uint64_t recoveries = 0;
+    uint64_t suppressions = 0;
+    uint64_t deferrals = 0;
+};
+
+#endif
@@ -0,0 +1,200 @@
+//sampleRing.cpp - Shared-memory ring of samples from an intfMonitor
+
+#include "sampleRing.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Identifies a segment as a sample ring of this layout
+const uint32_t RING_MAGIC = 0x534d5231;   // "SMR1"
+
+// The header gets the segment's first page, the entries follow it
+const size_t HEADER_SIZE = 4096;
+
+// The start of the segment, followed by the entries. head is only written
+// by the producer and tail only by the consumer, each on its own cache line
+// so the two sides never contend for one
+struct SampleRing::ring_header
+{
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t entry_size;
+
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint64_t> dropped;
+
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the ring is shared between processes so its counters must be lock free");
+
+// The segment size for a ring of the given capacity
+static size_t segment_size(uint32_t capacity)
+{
+    return HEADER_SIZE + sizeof(interface_information) * capacity;
+}
+
+SampleRing::SampleRing(int fd, void *mapping, size_t size, uint32_t capacity)
+    : segment_fd(fd), mapping(mapping), mapping_size(size), capacity(capacity), mask(capacity - 1)
+{
+    header = (ring_header *)mapping;
+    entries = (interface_information *)((char *)mapping + HEADER_SIZE);
+}
+
+SampleRing::~SampleRing()
+{
+    munmap(mapping, mapping_size);
+
+    if (segment_fd != -1) {
+        close(segment_fd);
+    }
+}
+
+SampleRing *SampleRing::create(uint32_t capacity)
+{
+    static_assert(sizeof(ring_header) <= HEADER_SIZE, "the ring header must fit in its page");
+
+    uint32_t rounded = 1;
+
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    int fd = memfd_create("intfMonitor-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    size_t size = segment_size(rounded);
+
+    // Seal the size so the consumer can never have the mapping pulled out
+    // from under it
+    if (ftruncate(fd, size) == -1
+            || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    ring_header *header = new (mapping) ring_header();
+    header->magic = RING_MAGIC;
+    header->capacity = rounded;
+    header->entry_size = sizeof(interface_information);
+    header->head.store(0);
+    header->dropped.store(0);
+    header->tail.store(0);
+
+    return new SampleRing(fd, mapping, size, rounded);
+}
+
+SampleRing *SampleRing::attach(int fd)
+{
+    struct stat status;
+
+    if (fstat(fd, &status) == -1) {
+        return nullptr;
+    }
+
+    // A segment too small for its header cannot be a ring
+    if ((size_t)status.st_size < HEADER_SIZE) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    // Only a segment sealed as create() seals it keeps its size, one the
+    // other process could still truncate would fault us when we read it
+    const int required_seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    if (seals == -1 || (seals & required_seals) != required_seals) {
+        errno = EPERM;
+        return nullptr;
+    }
+
+    void *mapping = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // Read once, the other process could change it between reads
+    ring_header *header = (ring_header *)mapping;
+    uint32_t capacity = *(volatile uint32_t *)&header->capacity;
+
+    // Check the layout matches ours and the entries fit in the segment
+    if (header->magic != RING_MAGIC
+            || header->entry_size != sizeof(interface_information)
+            || capacity == 0 || (capacity & (capacity - 1)) != 0
+            || segment_size(capacity) > (size_t)status.st_size) {
+        munmap(mapping, status.st_size);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return new SampleRing(-1, mapping, status.st_size, capacity);
+}
+
+bool SampleRing::push(const interface_information &info)
+{
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+
+    if (head - tail >= capacity) {
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    entries[head & mask] = info;
+
+    // Publish the entry only once it is completely written
+    header->head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool SampleRing::pop(interface_information &info)
+{
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t head = header->head.load(std::memory_order_acquire);
+
+    if (tail == head) {
+        return false;
+    }
+
+    // A producer can not be more than a ring ahead, one that claims to be
+    // only has its newest ring's worth taken
+    if (head - tail > capacity) {
+        tail = head - capacity;
+    }
+
+    info = entries[tail & mask];
+
+    // The producer's bytes are not trusted to end its operstate
+    info.operstate[OPERSTATE_LEN - 1] = '\0';
+
+    // Hand the slot back to the producer only once it has been copied out
+    header->tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+uint64_t SampleRing::dropped() const
+{
+    return header->dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,73 @@
+//sampleRing.h - Shared-memory ring of samples from an intfMonitor
+//
+// A single-producer/single-consumer ring in a memfd segment. The intfMonitor
+// creates it, passes the descriptor to the network monitor over the control
+// socket and from then on pushes every sample into it; the network monitor
+// maps the same segment and drains it on its own tick. Delivering a sample
+// costs no syscall and no copy through the kernel on either side, the socket
+// is left for control messages only
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "interfaceInfo.h"
+
+class SampleRing
+{
+public:
+    // The number of samples a ring holds by default, several seconds worth
+    // even at 100 samples per second
+    static const uint32_t DEFAULT_CAPACITY = 1024;
+
+    ~SampleRing();
+
+    SampleRing(const SampleRing &) = delete;
+    SampleRing &operator=(const SampleRing &) = delete;
+
+    // Creates a new ring in a memfd segment, capacity is rounded up to a
+    // power of two. Returns nullptr (with errno set) on failure
+    static SampleRing *create(uint32_t capacity = DEFAULT_CAPACITY);
+
+    // Maps a ring created by another process from its descriptor, checking
+    // that the segment really is one and is sealed against resizing.
+    // Returns nullptr (with errno set) on failure. The descriptor can be
+    // closed afterwards
+    static SampleRing *attach(int fd);
+
+    // The memfd backing the ring, only held by the creator
+    int fd() const { return segment_fd; }
+
+    // Producer side. Adds a sample, or counts it as dropped and returns false
+    // if the consumer has fallen a whole ring behind. Never blocks
+    bool push(const interface_information &info);
+
+    // Consumer side. Takes the oldest sample, with its operstate always
+    // terminated, returns false if empty
+    bool pop(interface_information &info);
+
+    // The number of samples the producer has had to drop so far
+    uint64_t dropped() const;
+
+private:
+    struct ring_header;
+
+    SampleRing(int fd, void *mapping, size_t size, uint32_t capacity);
+
+    int segment_fd;
+    void *mapping;
+    size_t mapping_size;
+    ring_header *header;
+    interface_information *entries;
+
+    // The capacity as checked when the ring was created or attached. The
+    // other process can write the header at any time, so its capacity is
+    // never trusted again
+    uint32_t capacity;
+    uint32_t mask;
+};
+
+#endif
@@ -0,0 +1,163 @@
+//sampleTimer.cpp - Drift-free sampling schedule
+
+#include "sampleTimer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+bool parse_interval(const char *text, long &interval_ms)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || value < MIN_INTERVAL_MS) {
+        return false;
+    }
+
+    interval_ms = value;
+
+    return true;
+}
+
+uint64_t backoff_delay_ms(long backoff_ms, long max_backoff_ms, int repeats)
+{
+    if (repeats <= 0) {
+        return 0;
+    }
+
+    uint64_t delay_ms = backoff_ms;
+
+    for (int i = 1; i < repeats && delay_ms < (uint64_t)max_backoff_ms; i++) {
+        delay_ms *= 2;
+    }
+
+    return std::min(delay_ms, (uint64_t)max_backoff_ms);
+}
+
+void tick_while_needed(int timer_fd, long tick_ms, bool needed)
+{
+    if (timer_fd == -1) {
+        return;
+    }
+
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    if (needed) {
+        interval.it_interval.tv_sec = tick_ms / 1000;
+        interval.it_interval.tv_nsec = (tick_ms % 1000) * 1000000L;
+        interval.it_value = interval.it_interval;
+    }
+
+    struct itimerspec current;
+    bool running = timerfd_gettime(timer_fd, &current) == 0 &&
+                   (current.it_value.tv_sec != 0 || current.it_value.tv_nsec != 0);
+
+    if (running != needed) {
+        timerfd_settime(timer_fd, 0, &interval, NULL);
+    }
+}
+
+bool apply_scheduling(const sampling_schedule &schedule)
+{
+    // With a pid of 0 both calls apply to the calling thread only
+    if (schedule.cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(schedule.cpu, &cpus);
+
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            return false;
+        }
+    }
+
+    if (schedule.fifo_priority > 0) {
+        struct sched_param parameters;
+
+        parameters.sched_priority = schedule.fifo_priority;
+
+        if (sched_setscheduler(0, SCHED_FIFO, &parameters) == -1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+SampleTimer::SampleTimer()
+    : timer_fd(-1), missed_ticks(0), reported_ticks(0),
+      first_due_ns(0), interval_ns(0), ticks(0)
+{
+}
+
+SampleTimer::~SampleTimer()
+{
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+}
+
+bool SampleTimer::start(long interval_ms)
+{
+    if (timer_fd == -1) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (timer_fd == -1) {
+            return false;
+        }
+    }
+
+    struct itimerspec schedule;
+
+    schedule.it_interval.tv_sec = interval_ms / 1000;
+    schedule.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+    // Every tick falls a whole number of intervals after now, the kernel
+    // keeps to that however late we read
+    clock_gettime(CLOCK_MONOTONIC, &schedule.it_value);
+    schedule.it_value.tv_sec += schedule.it_interval.tv_sec;
+    schedule.it_value.tv_nsec += schedule.it_interval.tv_nsec;
+    if (schedule.it_value.tv_nsec >= 1000000000L) {
+        schedule.it_value.tv_sec++;
+        schedule.it_value.tv_nsec -= 1000000000L;
+    }
+
+    first_due_ns = schedule.it_value.tv_sec * 1000000000ULL + schedule.it_value.tv_nsec;
+    interval_ns = interval_ms * 1000000ULL;
+    ticks = 0;
+
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &schedule, NULL) != -1;
+}
+
+bool SampleTimer::expired()
+{
+    uint64_t expirations;
+
+    while (read(timer_fd, &expirations, sizeof(expirations)) == -1) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    if (expirations > 1) {
+        missed_ticks += expirations - 1;
+    }
+    ticks += expirations;
+
+    return expirations > 0;
+}
+
+uint64_t SampleTimer::missed_since_last()
+{
+    uint64_t missed = missed_ticks - reported_ticks;
+
+    reported_ticks = missed_ticks;
+
+    return missed;
+}
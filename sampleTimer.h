@@ -0,0 +1,88 @@
+//sampleTimer.h - Drift-free sampling schedule
+//
+// Ticks on an absolute CLOCK_MONOTONIC schedule through a timerfd, so however
+// long a sample takes the next one is still due exactly one interval after
+// the last was. Ticks that pass while the sampler is busy are counted as
+// missed instead of being made up late. Also sets up the optional CPU pinning
+// and SCHED_FIFO scheduling that make intervals of a few milliseconds
+// affordable
+
+#ifndef SAMPLE_TIMER_H
+#define SAMPLE_TIMER_H
+
+#include <cstdint>
+
+// How often and how a sampler runs
+struct sampling_schedule
+{
+    // The time between samples, in milliseconds
+    long interval_ms = 1000;
+    // The CPU the sampler is pinned to, -1 to let it run anywhere
+    int cpu = -1;
+    // The SCHED_FIFO priority the sampler runs at, 0 for the normal scheduler
+    int fifo_priority = 0;
+};
+
+// The shortest interval accepted
+const long MIN_INTERVAL_MS = 1;
+
+// Parses a positive number of milliseconds (-t), returns false if invalid
+bool parse_interval(const char *text, long &interval_ms);
+
+// The wait before trying again after repeats quick failures in a row:
+// backoff_ms doubled for every one after the first, up to max_backoff_ms,
+// and none before the first
+uint64_t backoff_delay_ms(long backoff_ms, long max_backoff_ms, int repeats);
+
+// Ticks timer_fd every tick_ms while needed and stops it once not, so an
+// idle monitor is not woken for nothing. Re-arming a running timer would
+// put its next tick off, so it is only started when stopped and stopped
+// when running
+void tick_while_needed(int timer_fd, long tick_ms, bool needed);
+
+// Pins the calling thread to schedule.cpu and switches it to SCHED_FIFO at
+// schedule.fifo_priority, whichever are requested. Returns false (with errno
+// set) if either could not be done; SCHED_FIFO needs CAP_SYS_NICE
+bool apply_scheduling(const sampling_schedule &schedule);
+
+class SampleTimer
+{
+public:
+    SampleTimer();
+    ~SampleTimer();
+
+    SampleTimer(const SampleTimer &) = delete;
+    SampleTimer &operator=(const SampleTimer &) = delete;
+
+    // Starts ticking every interval_ms, the first tick is due one interval
+    // from now. Returns false (with errno set) on failure
+    bool start(long interval_ms);
+
+    // The descriptor to poll, readable once a tick is due
+    int fd() const { return timer_fd; }
+
+    // Consumes the ticks that are due without blocking. Returns true if at
+    // least one was, and counts any beyond the first as missed
+    bool expired();
+
+    // The number of ticks missed so far, and since the last call to
+    // missed_since_last()
+    uint64_t missed() const { return missed_ticks; }
+    uint64_t missed_since_last();
+
+    // When the latest tick consumed by expired() was due, in nanoseconds on
+    // CLOCK_MONOTONIC. Taken from now, it is how late the tick is being
+    // served
+    uint64_t due_ns() const { return first_due_ns + (ticks - 1) * interval_ns; }
+
+private:
+    int timer_fd;
+    uint64_t missed_ticks;
+    uint64_t reported_ticks;
+
+    uint64_t first_due_ns;
+    uint64_t interval_ns;
+    uint64_t ticks;
+};
+
+#endif
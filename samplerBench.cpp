@@ -0,0 +1,165 @@
+//samplerBench.cpp - Compares the per-sample cost of the sysfs read paths
+//
+// Usage: samplerBench [interface] [iterations]
+//
+// Times the original ifstream read_file() path (an open, read and close for
+// each of the 11 files on every sample) against SysfsSampler (one pread per
+// file through descriptors opened once) and the netlink collector (one dump
+// request for every interface). Read syscalls are measured from
+// /proc/self/io (which does not count socket send/recv); the open/close
+// count of each path is fixed by construction
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "interfaceInfo.h"
+#include "netlinkCollector.h"
+#include "sysfsSampler.h"
+
+// The files read by the original monitor loop, relative to the interface
+// directory
+static const char *legacy_files[] = {
+    "/operstate",
+    "/carrier_up_count",
+    "/carrier_down_count",
+    "/statistics/rx_bytes",
+    "/statistics/rx_dropped",
+    "/statistics/rx_errors",
+    "/statistics/rx_packets",
+    "/statistics/tx_bytes",
+    "/statistics/tx_dropped",
+    "/statistics/tx_errors",
+    "/statistics/tx_packets",
+};
+const int NUM_LEGACY_FILES = sizeof(legacy_files) / sizeof(legacy_files[0]);
+
+// The original read_file() from intfMonitor.cpp
+static std::string read_file(std::string filepath)
+{
+    std::string contents = "";
+
+    std::ifstream file;
+
+    file.open(filepath);
+
+    if (file.is_open())
+    {
+        file >> contents;
+
+        file.close();
+    }
+
+    return contents;
+}
+
+// Returns the number of read syscalls this process has made so far
+static long read_syscalls()
+{
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    long value;
+
+    while (io >> key >> value) {
+        if (key == "syscr:") {
+            return value;
+        }
+    }
+
+    return -1;
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *path, long long elapsed_ns, long reads,
+                   int opens_and_closes, int iterations)
+{
+    std::cout << path
+              << "  ns/sample:" << elapsed_ns / iterations
+              << "  read syscalls/sample:" << (double)reads / iterations
+              << "  open+close/sample:" << opens_and_closes
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string interface_name = argc > 1 ? argv[1] : "lo";
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+    std::string interface_directory = "/sys/class/net/" + interface_name;
+
+    if (iterations <= 0) {
+        std::cout << "samplerBench: iterations must be positive" << std::endl;
+        return 1;
+    }
+
+    // The original path, every file opened, read and closed on every sample
+    std::string sink;
+    long reads_before = read_syscalls();
+    long long start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        for (int f = 0; f < NUM_LEGACY_FILES; f++) {
+            sink = read_file(interface_directory + legacy_files[f]);
+        }
+    }
+
+    long long elapsed = now_ns() - start;
+    // Discount the read of /proc/self/io itself
+    long reads = read_syscalls() - reads_before - 1;
+    report("ifstream", elapsed, reads, 2 * NUM_LEGACY_FILES, iterations);
+
+    // The persistent descriptor path
+    SysfsSampler sampler;
+    interface_information info;
+
+    if (!sampler.open(interface_directory)) {
+        std::cout << "[ERR]: Unable to open " << interface_directory << ":" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    reads_before = read_syscalls();
+    start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        sampler.sample(info);
+    }
+
+    elapsed = now_ns() - start;
+    reads = read_syscalls() - reads_before - 1;
+    report("pread   ", elapsed, reads, 0, iterations);
+
+    // The netlink dump path
+    NetlinkCollector collector;
+
+    if (!collector.open()) {
+        std::cout << "[ERR]: Unable to open netlink:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+        return 1;
+    }
+    collector.add_interface(interface_name);
+
+    reads_before = read_syscalls();
+    start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        collector.collect(&info);
+    }
+
+    elapsed = now_ns() - start;
+    reads = read_syscalls() - reads_before - 1;
+    report("netlink ", elapsed, reads, 0, iterations);
+
+    return 0;
+}
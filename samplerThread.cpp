@@ -0,0 +1,467 @@
+//samplerThread.cpp - In-process monitoring of many interfaces from one thread
+
+#include "samplerThread.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+SamplerThread::SamplerThread(Collector *collector, const sampling_schedule &schedule,
+                             SelfStats *stats)
+    : collector(collector), schedule(schedule), stats(stats), stopping(false),
+      delivered(0)
+{
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    command_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+SamplerThread::~SamplerThread()
+{
+    stop();
+
+    if (wake_fd != -1) {
+        close(wake_fd);
+    }
+    if (command_fd != -1) {
+        close(command_fd);
+    }
+}
+
+int SamplerThread::add_interface(const std::string &interface_name)
+{
+    int interface = names.size();
+
+    for (size_t i = 0; i < names.size(); i++) {
+        if (removed[i] && names[i] == interface_name) {
+            interface = i;
+            break;
+        }
+    }
+
+    if (interface == (int)names.size()) {
+        names.push_back(interface_name);
+        removed.push_back(false);
+    }
+    removed[interface] = false;
+
+    if (!thread.joinable()) {
+        set_up(interface, interface_name);
+        return interface;
+    }
+
+    // The collector and the descriptors belong to the thread now, it sets the
+    // interface up before carrying out any command for it
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        additions.push_back({interface, interface_name});
+    }
+    write(command_fd, &one, sizeof(one));
+
+    return interface;
+}
+
+void SamplerThread::remove_interface(int interface)
+{
+    removed.at(interface) = true;
+
+    if (!thread.joinable()) {
+        tear_down(interface);
+        return;
+    }
+
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        removals.push_back(interface);
+    }
+    write(command_fd, &one, sizeof(one));
+}
+
+// Starts tracking an interface in the collector, a removed one under its
+// old index
+void SamplerThread::set_up(int interface, const std::string &interface_name)
+{
+    if (interface == (int)interfaces.size()) {
+        interfaces.emplace_back();
+        samples.resize(interfaces.size());
+        rate_calculator.resize(interfaces.size());
+    }
+
+    interface_descriptor &descriptor = interfaces[interface];
+
+    descriptor.name = interface_name;
+    descriptor.slot = collector->add_interface(interface_name);
+    descriptor.monitoring = false;
+
+    // The slot may have held another interface until the last tick
+    rate_calculator.clear(descriptor.slot);
+}
+
+// Stops tracking an interface, its slot is left zeroed so it rates as absent
+// until it is reused
+void SamplerThread::tear_down(int interface)
+{
+    interface_descriptor &descriptor = interfaces[interface];
+
+    if (descriptor.slot == -1) {
+        return;
+    }
+
+    collector->remove_interface(descriptor.slot);
+    memset(&samples[descriptor.slot], 0, sizeof(interface_information));
+    descriptor.slot = -1;
+    descriptor.monitoring = false;
+}
+
+bool SamplerThread::start()
+{
+    if (wake_fd == -1 || command_fd == -1 || !timer.start(schedule.interval_ms)) {
+        return false;
+    }
+
+    // Room for a tick's sample and a status change from every interface
+    // before the first handover, so a steady tick never grows them
+    events.reserve(2 * interfaces.size() + 16);
+    posting.reserve(events.capacity());
+    delivering.reserve(events.capacity());
+
+    // Without notifications a link going down is still caught by the
+    // operstate check on every tick, just later
+    if (!link_watcher.open()) {
+        std::cout << "[ERR]: Unable to watch link changes:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+    }
+
+    // Every interface is ready as soon as the thread exists, just as an
+    // intfMonitor is once it has connected
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        if (interfaces[i].slot != -1) {
+            post(i, MSG_READY);
+        }
+    }
+    hand_over();
+
+    thread = std::thread(&SamplerThread::run, this);
+
+    return true;
+}
+
+void SamplerThread::stop()
+{
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    write(command_fd, &one, sizeof(one));
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void SamplerThread::command(int interface, message_type request)
+{
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back({interface, request});
+    }
+    write(command_fd, &one, sizeof(one));
+}
+
+bool SamplerThread::next_event(interface_event &event)
+{
+    // Take everything posted so far in one go once the last lot is handed out
+    if (delivered == delivering.size()) {
+        delivering.clear();
+        delivered = 0;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (events.empty()) {
+            // Reset the descriptor's readiness now that everything is consumed
+            uint64_t count;
+            read(wake_fd, &count, sizeof(count));
+            return false;
+        }
+
+        delivering.swap(events);
+    }
+
+    event = delivering[delivered++];
+
+    return true;
+}
+
+// Queues an event to be handed over with the rest of the pass's
+void SamplerThread::post(int interface, message_type type,
+                         const interface_information *info,
+                         const interface_rates *rates)
+{
+    interface_event event;
+
+    event.interface = interface;
+    event.type = type;
+    if (info != nullptr) {
+        event.info = *info;
+    }
+    if (rates != nullptr) {
+        event.rates = *rates;
+    }
+
+    posting.push_back(event);
+}
+
+// Hands every event posted since the last time over to the network monitor
+// under one lock, and makes event_fd() readable with one write, however
+// many interfaces posted
+void SamplerThread::hand_over()
+{
+    if (posting.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (events.empty()) {
+            events.swap(posting);
+        } else {
+            events.insert(events.end(), posting.begin(), posting.end());
+        }
+    }
+    posting.clear();
+
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+}
+
+// Carries out a command exactly as an intfMonitor would on receiving the
+// equivalent message
+void SamplerThread::carry_out(const pending_command &pending)
+{
+    interface_descriptor &descriptor = interfaces[pending.interface];
+
+    // A removed interface is only told to shut down, which it already has
+    if (descriptor.slot == -1 && pending.request != MSG_SHUT_DOWN) {
+        return;
+    }
+
+    switch (pending.request) {
+        case MSG_MONITOR:
+            descriptor.monitoring = true;
+            post(pending.interface, MSG_MONITORING);
+            break;
+
+        case MSG_SET_LINK_UP:
+            if (link_control.set_link_up(descriptor.name) == -1) {
+                std::cout << "[ERR]: Unable to set interface up:" << std::endl
+                        << strerror(errno) << std::endl;
+                post(pending.interface, MSG_LINK_UP_FAILED);
+            } else {
+                post(pending.interface, MSG_LINK_UP);
+            }
+            break;
+
+        case MSG_SHUT_DOWN:
+            descriptor.monitoring = false;
+            post(pending.interface, MSG_DONE);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Samples every interface in one collector pass, rates them all in one batch
+// and hands the samples of the ones being monitored to the network monitor,
+// any whose link is no longer up stop being monitored and report Link Down
+void SamplerThread::sample_all()
+{
+    uint64_t started = monotonic_ns();
+    int found = collector->collect(samples.data());
+
+    if (found == -1) {
+        std::cout << "[ERR]: Unable to collect from " << collector->name() << ":" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+    }
+
+    // An interface that was not found has no counters to rate
+    counter_batch &batch = rate_calculator.next();
+
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        interface_descriptor &descriptor = interfaces[i];
+
+        if (descriptor.slot == -1) {
+            continue;
+        }
+
+        if (found == -1 || !collector->is_present(descriptor.slot)) {
+            if (found != -1 && descriptor.monitoring) {
+                std::cout << "[ERR]: Unable to read " << descriptor.name << ":" << std::endl;
+                std::cout << "interface not found" << std::endl;
+            }
+            memset(&samples[descriptor.slot], 0, sizeof(interface_information));
+        }
+    }
+
+    // Every slot is stored, the free ones as absent
+    for (size_t slot = 0; slot < samples.size(); slot++) {
+        batch.store(slot, samples[slot]);
+    }
+
+    rate_calculator.update();
+    uint64_t collected = monotonic_ns();
+
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        interface_descriptor &descriptor = interfaces[i];
+
+        if (!descriptor.monitoring) {
+            continue;
+        }
+
+        const interface_information &info = samples[descriptor.slot];
+        interface_rates rates;
+
+        rate_calculator.rates().get(descriptor.slot, rates);
+        post(i, MSG_SAMPLE, &info, &rates);
+
+        // If the operstate of the interface is not "up" then the interface
+        // has gone down and it is no longer monitored until told to again
+        if (strcmp(info.operstate, "up") != 0 && info.operstate[0] != '\0') {
+            link_down(i);
+        }
+    }
+
+    hand_over();
+
+    if (stats != nullptr) {
+        stats->stage(STAGE_COLLECT).record(collected - started);
+        stats->stage(STAGE_SEND).record(monotonic_ns() - collected);
+        stats->count_tick();
+    }
+}
+
+// Stops monitoring an interface whose link went down and reports it
+void SamplerThread::link_down(int interface)
+{
+    interfaces[interface].monitoring = false;
+    post(interface, MSG_LINK_DOWN);
+}
+
+// Handles every waiting link notification, a monitored interface that is
+// no longer up and running is reported straight away instead of at the
+// next tick
+void SamplerThread::watch_links()
+{
+    link_change change;
+
+    while (link_watcher.next_change(change)) {
+        if (link_is_running(change)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < interfaces.size(); i++) {
+            if (interfaces[i].monitoring && interfaces[i].name == change.name) {
+                link_down(i);
+            }
+        }
+    }
+
+    // Changes were lost, sample now to catch up on the real link states
+    if (link_watcher.overflowed()) {
+        sample_all();
+    }
+}
+
+void SamplerThread::run()
+{
+    // Pinning and real-time priority are best effort, without them the
+    // sampler still runs, just with more jitter
+    if (!apply_scheduling(schedule)) {
+        std::cout << "[ERR]: Unable to set the sampler's scheduling:" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+    }
+
+    // A descriptor of -1 (no link notifications) is skipped by poll()
+    struct pollfd descriptors[3];
+    descriptors[0].fd = command_fd;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = timer.fd();
+    descriptors[1].events = POLLIN;
+    descriptors[2].fd = link_watcher.fd();
+    descriptors[2].events = POLLIN;
+
+    while (true) {
+        // Sleep until the next tick unless a command, a stop or a link
+        // change arrives first
+        int ready = poll(descriptors, 3, -1);
+
+        if (ready == -1 && errno != EINTR) {
+            std::cout << "[ERR]: Sampler poll failed:" << std::endl;
+            std::cout << strerror(errno) << std::endl;
+        }
+
+        if (ready > 0 && (descriptors[2].revents & POLLIN)) {
+            watch_links();
+        }
+
+        carrying_out.clear();
+        setting_up.clear();
+        tearing_down.clear();
+        bool stop_requested = false;
+
+        if (ready > 0 && (descriptors[0].revents & POLLIN)) {
+            uint64_t count;
+            read(command_fd, &count, sizeof(count));
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            tearing_down.swap(removals);
+            setting_up.swap(additions);
+            carrying_out.swap(commands);
+            stop_requested = stopping;
+        }
+
+        // Removed interfaces are done as soon as they are no longer
+        // tracked, and new ones ready as soon as they are
+        for (int interface : tearing_down) {
+            tear_down(interface);
+            post(interface, MSG_DONE);
+        }
+
+        for (const pending_addition &addition : setting_up) {
+            set_up(addition.interface, addition.name);
+            post(addition.interface, MSG_READY);
+        }
+
+        for (const pending_command &command : carrying_out) {
+            carry_out(command);
+        }
+
+        // What the link changes and commands posted goes over together
+        hand_over();
+
+        if (stop_requested) {
+            break;
+        }
+
+        // Missed ticks are only counted here, printing them could block
+        // sampling behind a slow terminal
+        if (ready > 0 && (descriptors[1].revents & POLLIN) && timer.expired()) {
+            if (stats != nullptr) {
+                stats->stage(STAGE_TICK_LAG).record(monotonic_ns() - timer.due_ns());
+            }
+            sample_all();
+        }
+    }
+}
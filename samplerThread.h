@@ -0,0 +1,171 @@
+//samplerThread.h - In-process monitoring of many interfaces from one thread
+//
+// The in-process alternative to starting an intfMonitor per interface. A
+// single thread owns every interface descriptor, samples all of them through
+// one collector on a shared tick (one second unless configured otherwise)
+// and reports the same statuses and samples an intfMonitor sends as events,
+// while the network monitor drives it with the same Monitor, Set Link Up and
+// Shut Down commands it would send an intfMonitor. Link changes are watched
+// through rtnetlink notifications between ticks, so a link going down is
+// reported as soon as the kernel says so
+
+#ifndef SAMPLER_THREAD_H
+#define SAMPLER_THREAD_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "collector.h"
+#include "counterBatch.h"
+#include "interfaceInfo.h"
+#include "linkControl.h"
+#include "linkWatcher.h"
+#include "protocol.h"
+#include "sampleTimer.h"
+#include "selfStats.h"
+
+// A status reported by the sampler, the same message an intfMonitor would
+// send (MSG_READY, MSG_LINK_DOWN, MSG_SAMPLE, ...). info and rates are only
+// set for MSG_SAMPLE
+struct interface_event
+{
+    int interface;
+    message_type type;
+    interface_information info;
+    interface_rates rates;
+};
+
+class SamplerThread
+{
+public:
+    // The sampler takes ownership of the collector, and runs on the given
+    // schedule. If stats are given each tick's lag, collection and hand-over
+    // are timed into them
+    explicit SamplerThread(Collector *collector,
+                           const sampling_schedule &schedule = sampling_schedule(),
+                           SelfStats *stats = nullptr);
+    ~SamplerThread();
+
+    SamplerThread(const SamplerThread &) = delete;
+    SamplerThread &operator=(const SamplerThread &) = delete;
+
+    // Adds an interface to be sampled and returns its index, which is used
+    // to address commands and identifies the interface in events. Once the
+    // thread is running the interface is set up on it and reports Ready,
+    // without disturbing the interfaces already being sampled. A name that
+    // was removed gets its old index back
+    int add_interface(const std::string &interface_name);
+
+    // Stops sampling an interface that has gone away and gives its
+    // collector slot up. It reports Done, as it would on Shut Down
+    void remove_interface(int interface);
+
+    // Starts the sampler thread, every interface reports Ready once it runs.
+    // Returns false (with errno set) if it could not be started
+    bool start();
+
+    // Stops sampling and waits for the thread to finish
+    void stop();
+
+    // Queues a command (MSG_MONITOR, MSG_SET_LINK_UP or MSG_SHUT_DOWN) for
+    // an interface, it is carried out on the sampler thread straight away
+    // rather than at the next tick
+    void command(int interface, message_type request);
+
+    // A descriptor that becomes readable while events are waiting, for use
+    // with select() alongside the network monitor's sockets
+    int event_fd() const { return wake_fd; }
+
+    // Pops the oldest waiting event, returns false if there are none
+    bool next_event(interface_event &event);
+
+    // The number of ticks the sampler was too busy to take
+    uint64_t missed_ticks() const { return timer.missed(); }
+
+private:
+    struct interface_descriptor
+    {
+        std::string name;
+        // -1 while removed
+        int slot;
+        bool monitoring;
+    };
+
+    struct pending_addition
+    {
+        int interface;
+        std::string name;
+    };
+
+    struct pending_command
+    {
+        int interface;
+        message_type request;
+    };
+
+    void run();
+    void set_up(int interface, const std::string &interface_name);
+    void tear_down(int interface);
+    void carry_out(const pending_command &pending);
+    void sample_all();
+    void watch_links();
+    void link_down(int interface);
+    void post(int interface, message_type type,
+              const interface_information *info = nullptr,
+              const interface_rates *rates = nullptr);
+    void hand_over();
+
+    std::unique_ptr<Collector> collector;
+    std::vector<interface_descriptor> interfaces;
+    std::vector<interface_information> samples;
+
+    // Every slot's rates are worked out together as each tick is collected
+    BatchRateCalculator rate_calculator;
+
+    LinkWatcher link_watcher;
+    LinkControl link_control;
+
+    sampling_schedule schedule;
+    SampleTimer timer;
+    SelfStats *stats;
+
+    // Commands, events and additions are handed over by swapping a filled
+    // vector for an emptied one, so once both have grown to the busiest
+    // tick's size no tick allocates
+    std::thread thread;
+    std::mutex mutex;
+    std::vector<pending_command> commands;
+    std::vector<interface_event> events;
+    bool stopping;
+
+    // Belong to the sampler thread: the events posted since the last hand
+    // over, and the commands, additions and removals taken to be carried out
+    std::vector<interface_event> posting;
+    std::vector<pending_command> carrying_out;
+    std::vector<pending_addition> setting_up;
+    std::vector<int> tearing_down;
+
+    // Belong to the network monitor: the events taken to be handed out one
+    // at a time by next_event(), and how many have been
+    std::vector<interface_event> delivering;
+    size_t delivered;
+
+    // Interfaces added and removed while running, waiting for the thread
+    std::vector<pending_addition> additions;
+    std::vector<int> removals;
+
+    // Belong to the network monitor: every interface's name however far its
+    // set up has got, and which of them have been removed since
+    std::vector<std::string> names;
+    std::vector<bool> removed;
+
+    // Readable while events wait for the network monitor, and while commands
+    // wait for the sampler thread
+    int wake_fd;
+    int command_fd;
+};
+
+#endif
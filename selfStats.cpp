@@ -0,0 +1,396 @@
+//selfStats.cpp - What the monitor itself costs
+
+#include "selfStats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/resource.h>
+
+#include "interfaceInfo.h"
+#include "outputSink.h"
+
+// Every allocation through operator new is counted here. Replacing the
+// global operator is the only way to see the allocations made inside the
+// standard library as well as our own
+static std::atomic<uint64_t> allocation_count(0);
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    void *memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+const char *stage_name(stats_stage stage)
+{
+    switch (stage) {
+        case STAGE_TICK_LAG: return "tick_lag";
+        case STAGE_COLLECT: return "collect";
+        case STAGE_SEND: return "send";
+        case STAGE_DELIVERY: return "delivery";
+        case STAGE_DISPATCH: return "dispatch";
+        case STAGE_FORMAT: return "format";
+        case STAGE_RECOVERY: return "recovery";
+        default: return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram() : total(0), largest(0)
+{
+    for (std::atomic<uint64_t> &count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Durations under 16 ns have a bucket each, above that each power of two
+// has SUB_BUCKETS
+int LatencyHistogram::bucket(uint64_t duration_ns)
+{
+    if (duration_ns < SUB_BUCKETS) {
+        return duration_ns;
+    }
+
+    int exponent = 63 - __builtin_clzll(duration_ns);
+    int sub_bucket = (duration_ns >> (exponent - 4)) - SUB_BUCKETS;
+
+    return (exponent - 3) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucket_top(int index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    int exponent = index / SUB_BUCKETS + 3;
+    uint64_t width = 1ULL << (exponent - 4);
+    uint64_t bottom = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << (exponent - 4);
+
+    return bottom + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t duration_ns)
+{
+    counts[bucket(duration_ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t seen = largest.load(std::memory_order_relaxed);
+    while (duration_ns > seen &&
+           !largest.compare_exchange_weak(seen, duration_ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    uint64_t recorded = count();
+
+    if (recorded == 0) {
+        return 0;
+    }
+
+    // The rank of the recording wanted, counting from 1
+    uint64_t rank = fraction * recorded;
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+            // The top of the bucket can overshoot what was actually recorded
+            uint64_t top = bucket_top(i);
+            return top < max() ? top : max();
+        }
+    }
+
+    return max();
+}
+
+uint64_t allocations_made()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void read_process_usage(process_usage &usage)
+{
+    struct rusage resources;
+
+    memset(&usage, 0, sizeof(usage));
+
+    if (getrusage(RUSAGE_SELF, &resources) == 0) {
+        usage.cpu_ns = (resources.ru_utime.tv_sec + resources.ru_stime.tv_sec) * 1000000000ULL +
+                       (resources.ru_utime.tv_usec + resources.ru_stime.tv_usec) * 1000ULL;
+        usage.context_switches = resources.ru_nvcsw + resources.ru_nivcsw;
+    }
+
+    usage.allocations = allocations_made();
+
+    FILE *io = fopen("/proc/self/io", "re");
+    if (io == nullptr) {
+        return;
+    }
+
+    char name[32];
+    unsigned long long value;
+
+    while (fscanf(io, "%31[^:]: %llu\n", name, &value) == 2) {
+        if (strcmp(name, "rchar") == 0) {
+            usage.read_bytes = value;
+        } else if (strcmp(name, "wchar") == 0) {
+            usage.written_bytes = value;
+        } else if (strcmp(name, "syscr") == 0) {
+            usage.read_calls = value;
+        } else if (strcmp(name, "syscw") == 0) {
+            usage.write_calls = value;
+        }
+    }
+
+    fclose(io);
+}
+
+// The usage between two readings
+static process_usage usage_since(const process_usage &now, const process_usage &before)
+{
+    process_usage used;
+
+    used.cpu_ns = now.cpu_ns - before.cpu_ns;
+    used.read_calls = now.read_calls - before.read_calls;
+    used.write_calls = now.write_calls - before.write_calls;
+    used.read_bytes = now.read_bytes - before.read_bytes;
+    used.written_bytes = now.written_bytes - before.written_bytes;
+    used.allocations = now.allocations - before.allocations;
+    used.context_switches = now.context_switches - before.context_switches;
+
+    return used;
+}
+
+// The usage an intfMonitor sent
+static process_usage payload_usage(const stats_payload &payload)
+{
+    process_usage usage;
+
+    usage.cpu_ns = payload.cpu_ns;
+    usage.read_calls = payload.read_calls;
+    usage.write_calls = payload.write_calls;
+    usage.read_bytes = payload.read_bytes;
+    usage.written_bytes = payload.written_bytes;
+    usage.allocations = payload.allocations;
+    usage.context_switches = payload.context_switches;
+
+    return usage;
+}
+
+// Reports the usage over elapsed_ns, per tick. children is only reported
+// for the intfMonitors
+static void report_usage(OutputSink &output, const char *name, double elapsed_ns,
+                         double ticks_taken, const process_usage &used, int children = -1)
+{
+    double per_tick = ticks_taken > 0 ? 1.0 / ticks_taken : 0;
+
+    const stat_field fields[] = {
+        {"seconds", elapsed_ns / 1e9},
+        {"ticks", ticks_taken},
+        {"cpu_percent", elapsed_ns > 0 ? 100.0 * used.cpu_ns / elapsed_ns : 0},
+        {"cpu_us_per_tick", used.cpu_ns / 1000.0 * per_tick},
+        {"read_calls_per_tick", used.read_calls * per_tick},
+        {"write_calls_per_tick", used.write_calls * per_tick},
+        {"read_bytes_per_tick", used.read_bytes * per_tick},
+        {"written_bytes_per_tick", used.written_bytes * per_tick},
+        {"allocations_per_tick", used.allocations * per_tick},
+        {"wakeups_per_tick", used.context_switches * per_tick},
+        {"children", (double)children},
+    };
+    size_t count = sizeof(fields) / sizeof(fields[0]);
+
+    output.stats(name, fields, children >= 0 ? count : count - 1);
+}
+
+SelfStats::SelfStats() : ticks(0), last_ticks(0)
+{
+    read_process_usage(last_usage);
+    last_report_ns = monotonic_ns();
+}
+
+void SelfStats::report(OutputSink &output)
+{
+    // Durations are reported in microseconds
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const LatencyHistogram &histogram = stages[i];
+
+        if (histogram.count() == 0) {
+            continue;
+        }
+
+        const stat_field fields[] = {
+            {"count", (double)histogram.count()},
+            {"p50_us", histogram.percentile(0.5) / 1000.0},
+            {"p90_us", histogram.percentile(0.9) / 1000.0},
+            {"p99_us", histogram.percentile(0.99) / 1000.0},
+            {"p999_us", histogram.percentile(0.999) / 1000.0},
+            {"max_us", histogram.max() / 1000.0},
+        };
+
+        output.stats(stage_name((stats_stage)i), fields, sizeof(fields) / sizeof(fields[0]));
+    }
+
+    // Usage is reported for the time since the last report, per tick
+    process_usage usage;
+    uint64_t now = monotonic_ns();
+    uint64_t ticks_now = ticks.load(std::memory_order_relaxed);
+
+    read_process_usage(usage);
+
+    double elapsed_ns = now - last_report_ns;
+
+    report_usage(output, "usage", elapsed_ns, ticks_now - last_ticks, usage_since(usage, last_usage));
+    report_children(output, elapsed_ns);
+
+    last_usage = usage;
+    last_ticks = ticks_now;
+    last_report_ns = now;
+}
+
+void SelfStats::pack(stats_payload &payload) const
+{
+    process_usage usage;
+
+    read_process_usage(usage);
+    memset(&payload, 0, sizeof(payload));
+
+    for (int i = 0; i < MONITOR_STAGES; i++) {
+        const LatencyHistogram &histogram = stages[STAGE_TICK_LAG + i];
+        stage_summary &summary = payload.stages[i];
+
+        summary.count = histogram.count();
+        summary.p50_ns = histogram.percentile(0.5);
+        summary.p90_ns = histogram.percentile(0.9);
+        summary.p99_ns = histogram.percentile(0.99);
+        summary.p999_ns = histogram.percentile(0.999);
+        summary.max_ns = histogram.max();
+    }
+
+    payload.ticks = ticks.load(std::memory_order_relaxed);
+    payload.cpu_ns = usage.cpu_ns;
+    payload.read_calls = usage.read_calls;
+    payload.write_calls = usage.write_calls;
+    payload.read_bytes = usage.read_bytes;
+    payload.written_bytes = usage.written_bytes;
+    payload.allocations = usage.allocations;
+    payload.context_switches = usage.context_switches;
+}
+
+void SelfStats::record_child(int interface, const stats_payload &payload)
+{
+    if ((size_t)interface >= children.size()) {
+        children.resize(interface + 1);
+    }
+
+    children[interface].latest = payload;
+    children[interface].has_latest = true;
+}
+
+void SelfStats::forget_child(int interface)
+{
+    if ((size_t)interface < children.size()) {
+        children[interface] = child_stats();
+    }
+}
+
+// The intfMonitors' stages and their usage since the previous report, all
+// of them together. An intfMonitor that was started again since counts
+// from 0
+void SelfStats::report_children(OutputSink &output, double elapsed_ns)
+{
+    static const char *const stage_names[MONITOR_STAGES] = {
+        "child_tick_lag",
+        "child_collect",
+        "child_send",
+    };
+    stage_summary worst[MONITOR_STAGES];
+    process_usage used;
+    uint64_t ticks_taken = 0;
+    int reporting = 0;
+
+    memset(worst, 0, sizeof(worst));
+    memset(&used, 0, sizeof(used));
+
+    for (child_stats &child : children) {
+        if (!child.has_latest) {
+            continue;
+        }
+
+        const stats_payload &latest = child.latest;
+        reporting++;
+
+        for (int i = 0; i < MONITOR_STAGES; i++) {
+            const stage_summary &summary = latest.stages[i];
+
+            worst[i].count += summary.count;
+            worst[i].p50_ns = std::max(worst[i].p50_ns, summary.p50_ns);
+            worst[i].p90_ns = std::max(worst[i].p90_ns, summary.p90_ns);
+            worst[i].p99_ns = std::max(worst[i].p99_ns, summary.p99_ns);
+            worst[i].p999_ns = std::max(worst[i].p999_ns, summary.p999_ns);
+            worst[i].max_ns = std::max(worst[i].max_ns, summary.max_ns);
+        }
+
+        bool restarted = !child.has_reported || latest.ticks < child.reported.ticks ||
+                         latest.cpu_ns < child.reported.cpu_ns;
+        process_usage since = restarted ? payload_usage(latest)
+                                        : usage_since(payload_usage(latest), payload_usage(child.reported));
+
+        ticks_taken += restarted ? latest.ticks : latest.ticks - child.reported.ticks;
+        used.cpu_ns += since.cpu_ns;
+        used.read_calls += since.read_calls;
+        used.write_calls += since.write_calls;
+        used.read_bytes += since.read_bytes;
+        used.written_bytes += since.written_bytes;
+        used.allocations += since.allocations;
+        used.context_switches += since.context_switches;
+
+        child.reported = latest;
+        child.has_reported = true;
+    }
+
+    if (reporting == 0) {
+        return;
+    }
+
+    for (int i = 0; i < MONITOR_STAGES; i++) {
+        if (worst[i].count == 0) {
+            continue;
+        }
+
+        const stat_field fields[] = {
+            {"count", (double)worst[i].count},
+            {"p50_us", worst[i].p50_ns / 1000.0},
+            {"p90_us", worst[i].p90_ns / 1000.0},
+            {"p99_us", worst[i].p99_ns / 1000.0},
+            {"p999_us", worst[i].p999_ns / 1000.0},
+            {"max_us", worst[i].max_ns / 1000.0},
+        };
+
+        output.stats(stage_names[i], fields, sizeof(fields) / sizeof(fields[0]));
+    }
+
+    report_usage(output, "child_usage", elapsed_ns, ticks_taken, used, reporting);
+}
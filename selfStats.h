@@ -0,0 +1,150 @@
+//selfStats.h - What the monitor itself costs
+//
+// Latency histograms for every stage a sample passes through on its way to
+// being reported, and counters of the CPU time, system calls, bytes and
+// allocations the process spends per sampling tick. Recording is a couple of
+// relaxed atomic increments, so it stays on in production and can be done
+// from the sampler thread and the event loop at once. Each intfMonitor
+// keeps its own and sends them to the network monitor when asked, which
+// reports them along with its own
+
+#ifndef SELF_STATS_H
+#define SELF_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol.h"
+
+class OutputSink;
+
+// The stages timed, in the order a sample passes through them
+enum stats_stage
+{
+    // From when a tick was due to when the sampler got round to it
+    STAGE_TICK_LAG,
+    // Reading every interface's counters in one collector pass, and in-process
+    // rating them
+    STAGE_COLLECT,
+    // Handing a tick's samples to the network monitor
+    STAGE_SEND,
+    // From a sample being read to the network monitor handling it
+    STAGE_DELIVERY,
+    // Handling one sample: rates, history, metrics and output
+    STAGE_DISPATCH,
+    // Formatting one sample for the output
+    STAGE_FORMAT,
+    // From a link being reported down to it being monitored again
+    STAGE_RECOVERY,
+    NUM_STAGES
+};
+
+const char *stage_name(stats_stage stage);
+
+// A histogram of durations in nanoseconds in the manner of HdrHistogram:
+// every power of two is split into 16 linear buckets, so any duration from
+// 1 ns up is kept to within 1/16th of itself in a fixed 8 KB
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t duration_ns);
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+
+    // The duration the given fraction (0.5, 0.99, ...) of the recordings
+    // are at or below, as the top of the bucket it falls in
+    uint64_t percentile(double fraction) const;
+
+private:
+    static const int SUB_BUCKETS = 16;
+    static const int NUM_BUCKETS = (64 - 3) * SUB_BUCKETS;
+
+    static int bucket(uint64_t duration_ns);
+    static uint64_t bucket_top(int index);
+
+    std::atomic<uint64_t> counts[NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+};
+
+// The process's resource use so far
+struct process_usage
+{
+    // User and system CPU time of every thread
+    uint64_t cpu_ns;
+    // read- and write-like system calls, and the bytes they moved, as
+    // /proc/self/io counts them
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t read_bytes;
+    uint64_t written_bytes;
+    // Allocations through operator new
+    uint64_t allocations;
+    // Times a thread gave up the CPU to wait, every wakeup is one
+    uint64_t context_switches;
+};
+
+// Reads the process's usage. /proc/self/io may be missing, in which case
+// its counts are left at 0
+void read_process_usage(process_usage &usage);
+
+// The number of allocations through operator new so far, cheap enough to
+// read around a single operation
+uint64_t allocations_made();
+
+class SelfStats
+{
+public:
+    SelfStats();
+
+    LatencyHistogram &stage(stats_stage which) { return stages[which]; }
+
+    // Counts a sampling tick, the unit the usage is reported per
+    void count_tick() { ticks.fetch_add(1, std::memory_order_relaxed); }
+
+    // Fills a Stats message with the stages an intfMonitor times and the
+    // process's usage so far
+    void pack(stats_payload &payload) const;
+
+    // Takes the Stats an interface's intfMonitor answered with
+    void record_child(int interface, const stats_payload &payload);
+
+    // Stops reporting an interface's intfMonitor, once it has gone
+    void forget_child(int interface);
+
+    // Reports every stage timed so far, and the usage since the previous
+    // report. The intfMonitors' are reported too, as the stages child_*,
+    // whose counts are the sum of theirs and whose percentiles are the
+    // worst of theirs, and child_usage, for all of them together
+    void report(OutputSink &output);
+
+private:
+    // The latest Stats of an intfMonitor, and those the previous report
+    // counted its usage from
+    struct child_stats
+    {
+        stats_payload latest;
+        stats_payload reported;
+        bool has_latest = false;
+        bool has_reported = false;
+    };
+
+    void report_children(OutputSink &output, double elapsed_ns);
+
+    LatencyHistogram stages[NUM_STAGES];
+    std::atomic<uint64_t> ticks;
+
+    process_usage last_usage;
+    uint64_t last_ticks;
+    uint64_t last_report_ns;
+
+    // Indexed by interface
+    std::vector<child_stats> children;
+};
+
+#endif
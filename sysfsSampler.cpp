@@ -0,0 +1,241 @@
+//sysfsSampler.cpp - Persistent descriptor sampler for an interface's sysfs files
+
+#include "sysfsSampler.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "counterBatch.h"
+
+// The counter files read on every sample (relative to the interface
+// directory) and the member of interface_information each one is parsed into
+static const struct
+{
+    const char *filename;
+    uint64_t interface_information::*member;
+} counter_files[SysfsSampler::NUM_COUNTER_FILES] = {
+    {"/carrier_up_count",      &interface_information::carrier_up_count},
+    {"/carrier_down_count",    &interface_information::carrier_down_count},
+    {"/statistics/rx_bytes",   &interface_information::rx_bytes},
+    {"/statistics/rx_dropped", &interface_information::rx_dropped},
+    {"/statistics/rx_errors",  &interface_information::rx_errors},
+    {"/statistics/rx_packets", &interface_information::rx_packets},
+    {"/statistics/tx_bytes",   &interface_information::tx_bytes},
+    {"/statistics/tx_dropped", &interface_information::tx_dropped},
+    {"/statistics/tx_errors",  &interface_information::tx_errors},
+    {"/statistics/tx_packets", &interface_information::tx_packets},
+};
+
+// sysfs regenerates a file's contents on every read at offset 0, so no seek
+// or reopen is needed
+ssize_t read_from_start(int fd, char *buf, size_t size)
+{
+    ssize_t bytes_read;
+
+    do {
+        bytes_read = pread(fd, buf, size, 0);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    return bytes_read;
+}
+
+bool read_operstate(int fd, char *operstate)
+{
+    char buf[32];
+    ssize_t length = read_from_start(fd, buf, sizeof(buf));
+
+    if (length == -1) {
+        return false;
+    }
+
+    // Strip the trailing newline and keep what fits
+    while (length > 0 && (buf[length - 1] == '\n' || buf[length - 1] == ' ')) {
+        length--;
+    }
+    if (length > OPERSTATE_LEN - 1) {
+        length = OPERSTATE_LEN - 1;
+    }
+    memcpy(operstate, buf, length);
+    operstate[length] = '\0';
+
+    return true;
+}
+
+bool read_counter(int fd, uint64_t &value)
+{
+    // Any counter fits with room to spare for the parser's read ahead
+    char buf[32];
+    static_assert(sizeof(buf) >= DECIMAL_READ_PADDING, "buffer too small to parse from");
+
+    ssize_t length = read_from_start(fd, buf, sizeof(buf));
+
+    if (length == -1) {
+        return false;
+    }
+
+    // A file that does not hold a number (some virtual devices report
+    // nothing) leaves the value at 0
+    value = 0;
+    parse_decimal(buf, buf + length, value);
+
+    return true;
+}
+
+SysfsSampler::SysfsSampler() : operstate_fd(-1)
+{
+    for (int i = 0; i < NUM_COUNTER_FILES; i++) {
+        counter_fds[i] = -1;
+    }
+}
+
+SysfsSampler::~SysfsSampler()
+{
+    close();
+}
+
+bool SysfsSampler::open(const std::string &interface_directory)
+{
+    close();
+    directory = interface_directory;
+
+    return reopen();
+}
+
+void SysfsSampler::close()
+{
+    if (operstate_fd != -1) {
+        ::close(operstate_fd);
+        operstate_fd = -1;
+    }
+
+    for (int i = 0; i < NUM_COUNTER_FILES; i++) {
+        if (counter_fds[i] != -1) {
+            ::close(counter_fds[i]);
+            counter_fds[i] = -1;
+        }
+    }
+}
+
+// Opens operstate and every counter file. operstate is required since it is
+// how the monitor decides the link is up; a counter file the kernel does not
+// provide (older kernels lack the carrier counts) is simply reported as 0
+bool SysfsSampler::reopen()
+{
+    close();
+
+    std::string filepath = directory + "/operstate";
+    operstate_fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (operstate_fd == -1) {
+        return false;
+    }
+
+    for (int i = 0; i < NUM_COUNTER_FILES; i++) {
+        filepath = directory + counter_files[i].filename;
+        counter_fds[i] = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    return true;
+}
+
+// Reads every open file into info. Returns false if any read fails, which
+// for sysfs means the device behind the descriptors has been unregistered
+bool SysfsSampler::read_all(interface_information &info)
+{
+    if (!read_operstate(operstate_fd, info.operstate)) {
+        return false;
+    }
+
+    for (int i = 0; i < NUM_COUNTER_FILES; i++) {
+        uint64_t value = 0;
+
+        if (counter_fds[i] != -1 && !read_counter(counter_fds[i], value)) {
+            return false;
+        }
+
+        info.*(counter_files[i].member) = value;
+    }
+
+    info.timestamp_ns = monotonic_ns();
+
+    return true;
+}
+
+bool SysfsSampler::sample(interface_information &info)
+{
+    // Descriptors were dropped on an earlier failure, try to find the
+    // interface again
+    if (operstate_fd == -1 && !reopen()) {
+        return false;
+    }
+
+    if (read_all(info)) {
+        return true;
+    }
+
+    // The interface went away under us. It may already be back (a quick
+    // delete and re-create), in which case the fresh files can be read now;
+    // otherwise leave everything closed until the next sample
+    if (!reopen()) {
+        return false;
+    }
+
+    if (read_all(info)) {
+        return true;
+    }
+
+    int saved_errno = errno;
+    close();
+    errno = saved_errno;
+
+    return false;
+}
+
+SysfsCollector::SysfsCollector(const std::string &root) : root_directory(root)
+{
+}
+
+int SysfsCollector::add_interface(const std::string &interface_name)
+{
+    std::unique_ptr<SysfsSampler> sampler(new SysfsSampler());
+
+    // An interface that is not there yet is retried on every collect()
+    sampler->open(root_directory + interface_name);
+
+    if (!free_slots.empty()) {
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        samplers[slot] = std::move(sampler);
+        return slot;
+    }
+
+    samplers.push_back(std::move(sampler));
+    present.push_back(false);
+
+    return samplers.size() - 1;
+}
+
+void SysfsCollector::remove_interface(int slot)
+{
+    // Closes the interface's files, nothing is retried for it any more
+    samplers[slot].reset();
+    present[slot] = false;
+    free_slots.push_back(slot);
+}
+
+int SysfsCollector::collect(interface_information *samples)
+{
+    int found = 0;
+
+    for (size_t slot = 0; slot < samplers.size(); slot++) {
+        present[slot] = samplers[slot] && samplers[slot]->sample(samples[slot]);
+
+        if (present[slot]) {
+            found++;
+        }
+    }
+
+    return found;
+}
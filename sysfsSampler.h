@@ -0,0 +1,88 @@
+//sysfsSampler.h - Persistent descriptor sampler for an interface's sysfs files
+//
+// Opens the operstate and counter files of an interface directory once and
+// re-reads them with pread() on every sample, rather than constructing a
+// stream and paying an open/read/close for each counter on every tick
+
+#ifndef SYSFS_SAMPLER_H
+#define SYSFS_SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "collector.h"
+#include "interfaceInfo.h"
+
+// Reads the sysfs file behind fd from its start into buf, returning the
+// length read or -1 (with errno set)
+ssize_t read_from_start(int fd, char *buf, size_t size);
+
+// Reads an operstate file into operstate (OPERSTATE_LEN long) without its
+// newline, and a counter file into value. Both return false (with errno set)
+// if the read fails, which is how a removed interface shows
+bool read_operstate(int fd, char *operstate);
+bool read_counter(int fd, uint64_t &value);
+
+class SysfsSampler
+{
+public:
+    // The number of counter files (everything except operstate) per sample
+    static const int NUM_COUNTER_FILES = 10;
+
+    SysfsSampler();
+    ~SysfsSampler();
+
+    SysfsSampler(const SysfsSampler &) = delete;
+    SysfsSampler &operator=(const SysfsSampler &) = delete;
+
+    // Opens the files under the given interface directory (for example
+    // "/sys/class/net/eth0"). Returns false if operstate could not be opened,
+    // in which case errno describes why
+    bool open(const std::string &interface_directory);
+
+    // Closes every open descriptor
+    void close();
+
+    // Re-reads every file into info. If the interface disappeared since the
+    // last sample the stale descriptors are dropped and the files reopened,
+    // so an interface that comes back is picked up again. Returns false (with
+    // errno set) if the interface is not currently present
+    bool sample(interface_information &info);
+
+    bool is_open() const { return operstate_fd != -1; }
+
+private:
+    bool reopen();
+    bool read_all(interface_information &info);
+
+    std::string directory;
+
+    int operstate_fd;
+    int counter_fds[NUM_COUNTER_FILES];
+};
+
+// The sysfs collector backend, one SysfsSampler per tracked interface
+class SysfsCollector : public Collector
+{
+public:
+    // root is the directory holding one directory per interface
+    explicit SysfsCollector(const std::string &root = SYSFS_NET_ROOT);
+
+    const char *name() const override { return "sysfs"; }
+    int add_interface(const std::string &interface_name) override;
+    void remove_interface(int slot) override;
+    int collect(interface_information *samples) override;
+    bool is_present(int slot) const override { return present[slot]; }
+
+private:
+    std::string root_directory;
+    // nullptr in the slots free to be reused
+    std::vector<std::unique_ptr<SysfsSampler>> samplers;
+    std::vector<bool> present;
+    std::vector<int> free_slots;
+};
+
+#endif
@@ -0,0 +1,556 @@
+//topDisplay.cpp - A live table of every interface, for networkMonitor --top
+
+#include "topDisplay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Changed cells this close together are sent as one run, unchanged ones and
+// all, as that is shorter than another cursor move
+const int MERGE_GAP = 4;
+
+// Lines taken by the title and the column headings above the table, and
+// by the keys below it
+const int TOP_LINES = 2;
+const int BOTTOM_LINES = 1;
+
+// Where each sort's column is in a line, and how wide it is
+struct sort_column
+{
+    const char *name;
+    int column;
+    int width;
+};
+
+static const sort_column SORT_COLUMNS[] = {
+    {"name", 0, 12},
+    {"state", 13, 7},
+    {"rx", 20, 14},
+    {"tx", 34, 14},
+    {"drops", 48, 7},
+    {"errors", 55, 7},
+    {"flaps", 62, 6},
+};
+
+// Writes a figure in at most 6 characters, scaled by thousands: 999, 12.3K,
+// 4.56G
+static void format_figure(double value, char *text, size_t size)
+{
+    const char units[] = " KMGTP";
+    int unit = 0;
+
+    while (value >= 999.5 && unit < 5) {
+        value /= 1000;
+        unit++;
+    }
+
+    if (unit == 0) {
+        snprintf(text, size, "%.0f", value);
+    } else if (value < 9.995) {
+        snprintf(text, size, "%.2f%c", value, units[unit]);
+    } else if (value < 99.95) {
+        snprintf(text, size, "%.1f%c", value, units[unit]);
+    } else {
+        snprintf(text, size, "%.0f%c", value, units[unit]);
+    }
+}
+
+// The escape sequence that sets a cell's attributes
+static void append_attributes(std::string &frame, uint8_t attributes)
+{
+    frame.append("\x1b[0");
+    if (attributes & 1) {
+        frame.append(";1");
+    }
+    if (attributes & 2) {
+        frame.append(";7");
+    }
+    frame.push_back('m');
+}
+
+TopDisplay::TopDisplay()
+    : fd(-1), input_fd(-1), raw_input(false), sort(SORT_NAME), reversed(false),
+      first_shown(0), width(0), height(0)
+{
+}
+
+TopDisplay::~TopDisplay()
+{
+    close();
+}
+
+bool TopDisplay::open(int fd, int input_fd)
+{
+    this->fd = fd;
+    this->input_fd = input_fd;
+
+    if (input_fd != -1 && isatty(input_fd)) {
+        if (tcgetattr(input_fd, &saved_mode) == -1) {
+            return false;
+        }
+
+        // Ctrl+C still sends SIGINT. A read returns at once with whatever
+        // keys there are, so the descriptor, which the terminal's output
+        // shares, is never made non-blocking
+        struct termios mode = saved_mode;
+        mode.c_lflag &= ~(ICANON | ECHO);
+        mode.c_cc[VMIN] = 0;
+        mode.c_cc[VTIME] = 0;
+        if (tcsetattr(input_fd, TCSANOW, &mode) == -1) {
+            return false;
+        }
+        raw_input = true;
+    }
+
+    // The alternate screen, cleared, without a cursor
+    frame.assign("\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J");
+    resize();
+
+    return write_frame();
+}
+
+void TopDisplay::close()
+{
+    if (fd == -1) {
+        return;
+    }
+
+    frame.assign("\x1b[0m\x1b[?25h\x1b[?1049l");
+    write_frame();
+
+    if (raw_input) {
+        tcsetattr(input_fd, TCSANOW, &saved_mode);
+        raw_input = false;
+    }
+
+    fd = -1;
+    input_fd = -1;
+}
+
+void TopDisplay::add_interface(int interface, const std::string &name)
+{
+    if ((size_t)interface >= rows.size()) {
+        rows.resize(interface + 1);
+        order.reserve(rows.size());
+    }
+
+    row &added = rows[interface];
+
+    if (added.name != name) {
+        added = row();
+        added.name = name;
+    }
+    added.active = true;
+}
+
+void TopDisplay::remove_interface(int interface)
+{
+    if ((size_t)interface < rows.size()) {
+        rows[interface].active = false;
+        rows[interface].sampled = false;
+    }
+}
+
+void TopDisplay::update(int interface, const interface_information &info, const interface_rates &rates)
+{
+    if ((size_t)interface >= rows.size()) {
+        return;
+    }
+
+    row &updated = rows[interface];
+
+    if (info.timestamp_ns == 0) {
+        strcpy(updated.operstate, "missing");
+    } else {
+        memcpy(updated.operstate, info.operstate, OPERSTATE_LEN);
+        updated.operstate[OPERSTATE_LEN - 1] = '\0';
+    }
+    updated.down = info.timestamp_ns == 0 || strcmp(updated.operstate, "down") == 0 ||
+                   strcmp(updated.operstate, "lowerlayerdown") == 0;
+
+    // A link that was deleted and created again counts from 0 again
+    if (!updated.sampled || info.carrier_down_count < updated.first_carrier_downs + updated.flaps) {
+        updated.first_carrier_downs = info.carrier_down_count;
+    }
+    updated.flaps = info.carrier_down_count - updated.first_carrier_downs;
+    updated.sampled = true;
+
+    // A sample with nothing to rate against keeps the last rates shown
+    if (rates.valid) {
+        updated.rx_bits = rates.rx_bits;
+        updated.rx_packets = rates.rx_packets;
+        updated.tx_bits = rates.tx_bits;
+        updated.tx_packets = rates.tx_packets;
+        updated.drops = rates.rx_dropped + rates.tx_dropped;
+        updated.errors = rates.rx_errors + rates.tx_errors;
+    }
+}
+
+void TopDisplay::set_status(int interface, const char *status)
+{
+    if ((size_t)interface < rows.size()) {
+        rows[interface].status = status;
+    }
+}
+
+bool TopDisplay::handle_input()
+{
+    char keys[64];
+    ssize_t length;
+    int page = std::max(height - TOP_LINES - BOTTOM_LINES, 1);
+
+    while (true) {
+        // Input that is not a terminal is only read as far as it has
+        // arrived, so the read can not block
+        size_t wanted = sizeof(keys);
+        int waiting;
+
+        if (!raw_input) {
+            if (ioctl(input_fd, FIONREAD, &waiting) == -1 || waiting <= 0) {
+                break;
+            }
+            wanted = std::min(wanted, (size_t)waiting);
+        }
+
+        length = read(input_fd, keys, wanted);
+        if (length <= 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < length; i++) {
+            char key = keys[i];
+
+            // The arrows and page keys arrive as escape sequences
+            if (key == '\x1b' && i + 2 < length && keys[i + 1] == '[') {
+                char code = keys[i + 2];
+                i += 2;
+
+                if (code == 'A') {
+                    key = 'k';
+                } else if (code == 'B') {
+                    key = 'j';
+                } else if ((code == '5' || code == '6') && i + 1 < length && keys[i + 1] == '~') {
+                    key = code == '5' ? 'b' : ' ';
+                    i++;
+                } else {
+                    continue;
+                }
+            }
+
+            switch (key) {
+                case 'n': set_sort(SORT_NAME, sort == SORT_NAME && !reversed); break;
+                case 's': set_sort(SORT_STATE, sort == SORT_STATE && !reversed); break;
+                case 'r': set_sort(SORT_RX, sort == SORT_RX && !reversed); break;
+                case 't': set_sort(SORT_TX, sort == SORT_TX && !reversed); break;
+                case 'd': set_sort(SORT_DROPS, sort == SORT_DROPS && !reversed); break;
+                case 'e': set_sort(SORT_ERRORS, sort == SORT_ERRORS && !reversed); break;
+                case 'f': set_sort(SORT_FLAPS, sort == SORT_FLAPS && !reversed); break;
+                case 'j': scroll(1); break;
+                case 'k': scroll(-1); break;
+                case ' ': scroll(page); break;
+                case 'b': scroll(-page); break;
+                // l or ctrl+L, for a screen something else wrote on
+                case 'l':
+                case '\x0c': resize(width, height); break;
+                case 'q': return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void TopDisplay::set_sort(top_sort sort, bool reversed)
+{
+    this->sort = sort;
+    this->reversed = reversed;
+    first_shown = 0;
+}
+
+void TopDisplay::scroll(int lines)
+{
+    // Kept in range when the next frame is drawn
+    first_shown = std::max(first_shown + lines, 0);
+}
+
+void TopDisplay::resize()
+{
+    struct winsize size;
+
+    if (fd != -1 && ioctl(fd, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+        resize(size.ws_col, size.ws_row);
+    } else {
+        resize(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    }
+}
+
+void TopDisplay::resize(int width, int height)
+{
+    this->width = std::min(std::max(width, 1), (int)sizeof(line_text) - 1);
+    this->height = std::max(height, 1);
+
+    size_t cells = (size_t)this->width * this->height;
+
+    // No cell holds '\0', so every one of them is drawn again
+    front_text.assign(cells, '\0');
+    front_attributes.assign(cells, ATTR_NORMAL);
+    back_text.resize(cells);
+    back_attributes.resize(cells);
+    frame.reserve(cells * 4);
+}
+
+bool TopDisplay::ordered_before(int first, int second) const
+{
+    const row &a = rows[first];
+    const row &b = rows[second];
+    double figure_a = 0;
+    double figure_b = 0;
+
+    switch (sort) {
+        case SORT_NAME:
+            break;
+        case SORT_STATE:
+            figure_a = a.down;
+            figure_b = b.down;
+            break;
+        case SORT_RX:
+            figure_a = a.rx_bits;
+            figure_b = b.rx_bits;
+            break;
+        case SORT_TX:
+            figure_a = a.tx_bits;
+            figure_b = b.tx_bits;
+            break;
+        case SORT_DROPS:
+            figure_a = a.drops;
+            figure_b = b.drops;
+            break;
+        case SORT_ERRORS:
+            figure_a = a.errors;
+            figure_b = b.errors;
+            break;
+        case SORT_FLAPS:
+            figure_a = a.flaps;
+            figure_b = b.flaps;
+            break;
+    }
+
+    // Ties are broken by name, so rows with the same figures stay put
+    if (figure_a != figure_b) {
+        return reversed ? figure_a < figure_b : figure_a > figure_b;
+    }
+
+    int names = a.name.compare(b.name);
+    if (names != 0) {
+        return reversed ? names > 0 : names < 0;
+    }
+
+    return first < second;
+}
+
+void TopDisplay::sort_rows()
+{
+    order.clear();
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (rows[i].active) {
+            order.push_back(i);
+        }
+    }
+
+    std::sort(order.begin(), order.end(),
+              [this](int first, int second) { return ordered_before(first, second); });
+}
+
+size_t TopDisplay::render()
+{
+    if (fd == -1) {
+        return 0;
+    }
+
+    sort_rows();
+    compose();
+    diff();
+
+    front_text.swap(back_text);
+    front_attributes.swap(back_attributes);
+
+    // What the terminal shows is not known any more, draw it all next time
+    if (!frame.empty() && !write_frame()) {
+        resize(width, height);
+        return 0;
+    }
+
+    return frame.size();
+}
+
+void TopDisplay::put(int line, int column, const char *text, uint8_t attribute)
+{
+    if (line >= height) {
+        return;
+    }
+
+    size_t cell = (size_t)line * width;
+
+    for (int i = column; i < width && *text != '\0'; i++, text++) {
+        unsigned char character = *text;
+
+        back_text[cell + i] = character >= ' ' && character < 0x7f ? character : '?';
+        back_attributes[cell + i] = attribute;
+    }
+}
+
+void TopDisplay::compose()
+{
+    std::fill(back_text.begin(), back_text.end(), ' ');
+    std::fill(back_attributes.begin(), back_attributes.end(), ATTR_NORMAL);
+
+    int shown_lines = std::max(height - TOP_LINES - BOTTOM_LINES, 0);
+    int count = order.size();
+
+    first_shown = std::max(std::min(first_shown, count - shown_lines), 0);
+
+    int down = 0;
+    for (int interface : order) {
+        down += rows[interface].down;
+    }
+
+    int last_shown = std::min(first_shown + shown_lines, count);
+    snprintf(line_text, sizeof(line_text), "networkMonitor - %d interfaces, %d down, by %s%s, %d-%d",
+             count, down, SORT_COLUMNS[sort].name, reversed ? " reversed" : "",
+             count > 0 ? first_shown + 1 : 0, last_shown);
+    put(0, 0, line_text, ATTR_BOLD);
+
+    // The clock shows the table is alive when nothing else changes
+    time_t now = time(NULL);
+    struct tm local;
+    if (width > 40 && localtime_r(&now, &local) != nullptr) {
+        strftime(line_text, sizeof(line_text), "%H:%M:%S", &local);
+        put(0, width - 8, line_text, ATTR_NORMAL);
+    }
+
+    snprintf(line_text, sizeof(line_text), "%-12s %-7s%7s%7s%7s%7s%7s%7s%6s %-*s", "INTERFACE", "STATE",
+             "RX bps", "RX pps", "TX bps", "TX pps", "DROP/s", "ERR/s", "FLAPS",
+             std::max(width - 69, 0), "STATUS");
+    put(1, 0, line_text, ATTR_REVERSE);
+
+    // The sort's heading stands out
+    const sort_column &sorted = SORT_COLUMNS[sort];
+    if (height > 1) {
+        size_t cell = (size_t)width + sorted.column;
+        for (int i = 0; i < sorted.width && sorted.column + i < width; i++) {
+            back_attributes[cell + i] = ATTR_REVERSE | ATTR_BOLD;
+        }
+    }
+
+    for (int i = first_shown; i < last_shown; i++) {
+        compose_row(TOP_LINES + i - first_shown, rows[order[i]]);
+    }
+
+    if (height > TOP_LINES) {
+        put(height - 1, 0, "n s r t d e f: sort (again: reverse)  j k space b: scroll  l: redraw  q: quit",
+            ATTR_NORMAL);
+    }
+}
+
+void TopDisplay::compose_row(int line, const row &shown)
+{
+    char figures[7][8];
+
+    if (shown.sampled) {
+        format_figure(shown.rx_bits, figures[0], sizeof(figures[0]));
+        format_figure(shown.rx_packets, figures[1], sizeof(figures[1]));
+        format_figure(shown.tx_bits, figures[2], sizeof(figures[2]));
+        format_figure(shown.tx_packets, figures[3], sizeof(figures[3]));
+        format_figure(shown.drops, figures[4], sizeof(figures[4]));
+        format_figure(shown.errors, figures[5], sizeof(figures[5]));
+        format_figure(shown.flaps, figures[6], sizeof(figures[6]));
+    } else {
+        for (char *figure : figures) {
+            strcpy(figure, "-");
+        }
+    }
+
+    snprintf(line_text, sizeof(line_text), "%-12.12s %-7.7s%7s%7s%7s%7s%7s%7s%6s %s", shown.name.c_str(),
+             shown.sampled ? shown.operstate : "-", figures[0], figures[1], figures[2], figures[3],
+             figures[4], figures[5], figures[6], shown.status);
+    put(line, 0, line_text, shown.down ? ATTR_BOLD : ATTR_NORMAL);
+}
+
+// Turns the cells that differ between the back buffer and the front one
+// into the bytes that draw them
+void TopDisplay::diff()
+{
+    int cursor_line = -1;
+    int cursor_column = -1;
+    int attributes = -1;
+
+    frame.clear();
+
+    for (int line = 0; line < height; line++) {
+        size_t cell = (size_t)line * width;
+        int column = 0;
+
+        while (column < width) {
+            if (back_text[cell + column] == front_text[cell + column] &&
+                back_attributes[cell + column] == front_attributes[cell + column]) {
+                column++;
+                continue;
+            }
+
+            int last_changed = column;
+            for (int i = column + 1; i < width && i - last_changed <= MERGE_GAP; i++) {
+                if (back_text[cell + i] != front_text[cell + i] ||
+                    back_attributes[cell + i] != front_attributes[cell + i]) {
+                    last_changed = i;
+                }
+            }
+
+            if (line != cursor_line || column != cursor_column) {
+                char move[16];
+                int length = snprintf(move, sizeof(move), "\x1b[%d;%dH", line + 1, column + 1);
+                frame.append(move, length);
+            }
+
+            for (int i = column; i <= last_changed; i++) {
+                if (back_attributes[cell + i] != attributes) {
+                    attributes = back_attributes[cell + i];
+                    append_attributes(frame, attributes);
+                }
+                frame.push_back(back_text[cell + i]);
+            }
+
+            column = last_changed + 1;
+            cursor_line = line;
+            // The cursor stays in the last column once written to
+            cursor_column = column < width ? column : -1;
+        }
+    }
+
+    if (attributes > ATTR_NORMAL) {
+        append_attributes(frame, ATTR_NORMAL);
+    }
+}
+
+bool TopDisplay::write_frame()
+{
+    size_t written = 0;
+
+    while (written < frame.size()) {
+        ssize_t result = write(fd, frame.data() + written, frame.size() - written);
+
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+    }
+
+    return true;
+}
@@ -0,0 +1,151 @@
+//topDisplay.h - A live table of every interface, for networkMonitor --top
+//
+// The table is drawn on a screen model of two buffers of cells. Each frame
+// is composed into the back buffer and compared with the front one, which
+// holds what the terminal shows, and only the runs of cells that differ are
+// sent, each after a cursor move, in a single write(). A frame that changes
+// nothing writes nothing. Samples and statuses only update an interface's
+// row; frames are drawn when the monitor's own refresh timer asks for one,
+// so redrawing does not follow how often or how many interfaces are
+// sampled, and only the rows that fit on the screen are formatted
+
+#ifndef TOP_DISPLAY_H
+#define TOP_DISPLAY_H
+
+#include <cstdint>
+#include <string>
+#include <termios.h>
+#include <vector>
+
+#include "counterRates.h"
+#include "interfaceInfo.h"
+
+// What the table is sorted by. Names sort A to Z, states down first and
+// figures busiest first, unless reversed
+enum top_sort
+{
+    SORT_NAME,
+    SORT_STATE,
+    SORT_RX,
+    SORT_TX,
+    SORT_DROPS,
+    SORT_ERRORS,
+    SORT_FLAPS
+};
+
+class TopDisplay
+{
+public:
+    // How often the screen is redrawn unless told otherwise
+    static const long DEFAULT_REFRESH_MS = 100;
+
+    // The size taken when the terminal's can not be read
+    static const int DEFAULT_WIDTH = 80;
+    static const int DEFAULT_HEIGHT = 24;
+
+    TopDisplay();
+    ~TopDisplay();
+
+    TopDisplay(const TopDisplay &) = delete;
+    TopDisplay &operator=(const TopDisplay &) = delete;
+
+    // Takes over the terminal on fd: switches to its alternate screen and
+    // hides the cursor and, if input_fd is a terminal, reads its keys one
+    // at a time without echo. Keys are read without blocking but the
+    // descriptors are left blocking. Returns false (with errno set) if the
+    // terminal could not be set up
+    bool open(int fd, int input_fd);
+
+    // Gives the terminal back as it was found
+    void close();
+
+    // Shows an interface, under its index in the monitor's tables. Adding
+    // one again that was removed shows it again
+    void add_interface(int interface, const std::string &name);
+
+    // Stops showing an interface, keeping its row in case it comes back
+    void remove_interface(int interface);
+
+    // Takes an interface's latest sample. Flaps count from its first one
+    void update(int interface, const interface_information &info, const interface_rates &rates);
+
+    // Shows an interface's latest status. status is not copied, it must
+    // outlive the display, as message_name's names do
+    void set_status(int interface, const char *status);
+
+    // Handles the keys waiting on the input: n s r t d e f sort (the same
+    // one again reverses), j k, the arrows, space and b scroll, l redraws
+    // and q quits. Returns false once q has been pressed
+    bool handle_input();
+
+    void set_sort(top_sort sort, bool reversed = false);
+
+    // Reads the terminal's size again, or takes the size given, and
+    // repaints every cell on the next frame
+    void resize();
+    void resize(int width, int height);
+
+    // Draws a frame, returns the bytes written
+    size_t render();
+
+private:
+    enum cell_attribute : uint8_t
+    {
+        ATTR_NORMAL = 0,
+        ATTR_BOLD = 1,
+        ATTR_REVERSE = 2
+    };
+
+    struct row
+    {
+        std::string name;
+        bool active = false;
+        bool sampled = false;
+        char operstate[OPERSTATE_LEN];
+        bool down = false;
+        double rx_bits = 0;
+        double rx_packets = 0;
+        double tx_bits = 0;
+        double tx_packets = 0;
+        double drops = 0;
+        double errors = 0;
+        uint64_t first_carrier_downs = 0;
+        uint64_t flaps = 0;
+        const char *status = "";
+    };
+
+    bool ordered_before(int first, int second) const;
+    void sort_rows();
+    void compose();
+    void compose_row(int line, const row &shown);
+    void put(int line, int column, const char *text, uint8_t attribute);
+    void diff();
+    void scroll(int lines);
+    bool write_frame();
+
+    int fd;
+    int input_fd;
+    bool raw_input;
+    struct termios saved_mode;
+
+    std::vector<row> rows;
+    std::vector<int> order;
+    top_sort sort;
+    bool reversed;
+    int first_shown;
+
+    // The screen model: what the terminal shows (front) and the frame being
+    // drawn (back), a character and an attribute per cell, row by row
+    int width;
+    int height;
+    std::vector<char> front_text;
+    std::vector<uint8_t> front_attributes;
+    std::vector<char> back_text;
+    std::vector<uint8_t> back_attributes;
+
+    // The bytes of the frame being drawn, kept between frames
+    std::string frame;
+    char line_text[512];
+};
+
+#endif